@@ -1,4 +1,5 @@
 #include "adcensuscv.h"
+#include <omp.h>
 
 ADCensusCV::ADCensusCV(const Mat &leftImage, const Mat &rightImage,
                        Size censusWin, float lambdaAD, float lambdaCensus) {
@@ -9,6 +10,11 @@ ADCensusCV::ADCensusCV(const Mat &leftImage, const Mat &rightImage,
   this->lambdaCensus = lambdaCensus;
 }
 
+void ADCensusCV::setImages(const Mat &leftImage, const Mat &rightImage) {
+  this->leftImage = leftImage;
+  this->rightImage = rightImage;
+}
+
 float ADCensusCV::ad(int wL, int hL, int wR, int hR) const {
   float dist = 0;
   const Vec3b &colorLP = leftImage.at<Vec3b>(hL, wL);
@@ -58,3 +64,36 @@ float ADCensusCV::adCensus(int wL, int hL, int wR, int hR) const {
 
   return dist;
 }
+
+void ADCensusCV::computeCostVolume(CostVolume &costs, bool rightImage,
+                                   float defaultBorderCost) const {
+  const Size imgSize = leftImage.size();
+  const Size halfCensusWin(censusWin.width / 2, censusWin.height / 2);
+  const int disparities = costs.getDisparities();
+
+#pragma omp parallel for schedule(static) num_threads(omp_get_max_threads())
+  for (int h = 0; h < imgSize.height; h++) {
+    for (int w = 0; w < imgSize.width; w++) {
+      costType *pixelCosts = costs.ptr(h, w);
+      for (int d = 0; d < disparities; d++) {
+        int wL = w;
+        int wR = w;
+
+        if (!rightImage)
+          wR = w - d;
+        else
+          wL = w + d;
+
+        const bool out = wL - halfCensusWin.width < 0 ||
+                         wL + halfCensusWin.width >= imgSize.width ||
+                         wR - halfCensusWin.width < 0 ||
+                         wR + halfCensusWin.width >= imgSize.width ||
+                         h - halfCensusWin.height < 0 ||
+                         h + halfCensusWin.height >= imgSize.height;
+
+        pixelCosts[d] = out ? defaultBorderCost * COST_FACTOR
+                            : adCensus(wL, h, wR, h) / 2 * COST_FACTOR;
+      }
+    }
+  }
+}
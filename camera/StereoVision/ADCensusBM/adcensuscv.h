@@ -1,6 +1,7 @@
 #ifndef ADCENSUSCV_H
 #define ADCENSUSCV_H
 
+#include "costvolume.h"
 #include <opencv2/opencv.hpp>
 
 using namespace cv;
@@ -9,10 +10,18 @@ class ADCensusCV {
 public:
   ADCensusCV(const Mat &leftImage, const Mat &rightImage, Size censusWin,
              float lambdaAD, float lambdaCensus);
+  // binds the next pair, the images are not copied
+  void setImages(const Mat &leftImage, const Mat &rightImage);
   float ad(int wL, int hL, int wR, int hR) const;
   float census(int wL, int hL, int wR, int hR) const;
   float adCensus(int wL, int hL, int wR, int hR) const;
 
+  // Fills the costs of the left (rightImage false) or the right image for the
+  // disparity offsets 0 .. costs.getDisparities() - 1, rows in parallel.
+  // Pixels whose census window leaves an image get defaultBorderCost.
+  void computeCostVolume(CostVolume &costs, bool rightImage,
+                         float defaultBorderCost) const;
+
 private:
   Mat leftImage;
   Mat rightImage;
@@ -4,9 +4,6 @@ using namespace std;
 Aggregation::Aggregation(const Mat &leftImage, const Mat &rightImage,
                          uint colorThreshold1, uint colorThreshold2,
                          uint maxLength1, uint maxLength2) {
-  this->images[0] = leftImage;
-  this->images[1] = rightImage;
-  this->imgSize = leftImage.size();
   this->colorThreshold1 = colorThreshold1;
   this->colorThreshold2 = colorThreshold2;
   this->maxLength1 = maxLength1;
@@ -16,12 +13,32 @@ Aggregation::Aggregation(const Mat &leftImage, const Mat &rightImage,
   this->leftLimits.resize(2);
   this->rightLimits.resize(2);
 
+  setImages(leftImage, rightImage);
+}
+
+void Aggregation::setImages(const Mat &leftImage, const Mat &rightImage) {
+  this->images[0] = leftImage;
+  this->images[1] = rightImage;
+  this->imgSize = leftImage.size();
+
   for (uchar imageNo = 0; imageNo < 2; imageNo++) {
-    upLimits[imageNo] = computeLimits(-1, 0, imageNo);
-    downLimits[imageNo] = computeLimits(1, 0, imageNo);
-    leftLimits[imageNo] = computeLimits(0, -1, imageNo);
-    rightLimits[imageNo] = computeLimits(0, 1, imageNo);
+    computeLimits(upLimits[imageNo], -1, 0, imageNo);
+    computeLimits(downLimits[imageNo], 1, 0, imageNo);
+    computeLimits(leftLimits[imageNo], 0, -1, imageNo);
+    computeLimits(rightLimits[imageNo], 0, 1, imageNo);
   }
+
+  threadBuffers.resize(omp_get_max_threads());
+  for (size_t i = 0; i < threadBuffers.size(); i++) {
+    threadBuffers[i].create(imgSize);
+  }
+}
+
+void Aggregation::AggregationBuffers::create(const Size &size) {
+  costMap.create(size, CV_32F);
+  aggregatedCosts.create(size, CV_32F);
+  windowSizes.create(size, CV_32S);
+  tmpWindowSizes.create(size, CV_32S);
 }
 
 int Aggregation::colorDiff(const Vec3b &p1, const Vec3b &p2) {
@@ -86,8 +103,9 @@ int Aggregation::computeLimit(int height, int width, int directionH,
   return d - 1;
 }
 
-Mat Aggregation::computeLimits(int directionH, int directionW, int imageNo) {
-  Mat limits(imgSize, CV_32S);
+void Aggregation::computeLimits(Mat &limits, int directionH, int directionW,
+                                int imageNo) {
+  limits.create(imgSize, CV_32S);
   int h, w;
 #pragma omp parallel default(shared) private(w, h)                             \
     num_threads(omp_get_max_threads())
@@ -98,19 +116,18 @@ Mat Aggregation::computeLimits(int directionH, int directionW, int imageNo) {
           computeLimit(h, w, directionH, directionW, imageNo);
     }
   }
-
-  return limits;
 }
 
-Mat Aggregation::aggregation1D(const Mat &costMap, int directionH,
-                               int directionW, Mat &windowSizes,
-                               uchar imageNo) {
-  Mat tmpWindowSizes = Mat::zeros(imgSize, CV_32S);
-  Mat aggregatedCosts(imgSize, CV_32F);
+void Aggregation::aggregation1D(const Mat &costMap, int directionH,
+                                int directionW, Mat &windowSizes,
+                                uchar imageNo, AggregationBuffers &buffers) {
+  Mat &tmpWindowSizes = buffers.tmpWindowSizes;
+  Mat &aggregatedCosts = buffers.aggregatedCosts;
+  tmpWindowSizes.setTo(0);
   int dmin, dmax, d;
   int h, w;
 
-#pragma omp parallel default(shared) private(w, h, d)                          \
+#pragma omp parallel default(shared) private(w, h, d, dmin, dmax)              \
     num_threads(omp_get_max_threads())
 #pragma omp for schedule(static)
   for (h = 0; h < imgSize.height; h++) {
@@ -134,22 +151,29 @@ Mat Aggregation::aggregation1D(const Mat &costMap, int directionH,
   }
 
   tmpWindowSizes.copyTo(windowSizes);
-
-  return aggregatedCosts;
 }
 
 void Aggregation::aggregation2D(Mat &costMap, bool horizontalFirst,
                                 uchar imageNo) {
+  AggregationBuffers buffers;
+  buffers.create(imgSize);
+  aggregation2D(costMap, horizontalFirst, imageNo, buffers);
+}
+
+void Aggregation::aggregation2D(Mat &costMap, bool horizontalFirst,
+                                uchar imageNo, AggregationBuffers &buffers) {
   int directionH = 1, directionW = 0;
 
   if (horizontalFirst)
     std::swap(directionH, directionW);
 
-  Mat windowsSizes = Mat::ones(imgSize, CV_32S);
+  Mat &windowsSizes = buffers.windowSizes;
+  windowsSizes.setTo(1);
 
   for (uchar direction = 0; direction < 2; direction++) {
-    (aggregation1D(costMap, directionH, directionW, windowsSizes, imageNo))
-        .copyTo(costMap);
+    aggregation1D(costMap, directionH, directionW, windowsSizes, imageNo,
+                  buffers);
+    buffers.aggregatedCosts.copyTo(costMap);
     std::swap(directionH, directionW);
   }
 
@@ -160,6 +184,44 @@ void Aggregation::aggregation2D(Mat &costMap, bool horizontalFirst,
   }
 }
 
+void Aggregation::aggregation3D(CostVolume &costs, uint iterations,
+                                uchar imageNo) {
+  const int disparities = costs.getDisparities();
+  const int numThreads = omp_get_max_threads();
+
+  if (threadBuffers.size() < (size_t)numThreads) {
+    threadBuffers.resize(numThreads);
+    for (size_t i = 0; i < threadBuffers.size(); i++) {
+      threadBuffers[i].create(imgSize);
+    }
+  }
+
+#pragma omp parallel for schedule(static) num_threads(numThreads)
+  for (int d = 0; d < disparities; d++) {
+    AggregationBuffers &buffers = threadBuffers[omp_get_thread_num()];
+    CostSlice<costType> slice = costs.slice(d);
+    Mat &currCostMap = buffers.costMap;
+
+    for (int h = 0; h < imgSize.height; h++) {
+      for (int w = 0; w < imgSize.width; w++) {
+        currCostMap.at<float>(h, w) = (float)slice(h, w) / COST_FACTOR;
+      }
+    }
+
+    bool horizontalFirst = true;
+    for (uint i = 0; i < iterations; i++) {
+      aggregation2D(currCostMap, horizontalFirst, imageNo, buffers);
+      horizontalFirst = !horizontalFirst;
+    }
+
+    for (int h = 0; h < imgSize.height; h++) {
+      for (int w = 0; w < imgSize.width; w++) {
+        slice(h, w) = (costType)(currCostMap.at<float>(h, w) * COST_FACTOR);
+      }
+    }
+  }
+}
+
 void Aggregation::getLimits(vector<Mat> &upLimits, vector<Mat> &downLimits,
                             vector<Mat> &leftLimits,
                             vector<Mat> &rightLimits) const {
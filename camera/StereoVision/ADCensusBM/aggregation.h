@@ -1,6 +1,7 @@
 #ifndef AGGREGATION_H
 #define AGGREGATION_H
 #include "common.h"
+#include "costvolume.h"
 #include <omp.h>
 #include <opencv2/opencv.hpp>
 
@@ -11,11 +12,25 @@ class Aggregation {
 public:
   Aggregation(const Mat &leftImage, const Mat &rightImage, uint colorThreshold1,
               uint colorThreshold2, uint maxLength1, uint maxLength2);
+  // binds the next pair and recomputes the cross limits into the existing Mats
+  void setImages(const Mat &leftImage, const Mat &rightImage);
   void aggregation2D(Mat &costMap, bool horizontalFirst, uchar imageNo);
+  // aggregates every disparity of the volume, the disparities in parallel
+  void aggregation3D(CostVolume &costs, uint iterations, uchar imageNo);
   void getLimits(vector<Mat> &upLimits, vector<Mat> &downLimits,
                  vector<Mat> &leftLimits, vector<Mat> &rightLimits) const;
 
 private:
+  // scratch of the aggregation of one disparity
+  struct AggregationBuffers {
+    Mat costMap;
+    Mat aggregatedCosts;
+    Mat windowSizes;
+    Mat tmpWindowSizes;
+
+    void create(const Size &size);
+  };
+
   Mat images[2];
   Size imgSize;
   uint colorThreshold1, colorThreshold2;
@@ -24,14 +39,20 @@ private:
   vector<Mat> downLimits;
   vector<Mat> leftLimits;
   vector<Mat> rightLimits;
+  // one per thread of aggregation3D
+  vector<AggregationBuffers> threadBuffers;
 
   int colorDiff(const Vec3b &p1, const Vec3b &p2);
   int computeLimit(int height, int width, int directionH, int directionW,
                    uchar imageNo);
-  Mat computeLimits(int directionH, int directionW, int imageNo);
+  void computeLimits(Mat &limits, int directionH, int directionW,
+                     int imageNo);
 
-  Mat aggregation1D(const Mat &costMap, int directionH, int directionW,
-                    Mat &windowSizes, uchar imageNo);
+  void aggregation1D(const Mat &costMap, int directionH, int directionW,
+                     Mat &windowSizes, uchar imageNo,
+                     AggregationBuffers &buffers);
+  void aggregation2D(Mat &costMap, bool horizontalFirst, uchar imageNo,
+                     AggregationBuffers &buffers);
 };
 
 #endif // AGGREGATION_H
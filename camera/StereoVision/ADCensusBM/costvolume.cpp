@@ -0,0 +1,49 @@
+#include "costvolume.h"
+
+CostVolume::CostVolume() : data(nullptr), height(0), width(0), disparities(0) {}
+
+CostVolume::CostVolume(int height, int width, int disparities)
+    : data(nullptr), height(0), width(0), disparities(0) {
+  create(height, width, disparities);
+}
+
+bool CostVolume::create(int height, int width, int disparities) {
+  this->height = 0;
+  this->width = 0;
+  this->disparities = 0;
+  data = nullptr;
+  if (height <= 0 || width <= 0 || disparities <= 0) {
+    return false;
+  }
+
+  arena.Clear();
+  const size_t offset = arena.Reserve(static_cast<size_t>(height) * width *
+                                      disparities * sizeof(costType));
+  if (!arena.Allocate()) {
+    return false;
+  }
+
+  data = arena.Get<costType>(offset);
+  this->height = height;
+  this->width = width;
+  this->disparities = disparities;
+  return true;
+}
+
+void CostVolume::release() {
+  arena.Release();
+  data = nullptr;
+  height = 0;
+  width = 0;
+  disparities = 0;
+}
+
+CostTriplets::CostTriplets() : width(0), disparities(0) {}
+
+void CostTriplets::create(int height, int width, int disparities) {
+  const size_t pixels = static_cast<size_t>(height) * width;
+  this->width = width;
+  this->disparities = disparities;
+  centers.resize(pixels);
+  triplets.resize(3 * pixels);
+}
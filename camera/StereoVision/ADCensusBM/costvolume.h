@@ -0,0 +1,132 @@
+#ifndef COSTVOLUME_H
+#define COSTVOLUME_H
+
+#include "../StereoCommon/aligned_arena.h"
+#include "common.h"
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Strided view of one disparity of a cost volume, (h, w) addresses the cost of
+// pixel (h, w) at that disparity.
+template <typename T> class CostSlice {
+public:
+  CostSlice(T *data, int width, int stride)
+      : data(data), width(width), stride(stride) {}
+
+  T &operator()(int h, int w) const {
+    return data[(static_cast<size_t>(h) * width + w) * stride];
+  }
+
+private:
+  T *data;
+  int width;
+  int stride;
+};
+
+// Contiguous height x width x disparities cost volume. The costs of all
+// disparities of a pixel are adjacent, so per pixel argmins and scanline
+// passes read them in one go. The memory is aligned to a cache line and kept
+// by create when the size does not grow.
+class CostVolume {
+public:
+  CostVolume();
+  CostVolume(int height, int width, int disparities);
+
+  // the costs are zero after create
+  bool create(int height, int width, int disparities);
+
+  int getHeight() const { return height; }
+  int getWidth() const { return width; }
+  int getDisparities() const { return disparities; }
+  bool empty() const { return data == nullptr; }
+  // number of costs in the volume
+  size_t total() const {
+    return static_cast<size_t>(height) * width * disparities;
+  }
+
+  // frees the memory, the volume is empty afterwards
+  void release();
+
+  // costs of all disparities of pixel (h, w)
+  costType *ptr(int h, int w) {
+    return data + (static_cast<size_t>(h) * width + w) * disparities;
+  }
+  const costType *ptr(int h, int w) const {
+    return data + (static_cast<size_t>(h) * width + w) * disparities;
+  }
+
+  costType &at(int h, int w, int d) { return ptr(h, w)[d]; }
+  const costType &at(int h, int w, int d) const { return ptr(h, w)[d]; }
+
+  // cost of pixel (h, w) at disparity index d, false (cost unchanged) if d is
+  // out of range
+  bool get(int h, int w, int d, costType &cost) const {
+    if (d < 0 || d >= disparities) {
+      return false;
+    }
+    cost = ptr(h, w)[d];
+    return true;
+  }
+
+  CostSlice<costType> slice(int d) {
+    return CostSlice<costType>(data + d, width, disparities);
+  }
+  CostSlice<const costType> slice(int d) const {
+    return CostSlice<const costType>(data + d, width, disparities);
+  }
+
+private:
+  CostVolume(const CostVolume &);
+  CostVolume &operator=(const CostVolume &);
+
+  AlignedArena arena;
+  costType *data;
+  int height;
+  int width;
+  int disparities;
+};
+
+// Costs of the disparity indices d - 1, d and d + 1 of every pixel around one
+// index d per pixel, 3 costs instead of a whole cost volume. Gathered from the
+// volume, they serve the refinement steps once the volume is released.
+class CostTriplets {
+public:
+  CostTriplets();
+
+  void create(int height, int width, int disparities);
+  bool empty() const { return centers.empty(); }
+
+  // keeps the costs of pixel (h, w) around index d
+  void gather(const CostVolume &costs, int h, int w, int d) {
+    const size_t pixel = static_cast<size_t>(h) * width + w;
+    const costType *pixelCosts = costs.ptr(h, w);
+    centers[pixel] = d;
+    for (int i = 0; i < 3; i++) {
+      const int index = d - 1 + i;
+      triplets[3 * pixel + i] = (0 <= index && index < disparities)
+                                    ? pixelCosts[index]
+                                    : std::numeric_limits<costType>::max();
+    }
+  }
+
+  // same interface as CostVolume::get, false (cost unchanged) if d is not a
+  // kept index
+  bool get(int h, int w, int d, costType &cost) const {
+    const size_t pixel = static_cast<size_t>(h) * width + w;
+    const int i = d - centers[pixel] + 1;
+    if (i < 0 || i > 2 || d < 0 || d >= disparities) {
+      return false;
+    }
+    cost = triplets[3 * pixel + i];
+    return true;
+  }
+
+private:
+  int width;
+  int disparities;
+  std::vector<int> centers;
+  std::vector<costType> triplets;
+};
+
+#endif // COSTVOLUME_H
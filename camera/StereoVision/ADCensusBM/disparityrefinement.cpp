@@ -1,4 +1,5 @@
 #include "disparityrefinement.h"
+#include <algorithm>
 
 const int DisparityRefinement::DISP_OCCLUSION = 1;
 const int DisparityRefinement::DISP_MISMATCH = 2;
@@ -32,10 +33,11 @@ int DisparityRefinement::colorDiff(const Vec3b &p1, const Vec3b &p2) {
   return diff;
 }
 
-Mat DisparityRefinement::outlierElimination(const Mat &leftDisp,
-                                            const Mat &rightDisp) {
+void DisparityRefinement::outlierElimination(const Mat &leftDisp,
+                                             const Mat &rightDisp,
+                                             Mat &disparityMap) {
   Size dispSize = leftDisp.size();
-  Mat disparityMap(dispSize, CV_32S);
+  disparityMap.create(dispSize, CV_32S);
 
   //#pragma omp parallel for
   for (int h = 0; h < dispSize.height; h++) {
@@ -59,8 +61,6 @@ Mat DisparityRefinement::outlierElimination(const Mat &leftDisp,
       disparityMap.at<int>(h, w) = disparity;
     }
   }
-
-  return disparityMap;
 }
 
 void DisparityRefinement::regionVoting(Mat &disparity,
@@ -71,7 +71,7 @@ void DisparityRefinement::regionVoting(Mat &disparity,
                                        bool horizontalFirst) {
   // temporary disparity map that avoids too fast correction
   Size dispSize = disparity.size();
-  Mat dispTemp(dispSize, CV_32S);
+  dispTemp.create(dispSize, CV_32S);
 
   // histogram for voting
   vector<int> hist(dMax - dMin + 1, 0);
@@ -158,7 +158,7 @@ void DisparityRefinement::regionVoting(Mat &disparity,
 void DisparityRefinement::properInterpolation(Mat &disparity,
                                               const Mat &leftImage) {
   Size dispSize = disparity.size();
-  Mat dispTemp(dispSize, CV_32S);
+  dispTemp.create(dispSize, CV_32S);
 
   // look on the 16 different directions
   int directionsW[] = {0, 2, 2, 2, 0, -2, -2, -2, 1, 2, 2, 1, -1, -2, -2, -1};
@@ -171,8 +171,10 @@ void DisparityRefinement::properInterpolation(Mat &disparity,
       if (disparity.at<int>(h, w) >= dMin) {
         dispTemp.at<int>(h, w) = disparity.at<int>(h, w);
       } else {
-        vector<int> neighborDisps(16, disparity.at<int>(h, w));
-        vector<int> neighborDiffs(16, -1);
+        int neighborDisps[16];
+        int neighborDiffs[16];
+        std::fill(neighborDisps, neighborDisps + 16, disparity.at<int>(h, w));
+        std::fill(neighborDiffs, neighborDiffs + 16, -1);
         for (uchar direction = 0; direction < 16; direction++) {
           int hD = h, wD = w;
           bool inside = true, gotDisp = false;
@@ -222,15 +224,25 @@ void DisparityRefinement::properInterpolation(Mat &disparity,
   dispTemp.copyTo(disparity);
 }
 
-void DisparityRefinement::discontinuityAdjustment(
-    Mat &disparity, const vector<vector<Mat>> &costs) {
+void DisparityRefinement::discontinuityAdjustment(Mat &disparity,
+                                                  const CostVolume &costs) {
+  adjustDiscontinuities(disparity, costs);
+}
+
+void DisparityRefinement::discontinuityAdjustment(Mat &disparity,
+                                                  const CostTriplets &costs) {
+  adjustDiscontinuities(disparity, costs);
+}
+
+template <typename Costs>
+void DisparityRefinement::adjustDiscontinuities(Mat &disparity,
+                                                const Costs &costs) {
   Size dispSize = disparity.size();
-  Mat dispTemp, detectedEdges, dispGray;
 
   disparity.copyTo(dispTemp);
 
   // Edge Detection
-  dispGray = convertDisp2Gray(disparity);
+  convertDisp2Gray(disparity, dispGray);
   blur(dispGray, detectedEdges, Size(blurKernelSize, blurKernelSize));
   Canny(detectedEdges, detectedEdges, cannyThreshold1, cannyThreshold2,
         cannyKernelSize);
@@ -276,29 +288,34 @@ void DisparityRefinement::discontinuityAdjustment(
           // select pixels from both sides of the edge
           direction = (direction + 4) % 8;
 
-          if (disp >= dMin) {
-            costType cost = costs[0][disp - dMin].at<costType>(h, w);
+          costType cost;
+          if (disp >= dMin && costs.get(h, w, disp - dMin, cost)) {
             int d1 = disparity.at<int>(h + directionsH[direction],
                                        w + directionsW[direction]);
             int d2 = disparity.at<int>(h + directionsH[direction + 1],
                                        w + directionsW[direction + 1]);
 
-            costType cost1 = (d1 >= dMin) ? costs[0][d1 - dMin].at<costType>(
-                                                h + directionsH[direction],
-                                                w + directionsW[direction])
-                                          : -1;
+            // noCost for a neighbour without a cost, get leaves it unchanged
+            // if the costs do not hold the disparity
+            const costType noCost = static_cast<costType>(-1);
+            costType cost1 = noCost;
+            if (d1 >= dMin) {
+              costs.get(h + directionsH[direction], w + directionsW[direction],
+                        d1 - dMin, cost1);
+            }
 
-            costType cost2 = (d2 >= dMin) ? costs[0][d2 - dMin].at<costType>(
-                                                h + directionsH[direction + 1],
-                                                w + directionsW[direction + 1])
-                                          : -1;
+            costType cost2 = noCost;
+            if (d2 >= dMin) {
+              costs.get(h + directionsH[direction + 1],
+                        w + directionsW[direction + 1], d2 - dMin, cost2);
+            }
 
-            if (cost1 != -1 && cost1 < cost) {
+            if (cost1 != noCost && cost1 < cost) {
               disp = d1;
               cost = cost1;
             }
 
-            if (cost2 != -1 && cost2 < cost) {
+            if (cost2 != noCost && cost2 < cost) {
               disp = d2;
             }
           }
@@ -312,23 +329,38 @@ void DisparityRefinement::discontinuityAdjustment(
   dispTemp.copyTo(disparity);
 }
 
-Mat DisparityRefinement::subpixelEnhancement(Mat &disparity,
-                                             const vector<vector<Mat>> &costs) {
+void DisparityRefinement::subpixelEnhancement(const Mat &disparity,
+                                              const CostVolume &costs,
+                                              Mat &floatDisparity) {
+  enhanceSubpixel(disparity, costs, floatDisparity);
+}
+
+void DisparityRefinement::subpixelEnhancement(const Mat &disparity,
+                                              const CostTriplets &costs,
+                                              Mat &floatDisparity) {
+  enhanceSubpixel(disparity, costs, floatDisparity);
+}
+
+template <typename Costs>
+void DisparityRefinement::enhanceSubpixel(const Mat &disparity,
+                                          const Costs &costs,
+                                          Mat &floatDisparity) {
   Size dispSize = disparity.size();
-  Mat dispTemp(dispSize, CV_32F);
+  floatDisparity.create(dispSize, CV_32F);
 
   for (size_t h = 0; h < dispSize.height; h++) {
     for (size_t w = 0; w < dispSize.width; w++) {
       int disp = disparity.at<int>(h, w);
       float interDisp = disp;
 
-      if (disp > dMin && disp < dMax) {
-        float cost =
-            costs[0][disp - dMin].at<costType>(h, w) / (float)COST_FACTOR;
-        float costPlus =
-            costs[0][disp + 1 - dMin].at<costType>(h, w) / (float)COST_FACTOR;
-        float costMinus =
-            costs[0][disp - 1 - dMin].at<costType>(h, w) / (float)COST_FACTOR;
+      costType rawCost, rawCostPlus, rawCostMinus;
+      if (disp > dMin && disp < dMax &&
+          costs.get(h, w, disp - dMin, rawCost) &&
+          costs.get(h, w, disp - dMin + 1, rawCostPlus) &&
+          costs.get(h, w, disp - dMin - 1, rawCostMinus)) {
+        float cost = rawCost / (float)COST_FACTOR;
+        float costPlus = rawCostPlus / (float)COST_FACTOR;
+        float costMinus = rawCostMinus / (float)COST_FACTOR;
 
         float diff =
             (costPlus - costMinus) / (2 * (costPlus + costMinus - 2 * cost));
@@ -337,17 +369,16 @@ Mat DisparityRefinement::subpixelEnhancement(Mat &disparity,
           interDisp -= diff;
       }
 
-      dispTemp.at<float>(h, w) = interDisp;
+      floatDisparity.at<float>(h, w) = interDisp;
     }
   }
 
-  medianBlur(dispTemp, dispTemp, 3);
-  return dispTemp;
+  medianBlur(floatDisparity, floatDisparity, 3);
 }
 
-Mat DisparityRefinement::convertDisp2Gray(const Mat &disparity) {
+void DisparityRefinement::convertDisp2Gray(const Mat &disparity, Mat &dispU) {
   Size dispSize = disparity.size();
-  Mat dispU(dispSize, CV_8U);
+  dispU.create(dispSize, CV_8U);
 
   for (size_t h = 0; h < dispSize.height; h++) {
     for (size_t w = 0; w < dispSize.width; w++) {
@@ -357,5 +388,4 @@ Mat DisparityRefinement::convertDisp2Gray(const Mat &disparity) {
   }
 
   equalizeHist(dispU, dispU);
-  return dispU;
 }
@@ -3,6 +3,7 @@
 
 #include "adcensuscv.h"
 #include "common.h"
+#include "costvolume.h"
 #include <opencv2/opencv.hpp>
 
 using namespace cv;
@@ -15,22 +16,38 @@ public:
                       uint maxSearchDepth, uint blurKernelSize,
                       uint cannyThreshold1, uint cannyThreshold2,
                       uint cannyKernelSize);
-  Mat outlierElimination(const Mat &leftDisp, const Mat &rightDisp);
+  // the maps of the methods below are reused between frames, so a stream of
+  // disparities of one size is refined without reallocation
+  void outlierElimination(const Mat &leftDisp, const Mat &rightDisp,
+                          Mat &disparity);
   void regionVoting(Mat &disparity, const vector<Mat> &upLimits,
                     const vector<Mat> &downLimits,
                     const vector<Mat> &leftLimits,
                     const vector<Mat> &rightLimits, bool horizontalFirst);
   void properInterpolation(Mat &disparity, const Mat &leftImage);
-  void discontinuityAdjustment(Mat &disparity,
-                               const vector<vector<Mat>> &costs);
-  Mat subpixelEnhancement(Mat &disparity, const vector<vector<Mat>> &costs);
+  // costs is the volume of the left image
+  void discontinuityAdjustment(Mat &disparity, const CostVolume &costs);
+  void subpixelEnhancement(const Mat &disparity, const CostVolume &costs,
+                           Mat &floatDisparity);
+  // Same with the triplets gathered around the cost minima of the left image.
+  // Pixels whose disparity left the triplet of its minimum are not adjusted
+  // and keep their integer disparity.
+  void discontinuityAdjustment(Mat &disparity, const CostTriplets &costs);
+  void subpixelEnhancement(const Mat &disparity, const CostTriplets &costs,
+                           Mat &floatDisparity);
 
   static const int DISP_OCCLUSION;
   static const int DISP_MISMATCH;
 
 private:
   int colorDiff(const Vec3b &p1, const Vec3b &p2);
-  Mat convertDisp2Gray(const Mat &disparity);
+  template <typename Costs>
+  void adjustDiscontinuities(Mat &disparity, const Costs &costs);
+  template <typename Costs>
+  void enhanceSubpixel(const Mat &disparity, const Costs &costs,
+                       Mat &floatDisparity);
+
+  void convertDisp2Gray(const Mat &disparity, Mat &dispGray);
 
   int occlusionValue;
   int mismatchValue;
@@ -44,6 +61,11 @@ private:
   uint cannyThreshold1;
   uint cannyThreshold2;
   uint cannyKernelSize;
+
+  // scratch maps of the refinement steps
+  Mat dispTemp;
+  Mat dispGray;
+  Mat detectedEdges;
 };
 
 #endif // DISPARITYREFINEMENT_H
@@ -7,7 +7,8 @@ using namespace std;
 ScanlineOptimization::ScanlineOptimization(const Mat &leftImage,
                                            const Mat &rightImage, int dMin,
                                            int dMax, uint colorThreshold,
-                                           float pi1, float pi2) {
+                                           float pi1, float pi2,
+                                           int numThreads) {
   this->images[0] = leftImage;
   this->images[1] = rightImage;
   this->imgSize = leftImage.size();
@@ -16,161 +17,207 @@ ScanlineOptimization::ScanlineOptimization(const Mat &leftImage,
   this->colorDifference = colorThreshold;
   this->pi1 = pi1;
   this->pi2 = pi2;
+  this->numThreads = (numThreads > 0) ? numThreads : 1;
+  this->threadBuffers.assign(this->numThreads, LineBuffers(dMax - dMin + 1));
 }
 
-void ScanlineOptimization::optimization(vector<Mat> *costMaps,
+void ScanlineOptimization::setImages(const Mat &leftImage,
+                                     const Mat &rightImage) {
+  this->images[0] = leftImage;
+  this->images[1] = rightImage;
+  this->imgSize = leftImage.size();
+}
+
+void ScanlineOptimization::optimization(CostVolume *costs,
                                         bool rightFirst) {
 
-  verticalComputation(0, 1, costMaps, rightFirst);
+  verticalComputation(0, 1, costs, rightFirst);
 
-  verticalComputation(imgSize.height - 1, -1, costMaps, rightFirst);
+  verticalComputation(imgSize.height - 1, -1, costs, rightFirst);
 
-  horizontalComputation(0, 1, costMaps, rightFirst);
+  horizontalComputation(0, 1, costs, rightFirst);
 
-  horizontalComputation(imgSize.width - 1, -1, costMaps, rightFirst);
+  horizontalComputation(imgSize.width - 1, -1, costs, rightFirst);
 }
 
 void ScanlineOptimization::verticalComputation(int height, int direction,
-                                               vector<Mat> *costMaps,
+                                               CostVolume *costs,
                                                bool rightFirst) {
 
-  // computes vertical optimized costs
-  size_t height1;
-  //    #pragma omp parallel default(shared) private(height1)
-  //    num_threads(omp_get_max_threads()) #pragma omp for schedule(static)
-  for (height1 = height + direction; 0 <= height1 && height1 < imgSize.height;
-       height1 += direction) {
-    verticalOptimization(height1, height1 - direction, costMaps, rightFirst);
+  // computes vertical optimized costs, the columns are independent of each
+  // other, so each thread walks its own columns from start to end
+#pragma omp parallel num_threads(numThreads)
+  {
+    LineBuffers &buffers = threadBuffers[omp_get_thread_num()];
+
+#pragma omp for schedule(static)
+    for (int width = 0; width < imgSize.width; width++) {
+      verticalOptimization(width, height, direction, costs, rightFirst,
+                           buffers);
+    }
   }
 }
 
-void ScanlineOptimization::verticalOptimization(int height1, int height2,
-                                                vector<Mat> *costMaps,
-                                                bool rightFirst) {
-  for (size_t width = 0; width < imgSize.width; width++) {
-    partialOptimization(height1, height2, width, width, costMaps, rightFirst);
+void ScanlineOptimization::verticalOptimization(int width, int height,
+                                                int direction,
+                                                CostVolume *costs,
+                                                bool rightFirst,
+                                                LineBuffers &buffers) {
+  startLine(height, width, costs, buffers);
+  for (int height1 = height + direction;
+       0 <= height1 && height1 < imgSize.height; height1 += direction) {
+    partialOptimization(height1, height1 - direction, width, width, costs,
+                        rightFirst, buffers);
   }
 }
 
 void ScanlineOptimization::horizontalComputation(int width, int direction,
-                                                 vector<Mat> *costMaps,
+                                                 CostVolume *costs,
                                                  bool rightFirst) {
 
-  // computes horizontal optimized costs
-  size_t width1;
-  //    #pragma omp parallel default(shared) private(width1)
-  //    num_threads(omp_get_max_threads()) #pragma omp for schedule(static)
-  for (width1 = width + direction; 0 <= width1 && width1 < imgSize.width;
+  // computes horizontal optimized costs, one row per thread at a time
+#pragma omp parallel num_threads(numThreads)
+  {
+    LineBuffers &buffers = threadBuffers[omp_get_thread_num()];
+
+#pragma omp for schedule(static)
+    for (int height = 0; height < imgSize.height; height++) {
+      horizontalOptimization(height, width, direction, costs, rightFirst,
+                             buffers);
+    }
+  }
+}
+
+void ScanlineOptimization::horizontalOptimization(int height, int width,
+                                                  int direction,
+                                                  CostVolume *costs,
+                                                  bool rightFirst,
+                                                  LineBuffers &buffers) {
+  startLine(height, width, costs, buffers);
+  for (int width1 = width + direction; 0 <= width1 && width1 < imgSize.width;
        width1 += direction) {
-    horizontalOptimization(width1, width1 - direction, costMaps, rightFirst);
+    partialOptimization(height, height, width1, width1 - direction, costs,
+                        rightFirst, buffers);
   }
 }
 
-void ScanlineOptimization::horizontalOptimization(int width1, int width2,
-                                                  vector<Mat> *costMaps,
-                                                  bool rightFirst) {
-  for (size_t height = 0; height < imgSize.height; height++) {
-    partialOptimization(height, height, width1, width2, costMaps, rightFirst);
+void ScanlineOptimization::startLine(int height, int width,
+                                     const CostVolume *costs,
+                                     LineBuffers &buffers) const {
+  // the first pixel of a scanline keeps its costs
+  const costType *firstCosts = costs->ptr(height, width);
+  for (int disparity = 0; disparity <= dMax - dMin; ++disparity) {
+    buffers.prevCosts[disparity] = firstCosts[disparity] / (float)COST_FACTOR;
   }
 }
 
 void ScanlineOptimization::partialOptimization(int height1, int height2,
                                                int width1, int width2,
-                                               vector<Mat> *costMaps,
-                                               bool rightFirst) {
-  float minOptCost =
-      costMaps->at(0).at<costType>(height2, width2) / (float)COST_FACTOR;
+                                               CostVolume *costs,
+                                               bool rightFirst,
+                                               LineBuffers &buffers) const {
+  // costs of all disparities of the current pixel, the optimized costs of the
+  // previous pixel on the path are in buffers.prevCosts
+  costType *currCosts = costs->ptr(height1, width1);
+  float *prevCosts = &buffers.prevCosts[0];
+  const float *p1 = &buffers.p1[0];
+  const float *p2 = &buffers.p2[0];
+
+  // compute P1 and P2 parameters of all disparities for this step
+  computeP1P2(height1, height2, width1, width2, &buffers.p1[0],
+              &buffers.p2[0], rightFirst);
+
+  float minOptCost = prevCosts[0];
 
   // find minimal previous optimized cost for a given column index
   for (int disparity = 1; disparity <= dMax - dMin; ++disparity) {
-    float tmpCost = costMaps->at(disparity).at<costType>(height2, width2) /
-                    (float)COST_FACTOR;
-    if (minOptCost > tmpCost)
-      minOptCost = tmpCost;
+    if (minOptCost > prevCosts[disparity])
+      minOptCost = prevCosts[disparity];
   }
 
-  float minkCr = minOptCost;
+  const float minkCr = minOptCost;
+
+  // the previous cost of disparity - 1 is overwritten in the loop
+  float prevLower = 0;
 
   for (int disparity = 0; disparity <= dMax - dMin; ++disparity) {
     // C1(p,d) - min_k(Cr(p-r,k))
-    float cost = costMaps->at(disparity).at<costType>(height1, width1) /
-                     (float)COST_FACTOR -
-                 minkCr;
-
-    // compute P1 and P2 parameters for better scanline optimization
-    float p1, p2;
-    computeP1P2(height1, height2, width1, width2, disparity + dMin, p1, p2,
-                rightFirst);
+    float cost = currCosts[disparity] / (float)COST_FACTOR - minkCr;
 
     // compute min(Cr(p-r,d), Cr(p-r, d+-1) + P1, min_k(Cr(p-r,k)+P2))
-    minOptCost = minkCr + p2;
+    minOptCost = minkCr + p2[disparity];
 
-    float tmpCost = costMaps->at(disparity).at<costType>(height2, width2) /
-                    (float)COST_FACTOR;
-    if (minOptCost > tmpCost)
-      minOptCost = tmpCost;
+    const float prevCost = prevCosts[disparity];
+    if (minOptCost > prevCost)
+      minOptCost = prevCost;
 
     if (disparity != 0) {
-      tmpCost = costMaps->at(disparity - 1).at<costType>(height2, width2) /
-                    (float)COST_FACTOR +
-                p1;
+      float tmpCost = prevLower + p1[disparity];
       if (minOptCost > tmpCost)
         minOptCost = tmpCost;
     }
 
     if (disparity != dMax - dMin) {
-      tmpCost = costMaps->at(disparity + 1).at<costType>(height2, width2) /
-                    (float)COST_FACTOR +
-                p1;
+      float tmpCost = prevCosts[disparity + 1] + p1[disparity];
       if (minOptCost > tmpCost)
         minOptCost = tmpCost;
     }
 
-    costMaps->at(disparity).at<costType>(height1, width1) =
+    const costType optCost =
         (costType)(((cost + minOptCost)) / 2 * COST_FACTOR);
+    currCosts[disparity] = optCost;
+
+    prevLower = prevCost;
+    prevCosts[disparity] = optCost / (float)COST_FACTOR;
   }
 }
 
 void ScanlineOptimization::computeP1P2(int height1, int height2, int width1,
-                                       int width2, int disparity, float &p1,
-                                       float &p2, bool rightFirst) {
+                                       int width2, float *p1, float *p2,
+                                       bool rightFirst) const {
   int imageNo = 0;
   int otherImgNo = 1;
+  int sign = 1;
 
   if (rightFirst) {
     imageNo = 1;
     otherImgNo = 0;
-    disparity = -disparity;
+    sign = -1;
   }
 
-  // compute color differences between pixels in the two pictures
+  // compute color differences between pixels in the two pictures, the one of
+  // the reference image is the same for all disparities
   int d1 = colorDiff(images[imageNo].at<Vec3b>(height1, width1),
                      images[imageNo].at<Vec3b>(height2, width2));
-  int d2 = colorDifference + 1;
 
-  if (0 <= width1 + disparity && width1 + disparity < imgSize.width &&
-      0 <= width2 + disparity && width2 + disparity < imgSize.width) {
-    d2 = colorDiff(images[otherImgNo].at<Vec3b>(height1, width1 + disparity),
-                   images[otherImgNo].at<Vec3b>(height2, width2 + disparity));
-  }
+  for (int index = 0; index <= dMax - dMin; ++index) {
+    const int disparity = sign * (index + dMin);
+    int d2 = colorDifference + 1;
 
-  // depending on the color differences computed previously, find the so
-  // parameters
-  if (d1 < colorDifference) {
-    if (d2 < colorDifference) {
-      p1 = pi1;
-      p2 = pi2;
-    } else {
-      p1 = pi1 / 4.0;
-      p2 = pi2 / 4.0;
+    if (0 <= width1 + disparity && width1 + disparity < imgSize.width &&
+        0 <= width2 + disparity && width2 + disparity < imgSize.width) {
+      d2 = colorDiff(images[otherImgNo].at<Vec3b>(height1, width1 + disparity),
+                     images[otherImgNo].at<Vec3b>(height2, width2 + disparity));
     }
-  } else {
-    if (d2 < colorDifference) {
-      p1 = pi1 / 4.0;
-      p2 = pi2 / 4.0;
+
+    // depending on the color differences computed previously, find the so
+    // parameters
+    if (d1 < colorDifference) {
+      if (d2 < colorDifference) {
+        p1[index] = pi1;
+        p2[index] = pi2;
+      } else {
+        p1[index] = pi1 / 4.0;
+        p2[index] = pi2 / 4.0;
+      }
     } else {
-      p1 = pi1 / 10.0;
-      p2 = pi2 / 10.0;
+      if (d2 < colorDifference) {
+        p1[index] = pi1 / 4.0;
+        p2[index] = pi2 / 4.0;
+      } else {
+        p1[index] = pi1 / 10.0;
+        p2[index] = pi2 / 10.0;
+      }
     }
   }
 }
@@ -47,6 +47,7 @@
 #include <opencv2/opencv.hpp>
 #include <omp.h>
 #include "common.h"
+#include "costvolume.h"
 
 using namespace cv;
 using namespace std;
@@ -54,10 +55,28 @@ using namespace std;
 class ScanlineOptimization
 {
 public:
+    // numThreads scanlines are optimized at once, the vertical passes split the columns and the
+    // horizontal passes the rows among the threads. The result does not depend on numThreads.
+    // The line buffers are kept in the object, so one object optimizes one volume at a time.
     ScanlineOptimization(const Mat &leftImage, const Mat &rightImage, int dMin, int dMax,
-                         uint colorDifference, float pi1, float pi2);
-    void optimization(vector<Mat> *costMaps, bool rightFirst);
+                         uint colorDifference, float pi1, float pi2,
+                         int numThreads = omp_get_max_threads());
+    // binds the next pair of the same size, the images are not copied
+    void setImages(const Mat &leftImage, const Mat &rightImage);
+    void optimization(CostVolume *costs, bool rightFirst);
 private:
+    // scratch of the scanline a thread works on: the optimized costs of the previous pixel and
+    // the penalties of the current step for all disparities
+    struct LineBuffers
+    {
+        explicit LineBuffers(int disparities)
+            : prevCosts(disparities), p1(disparities), p2(disparities) {}
+
+        vector<float> prevCosts;
+        vector<float> p1;
+        vector<float> p2;
+    };
+
     Mat images[2];
     Size imgSize;
     int dMin;
@@ -65,16 +84,24 @@ private:
     uint colorDifference;
     float pi1;
     float pi2;
+    int numThreads;
+    // one per thread, kept between the passes
+    vector<LineBuffers> threadBuffers;
 
-    void verticalComputation(int height, int direction, vector<Mat> *costMaps, bool rightFirst);
-    void verticalOptimization(int height1, int height2, vector<Mat> *costMaps, bool rightFirst);
+    void verticalComputation(int height, int direction, CostVolume *costs, bool rightFirst);
+    void verticalOptimization(int width, int height, int direction, CostVolume *costs,
+                              bool rightFirst, LineBuffers &buffers);
 
-    void horizontalComputation(int width, int direction, vector<Mat> *costMaps, bool rightFirst);
-    void horizontalOptimization(int width1, int width2, vector<Mat> *costMaps, bool rightFirst);
+    void horizontalComputation(int width, int direction, CostVolume *costs, bool rightFirst);
+    void horizontalOptimization(int height, int width, int direction, CostVolume *costs,
+                                bool rightFirst, LineBuffers &buffers);
 
-    void partialOptimization(int height1, int height2, int width1, int width2, vector<Mat> *costMaps, bool rightFirst);
+    void startLine(int height, int width, const CostVolume *costs, LineBuffers &buffers) const;
+    void partialOptimization(int height1, int height2, int width1, int width2, CostVolume *costs,
+                             bool rightFirst, LineBuffers &buffers) const;
 
-    void computeP1P2(int height1, int height2, int width1, int width2, int disparity, float &p1, float &p2, bool rightFirst);
+    void computeP1P2(int height1, int height2, int width1, int width2, float *p1, float *p2,
+                     bool rightFirst) const;
 
     int colorDiff(const Vec3b &p1, const Vec3b &p2) const;
 };
@@ -5,6 +5,74 @@
 
 // #define DEBUG
 
+namespace {
+
+// keeps value if the node is missing
+template <typename T> void readParam(const FileNode &node, T &value) {
+  if (!node.empty()) {
+    value = (T)(int)node;
+  }
+}
+
+template <> void readParam<float>(const FileNode &node, float &value) {
+  if (!node.empty()) {
+    value = (float)node;
+  }
+}
+
+} // namespace
+
+StereoParams::StereoParams()
+    : dMin(0), dMax(60), censusWin(9, 7), defaultBorderCost(0.999f),
+      lambdaAD(10.0f), lambdaCensus(30.0f), aggregatingIterations(4),
+      colorThreshold1(20), colorThreshold2(6), maxLength1(34), maxLength2(17),
+      colorDifference(15), pi1(0.1f), pi2(0.3f), dispTolerance(0),
+      votingThreshold(20), votingRatioThreshold(0.4f), maxSearchDepth(20),
+      blurKernelSize(3), cannyThreshold1(20), cannyThreshold2(60),
+      cannyKernelSize(3), printTiming(true), sparseRefinement(false),
+      releaseCostVolumes(false) {}
+
+bool StereoParams::read(const string &path) {
+  FileStorage fs(path, FileStorage::READ);
+  if (!fs.isOpened()) {
+    return false;
+  }
+
+  readParam(fs["dMin"], dMin);
+  readParam(fs["dMax"], dMax);
+  // the examples build the window as Size(censusWinH, censusWinW)
+  readParam(fs["censusWinH"], censusWin.width);
+  readParam(fs["censusWinW"], censusWin.height);
+  readParam(fs["defaultBorderCost"], defaultBorderCost);
+  readParam(fs["lambdaAD"], lambdaAD);
+  readParam(fs["lambdaCensus"], lambdaCensus);
+  readParam(fs["aggregatingIterations"], aggregatingIterations);
+  readParam(fs["colorThreshold1"], colorThreshold1);
+  readParam(fs["colorThreshold2"], colorThreshold2);
+  readParam(fs["maxLength1"], maxLength1);
+  readParam(fs["maxLength2"], maxLength2);
+  readParam(fs["colorDifference"], colorDifference);
+  readParam(fs["pi1"], pi1);
+  readParam(fs["pi2"], pi2);
+  readParam(fs["dispTolerance"], dispTolerance);
+  readParam(fs["votingThreshold"], votingThreshold);
+  readParam(fs["votingRatioThreshold"], votingRatioThreshold);
+  readParam(fs["maxSearchDepth"], maxSearchDepth);
+  readParam(fs["blurKernelSize"], blurKernelSize);
+  readParam(fs["cannyThreshold1"], cannyThreshold1);
+  readParam(fs["cannyThreshold2"], cannyThreshold2);
+  readParam(fs["cannyKernelSize"], cannyKernelSize);
+  readParam(fs["sparseRefinement"], sparseRefinement);
+  readParam(fs["releaseCostVolumes"], releaseCostVolumes);
+  return true;
+}
+
+StereoProcessor::StereoProcessor(const StereoParams &params) {
+  this->params = params;
+  this->validParams = false;
+  this->dispComputed = false;
+}
+
 StereoProcessor::StereoProcessor(
     uint dMin, uint dMax, Mat leftImage, Mat rightImage, Size censusWin,
     float defaultBorderCost, float lambdaAD, float lambdaCensus,
@@ -13,30 +81,30 @@ StereoProcessor::StereoProcessor(
     float pi2, uint dispTolerance, uint votingThreshold,
     float votingRatioThreshold, uint maxSearchDepth, uint blurKernelSize,
     uint cannyThreshold1, uint cannyThreshold2, uint cannyKernelSize) {
-  this->dMin = dMin;
-  this->dMax = dMax;
+  this->params.dMin = dMin;
+  this->params.dMax = dMax;
   this->images[0] = leftImage;
   this->images[1] = rightImage;
-  this->censusWin = censusWin;
-  this->defaultBorderCost = defaultBorderCost;
-  this->lambdaAD = lambdaAD;
-  this->lambdaCensus = lambdaCensus;
-  this->aggregatingIterations = aggregatingIterations;
-  this->colorThreshold1 = colorThreshold1;
-  this->colorThreshold2 = colorThreshold2;
-  this->maxLength1 = maxLength1;
-  this->maxLength2 = maxLength2;
-  this->colorDifference = colorDifference;
-  this->pi1 = pi1;
-  this->pi2 = pi2;
-  this->dispTolerance = dispTolerance;
-  this->votingThreshold = votingThreshold;
-  this->votingRatioThreshold = votingRatioThreshold;
-  this->maxSearchDepth = maxSearchDepth;
-  this->blurKernelSize = blurKernelSize;
-  this->cannyThreshold1 = cannyThreshold1;
-  this->cannyThreshold2 = cannyThreshold2;
-  this->cannyKernelSize = cannyKernelSize;
+  this->params.censusWin = censusWin;
+  this->params.defaultBorderCost = defaultBorderCost;
+  this->params.lambdaAD = lambdaAD;
+  this->params.lambdaCensus = lambdaCensus;
+  this->params.aggregatingIterations = aggregatingIterations;
+  this->params.colorThreshold1 = colorThreshold1;
+  this->params.colorThreshold2 = colorThreshold2;
+  this->params.maxLength1 = maxLength1;
+  this->params.maxLength2 = maxLength2;
+  this->params.colorDifference = colorDifference;
+  this->params.pi1 = pi1;
+  this->params.pi2 = pi2;
+  this->params.dispTolerance = dispTolerance;
+  this->params.votingThreshold = votingThreshold;
+  this->params.votingRatioThreshold = votingRatioThreshold;
+  this->params.maxSearchDepth = maxSearchDepth;
+  this->params.blurKernelSize = blurKernelSize;
+  this->params.cannyThreshold1 = cannyThreshold1;
+  this->params.cannyThreshold2 = cannyThreshold2;
+  this->params.cannyKernelSize = cannyKernelSize;
   this->validParams = false;
   this->dispComputed = false;
 }
@@ -49,224 +117,221 @@ StereoProcessor::StereoProcessor(
     uint dispTolerance, uint votingThreshold, float votingRatioThreshold,
     uint maxSearchDepth, uint blurKernelSize, uint cannyThreshold1,
     uint cannyThreshold2, uint cannyKernelSize) {
-  this->dMin = dMin;
-  this->dMax = dMax;
-  this->censusWin = censusWin;
-  this->defaultBorderCost = defaultBorderCost;
-  this->lambdaAD = lambdaAD;
-  this->lambdaCensus = lambdaCensus;
-  this->aggregatingIterations = aggregatingIterations;
-  this->colorThreshold1 = colorThreshold1;
-  this->colorThreshold2 = colorThreshold2;
-  this->maxLength1 = maxLength1;
-  this->maxLength2 = maxLength2;
-  this->colorDifference = colorDifference;
-  this->pi1 = pi1;
-  this->pi2 = pi2;
-  this->dispTolerance = dispTolerance;
-  this->votingThreshold = votingThreshold;
-  this->votingRatioThreshold = votingRatioThreshold;
-  this->maxSearchDepth = maxSearchDepth;
-  this->blurKernelSize = blurKernelSize;
-  this->cannyThreshold1 = cannyThreshold1;
-  this->cannyThreshold2 = cannyThreshold2;
-  this->cannyKernelSize = cannyKernelSize;
+  this->params.dMin = dMin;
+  this->params.dMax = dMax;
+  this->params.censusWin = censusWin;
+  this->params.defaultBorderCost = defaultBorderCost;
+  this->params.lambdaAD = lambdaAD;
+  this->params.lambdaCensus = lambdaCensus;
+  this->params.aggregatingIterations = aggregatingIterations;
+  this->params.colorThreshold1 = colorThreshold1;
+  this->params.colorThreshold2 = colorThreshold2;
+  this->params.maxLength1 = maxLength1;
+  this->params.maxLength2 = maxLength2;
+  this->params.colorDifference = colorDifference;
+  this->params.pi1 = pi1;
+  this->params.pi2 = pi2;
+  this->params.dispTolerance = dispTolerance;
+  this->params.votingThreshold = votingThreshold;
+  this->params.votingRatioThreshold = votingRatioThreshold;
+  this->params.maxSearchDepth = maxSearchDepth;
+  this->params.blurKernelSize = blurKernelSize;
+  this->params.cannyThreshold1 = cannyThreshold1;
+  this->params.cannyThreshold2 = cannyThreshold2;
+  this->params.cannyKernelSize = cannyKernelSize;
   this->validParams = false;
   this->dispComputed = false;
 }
 
-StereoProcessor::~StereoProcessor() {
-  delete adCensus;
-  delete aggregation;
-  delete dispRef;
-}
+StereoProcessor::~StereoProcessor() {}
 
-bool StereoProcessor::init() {
-  bool valid = true;
+bool StereoProcessor::init() { return init(images[0].size()); }
 
-  this->imgSize = images[0].size();
-  costMaps.resize(2);
-  for (size_t i = 0; i < 2; i++) {
-    costMaps[i].resize(abs(dMax - dMin) + 1);
-    for (size_t j = 0; j < costMaps[i].size(); j++) {
-      costMaps[i][j].create(imgSize, COST_MAP_TYPE);
-    }
+bool StereoProcessor::init(const Size &imgSize) {
+  const int dMin = params.dMin;
+  const int dMax = params.dMax;
+  bool valid = imgSize.width > 0 && imgSize.height > 0 && dMin <= dMax;
+
+  if (valid && imgSize == this->imgSize && validParams) {
+    return true;
+  }
+
+  this->imgSize = imgSize;
+  for (size_t i = 0; i < 2 && valid; i++) {
+    valid = costVolumes[i].create(imgSize.height, imgSize.width,
+                                  dMax - dMin + 1);
   }
 
-  adCensus =
-      new ADCensusCV(images[0], images[1], censusWin, lambdaAD, lambdaCensus);
-  aggregation = new Aggregation(images[0], images[1], colorThreshold1,
-                                colorThreshold2, maxLength1, maxLength2);
-  dispRef = new DisparityRefinement(dispTolerance, dMin, dMax, votingThreshold,
-                                    votingRatioThreshold, maxSearchDepth,
-                                    blurKernelSize, cannyThreshold1,
-                                    cannyThreshold2, cannyKernelSize);
+  // the helpers only get images of this size, until then they work on blank
+  // images of it
+  const Mat blank = Mat::zeros(imgSize, CV_8UC3);
+  if (valid && (images[0].size() != imgSize || images[1].size() != imgSize)) {
+    images[0] = blank;
+    images[1] = blank;
+  }
+
+  if (valid) {
+    adCensus.reset(new ADCensusCV(images[0], images[1], params.censusWin,
+                                  params.lambdaAD, params.lambdaCensus));
+    aggregation.reset(new Aggregation(
+        images[0], images[1], params.colorThreshold1, params.colorThreshold2,
+        params.maxLength1, params.maxLength2));
+    scanline.reset(new ScanlineOptimization(images[0], images[1], dMin, dMax,
+                                            params.colorDifference,
+                                            params.pi1, params.pi2));
+    dispRef.reset(new DisparityRefinement(
+        params.dispTolerance, dMin, dMax, params.votingThreshold,
+        params.votingRatioThreshold, params.maxSearchDepth,
+        params.blurKernelSize, params.cannyThreshold1, params.cannyThreshold2,
+        params.cannyKernelSize));
+  }
 
   validParams = valid;
+  dispComputed = false;
   return valid;
 }
 
 bool StereoProcessor::compute() {
-  if (validParams) {
-    TicToc t_costInitialization;
-    costInitialization();
-    std::cout << "t_costInitialization: " << t_costInitialization.toc() << "ms"
-              << std::endl;
-    TicToc t_costAggregation;
-    costAggregation();
-    std::cout << "t_costAggregation: " << t_costAggregation.toc() << "ms"
-              << std::endl;
-    TicToc t_scanlineOptimization;
-    scanlineOptimization();
-    std::cout << "t_scanlineOptimization: " << t_scanlineOptimization.toc()
-              << "ms" << std::endl;
-    outlierElimination();
-    regionVoting();
-    properInterpolation();
-    discontinuityAdjustment();
-    subpixelEnhancement();
-    dispComputed = true;
+  if (!validParams) {
+    return false;
+  }
+
+  stageTimer.Clear();
+  return computeStages();
+}
+
+bool StereoProcessor::compute(const cv::Mat &img_left,
+                              const cv::Mat &img_right) {
+  if (img_left.empty() || img_left.type() != CV_8UC3 ||
+      img_right.type() != CV_8UC3 || img_left.size() != img_right.size()) {
+    return false;
+  }
+
+  if (!init(img_left.size())) {
+    return false;
+  }
+
+  stageTimer.Clear();
+  setImages(img_left, img_right);
+  stageTimer.Lap("setImages");
+  return computeStages();
+}
+
+bool StereoProcessor::computeStages() {
+  if (!costInitialization()) {
+    return false;
   }
+  const double tCostInit = stageTimer.Lap("costInitialization");
+  costAggregation();
+  const double tCostAggr = stageTimer.Lap("costAggregation");
+  scanlineOptimization();
+  const double tScanline = stageTimer.Lap("scanlineOptimization");
+  if (params.printTiming) {
+    std::cout << "t_costInitialization: " << tCostInit << "ms" << std::endl;
+    std::cout << "t_costAggregation: " << tCostAggr << "ms" << std::endl;
+    std::cout << "t_scanlineOptimization: " << tScanline << "ms" << std::endl;
+  }
+  outlierElimination();
+  stageTimer.Lap("outlierElimination");
+  regionVoting();
+  stageTimer.Lap("regionVoting");
+  properInterpolation();
+  stageTimer.Lap("properInterpolation");
+  discontinuityAdjustment();
+  stageTimer.Lap("discontinuityAdjustment");
+  subpixelEnhancement();
+  stageTimer.Lap("subpixelEnhancement");
+  dispComputed = true;
+  return true;
+}
 
-  return validParams;
+void StereoProcessor::setImages(const Mat &leftImage, const Mat &rightImage) {
+  images[0] = leftImage;
+  images[1] = rightImage;
+  adCensus->setImages(leftImage, rightImage);
+  aggregation->setImages(leftImage, rightImage);
+  scanline->setImages(leftImage, rightImage);
+  dispComputed = false;
 }
 
 Mat StereoProcessor::getDisparity() const {
   return (dispComputed) ? floatDisparityMap : Mat();
 }
 
-void StereoProcessor::costInitialization() {
-  Size halfCensusWin(censusWin.width / 2, censusWin.height / 2);
-  bool out;
-  int d, h, w, wL, wR;
-  size_t imageNo;
-
-  for (imageNo = 0; imageNo < 2; ++imageNo) {
-#pragma omp parallel default(shared) private(d, h, w, wL, wR, out)             \
-    num_threads(omp_get_max_threads())
-#pragma omp for schedule(static)
-    for (d = 0; d <= dMax - dMin; d++) {
-      for (h = 0; h < imgSize.height; h++) {
-        for (w = 0; w < imgSize.width; w++) {
-          wL = w;
-          wR = w;
-
-          if (imageNo == 0)
-            wR = w - d;
-          else
-            wL = w + d;
-
-          out = wL - halfCensusWin.width < 0 ||
-                wL + halfCensusWin.width >= imgSize.width ||
-                wR - halfCensusWin.width < 0 ||
-                wR + halfCensusWin.width >= imgSize.width ||
-                h - halfCensusWin.height < 0 ||
-                h + halfCensusWin.height >= imgSize.height;
-
-          costMaps[imageNo][d].at<costType>(h, w) =
-              out ? defaultBorderCost * COST_FACTOR
-                  : adCensus->adCensus(wL, h, wR, h) / 2 * COST_FACTOR;
-        }
-      }
+const StereoParams &StereoProcessor::getParams() const { return params; }
+
+const StageTimer &StereoProcessor::getStageTimer() const { return stageTimer; }
+
+bool StereoProcessor::costInitialization() {
+  // released after the last frame with releaseCostVolumes
+  for (size_t imageNo = 0; imageNo < 2; ++imageNo) {
+    if (costVolumes[imageNo].empty() &&
+        !costVolumes[imageNo].create(imgSize.height, imgSize.width,
+                                     params.dMax - params.dMin + 1)) {
+      return false;
     }
   }
 
+  for (size_t imageNo = 0; imageNo < 2; ++imageNo) {
+    adCensus->computeCostVolume(costVolumes[imageNo], imageNo == 1,
+                                params.defaultBorderCost);
+  }
+
 #ifdef DEBUG
-  Mat disp = cost2disparity(0);
+  Mat disp;
+  cost2disparity(0, disp);
   saveDisparity<int>(disp, "01_dispLR.png");
 
-  disp = cost2disparity(1);
+  cost2disparity(1, disp);
   saveDisparity<int>(disp, "01_dispRL.png");
 #endif
+  return true;
 }
 
 void StereoProcessor::costAggregation() {
-  size_t imageNo, i;
-  int d;
-
-  for (imageNo = 0; imageNo < 2; ++imageNo) {
-
-#if COST_TYPE_NOT_FLOAT
-#pragma omp parallel default(shared) private(d, i)                             \
-    num_threads(omp_get_max_threads())
-#pragma omp for schedule(static)
-    for (d = 0; d <= dMax - dMin; d++) {
-      Mat currCostMap(imgSize, CV_32F);
-
-      for (int h = 0; h < imgSize.height; h++) {
-        for (int w = 0; w < imgSize.width; w++) {
-          currCostMap.at<float>(h, w) =
-              (float)costMaps[imageNo][d].at<costType>(h, w) / COST_FACTOR;
-        }
-      }
-
-      bool horizontalFirst = true;
-      for (i = 0; i < aggregatingIterations; i++) {
-        aggregation->aggregation2D(currCostMap, horizontalFirst, imageNo);
-        horizontalFirst = !horizontalFirst;
-      }
-
-      for (int h = 0; h < imgSize.height; h++) {
-        for (int w = 0; w < imgSize.width; w++) {
-          costMaps[imageNo][d].at<costType>(h, w) =
-              (costType)(currCostMap.at<float>(h, w) * COST_FACTOR);
-        }
-      }
-    }
-#else
-#pragma omp parallel default(shared) private(d, i)                             \
-    num_threads(omp_get_max_threads())
-#pragma omp for schedule(static)
-    for (d = 0; d <= dMax - dMin; d++) {
-      bool horizontalFirst = true;
-      for (i = 0; i < aggregatingIterations; i++) {
-        aggregation->aggregation2D(costMaps[imageNo][d], horizontalFirst,
-                                   imageNo);
-        horizontalFirst = !horizontalFirst;
-        cout << "[StereoProcessor] aggregation iteration no. " << i
-             << ", disparity no. " << d << " for image no. " << imageNo << endl;
-      }
-    }
-#endif
+  for (size_t imageNo = 0; imageNo < 2; ++imageNo) {
+    aggregation->aggregation3D(costVolumes[imageNo],
+                               params.aggregatingIterations, imageNo);
   }
 
 #ifdef DEBUG
-  Mat disp = cost2disparity(0);
+  Mat disp;
+  cost2disparity(0, disp);
   saveDisparity<int>(disp, "02_dispLR_agg.png");
 
-  disp = cost2disparity(1);
+  cost2disparity(1, disp);
   saveDisparity<int>(disp, "02_dispRL_agg.png");
 #endif
 }
 
 void StereoProcessor::scanlineOptimization() {
-  ScanlineOptimization sO(images[0], images[1], dMin, dMax, colorDifference,
-                          pi1, pi2);
-  int imageNo;
-
-#pragma omp parallel default(shared) private(imageNo)                          \
-    num_threads(omp_get_max_threads())
-#pragma omp for schedule(static)
-  for (imageNo = 0; imageNo < 2; ++imageNo) {
-
-    sO.optimization(&costMaps[imageNo], (imageNo == 1));
+  // the passes split the scanlines of one image among the threads
+  for (size_t imageNo = 0; imageNo < 2; ++imageNo) {
+    scanline->optimization(&costVolumes[imageNo], (imageNo == 1));
   }
 
 #ifdef DEBUG
-  Mat disp = cost2disparity(0);
+  Mat disp;
+  cost2disparity(0, disp);
   saveDisparity<int>(disp, "03_dispLR_so.png");
 
-  disp = cost2disparity(1);
+  cost2disparity(1, disp);
   saveDisparity<int>(disp, "03_dispRL_so.png");
 #endif
 }
 
 void StereoProcessor::outlierElimination() {
+  cost2disparity(0, costDisparities[0],
+                 params.sparseRefinement ? &costTriplets : nullptr);
+  cost2disparity(1, costDisparities[1]);
 
-  Mat disp0 = cost2disparity(0);
-  Mat disp1 = cost2disparity(1);
+  if (params.sparseRefinement && params.releaseCostVolumes) {
+    costVolumes[0].release();
+    costVolumes[1].release();
+  }
 
-  disparityMap = dispRef->outlierElimination(disp0, disp1);
+  dispRef->outlierElimination(costDisparities[0], costDisparities[1],
+                              disparityMap);
 
 #ifdef DEBUG
   saveDisparity<int>(disparityMap, "04_dispBoth_oe.png");
@@ -274,8 +339,7 @@ void StereoProcessor::outlierElimination() {
 }
 
 void StereoProcessor::regionVoting() {
-  vector<Mat> upLimits, downLimits, leftLimits, rightLimits;
-
+  // shares the data of the limits of the aggregation
   aggregation->getLimits(upLimits, downLimits, leftLimits, rightLimits);
 
   bool horizontalFirst = false;
@@ -299,7 +363,11 @@ void StereoProcessor::properInterpolation() {
 }
 
 void StereoProcessor::discontinuityAdjustment() {
-  dispRef->discontinuityAdjustment(disparityMap, costMaps);
+  if (params.sparseRefinement) {
+    dispRef->discontinuityAdjustment(disparityMap, costTriplets);
+  } else {
+    dispRef->discontinuityAdjustment(disparityMap, costVolumes[0]);
+  }
 
 #ifdef DEBUG
   saveDisparity<int>(disparityMap, "07_dispBoth_da.png");
@@ -307,29 +375,46 @@ void StereoProcessor::discontinuityAdjustment() {
 }
 
 void StereoProcessor::subpixelEnhancement() {
-  floatDisparityMap = dispRef->subpixelEnhancement(disparityMap, costMaps);
+  if (params.sparseRefinement) {
+    dispRef->subpixelEnhancement(disparityMap, costTriplets,
+                                 floatDisparityMap);
+  } else {
+    dispRef->subpixelEnhancement(disparityMap, costVolumes[0],
+                                 floatDisparityMap);
+  }
 
 #ifdef DEBUG
   saveDisparity<float>(floatDisparityMap, "08_dispBoth_se.png");
 #endif
 }
 
-Mat StereoProcessor::cost2disparity(int imageNo) {
-  Mat disp(imgSize, CV_32S);
-  Mat lowCost(imgSize, COST_MAP_TYPE,
-              Scalar(std::numeric_limits<costType>::max()));
-
-  for (int d = 0; d <= dMax - dMin; d++) {
-    for (size_t h = 0; h < imgSize.height; h++) {
-      for (size_t w = 0; w < imgSize.width; w++) {
-        if (lowCost.at<costType>(h, w) >
-            costMaps[imageNo][d].at<costType>(h, w)) {
-          lowCost.at<costType>(h, w) = costMaps[imageNo][d].at<costType>(h, w);
-          disp.at<int>(h, w) = d + dMin;
+void StereoProcessor::cost2disparity(int imageNo, Mat &disp,
+                                     CostTriplets *triplets) {
+  disp.create(imgSize, CV_32S);
+  const CostVolume &costs = costVolumes[imageNo];
+  const int disparities = costs.getDisparities();
+  if (triplets) {
+    triplets->create(imgSize.height, imgSize.width, disparities);
+  }
+
+#pragma omp parallel for schedule(static) num_threads(omp_get_max_threads())
+  for (int h = 0; h < imgSize.height; h++) {
+    int *dispRow = disp.ptr<int>(h);
+    for (int w = 0; w < imgSize.width; w++) {
+      // the first of equal minima wins
+      const costType *pixelCosts = costs.ptr(h, w);
+      costType lowCost = std::numeric_limits<costType>::max();
+      int bestDisp = 0;
+      for (int d = 0; d < disparities; d++) {
+        if (lowCost > pixelCosts[d]) {
+          lowCost = pixelCosts[d];
+          bestDisp = d;
         }
       }
+      dispRow[w] = bestDisp + params.dMin;
+      if (triplets) {
+        triplets->gather(costs, h, w, bestDisp);
+      }
     }
   }
-
-  return disp;
 }
@@ -1,16 +1,67 @@
 #ifndef STEREOPROCESSOR_H
 #define STEREOPROCESSOR_H
+#include "../StereoCommon/stage_timer.h"
 #include "adcensuscv.h"
 #include "aggregation.h"
 #include "common.h"
+#include "costvolume.h"
 #include "disparityrefinement.h"
 #include "scanlineoptimization.h"
+#include <memory>
 #include <omp.h>
 
 using namespace std;
 
+// Parameters of the StereoProcessor, the defaults are the ones of
+// config/adcensus.yaml
+struct StereoParams {
+  StereoParams();
+
+  // Overwrites the parameters found in an OpenCV YAML/XML file with the keys of
+  // config/adcensus.yaml, returns false if the file can not be opened.
+  bool read(const string &path);
+
+  int dMin;
+  int dMax;
+  Size censusWin;
+  float defaultBorderCost;
+  float lambdaAD;
+  float lambdaCensus;
+  uint aggregatingIterations;
+  uint colorThreshold1;
+  uint colorThreshold2;
+  uint maxLength1;
+  uint maxLength2;
+  uint colorDifference;
+  float pi1;
+  float pi2;
+  uint dispTolerance;
+  uint votingThreshold;
+  float votingRatioThreshold;
+  uint maxSearchDepth;
+  uint blurKernelSize;
+  uint cannyThreshold1;
+  uint cannyThreshold2;
+  uint cannyKernelSize;
+  // print the timings of the first stages on every compute
+  bool printTiming;
+  // The discontinuity adjustment and the subpixel enhancement read the costs
+  // d - 1, d, d + 1 around the cost minimum d of every pixel, gathered while
+  // picking the minima, instead of the left cost volume. Pixels whose
+  // disparity the refinement moved off that triplet keep it as it is.
+  bool sparseRefinement;
+  // with sparseRefinement, free the cost volumes once the minima are picked,
+  // they are allocated again by the next compute
+  bool releaseCostVolumes;
+};
+
+// Configured once, the processor keeps its cost volumes, helpers and scratch
+// buffers between frames, so a stream of pairs of one size is processed
+// without reallocation. A pair of another size reallocates once.
 class StereoProcessor {
 public:
+  explicit StereoProcessor(const StereoParams &params);
+
   StereoProcessor(uint dMin, uint dMax, Mat leftImage, Mat rightImage,
                   Size censusWin, float defaultBorderCost, float lambdaAD,
                   float lambdaCensus, uint aggregatingIterations,
@@ -32,46 +83,54 @@ public:
                   uint cannyThreshold2, uint cannyKernelSize);
 
   ~StereoProcessor();
+
+  // allocates for the pair given to the constructor
   bool init();
+  // allocates for pairs of imgSize, nothing is reallocated if it is the size
+  // of the last init
+  bool init(const Size &imgSize);
+  // computes the disparity of the current pair
   bool compute();
 
+  // computes the disparity of a new pair (CV_8UC3), the first pair and any
+  // pair of another size call init
   bool compute(const cv::Mat &img_left, const cv::Mat &img_right);
+
+  // the disparity of the left image (CV_32F), its data is overwritten by the
+  // next compute
   Mat getDisparity() const;
 
+  const StereoParams &getParams() const;
+
+  // stage timings of the last compute, compute(img_left, img_right) records
+  // the setup of the new pair as stage "setImages"
+  const StageTimer &getStageTimer() const;
+
 private:
-  int dMin;
-  int dMax;
+  StereoParams params;
   Mat images[2];
-  Size censusWin;
-  float defaultBorderCost;
-  float lambdaAD;
-  float lambdaCensus;
-  uint aggregatingIterations;
-  uint colorThreshold1;
-  uint colorThreshold2;
-  uint maxLength1;
-  uint maxLength2;
-  uint colorDifference;
-  float pi1;
-  float pi2;
-  uint dispTolerance;
-  uint votingThreshold;
-  float votingRatioThreshold;
-  uint maxSearchDepth;
-  uint blurKernelSize;
-  uint cannyThreshold1;
-  uint cannyThreshold2;
-  uint cannyKernelSize;
   bool validParams, dispComputed;
 
-  vector<vector<Mat>> costMaps;
+  // costs of the left and the right image
+  CostVolume costVolumes[2];
   Size imgSize;
-  ADCensusCV *adCensus;
-  Aggregation *aggregation;
+  std::unique_ptr<ADCensusCV> adCensus;
+  std::unique_ptr<Aggregation> aggregation;
+  std::unique_ptr<ScanlineOptimization> scanline;
+  std::unique_ptr<DisparityRefinement> dispRef;
+  vector<Mat> upLimits, downLimits, leftLimits, rightLimits;
+  Mat costDisparities[2];
+  // costs around the minima of the left image for sparseRefinement
+  CostTriplets costTriplets;
   Mat disparityMap, floatDisparityMap;
-  DisparityRefinement *dispRef;
+  StageTimer stageTimer;
+
+  void setImages(const Mat &leftImage, const Mat &rightImage);
+  // runs all stages on the current pair and records their laps, false if the
+  // cost volumes can not be allocated
+  bool computeStages();
 
-  void costInitialization();
+  bool costInitialization();
   void costAggregation();
   void scanlineOptimization();
   void outlierElimination();
@@ -80,7 +139,10 @@ private:
   void discontinuityAdjustment();
   void subpixelEnhancement();
 
-  Mat cost2disparity(int imageNo);
+  // picks the disparity of the lowest cost per pixel and if triplets is given
+  // keeps the costs around it
+  void cost2disparity(int imageNo, Mat &disp,
+                      CostTriplets *triplets = nullptr);
 };
 
 #endif // STEREOPROCESSOR_H
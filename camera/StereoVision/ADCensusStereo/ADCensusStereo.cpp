@@ -1,15 +1,13 @@
 #include "ADCensusStereo.h"
 #include <algorithm>
-#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <opencv2/opencv.hpp>
 
-using namespace std::chrono;
-
 ADCensusStereo::ADCensusStereo()
     : width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
-      disp_left_(nullptr), disp_right_(nullptr), is_initialized_(true) {}
+      disp_left_(nullptr), disp_right_(nullptr), cost_aggregated_(false),
+      is_initialized_(true) {}
 
 ADCensusStereo::~ADCensusStereo() {
   Release();
@@ -36,18 +34,21 @@ bool ADCensusStereo::Initialize(const int &width, const int &height,
   disp_right_ = new float[img_size];
 
   if (!cost_computer_.Initialize(width_, height_, option_.min_disparity,
-                                 option_.max_disparity)) {
+                                 option_.max_disparity,
+                                 option_.do_fixed_point)) {
     is_initialized_ = false;
     return is_initialized_;
   }
 
   if (!aggregator_.Initialize(width_, height_, option_.min_disparity,
-                              option_.max_disparity)) {
+                              option_.max_disparity, option_.do_fixed_point,
+                              option_.do_integral_aggregation,
+                              option_.num_threads)) {
     is_initialized_ = false;
     return is_initialized_;
   }
 
-  if (!refiner_.Initialize(width_, height_)) {
+  if (!refiner_.Initialize(width_, height_, disp_range, option_.num_threads)) {
     is_initialized_ = false;
     return is_initialized_;
   }
@@ -66,49 +67,62 @@ bool ADCensusStereo::Match(const cv::Mat &img_left, const cv::Mat &img_right,
   img_left_ = img_left.data;
   img_right_ = img_right.data;
 
-  auto start = steady_clock::now();
+  timer_.Clear();
 
   ComputeCost();
 
-  auto end = steady_clock::now();
-  auto tt = duration_cast<milliseconds>(end - start);
-  printf("computing cost! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  double ms = timer_.Lap("cost");
+  if (option_.do_print_timing) {
+    printf("computing cost! timing :	%lf s\n", ms / 1000.0);
+  }
+
+  cost_aggregated_ = false;
+  if (option_.aggregation_iters > 0 && !BudgetSpent()) {
+    CostAggregation();
+    cost_aggregated_ = true;
 
-  CostAggregation();
+    ms = timer_.Lap("aggregation");
+    if (option_.do_print_timing) {
+      printf("cost aggregating! timing :	%lf s\n", ms / 1000.0);
+    }
+  }
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("cost aggregating! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  if (option_.do_scanline_optimization && !BudgetSpent()) {
+    ScanlineOptimize();
 
-  ScanlineOptimize();
+    ms = timer_.Lap("scanline");
+    if (option_.do_print_timing) {
+      printf("scanline optimizing! timing :	%lf s\n", ms / 1000.0);
+    }
+  }
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("scanline optimizing! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  const bool do_refinement = option_.do_refinement && !BudgetSpent();
 
   ComputeDisparity();
-  ComputeDisparityRight();
+  if (do_refinement && option_.do_lr_check) {
+    ComputeDisparityRight();
+  }
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("computing disparities! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  ms = timer_.Lap("disparity");
+  if (option_.do_print_timing) {
+    printf("computing disparities! timing :	%lf s\n", ms / 1000.0);
+  }
 
-  MultiStepRefine();
+  if (do_refinement) {
+    MultiStepRefine();
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("multistep refining! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+    ms = timer_.Lap("refine");
+    if (option_.do_print_timing) {
+      printf("multistep refining! timing :	%lf s\n", ms / 1000.0);
+    }
+  }
 
   memcpy(disp_left.data, disp_left_, height_ * width_ * sizeof(float));
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("output disparities! timing :	%lf s\n", tt.count() / 1000.0);
+  ms = timer_.Lap("output");
+  if (option_.do_print_timing) {
+    printf("output disparities! timing :	%lf s\n", ms / 1000.0);
+  }
 
   return true;
 }
@@ -129,45 +143,91 @@ void ADCensusStereo::ComputeCost() {
 }
 
 void ADCensusStereo::CostAggregation() {
-  aggregator_.SetData(img_left_, img_right_, cost_computer_.get_cost_ptr());
+  if (option_.do_fixed_point) {
+    aggregator_.SetData(img_left_, img_right_,
+                        cost_computer_.get_cost_fixed_ptr());
+  } else {
+    aggregator_.SetData(img_left_, img_right_, cost_computer_.get_cost_ptr());
+  }
   aggregator_.SetParams(option_.cross_L1, option_.cross_L2, option_.cross_t1,
                         option_.cross_t2);
-  aggregator_.Aggregate(4);
+  aggregator_.Aggregate(option_.aggregation_iters);
+}
+
+bool ADCensusStereo::BudgetSpent() const {
+  return option_.time_budget_ms > 0.0f &&
+         timer_.total() >= option_.time_budget_ms;
+}
+
+float *ADCensusStereo::CostResult() {
+  return cost_aggregated_ ? aggregator_.get_cost_ptr()
+                          : cost_computer_.get_cost_ptr();
+}
+
+uint16_t *ADCensusStereo::CostResultFixed() {
+  return cost_aggregated_ ? aggregator_.get_cost_fixed_ptr()
+                          : cost_computer_.get_cost_fixed_ptr();
 }
 
 void ADCensusStereo::ScanlineOptimize() {
-  scan_line_.SetData(img_left_, img_right_, cost_computer_.get_cost_ptr(),
-                     aggregator_.get_cost_ptr());
+  // the other cost volume is the buffer of the scanline passes, the result
+  // stays in the current one
+  if (option_.do_fixed_point) {
+    uint16_t *buffer = cost_aggregated_ ? cost_computer_.get_cost_fixed_ptr()
+                                        : aggregator_.get_cost_fixed_ptr();
+    scan_line_.SetData(img_left_, img_right_, buffer, CostResultFixed());
+  } else {
+    float *buffer = cost_aggregated_ ? cost_computer_.get_cost_ptr()
+                                     : aggregator_.get_cost_ptr();
+    scan_line_.SetData(img_left_, img_right_, buffer, CostResult());
+  }
   scan_line_.SetParam(width_, height_, option_.min_disparity,
                       option_.max_disparity, option_.so_p1, option_.so_p2,
-                      option_.so_tso);
+                      option_.so_tso, option_.num_threads);
   scan_line_.Optimize();
 }
 
 void ADCensusStereo::MultiStepRefine() {
-  refiner_.SetData(img_left_, aggregator_.get_cost_ptr(),
-                   aggregator_.get_arms_ptr(), disp_left_, disp_right_);
+  // the region voting needs the arms of the aggregation
+  if (!cost_aggregated_ && option_.do_lr_check && option_.do_filling) {
+    if (option_.do_fixed_point) {
+      aggregator_.SetData(img_left_, img_right_,
+                          cost_computer_.get_cost_fixed_ptr());
+    } else {
+      aggregator_.SetData(img_left_, img_right_,
+                          cost_computer_.get_cost_ptr());
+    }
+    aggregator_.SetParams(option_.cross_L1, option_.cross_L2,
+                          option_.cross_t1, option_.cross_t2);
+    aggregator_.BuildArms();
+  }
+
+  if (option_.do_fixed_point) {
+    refiner_.SetData(img_left_, CostResultFixed(), aggregator_.get_arms_ptr(),
+                     disp_left_, disp_right_);
+  } else {
+    refiner_.SetData(img_left_, CostResult(), aggregator_.get_arms_ptr(),
+                     disp_left_, disp_right_);
+  }
   refiner_.SetParam(option_.min_disparity, option_.max_disparity,
                     option_.irv_ts, option_.irv_th, option_.lrcheck_thres,
                     option_.do_lr_check, option_.do_filling, option_.do_filling,
-                    option_.do_discontinuity_adjustment);
+                    option_.do_discontinuity_adjustment,
+                    option_.do_parallel_refinement);
   refiner_.Refine();
 }
 
-void ADCensusStereo::ComputeDisparity() {
-  const int &min_disparity = option_.min_disparity;
-  const int &max_disparity = option_.max_disparity;
+// Winner takes all with sub-pixel interpolation. T is float or the fixed point
+// cost, which is compared and interpolated as float.
+template <typename T>
+static void ComputeDisparityWta(const T *cost_ptr, const int &width,
+                                const int &height, const int &min_disparity,
+                                const int &max_disparity, float *disparity) {
   const int disp_range = max_disparity - min_disparity;
   if (disp_range <= 0) {
     return;
   }
 
-  const auto disparity = disp_left_;
-  const auto cost_ptr = aggregator_.get_cost_ptr();
-
-  const int width = width_;
-  const int height = height_;
-
   std::vector<float> cost_local(disp_range);
 
   for (int i = 0; i < height; i++) {
@@ -204,20 +264,17 @@ void ADCensusStereo::ComputeDisparity() {
   }
 }
 
-void ADCensusStereo::ComputeDisparityRight() {
-  const int &min_disparity = option_.min_disparity;
-  const int &max_disparity = option_.max_disparity;
+template <typename T>
+static void ComputeDisparityRightWta(const T *cost_ptr, const int &width,
+                                     const int &height,
+                                     const int &min_disparity,
+                                     const int &max_disparity,
+                                     float *disparity) {
   const int disp_range = max_disparity - min_disparity;
   if (disp_range <= 0) {
     return;
   }
 
-  const auto disparity = disp_right_;
-  const auto cost_ptr = aggregator_.get_cost_ptr();
-
-  const int width = width_;
-  const int height = height_;
-
   std::vector<float> cost_local(disp_range);
 
   // cost(xr,yr,d) = cost(xr+d,yl,d)
@@ -262,6 +319,29 @@ void ADCensusStereo::ComputeDisparityRight() {
   }
 }
 
+void ADCensusStereo::ComputeDisparity() {
+  if (option_.do_fixed_point) {
+    ComputeDisparityWta(CostResultFixed(), width_, height_,
+                        option_.min_disparity, option_.max_disparity,
+                        disp_left_);
+  } else {
+    ComputeDisparityWta(CostResult(), width_, height_, option_.min_disparity,
+                        option_.max_disparity, disp_left_);
+  }
+}
+
+void ADCensusStereo::ComputeDisparityRight() {
+  if (option_.do_fixed_point) {
+    ComputeDisparityRightWta(CostResultFixed(), width_, height_,
+                             option_.min_disparity, option_.max_disparity,
+                             disp_right_);
+  } else {
+    ComputeDisparityRightWta(CostResult(), width_, height_,
+                             option_.min_disparity, option_.max_disparity,
+                             disp_right_);
+  }
+}
+
 void ADCensusStereo::Release() {
   SAFE_DELETE(disp_left_);
   SAFE_DELETE(disp_right_);
@@ -1,5 +1,8 @@
+#ifndef AD_CENSUS_STEREO_H_
+#define AD_CENSUS_STEREO_H_
 
 #include <opencv2/opencv.hpp>
+#include "../StereoCommon/stage_timer.h"
 #include "adcensus_types.h"
 #include "cost_computor.h"
 #include "cross_aggregator.h"
@@ -14,10 +17,14 @@ class ADCensusStereo {
     bool Initialize(const int& width, const int& height, const ADCensusOption& option);
 
     // bool Match(const uint8* img_left, const uint8* img_right, float* disp_left);
+    // runs the stages selected in the option, see ADCensusOption::aggregation_iters
     bool Match(const cv::Mat& img_left, const cv::Mat& img_right, cv::Mat& disp_left);
 
     bool Reset(const size_t& width, const size_t& height, const ADCensusOption& option);
 
+    // stage timings of the last Match
+    const StageTimer& GetStageTimer() const { return timer_; }
+
    private:
     void ComputeCost();
 
@@ -31,6 +38,13 @@ class ADCensusStereo {
 
     void ComputeDisparityRight();
 
+    // true once the stages run so far have used up option_.time_budget_ms
+    bool BudgetSpent() const;
+
+    // cost volume holding the result of the last cost stage that ran
+    float* CostResult();
+    uint16_t* CostResultFixed();
+
     void Release();
 
    private:
@@ -50,5 +64,12 @@ class ADCensusStereo {
     float* disp_left_;
     float* disp_right_;
 
+    // the aggregator holds the current cost volume, otherwise the cost computor
+    bool cost_aggregated_;
+
+    StageTimer timer_;
+
     bool is_initialized_;
 };
+
+#endif
@@ -0,0 +1,145 @@
+#include "adcensus_region.h"
+#include <algorithm>
+#include <cstdio>
+#include "../StereoCommon/region.h"
+
+ADCensusRegionMatcher::ADCensusRegionMatcher()
+    : width_(0), height_(0), margin_(0), num_tiles_(0), is_initialized_(false) {}
+
+ADCensusRegionMatcher::~ADCensusRegionMatcher() { Release(); }
+
+bool ADCensusRegionMatcher::Initialize(const int& width, const int& height,
+                                       const ADCensusOption& option, const int& margin) {
+    Release();
+
+    is_initialized_ = false;
+    if (width <= 0 || height <= 0 || margin < 0 ||
+        option.max_disparity <= option.min_disparity) {
+        return false;
+    }
+
+    width_ = width;
+    height_ = height;
+    margin_ = margin;
+    option_ = option;
+    option_.num_threads = std::max(option.num_threads, 1);
+
+    is_initialized_ = true;
+    return is_initialized_;
+}
+
+bool ADCensusRegionMatcher::Match(const cv::Mat& img_left, const cv::Mat& img_right,
+                                  const std::vector<cv::Rect>& regions, cv::Mat& disp_left) {
+    if (!is_initialized_) {
+        return false;
+    }
+    if (img_left.cols != width_ || img_left.rows != height_ || img_left.type() != CV_8UC3 ||
+        img_right.size() != img_left.size() || img_right.type() != CV_8UC3) {
+        return false;
+    }
+
+    timer_.Clear();
+
+    if (!PrepareTiles(regions)) {
+        return false;
+    }
+
+    // one tile per thread, or the tiles one after another when each engine has all threads. A
+    // team of one keeps the parallel regions of the engines active, nested teams would run on a
+    // single thread.
+    const int num_threads =
+        num_tiles_ >= option_.num_threads ? std::min(option_.num_threads, num_tiles_) : 1;
+    bool ok = true;
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads) reduction(&& : ok)
+    for (int n = 0; n < num_tiles_; n++) {
+        auto& tile = tiles_[n];
+        // copyTo gives continuous buffers as expected by ADCensusStereo
+        img_left(tile.window).copyTo(tile.img_left);
+        img_right(tile.window).copyTo(tile.img_right);
+        if (!tile.stereo->Match(tile.img_left, tile.img_right, tile.disp_left)) {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        return false;
+    }
+
+    // stitch the regions into the output in the order they were given
+    disp_left.create(height_, width_, CV_32F);
+    disp_left.setTo(cv::Scalar(Invalid_Float));
+    for (int n = 0; n < num_tiles_; n++) {
+        const auto& tile = tiles_[n];
+        const cv::Rect local(tile.roi.x - tile.window.x, tile.roi.y - tile.window.y,
+                             tile.roi.width, tile.roi.height);
+        tile.disp_left(local).copyTo(disp_left(tile.roi));
+    }
+
+    const double ms = timer_.Lap("matching");
+    if (option_.do_print_timing) {
+        printf("matching %d regions! timing :	%lf s\n", num_tiles_, ms / 1000.0);
+    }
+
+    return true;
+}
+
+bool ADCensusRegionMatcher::PrepareTiles(const std::vector<cv::Rect>& regions) {
+    std::vector<cv::Rect> rois;
+    for (const auto& roi : regions) {
+        const auto clipped = roi & cv::Rect(0, 0, width_, height_);
+        if (clipped.area() > 0) {
+            rois.push_back(clipped);
+        }
+    }
+    num_tiles_ = static_cast<int>(rois.size());
+    if (tiles_.size() < rois.size()) {
+        Tile tile;
+        tile.num_threads = 0;
+        tile.stereo = nullptr;
+        tiles_.resize(rois.size(), tile);
+    }
+
+    // with fewer tiles than threads the tiles are matched one after another, each engine with all
+    // threads, otherwise each engine has a single thread
+    const int num_threads = num_tiles_ < option_.num_threads ? option_.num_threads : 1;
+
+    for (int n = 0; n < num_tiles_; n++) {
+        auto& tile = tiles_[n];
+        const auto& roi = rois[n];
+        const auto window = region::MatchWindow(
+            region::Rect(roi.x, roi.y, roi.width, roi.height), width_, height_,
+            option_.min_disparity, option_.max_disparity, margin_);
+        const bool is_same_size = tile.stereo != nullptr && tile.window.width == window.width &&
+                                  tile.window.height == window.height &&
+                                  tile.num_threads == num_threads;
+        tile.roi = roi;
+        tile.window = cv::Rect(window.x, window.y, window.width, window.height);
+        if (is_same_size) {
+            continue;
+        }
+
+        delete tile.stereo;
+        tile.stereo = new ADCensusStereo();
+        tile.num_threads = num_threads;
+        ADCensusOption option = option_;
+        option.num_threads = num_threads;
+        // the tiles run in parallel, Match prints one line for all of them
+        option.do_print_timing = false;
+        if (!tile.stereo->Initialize(window.width, window.height, option)) {
+            delete tile.stereo;
+            tile.stereo = nullptr;
+            return false;
+        }
+        tile.disp_left.create(window.height, window.width, CV_32F);
+    }
+
+    return true;
+}
+
+void ADCensusRegionMatcher::Release() {
+    for (auto& tile : tiles_) {
+        delete tile.stereo;
+        tile.stereo = nullptr;
+    }
+    tiles_.clear();
+    num_tiles_ = 0;
+}
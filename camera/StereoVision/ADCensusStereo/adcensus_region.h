@@ -0,0 +1,62 @@
+#ifndef AD_CENSUS_REGION_H_
+#define AD_CENSUS_REGION_H_
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "../StereoCommon/stage_timer.h"
+#include "ADCensusStereo.h"
+
+// Matches only a list of regions of interest. Every region is matched as a tile
+// with its own ADCensusStereo engine over region::MatchWindow and the tiles are stitched into the
+// output. With at least option.num_threads regions the tiles run in parallel with one thread each,
+// with fewer regions they run one after another with all threads.
+// Engines are kept between calls and only reallocated when a tile changes size.
+class ADCensusRegionMatcher {
+   public:
+    ADCensusRegionMatcher();
+    ~ADCensusRegionMatcher();
+
+    // margin should cover the cross arms (cross_L1) plus some room for the scanline
+    // optimization to settle.
+    bool Initialize(const int& width, const int& height, const ADCensusOption& option,
+                    const int& margin = 64);
+
+    // img_left and img_right are CV_8UC3, disp_left is CV_32F of the full image size. Pixels
+    // outside all regions are set to Invalid_Float, where regions overlap the later one is kept.
+    bool Match(const cv::Mat& img_left, const cv::Mat& img_right,
+               const std::vector<cv::Rect>& regions, cv::Mat& disp_left);
+
+    // time of the last Match
+    const StageTimer& GetStageTimer() const { return timer_; }
+
+   private:
+    struct Tile {
+        cv::Rect roi;
+        cv::Rect window;
+        int num_threads;
+        ADCensusStereo* stereo;
+        cv::Mat img_left;
+        cv::Mat img_right;
+        cv::Mat disp_left;
+    };
+
+    bool PrepareTiles(const std::vector<cv::Rect>& regions);
+
+    void Release();
+
+   private:
+    ADCensusOption option_;
+
+    int width_;
+    int height_;
+    int margin_;
+
+    std::vector<Tile> tiles_;
+    int num_tiles_;
+
+    StageTimer timer_;
+
+    bool is_initialized_;
+};
+
+#endif
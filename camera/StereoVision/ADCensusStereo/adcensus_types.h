@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <limits>
 #include <vector>
+#include "../StereoCommon/stereo_constants.h"
 using std::pair;
 using std::vector;
 using namespace std;
@@ -18,13 +19,12 @@ using namespace std;
 
 typedef uint8_t uint8;
 
-constexpr auto Invalid_Float = std::numeric_limits<float>::infinity();
-
-constexpr auto Large_Float = 99999.0f;
-constexpr auto Small_Float = -99999.0f;
-
 enum CensusSize { Census5x5 = 0, Census9x7 };
 
+// cost of 1.0 in the uint16 fixed point cost volumes (do_fixed_point). The initial cost is at
+// most 2.0 and each of the four scanline passes adds at most so_p2, larger costs saturate.
+constexpr uint16_t Fixed_Cost_One = 4064;
+
 struct ADCensusOption {
     int min_disparity;
     int max_disparity;
@@ -47,6 +47,36 @@ struct ADCensusOption {
     bool do_filling;
     bool do_discontinuity_adjustment;
 
+    // Stages of Match. Cost computation and winner takes all always run. The right disparity map
+    // is only computed for the left-right check of the refinement.
+    // iterations of the cross based aggregation, 0 skips it
+    int aggregation_iters;
+    bool do_scanline_optimization;
+    bool do_refinement;
+    // latency budget of Match in ms, 0 for none. Once the stages run so far have used it up, the
+    // remaining optional stages (aggregation, scanline optimization, refinement) are skipped.
+    float time_budget_ms;
+
+    // number of OpenMP threads
+    int num_threads;
+
+    // keep the cost volumes as uint16 fixed point (Fixed_Cost_One) instead of float, with the
+    // exponential AD + census cost taken from lookup tables. Halves the volume memory.
+    bool do_fixed_point;
+
+    // take the cross arm sums of the aggregation from prefix sums of every disparity slice
+    // instead of summing each arm. The float sums are rounded differently, off by default so
+    // that the float disparities stay unchanged.
+    bool do_integral_aggregation;
+
+    // split the refinement among num_threads threads. The region voting then updates all pixels
+    // of an iteration at once instead of one after the other and the median filter reads the
+    // unfiltered map, which changes the result slightly.
+    bool do_parallel_refinement;
+
+    // print the time of every stage of Match
+    bool do_print_timing;
+
     ADCensusOption()
         : min_disparity(0),
           max_disparity(64),
@@ -64,7 +94,30 @@ struct ADCensusOption {
           lrcheck_thres(1.0f),
           do_lr_check(true),
           do_filling(true),
-          do_discontinuity_adjustment(false){};
+          do_discontinuity_adjustment(false),
+          aggregation_iters(4),
+          do_scanline_optimization(true),
+          do_refinement(true),
+          time_budget_ms(0.0f),
+          num_threads(1),
+          do_fixed_point(false),
+          do_integral_aggregation(false),
+          do_parallel_refinement(false),
+          do_print_timing(true){};
+
+    // Fast preset: fixed point volumes, two aggregation iterations and only the median filter of
+    // the refinement, within time_budget_ms (0 for none).
+    static ADCensusOption Fast(const float& time_budget_ms = 0.0f) {
+        ADCensusOption option;
+        option.do_fixed_point = true;
+        option.do_integral_aggregation = true;
+        option.aggregation_iters = 2;
+        option.do_lr_check = false;
+        option.do_filling = false;
+        option.do_discontinuity_adjustment = false;
+        option.time_budget_ms = time_budget_ms;
+        return option;
+    }
 };
 
 struct ADColor {
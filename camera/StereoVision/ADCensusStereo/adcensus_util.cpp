@@ -1,42 +1,9 @@
 #include "adcensus_util.h"
 #include <cassert>
+#include <omp.h>
 
-void adcensus_util::census_transform_9x7(const uint8 *source, vector<size_t> &census,
-                                         const int &width, const int &height) {
-    if (source == nullptr || census.empty() || width <= 9 || height <= 7) {
-        return;
-    }
-
-    for (int i = 4; i < height - 4; i++) {
-        for (int j = 3; j < width - 3; j++) {
-            const uint8 gray_center = source[i * width + j];
-
-            size_t census_val = 0u;
-            for (int r = -4; r <= 4; r++) {
-                for (int c = -3; c <= 3; c++) {
-                    census_val <<= 1;
-                    const uint8 gray = source[(i + r) * width + j + c];
-                    if (gray < gray_center) {
-                        census_val += 1;
-                    }
-                }
-            }
-
-            census[i * width + j] = census_val;
-        }
-    }
-}
-
-uint8 adcensus_util::Hamming64(const size_t &x, const size_t &y) {
-    size_t dist = 0, val = x ^ y;
-
-    // Count the number of set bits
-    while (val) {
-        ++dist;
-        val &= val - 1;
-    }
-
-    return static_cast<uint8>(dist);
+uint8 adcensus_util::Hamming64(const uint64_t &x, const uint64_t &y) {
+    return static_cast<uint8>(__builtin_popcountll(x ^ y));
 }
 
 void adcensus_util::MedianFilter(const float *in, float *out, const int &width, const int &height,
@@ -65,4 +32,32 @@ void adcensus_util::MedianFilter(const float *in, float *out, const int &width,
             }
         }
     }
+}
+
+void adcensus_util::MedianFilter(const float *in, float *out, const int &width, const int &height,
+                                 const int wnd_size, const int &num_threads, float *wnd_data) {
+    assert(in != out);
+    const int radius = wnd_size / 2;
+    const int size = wnd_size * wnd_size;
+
+#pragma omp parallel for schedule(static) num_threads(num_threads)
+    for (int y = 0; y < height; y++) {
+        float *wnd = wnd_data + omp_get_thread_num() * size;
+        for (int x = 0; x < width; x++) {
+            int n = 0;
+            for (int r = -radius; r <= radius; r++) {
+                for (int c = -radius; c <= radius; c++) {
+                    const int row = y + r;
+                    const int col = x + c;
+                    if (row >= 0 && row < height && col >= 0 && col < width) {
+                        wnd[n++] = in[row * width + col];
+                    }
+                }
+            }
+            std::sort(wnd, wnd + n);
+            if (n > 0) {
+                out[y * width + x] = wnd[n / 2];
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -5,11 +5,14 @@
 
 namespace adcensus_util {
 
-void census_transform_9x7(const uint8* source, vector<size_t>& census, const int& width,
-                          const int& height);
 // Hamming distance
-uint8 Hamming64(const size_t& x, const size_t& y);
+uint8 Hamming64(const uint64_t& x, const uint64_t& y);
 
 void MedianFilter(const float* in, float* out, const int& width, const int& height,
                   const int wnd_size);
+
+// Same with the rows split among num_threads threads, in and out must not overlap. wnd_data holds
+// wnd_size * wnd_size floats per thread.
+void MedianFilter(const float* in, float* out, const int& width, const int& height,
+                  const int wnd_size, const int& num_threads, float* wnd_data);
 }  // namespace adcensus_util
\ No newline at end of file
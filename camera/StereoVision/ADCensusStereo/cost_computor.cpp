@@ -1,5 +1,6 @@
 #include "cost_computor.h"
 #include <cmath>
+#include "../StereoCommon/census.h"
 #include "adcensus_util.h"
 
 CostComputor::CostComputor()
@@ -11,16 +12,18 @@ CostComputor::CostComputor()
       lambda_census_(0),
       min_disparity_(0),
       max_disparity_(0),
+      fixed_point_(false),
       is_initialized_(false) {}
 
 CostComputor::~CostComputor() {}
 
 bool CostComputor::Initialize(const int &width, const int &height, const int &min_disparity,
-                              const int &max_disparity) {
+                              const int &max_disparity, const bool &fixed_point) {
     width_ = width;
     height_ = height;
     min_disparity_ = min_disparity;
     max_disparity_ = max_disparity;
+    fixed_point_ = fixed_point;
 
     const int img_size = width_ * height_;
     const int disp_range = max_disparity_ - min_disparity_;
@@ -33,10 +36,18 @@ bool CostComputor::Initialize(const int &width, const int &height, const int &mi
     gray_right_.resize(img_size);
     census_left_.resize(img_size, 0);
     census_right_.resize(img_size, 0);
-    cost_init_.resize(img_size * disp_range);
+    // only the volume of the selected representation is kept
+    if (fixed_point_) {
+        vector<float>().swap(cost_init_);
+        cost_init_fixed_.resize(img_size * disp_range);
+    } else {
+        vector<uint16_t>().swap(cost_init_fixed_);
+        cost_init_.resize(img_size * disp_range);
+    }
 
     is_initialized_ = !gray_left_.empty() && !gray_right_.empty() && !census_left_.empty() &&
-                      !census_right_.empty() && !cost_init_.empty();
+                      !census_right_.empty() &&
+                      (fixed_point_ ? !cost_init_fixed_.empty() : !cost_init_.empty());
     return is_initialized_;
 }
 
@@ -46,10 +57,31 @@ void CostComputor::SetData(const uint8 *img_left, const uint8 *img_right) {
 }
 
 void CostComputor::SetParams(const int &lambda_ad, const int &lambda_census) {
+    if (lambda_ad != lambda_ad_ || lambda_census != lambda_census_) {
+        cost_table_ad_.clear();
+        cost_table_census_.clear();
+    }
     lambda_ad_ = lambda_ad;
     lambda_census_ = lambda_census;
 }
 
+void CostComputor::BuildCostTables() {
+    // 1 - exp(-cost / lambda) in units of Fixed_Cost_One, the AD cost is the sum of the three
+    // channel differences divided by 3
+    cost_table_ad_.resize(3 * 255 + 1);
+    for (int n = 0; n < static_cast<int>(cost_table_ad_.size()); n++) {
+        const float cost_ad = n / 3.0f;
+        cost_table_ad_[n] =
+            static_cast<uint16_t>(lround(Fixed_Cost_One * (1 - exp(-cost_ad / lambda_ad_))));
+    }
+    cost_table_census_.resize(64 + 1);
+    for (int n = 0; n < static_cast<int>(cost_table_census_.size()); n++) {
+        const float cost_census = static_cast<float>(n);
+        cost_table_census_[n] = static_cast<uint16_t>(
+            lround(Fixed_Cost_One * (1 - exp(-cost_census / lambda_census_))));
+    }
+}
+
 void CostComputor::ComputeGray() {
     for (int n = 0; n < 2; n++) {
         const auto color = (n == 0) ? img_left_ : img_right_;
@@ -66,8 +98,8 @@ void CostComputor::ComputeGray() {
 }
 
 void CostComputor::CensusTransform() {
-    adcensus_util::census_transform_9x7(&gray_left_[0], census_left_, width_, height_);
-    adcensus_util::census_transform_9x7(&gray_right_[0], census_right_, width_, height_);
+    census::Transform9x7(&gray_left_[0], &census_left_[0], width_, height_);
+    census::Transform9x7(&gray_right_[0], &census_right_[0], width_, height_);
 }
 
 void CostComputor::ComputeCost() {
@@ -106,6 +138,43 @@ void CostComputor::ComputeCost() {
     }
 }
 
+void CostComputor::ComputeCostFixed() {
+    const int disp_range = max_disparity_ - min_disparity_;
+
+    if (cost_table_ad_.empty() || cost_table_census_.empty()) {
+        BuildCostTables();
+    }
+    const uint16_t *table_ad = &cost_table_ad_[0];
+    const uint16_t *table_census = &cost_table_census_[0];
+
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            const auto bl = img_left_[y * width_ * 3 + 3 * x];
+            const auto gl = img_left_[y * width_ * 3 + 3 * x + 1];
+            const auto rl = img_left_[y * width_ * 3 + 3 * x + 2];
+            const auto &census_val_l = census_left_[y * width_ + x];
+            uint16_t *cost = &cost_init_fixed_[y * width_ * disp_range + x * disp_range];
+            for (int d = min_disparity_; d < max_disparity_; d++) {
+                const int xr = x - d;
+                if (xr < 0 || xr >= width_) {
+                    cost[d - min_disparity_] = Fixed_Cost_One;
+                    continue;
+                }
+
+                const auto br = img_right_[y * width_ * 3 + 3 * xr];
+                const auto gr = img_right_[y * width_ * 3 + 3 * xr + 1];
+                const auto rr = img_right_[y * width_ * 3 + 3 * xr + 2];
+                const int sum_ad = abs(bl - br) + abs(gl - gr) + abs(rl - rr);
+
+                const auto &census_val_r = census_right_[y * width_ + xr];
+                const int dist_census = adcensus_util::Hamming64(census_val_l, census_val_r);
+
+                cost[d - min_disparity_] = table_ad[sum_ad] + table_census[dist_census];
+            }
+        }
+    }
+}
+
 void CostComputor::Compute() {
     if (!is_initialized_) {
         return;
@@ -115,7 +184,11 @@ void CostComputor::Compute() {
 
     CensusTransform();
 
-    ComputeCost();
+    if (fixed_point_) {
+        ComputeCostFixed();
+    } else {
+        ComputeCost();
+    }
 }
 
 float *CostComputor::get_cost_ptr() {
@@ -125,3 +198,11 @@ float *CostComputor::get_cost_ptr() {
         return nullptr;
     }
 }
+
+uint16_t *CostComputor::get_cost_fixed_ptr() {
+    if (!cost_init_fixed_.empty()) {
+        return &cost_init_fixed_[0];
+    } else {
+        return nullptr;
+    }
+}
\ No newline at end of file
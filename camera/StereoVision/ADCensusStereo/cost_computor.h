@@ -8,8 +8,9 @@ class CostComputor {
     CostComputor();
     ~CostComputor();
 
+    // with fixed_point the cost volume is uint16 (Fixed_Cost_One), see get_cost_fixed_ptr
     bool Initialize(const int& width, const int& height, const int& min_disparity,
-                    const int& max_disparity);
+                    const int& max_disparity, const bool& fixed_point = false);
 
     void SetData(const uint8* img_left, const uint8* img_right);
 
@@ -19,6 +20,8 @@ class CostComputor {
 
     float* get_cost_ptr();
 
+    uint16_t* get_cost_fixed_ptr();
+
    private:
     void ComputeGray();
 
@@ -26,6 +29,10 @@ class CostComputor {
 
     void ComputeCost();
 
+    void ComputeCostFixed();
+
+    void BuildCostTables();
+
    private:
     int width_;
     int height_;
@@ -36,17 +43,24 @@ class CostComputor {
     vector<uint8> gray_left_;
     vector<uint8> gray_right_;
 
-    vector<size_t> census_left_;
-    vector<size_t> census_right_;
+    vector<uint64_t> census_left_;
+    vector<uint64_t> census_right_;
 
     vector<float> cost_init_;
 
+    // fixed point volume and the cost of every AD sum (0..765) and census distance (0..64)
+    vector<uint16_t> cost_init_fixed_;
+    vector<uint16_t> cost_table_ad_;
+    vector<uint16_t> cost_table_census_;
+
     int lambda_ad_;
     int lambda_census_;
 
     int min_disparity_;
     int max_disparity_;
 
+    bool fixed_point_;
+
     bool is_initialized_;
 };
 #endif
\ No newline at end of file
@@ -1,28 +1,43 @@
 #include "cross_aggregator.h"
 #include <cstring>
+#include <omp.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 CrossAggregator::CrossAggregator()
     : width_(0),
       height_(0),
+      plane_stride_(0),
       img_left_(nullptr),
       img_right_(nullptr),
       cost_init_(nullptr),
+      cost_init_fixed_(nullptr),
       cross_L1_(0),
       cross_L2_(0),
       cross_t1_(0),
       cross_t2_(0),
       min_disparity_(0),
       max_disparity_(0),
+      fixed_point_(false),
+      integral_sums_(false),
+      num_threads_(1),
+      tmp_size_(0),
       is_initialized_(false) {}
 
 CrossAggregator::~CrossAggregator() {}
 
 bool CrossAggregator::Initialize(const int &width, const int &height, const int &min_disparity,
-                                 const int &max_disparity) {
+                                 const int &max_disparity, const bool &fixed_point,
+                                 const bool &integral_sums, const int &num_threads) {
     width_ = width;
     height_ = height;
     min_disparity_ = min_disparity;
     max_disparity_ = max_disparity;
+    fixed_point_ = fixed_point;
+    integral_sums_ = integral_sums;
+    num_threads_ = std::max(num_threads, 1);
 
     const int img_size = width_ * height_;
     const int disp_range = max_disparity_ - min_disparity_;
@@ -31,13 +46,35 @@ bool CrossAggregator::Initialize(const int &width, const int &height, const int
         return is_initialized_;
     }
 
-    vec_cross_arms_.clear();
-    vec_cross_arms_.resize(img_size);
+    cross_arms_.Resize(img_size);
 
-    vec_cost_tmp_[0].clear();
-    vec_cost_tmp_[0].resize(img_size);
-    vec_cost_tmp_[1].clear();
-    vec_cost_tmp_[1].resize(img_size);
+    plane_stride_ = width_ + 2 * kArmPadding;
+    for (int c = 0; c < 3; c++) {
+        color_planes_[c].assign(plane_stride_ * height_, 0);
+    }
+
+    // only the buffers of the selected representation are kept, one slice (or prefix sums with
+    // a leading row and column of zeros) per thread
+    tmp_size_ = integral_sums_ ? (width_ + 1) * (height_ + 1) : img_size;
+    const int tmp_size = tmp_size_ * num_threads_;
+    for (int k = 0; k < 2; k++) {
+        vec_cost_tmp_[k].clear();
+        vec_cost_sum_tmp_[k].clear();
+        vec_cost_fixed_tmp_[k].clear();
+        if (fixed_point_) {
+            vector<float>().swap(vec_cost_tmp_[k]);
+            vector<double>().swap(vec_cost_sum_tmp_[k]);
+            vec_cost_fixed_tmp_[k].resize(tmp_size);
+        } else if (integral_sums_) {
+            vector<float>().swap(vec_cost_tmp_[k]);
+            vector<uint32_t>().swap(vec_cost_fixed_tmp_[k]);
+            vec_cost_sum_tmp_[k].resize(tmp_size);
+        } else {
+            vector<double>().swap(vec_cost_sum_tmp_[k]);
+            vector<uint32_t>().swap(vec_cost_fixed_tmp_[k]);
+            vec_cost_tmp_[k].resize(tmp_size);
+        }
+    }
 
     vec_sup_count_[0].clear();
     vec_sup_count_[0].resize(img_size);
@@ -46,12 +83,28 @@ bool CrossAggregator::Initialize(const int &width, const int &height, const int
     vec_sup_count_tmp_.clear();
     vec_sup_count_tmp_.resize(img_size);
 
-    cost_aggr_.resize(img_size * disp_range);
+    if (fixed_point_) {
+        vector<float>().swap(cost_aggr_);
+        cost_aggr_fixed_.resize(img_size * disp_range);
+    } else {
+        vector<uint16_t>().swap(cost_aggr_fixed_);
+        cost_aggr_.resize(img_size * disp_range);
+    }
 
-    is_initialized_ = !vec_cross_arms_.empty() && !vec_cost_tmp_[0].empty() &&
-                      !vec_cost_tmp_[1].empty() && !vec_sup_count_[0].empty() &&
+    bool cost_allocated = false;
+    if (fixed_point_) {
+        cost_allocated = !vec_cost_fixed_tmp_[0].empty() && !vec_cost_fixed_tmp_[1].empty() &&
+                         !cost_aggr_fixed_.empty();
+    } else if (integral_sums_) {
+        cost_allocated = !vec_cost_sum_tmp_[0].empty() && !vec_cost_sum_tmp_[1].empty() &&
+                         !cost_aggr_.empty();
+    } else {
+        cost_allocated =
+            !vec_cost_tmp_[0].empty() && !vec_cost_tmp_[1].empty() && !cost_aggr_.empty();
+    }
+    is_initialized_ = !cross_arms_.left.empty() && !vec_sup_count_[0].empty() &&
                       !vec_sup_count_[1].empty() && !vec_sup_count_tmp_.empty() &&
-                      !cost_aggr_.empty();
+                      cost_allocated;
     return is_initialized_;
 }
 
@@ -60,6 +113,15 @@ void CrossAggregator::SetData(const uint8 *img_left, const uint8 *img_right,
     img_left_ = img_left;
     img_right_ = img_right;
     cost_init_ = cost_init;
+    cost_init_fixed_ = nullptr;
+}
+
+void CrossAggregator::SetData(const uint8 *img_left, const uint8 *img_right,
+                              const uint16_t *cost_init) {
+    img_left_ = img_left;
+    img_right_ = img_right;
+    cost_init_ = nullptr;
+    cost_init_fixed_ = cost_init;
 }
 
 void CrossAggregator::SetParams(const int &cross_L1, const int &cross_L2, const int &cross_t1,
@@ -71,15 +133,147 @@ void CrossAggregator::SetParams(const int &cross_L1, const int &cross_L2, const
 }
 
 void CrossAggregator::BuildArms() {
-    for (int y = 0; y < height_; y++) {
-        for (int x = 0; x < width_; x++) {
-            CrossArm &arm = vec_cross_arms_[y * width_ + x];
-            FindHorizontalArm(x, y, arm.left, arm.right);
-            FindVerticalArm(x, y, arm.top, arm.bottom);
+    if (!is_initialized_ || img_left_ == nullptr) {
+        return;
+    }
+
+    // the rows are independent, each one first splits its pixels into the colour planes
+#pragma omp parallel num_threads(num_threads_)
+    {
+#pragma omp for schedule(static)
+        for (int y = 0; y < height_; y++) {
+            const uint8 *img_row = img_left_ + y * width_ * 3;
+            for (int c = 0; c < 3; c++) {
+                uint8 *plane_row = &color_planes_[c][y * plane_stride_ + kArmPadding];
+                for (int x = 0; x < width_; x++) {
+                    plane_row[x] = img_row[3 * x + c];
+                }
+            }
+        }
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height_; y++) {
+            const int x_done = FindArmsRowSimd(y);
+            FindArmsRow(y, x_done, width_);
         }
     }
 }
 
+void CrossAggregator::FindArmsRow(const int &y, const int &x_begin, const int &x_end) {
+    for (int x = x_begin; x < x_end; x++) {
+        const int idx = y * width_ + x;
+        FindHorizontalArm(x, y, cross_arms_.left[idx], cross_arms_.right[idx]);
+        FindVerticalArm(x, y, cross_arms_.top[idx], cross_arms_.bottom[idx]);
+    }
+}
+
+#if defined(__SSE2__)
+namespace {
+
+// max(|a - b|) over the three channels of 16 pixels
+inline __m128i ColorDist16(const __m128i *a, const __m128i *b) {
+    __m128i dist = _mm_setzero_si128();
+    for (int c = 0; c < 3; c++) {
+        const __m128i diff = _mm_or_si128(_mm_subs_epu8(a[c], b[c]), _mm_subs_epu8(b[c], a[c]));
+        dist = _mm_max_epu8(dist, diff);
+    }
+    return dist;
+}
+
+// 0xff where dist < threshold, threshold in [1, 256]
+inline __m128i Less16(const __m128i &dist, const __m128i &threshold_minus_1) {
+    return _mm_cmpeq_epi8(_mm_subs_epu8(dist, threshold_minus_1), _mm_setzero_si128());
+}
+
+// Arm lengths of the 16 pixels at planes[c] + offset, following the pixels `step` bytes apart
+// for at most max_length steps. The three rules are evaluated for all pixels at once, a pixel
+// stops at its first failing step.
+inline __m128i FindArms16(const uint8 *const *planes, const int &offset, const int &step,
+                          const int &max_length, const int &cross_L2, const __m128i &t1_minus_1,
+                          const __m128i &t2_minus_1) {
+    __m128i color0[3], color_last[3], color[3];
+    for (int c = 0; c < 3; c++) {
+        color0[c] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[c] + offset));
+        color_last[c] = color0[c];
+    }
+
+    __m128i active = _mm_cmpeq_epi8(color0[0], color0[0]);
+    __m128i length = _mm_setzero_si128();
+    for (int n = 0; n < max_length; n++) {
+        const int pos = offset + (n + 1) * step;
+        for (int c = 0; c < 3; c++) {
+            color[c] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[c] + pos));
+        }
+        // the first step compares against the centre twice, which is the same rule
+        const __m128i dist1 = ColorDist16(color, color0);
+        const __m128i dist2 = ColorDist16(color, color_last);
+        __m128i pass = _mm_and_si128(Less16(dist1, t1_minus_1), Less16(dist2, t1_minus_1));
+        if (n + 1 > cross_L2) {
+            pass = _mm_and_si128(pass, Less16(dist1, t2_minus_1));
+        }
+        active = _mm_and_si128(active, pass);
+        if (_mm_movemask_epi8(active) == 0) {
+            break;
+        }
+        // active lanes are -1
+        length = _mm_sub_epi8(length, active);
+        for (int c = 0; c < 3; c++) {
+            color_last[c] = color[c];
+        }
+    }
+    return length;
+}
+
+}  // namespace
+#endif
+
+int CrossAggregator::FindArmsRowSimd(const int &y) {
+#if defined(__SSE2__)
+    const int max_length = std::min(cross_L1_, MAX_ARM_LENGTH);
+    if (cross_t1_ <= 0 || cross_t2_ <= 0 || max_length <= 0) {
+        return 0;
+    }
+    const __m128i t1_minus_1 = _mm_set1_epi8(static_cast<char>(std::min(cross_t1_, 256) - 1));
+    const __m128i t2_minus_1 = _mm_set1_epi8(static_cast<char>(std::min(cross_t2_, 256) - 1));
+    const uint8 *planes[3] = {&color_planes_[0][0], &color_planes_[1][0], &color_planes_[2][0]};
+
+    // the vertical arms are cut at the image border by the number of steps, the horizontal ones
+    // run into the padding and are clamped below
+    const int max_top = std::min(max_length, y);
+    const int max_bottom = std::min(max_length, height_ - 1 - y);
+    const int row = y * plane_stride_ + kArmPadding;
+    const int x_end = width_ / 16 * 16;
+    for (int x = 0; x < x_end; x += 16) {
+        const int idx = y * width_ + x;
+        const __m128i left = FindArms16(planes, row + x, -1, max_length, cross_L2_, t1_minus_1,
+                                        t2_minus_1);
+        const __m128i right = FindArms16(planes, row + x, 1, max_length, cross_L2_, t1_minus_1,
+                                         t2_minus_1);
+        const __m128i top = FindArms16(planes, row + x, -plane_stride_, max_top, cross_L2_,
+                                       t1_minus_1, t2_minus_1);
+        const __m128i bottom = FindArms16(planes, row + x, plane_stride_, max_bottom, cross_L2_,
+                                          t1_minus_1, t2_minus_1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&cross_arms_.left[idx]), left);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&cross_arms_.right[idx]), right);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&cross_arms_.top[idx]), top);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(&cross_arms_.bottom[idx]), bottom);
+    }
+
+    // horizontal arms may not leave the image
+    for (int x = 0; x < std::min(max_length, x_end); x++) {
+        auto &left = cross_arms_.left[y * width_ + x];
+        left = std::min<int>(left, x);
+    }
+    for (int x = std::max(0, width_ - 1 - max_length); x < x_end; x++) {
+        auto &right = cross_arms_.right[y * width_ + x];
+        right = std::min<int>(right, width_ - 1 - x);
+    }
+    return x_end;
+#else
+    return 0;
+#endif
+}
+
 void CrossAggregator::Aggregate(const int &num_iters) {
     if (!is_initialized_) {
         return;
@@ -89,21 +283,57 @@ void CrossAggregator::Aggregate(const int &num_iters) {
 
     BuildArms();
 
-    bool horizontal_first = true;
-
     ComputeSupPixelCount();
 
-    std::memcpy(&cost_aggr_[0], cost_init_, width_ * height_ * disp_range * sizeof(float));
+    if (fixed_point_) {
+        if (cost_init_fixed_ == nullptr) {
+            return;
+        }
+        std::memcpy(&cost_aggr_fixed_[0], cost_init_fixed_,
+                    width_ * height_ * disp_range * sizeof(uint16_t));
+    } else {
+        if (cost_init_ == nullptr) {
+            return;
+        }
+        std::memcpy(&cost_aggr_[0], cost_init_, width_ * height_ * disp_range * sizeof(float));
+    }
+
+    if (fixed_point_) {
+        AggregateSlices(num_iters, &cost_aggr_fixed_[0], &vec_cost_fixed_tmp_[0][0],
+                        &vec_cost_fixed_tmp_[1][0], tmp_size_);
+    } else if (integral_sums_) {
+        AggregateSlices(num_iters, &cost_aggr_[0], &vec_cost_sum_tmp_[0][0],
+                        &vec_cost_sum_tmp_[1][0], tmp_size_);
+    } else {
+        AggregateSlices(num_iters, &cost_aggr_[0], &vec_cost_tmp_[0][0], &vec_cost_tmp_[1][0],
+                        tmp_size_);
+    }
+}
 
-    for (int k = 0; k < num_iters; k++) {
-        for (int d = min_disparity_; d < max_disparity_; d++) {
-            AggregateInArms(d, horizontal_first);
+template <typename T, typename S>
+void CrossAggregator::AggregateSlices(const int &num_iters, T *cost_aggr, S *cost_tmp_0,
+                                      S *cost_tmp_1, const int &tmp_size) {
+    // the iterations of a disparity slice only depend on the same slice, so the slices run in
+    // parallel with all their iterations. Contiguous blocks of disparities per thread keep the
+    // threads off each other's cache lines.
+#pragma omp parallel for schedule(static) num_threads(num_threads_)
+    for (int d = min_disparity_; d < max_disparity_; d++) {
+        const int offset = omp_get_thread_num() * tmp_size;
+        bool horizontal_first = true;
+        for (int k = 0; k < num_iters; k++) {
+            if (integral_sums_) {
+                AggregateInArmsIntegral(d, horizontal_first, cost_aggr, cost_tmp_0 + offset,
+                                        cost_tmp_1 + offset);
+            } else {
+                AggregateInArms(d, horizontal_first, cost_aggr, cost_tmp_0 + offset,
+                                cost_tmp_1 + offset);
+            }
+            horizontal_first = !horizontal_first;
         }
-        horizontal_first = !horizontal_first;
     }
 }
 
-CrossArm *CrossAggregator::get_arms_ptr() { return &vec_cross_arms_[0]; }
+const CrossArms *CrossAggregator::get_arms_ptr() const { return &cross_arms_; }
 
 float *CrossAggregator::get_cost_ptr() {
     if (!cost_aggr_.empty()) {
@@ -113,6 +343,14 @@ float *CrossAggregator::get_cost_ptr() {
     }
 }
 
+uint16_t *CrossAggregator::get_cost_fixed_ptr() {
+    if (!cost_aggr_fixed_.empty()) {
+        return &cost_aggr_fixed_[0];
+    } else {
+        return nullptr;
+    }
+}
+
 void CrossAggregator::FindHorizontalArm(const int &x, const int &y, uint8 &left,
                                         uint8 &right) const {
     const auto img0 = img_left_ + y * width_ * 3 + 3 * x;
@@ -223,45 +461,47 @@ void CrossAggregator::FindVerticalArm(const int &x, const int &y, uint8 &top, ui
 }
 
 void CrossAggregator::ComputeSupPixelCount() {
+    const uint8 *arm_left = &cross_arms_.left[0];
+    const uint8 *arm_right = &cross_arms_.right[0];
+    const uint8 *arm_top = &cross_arms_.top[0];
+    const uint8 *arm_bottom = &cross_arms_.bottom[0];
+
     bool horizontal_first = true;
     for (int n = 0; n < 2; n++) {
         // n=0 : horizontal_first; n=1 : vertical_first
         const int id = horizontal_first ? 0 : 1;
         for (int k = 0; k < 2; k++) {
             // k=0 : pass1; k=1 : pass2
+#pragma omp parallel for schedule(static) num_threads(num_threads_)
             for (int y = 0; y < height_; y++) {
                 for (int x = 0; x < width_; x++) {
-                    auto &arm = vec_cross_arms_[y * width_ + x];
+                    const int idx = y * width_ + x;
                     int count = 0;
                     if (horizontal_first) {
                         if (k == 0) {
                             // horizontal
-                            for (int t = -arm.left; t <= arm.right; t++) {
-                                count++;
-                            }
+                            count = arm_left[idx] + arm_right[idx] + 1;
                         } else {
                             // vertical
-                            for (int t = -arm.top; t <= arm.bottom; t++) {
+                            for (int t = -arm_top[idx]; t <= arm_bottom[idx]; t++) {
                                 count += vec_sup_count_tmp_[(y + t) * width_ + x];
                             }
                         }
                     } else {
                         if (k == 0) {
                             // vertical
-                            for (int t = -arm.top; t <= arm.bottom; t++) {
-                                count++;
-                            }
+                            count = arm_top[idx] + arm_bottom[idx] + 1;
                         } else {
                             // horizontal
-                            for (int t = -arm.left; t <= arm.right; t++) {
+                            for (int t = -arm_left[idx]; t <= arm_right[idx]; t++) {
                                 count += vec_sup_count_tmp_[y * width_ + x + t];
                             }
                         }
                     }
                     if (k == 0) {
-                        vec_sup_count_tmp_[y * width_ + x] = count;
+                        vec_sup_count_tmp_[idx] = count;
                     } else {
-                        vec_sup_count_[id][y * width_ + x] = count;
+                        vec_sup_count_[id][idx] = count;
                     }
                 }
             }
@@ -270,7 +510,65 @@ void CrossAggregator::ComputeSupPixelCount() {
     }
 }
 
-void CrossAggregator::AggregateInArms(const int &disparity, const bool &horizontal_first) {
+// mean of the costs over the support region, rounded in fixed point
+static inline float AverageCost(const float &sum, const uint16_t &count) { return sum / count; }
+
+static inline float AverageCost(const double &sum, const uint16_t &count) {
+    return static_cast<float>(sum / count);
+}
+
+static inline uint16_t AverageCost(const uint32_t &sum, const uint16_t &count) {
+    return static_cast<uint16_t>((sum + count / 2) / count);
+}
+
+// Sums of src over the horizontal arms into dst, src is read every src_stride elements. prefix
+// holds width + 1 sums per row. dst may be src.
+template <typename S, typename T>
+static void SumHorizontalArms(const T *src, const int &src_stride, const CrossArms &arms,
+                              const int &width, const int &height, S *prefix, S *dst) {
+    const uint8 *arm_left = &arms.left[0];
+    const uint8 *arm_right = &arms.right[0];
+    for (int y = 0; y < height; y++) {
+        S *prefix_row = prefix + y * (width + 1);
+        prefix_row[0] = 0;
+        for (int x = 0; x < width; x++) {
+            prefix_row[x + 1] = prefix_row[x] + src[(y * width + x) * src_stride];
+        }
+        for (int x = 0; x < width; x++) {
+            const int idx = y * width + x;
+            dst[idx] = prefix_row[x + arm_right[idx] + 1] - prefix_row[x - arm_left[idx]];
+        }
+    }
+}
+
+// Same over the vertical arms, prefix holds height + 1 rows of sums.
+template <typename S, typename T>
+static void SumVerticalArms(const T *src, const int &src_stride, const CrossArms &arms,
+                            const int &width, const int &height, S *prefix, S *dst) {
+    const uint8 *arm_top = &arms.top[0];
+    const uint8 *arm_bottom = &arms.bottom[0];
+    for (int x = 0; x < width; x++) {
+        prefix[x] = 0;
+    }
+    for (int y = 0; y < height; y++) {
+        const S *prefix_last = prefix + y * width;
+        S *prefix_row = prefix + (y + 1) * width;
+        for (int x = 0; x < width; x++) {
+            prefix_row[x] = prefix_last[x] + src[(y * width + x) * src_stride];
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const int idx = y * width + x;
+            dst[idx] = prefix[(y + arm_bottom[idx] + 1) * width + x] -
+                       prefix[(y - arm_top[idx]) * width + x];
+        }
+    }
+}
+
+template <typename T, typename S>
+void CrossAggregator::AggregateInArms(const int &disparity, const bool &horizontal_first,
+                                      T *cost_aggr, S *cost_tmp_0, S *cost_tmp_1) const {
     if (disparity < min_disparity_ || disparity >= max_disparity_) {
         return;
     }
@@ -282,51 +580,88 @@ void CrossAggregator::AggregateInArms(const int &disparity, const bool &horizont
 
     for (int y = 0; y < height_; y++) {
         for (int x = 0; x < width_; x++) {
-            vec_cost_tmp_[0][y * width_ + x] =
-                cost_aggr_[y * width_ * disp_range + x * disp_range + disp];
+            cost_tmp_0[y * width_ + x] = cost_aggr[y * width_ * disp_range + x * disp_range + disp];
         }
     }
 
+    const uint8 *arm_left = &cross_arms_.left[0];
+    const uint8 *arm_right = &cross_arms_.right[0];
+    const uint8 *arm_top = &cross_arms_.top[0];
+    const uint8 *arm_bottom = &cross_arms_.bottom[0];
+
     const int ct_id = horizontal_first ? 0 : 1;
     for (int k = 0; k < 2; k++) {
         // k==0: pass1
         // k==1: pass2
         for (int y = 0; y < height_; y++) {
             for (int x = 0; x < width_; x++) {
-                auto &arm = vec_cross_arms_[y * width_ + x];
-                float cost = 0.0f;
+                const int idx = y * width_ + x;
+                S cost = 0;
                 if (horizontal_first) {
                     if (k == 0) {
                         // horizontal
-                        for (int t = -arm.left; t <= arm.right; t++) {
-                            cost += vec_cost_tmp_[0][y * width_ + x + t];
+                        for (int t = -arm_left[idx]; t <= arm_right[idx]; t++) {
+                            cost += cost_tmp_0[y * width_ + x + t];
                         }
                     } else {
                         // vertical
-                        for (int t = -arm.top; t <= arm.bottom; t++) {
-                            cost += vec_cost_tmp_[1][(y + t) * width_ + x];
+                        for (int t = -arm_top[idx]; t <= arm_bottom[idx]; t++) {
+                            cost += cost_tmp_1[(y + t) * width_ + x];
                         }
                     }
                 } else {
                     if (k == 0) {
                         // vertical
-                        for (int t = -arm.top; t <= arm.bottom; t++) {
-                            cost += vec_cost_tmp_[0][(y + t) * width_ + x];
+                        for (int t = -arm_top[idx]; t <= arm_bottom[idx]; t++) {
+                            cost += cost_tmp_0[(y + t) * width_ + x];
                         }
                     } else {
                         // horizontal
-                        for (int t = -arm.left; t <= arm.right; t++) {
-                            cost += vec_cost_tmp_[1][y * width_ + x + t];
+                        for (int t = -arm_left[idx]; t <= arm_right[idx]; t++) {
+                            cost += cost_tmp_1[y * width_ + x + t];
                         }
                     }
                 }
                 if (k == 0) {
-                    vec_cost_tmp_[1][y * width_ + x] = cost;
+                    cost_tmp_1[y * width_ + x] = cost;
                 } else {
-                    cost_aggr_[y * width_ * disp_range + x * disp_range + disp] =
-                        cost / vec_sup_count_[ct_id][y * width_ + x];
+                    cost_aggr[y * width_ * disp_range + x * disp_range + disp] =
+                        AverageCost(cost, vec_sup_count_[ct_id][y * width_ + x]);
                 }
             }
         }
     }
 }
+
+template <typename T, typename S>
+void CrossAggregator::AggregateInArmsIntegral(const int &disparity, const bool &horizontal_first,
+                                              T *cost_aggr, S *prefix, S *sums) const {
+    if (disparity < min_disparity_ || disparity >= max_disparity_) {
+        return;
+    }
+    const auto disp = disparity - min_disparity_;
+    const int disp_range = max_disparity_ - min_disparity_;
+    if (disp_range <= 0) {
+        return;
+    }
+
+    // pass1 sums the slice of the volume, pass2 the sums of pass1 in place. Unsigned sums may
+    // wrap around in the prefix, the differences are still exact.
+    const CrossArms &arms = cross_arms_;
+    const T *slice = cost_aggr + disp;
+    if (horizontal_first) {
+        SumHorizontalArms(slice, disp_range, arms, width_, height_, prefix, sums);
+        SumVerticalArms(sums, 1, arms, width_, height_, prefix, sums);
+    } else {
+        SumVerticalArms(slice, disp_range, arms, width_, height_, prefix, sums);
+        SumHorizontalArms(sums, 1, arms, width_, height_, prefix, sums);
+    }
+
+    const int ct_id = horizontal_first ? 0 : 1;
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            cost_aggr[y * width_ * disp_range + x * disp_range + disp] =
+                AverageCost(sums[y * width_ + x], vec_sup_count_[ct_id][y * width_ + x]);
+        }
+    }
+}
\ No newline at end of file
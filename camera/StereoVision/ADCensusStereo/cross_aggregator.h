@@ -4,9 +4,16 @@
 #include <algorithm>
 #include "adcensus_types.h"
 
-struct CrossArm {
-    uint8 left, right, top, bottom;
-    CrossArm() : left(0), right(0), top(0), bottom(0) {}
+// Arm lengths of every pixel as a structure of arrays, one width * height plane per direction.
+struct CrossArms {
+    vector<uint8> left, right, top, bottom;
+
+    void Resize(const int& size) {
+        left.assign(size, 0);
+        right.assign(size, 0);
+        top.assign(size, 0);
+        bottom.assign(size, 0);
+    }
 };
 
 #define MAX_ARM_LENGTH 255
@@ -16,26 +23,56 @@ class CrossAggregator {
     CrossAggregator();
     ~CrossAggregator();
 
+    // with fixed_point the costs are aggregated as uint16 (Fixed_Cost_One), see the uint16 SetData
+    // and get_cost_fixed_ptr. With integral_sums the arm sums are taken from prefix sums along
+    // the rows and columns of each disparity slice. The slices are aggregated in parallel on
+    // num_threads threads.
     bool Initialize(const int& width, const int& height, const int& min_disparity,
-                    const int& max_disparity);
+                    const int& max_disparity, const bool& fixed_point = false,
+                    const bool& integral_sums = false, const int& num_threads = 1);
 
     void SetData(const uint8* img_left, const uint8* img_right, const float* cost_init);
 
+    void SetData(const uint8* img_left, const uint8* img_right, const uint16_t* cost_init);
+
     void SetParams(const int& cross_L1, const int& cross_L2, const int& cross_t1,
                    const int& cross_t2);
 
+    // builds the arms and aggregates the costs num_iters times
     void Aggregate(const int& num_iters);
 
-    CrossArm* get_arms_ptr();
+    // only builds the arms, for a refinement without aggregation
+    void BuildArms();
+
+    const CrossArms* get_arms_ptr() const;
 
     float* get_cost_ptr();
 
+    uint16_t* get_cost_fixed_ptr();
+
    private:
-    void BuildArms();
+    // arms of the pixels [x_begin, x_end) of row y, pixel by pixel
+    void FindArmsRow(const int& y, const int& x_begin, const int& x_end);
+    // same for 16 pixels at once on the padded colour planes, returns the first pixel not done
+    int FindArmsRowSimd(const int& y);
     void FindHorizontalArm(const int& x, const int& y, uint8& left, uint8& right) const;
     void FindVerticalArm(const int& x, const int& y, uint8& top, uint8& bottom) const;
     void ComputeSupPixelCount();
-    void AggregateInArms(const int& disparity, const bool& horizontal_first);
+    // T is the cost type, S the type of the sums over the arms
+    template <typename T, typename S>
+    void AggregateInArms(const int& disparity, const bool& horizontal_first, T* cost_aggr,
+                         S* cost_tmp_0, S* cost_tmp_1) const;
+
+    // same with prefix sums, prefix holds (width + 1) * (height + 1) sums
+    template <typename T, typename S>
+    void AggregateInArmsIntegral(const int& disparity, const bool& horizontal_first,
+                                 T* cost_aggr, S* prefix, S* sums) const;
+
+    // runs num_iters iterations on every disparity slice, each thread uses its own part of
+    // cost_tmp_0 and cost_tmp_1 of tmp_size elements
+    template <typename T, typename S>
+    void AggregateSlices(const int& num_iters, T* cost_aggr, S* cost_tmp_0, S* cost_tmp_1,
+                         const int& tmp_size);
 
     inline int ColorDist(const ADColor& c1, const ADColor& c2) const {
         return std::max(abs(c1.r - c2.r), std::max(abs(c1.g - c2.g), abs(c1.b - c2.b)));
@@ -45,7 +82,13 @@ class CrossAggregator {
     int width_;
     int height_;
 
-    vector<CrossArm> vec_cross_arms_;
+    CrossArms cross_arms_;
+
+    // colour channels of the left image as planes with kArmPadding bytes before and after each
+    // row, so that arms may be followed past the border and clamped afterwards
+    static const int kArmPadding = 256;
+    int plane_stride_;
+    vector<uint8> color_planes_[3];
 
     const uint8* img_left_;
     const uint8* img_right_;
@@ -53,7 +96,15 @@ class CrossAggregator {
     const float* cost_init_;
     vector<float> cost_aggr_;
 
+    // slice buffers of every thread, float sums of the direct aggregation or double prefix sums
     vector<float> vec_cost_tmp_[2];
+    vector<double> vec_cost_sum_tmp_[2];
+
+    // fixed point volumes, the sums over the arms need 32 bits
+    const uint16_t* cost_init_fixed_;
+    vector<uint16_t> cost_aggr_fixed_;
+    vector<uint32_t> vec_cost_fixed_tmp_[2];
+
     vector<uint16_t> vec_sup_count_[2];
     vector<uint16_t> vec_sup_count_tmp_;
 
@@ -64,6 +115,12 @@ class CrossAggregator {
     int min_disparity_;
     int max_disparity_;
 
+    bool fixed_point_;
+    bool integral_sums_;
+    int num_threads_;
+    // elements of the slice buffers per thread
+    int tmp_size_;
+
     bool is_initialized_;
 };
 #endif
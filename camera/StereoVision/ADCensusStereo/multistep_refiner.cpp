@@ -1,12 +1,16 @@
 #include "multistep_refiner.h"
 #include <cmath>
+#include <algorithm>
 #include <cstring>
+#include <omp.h>
 #include "adcensus_util.h"
+
 MultiStepRefiner::MultiStepRefiner()
     : width_(0),
       height_(0),
       img_left_(nullptr),
       cost_(nullptr),
+      cost_fixed_(nullptr),
       cross_arms_(nullptr),
       disp_left_(nullptr),
       disp_right_(nullptr),
@@ -18,27 +22,60 @@ MultiStepRefiner::MultiStepRefiner()
       do_lr_check_(false),
       do_region_voting_(false),
       do_interpolating_(false),
-      do_discontinuity_adjustment_(false) {}
+      do_discontinuity_adjustment_(false),
+      do_parallel_(false),
+      num_threads_(1),
+      max_disp_range_(0) {}
 
 MultiStepRefiner::~MultiStepRefiner() {}
 
-bool MultiStepRefiner::Initialize(const int &width, const int &height) {
+bool MultiStepRefiner::Initialize(const int &width, const int &height, const int &disp_range,
+                                  const int &num_threads) {
     width_ = width;
     height_ = height;
-    if (width_ <= 0 || height_ <= 0) {
+    if (width_ <= 0 || height_ <= 0 || disp_range <= 0) {
         return false;
     }
+    num_threads_ = std::max(num_threads, 1);
+    max_disp_range_ = disp_range;
 
+    const int img_size = width * height;
     vec_edge_left_.clear();
-    vec_edge_left_.resize(width * height);
+    vec_edge_left_.resize(img_size);
+
+    mismatches_.reserve(img_size);
+    occlusions_.reserve(img_size);
+    vec_histogram_.assign(num_threads_ * disp_range, 0);
+    vec_fill_disps_.assign(img_size, 0.0f);
+    vec_median_in_.assign(img_size, 0.0f);
+    vec_median_wnd_.assign(num_threads_ * 9, 0.0f);
+
+    const float pi = 3.1415926f;
+    double ang = 0.0;
+    for (int s = 0; s < 16; s++) {
+        search_sin_[s] = sin(ang);
+        search_cos_[s] = cos(ang);
+        ang += pi / 16;
+    }
 
     return true;
 }
 
-void MultiStepRefiner::SetData(const uint8 *img_left, float *cost, const CrossArm *cross_arms,
+void MultiStepRefiner::SetData(const uint8 *img_left, float *cost, const CrossArms *cross_arms,
                                float *disp_left, float *disp_right) {
     img_left_ = img_left;
     cost_ = cost;
+    cost_fixed_ = nullptr;
+    cross_arms_ = cross_arms;
+    disp_left_ = disp_left;
+    disp_right_ = disp_right;
+}
+
+void MultiStepRefiner::SetData(const uint8 *img_left, uint16_t *cost, const CrossArms *cross_arms,
+                               float *disp_left, float *disp_right) {
+    img_left_ = img_left;
+    cost_ = nullptr;
+    cost_fixed_ = cost;
     cross_arms_ = cross_arms;
     disp_left_ = disp_left;
     disp_right_ = disp_right;
@@ -48,7 +85,7 @@ void MultiStepRefiner::SetParam(const int &min_disparity, const int &max_dispari
                                 const int &irv_ts, const float &irv_th, const float &lrcheck_thres,
                                 const bool &do_lr_check, const bool &do_region_voting,
                                 const bool &do_interpolating,
-                                const bool &do_discontinuity_adjustment) {
+                                const bool &do_discontinuity_adjustment, const bool &do_parallel) {
     min_disparity_ = min_disparity;
     max_disparity_ = max_disparity;
     irv_ts_ = irv_ts;
@@ -58,11 +95,13 @@ void MultiStepRefiner::SetParam(const int &min_disparity, const int &max_dispari
     do_region_voting_ = do_region_voting;
     do_interpolating_ = do_interpolating;
     do_discontinuity_adjustment_ = do_discontinuity_adjustment;
+    do_parallel_ = do_parallel;
 }
 
 void MultiStepRefiner::Refine() {
     if (width_ <= 0 || height_ <= 0 || disp_left_ == nullptr || disp_right_ == nullptr ||
-        cost_ == nullptr || cross_arms_ == nullptr) {
+        (cost_ == nullptr && cost_fixed_ == nullptr) || cross_arms_ == nullptr ||
+        max_disparity_ - min_disparity_ > max_disp_range_) {
         return;
     }
 
@@ -84,7 +123,13 @@ void MultiStepRefiner::Refine() {
     }
 
     // median filter
-    adcensus_util::MedianFilter(disp_left_, disp_left_, width_, height_, 3);
+    if (do_parallel_) {
+        std::copy(disp_left_, disp_left_ + width_ * height_, vec_median_in_.begin());
+        adcensus_util::MedianFilter(&vec_median_in_[0], disp_left_, width_, height_, 3,
+                                    num_threads_, &vec_median_wnd_[0]);
+    } else {
+        adcensus_util::MedianFilter(disp_left_, disp_left_, width_, height_, 3);
+    }
 }
 
 void MultiStepRefiner::OutlierDetection() {
@@ -136,6 +181,47 @@ void MultiStepRefiner::OutlierDetection() {
     }
 }
 
+float MultiStepRefiner::VoteInRegion(const int &x, const int &y, int *histogram) const {
+    const int width = width_;
+    const auto disp_range = max_disparity_ - min_disparity_;
+    const uint8 *arm_left = &cross_arms_->left[0];
+    const uint8 *arm_right = &cross_arms_->right[0];
+    const uint8 *arm_top = &cross_arms_->top[0];
+    const uint8 *arm_bottom = &cross_arms_->bottom[0];
+
+    // init histogram
+    memset(histogram, 0, disp_range * sizeof(int));
+
+    // the winner is kept up to date while the votes are added along the arms, ties go to the
+    // smaller disparity
+    int best_disp = 0, count = 0;
+    int max_ht = 0;
+    const int idx = y * width + x;
+    for (int t = -arm_top[idx]; t <= arm_bottom[idx]; t++) {
+        const int &yt = y + t;
+        const int idx2 = yt * width_ + x;
+        for (int s = -arm_left[idx2]; s <= arm_right[idx2]; s++) {
+            const auto &d = disp_left_[yt * width + x + s];
+            if (d != Invalid_Float) {
+                const int di = lround(d) - min_disparity_;
+                const int h = ++histogram[di];
+                if (h > max_ht || (h == max_ht && di < best_disp)) {
+                    max_ht = h;
+                    best_disp = di;
+                }
+                count++;
+            }
+        }
+    }
+
+    if (max_ht > 0) {
+        if (count > irv_ts_ && max_ht * 1.0f / count > irv_th_) {
+            return best_disp + min_disparity_;
+        }
+    }
+    return Invalid_Float;
+}
+
 void MultiStepRefiner::IterativeRegionVoting() {
     const int width = width_;
 
@@ -143,64 +229,39 @@ void MultiStepRefiner::IterativeRegionVoting() {
     if (disp_range <= 0) {
         return;
     }
-    const auto arms = cross_arms_;
-
-    vector<int> histogram(disp_range, 0);
 
     const int num_iters = 5;
 
     for (int it = 0; it < num_iters; it++) {
         for (int k = 0; k < 2; k++) {
             auto &trg_pixels = (k == 0) ? mismatches_ : occlusions_;
-            for (auto &pix : trg_pixels) {
-                const int &x = pix.first;
-                const int &y = pix.second;
-                auto &disp = disp_left_[y * width + x];
-                if (disp != Invalid_Float) {
-                    continue;
+            const int num_pixels = static_cast<int>(trg_pixels.size());
+            if (do_parallel_) {
+                // all pixels vote on the disparities of the previous iteration
+#pragma omp parallel for schedule(static) num_threads(num_threads_)
+                for (int n = 0; n < num_pixels; n++) {
+                    int *histogram = &vec_histogram_[omp_get_thread_num() * max_disp_range_];
+                    const auto &pix = trg_pixels[n];
+                    vec_fill_disps_[n] = VoteInRegion(pix.first, pix.second, histogram);
                 }
-
-                // init histogram
-                memset(&histogram[0], 0, disp_range * sizeof(int));
-
-                auto &arm = arms[y * width + x];
-                for (int t = -arm.top; t <= arm.bottom; t++) {
-                    const int &yt = y + t;
-                    auto &arm2 = arms[yt * width_ + x];
-                    for (int s = -arm2.left; s <= arm2.right; s++) {
-                        const auto &d = disp_left_[yt * width + x + s];
-                        if (d != Invalid_Float) {
-                            const auto di = lround(d);
-                            histogram[di - min_disparity_]++;
-                        }
-                    }
-                }
-                int best_disp = 0, count = 0;
-                int max_ht = 0;
-                for (int d = 0; d < disp_range; d++) {
-                    const auto &h = histogram[d];
-                    if (max_ht < h) {
-                        max_ht = h;
-                        best_disp = d;
-                    }
-                    count += h;
+                for (int n = 0; n < num_pixels; n++) {
+                    const auto &pix = trg_pixels[n];
+                    disp_left_[pix.second * width + pix.first] = vec_fill_disps_[n];
                 }
-
-                if (max_ht > 0) {
-                    if (count > irv_ts_ && max_ht * 1.0f / count > irv_th_) {
-                        disp = best_disp + min_disparity_;
+            } else {
+                for (auto &pix : trg_pixels) {
+                    auto &disp = disp_left_[pix.second * width + pix.first];
+                    if (disp == Invalid_Float) {
+                        disp = VoteInRegion(pix.first, pix.second, &vec_histogram_[0]);
                     }
                 }
             }
-            for (auto it = trg_pixels.begin(); it != trg_pixels.end();) {
-                const int x = it->first;
-                const int y = it->second;
-                if (disp_left_[y * width + x] != Invalid_Float) {
-                    it = trg_pixels.erase(it);
-                } else {
-                    ++it;
-                }
-            }
+            trg_pixels.erase(std::remove_if(trg_pixels.begin(), trg_pixels.end(),
+                                            [&](const pair<int, int> &pix) {
+                                                return disp_left_[pix.second * width + pix.first] !=
+                                                       Invalid_Float;
+                                            }),
+                             trg_pixels.end());
         }
     }
 }
@@ -209,27 +270,29 @@ void MultiStepRefiner::ProperInterpolation() {
     const int width = width_;
     const int height = height_;
 
-    const float pi = 3.1415926f;
     const int max_search_length = std::max(abs(max_disparity_), abs(min_disparity_));
 
-    std::vector<pair<int, float>> disp_collects;
     for (int k = 0; k < 2; k++) {
         auto &trg_pixels = (k == 0) ? mismatches_ : occlusions_;
         if (trg_pixels.empty()) {
             continue;
         }
-        std::vector<float> fill_disps(trg_pixels.size());
+        float *fill_disps = &vec_fill_disps_[0];
+        const int num_pixels = static_cast<int>(trg_pixels.size());
 
-        for (auto n = 0u; n < trg_pixels.size(); n++) {
+        // every pixel is filled from the disparities before the pass, so the pixels are independent
+#pragma omp parallel for schedule(static) num_threads(do_parallel_ ? num_threads_ : 1)
+        for (int n = 0; n < num_pixels; n++) {
             auto &pix = trg_pixels[n];
             const int x = pix.first;
             const int y = pix.second;
 
-            disp_collects.clear();
-            double ang = 0.0;
+            // first valid pixel in each of the 16 directions
+            pair<int, float> disp_collects[16];
+            int num_collects = 0;
             for (int s = 0; s < 16; s++) {
-                const auto sina = sin(ang);
-                const auto cosa = cos(ang);
+                const auto sina = search_sin_[s];
+                const auto cosa = search_cos_[s];
                 for (int m = 1; m < max_search_length; m++) {
                     const int yy = lround(y + m * sina);
                     const int xx = lround(x + m * cosa);
@@ -238,13 +301,13 @@ void MultiStepRefiner::ProperInterpolation() {
                     }
                     const auto &d = disp_left_[yy * width + xx];
                     if (d != Invalid_Float) {
-                        disp_collects.emplace_back(yy * width * 3 + 3 * xx, d);
+                        disp_collects[num_collects++] = std::make_pair(yy * width * 3 + 3 * xx, d);
                         break;
                     }
                 }
-                ang += pi / 16;
             }
-            if (disp_collects.empty()) {
+            fill_disps[n] = 0.0f;
+            if (num_collects == 0) {
                 continue;
             }
 
@@ -254,7 +317,8 @@ void MultiStepRefiner::ProperInterpolation() {
                 const auto color =
                     ADColor(img_left_[y * width * 3 + 3 * x], img_left_[y * width * 3 + 3 * x + 1],
                             img_left_[y * width * 3 + 3 * x + 2]);
-                for (auto &dc : disp_collects) {
+                for (int c = 0; c < num_collects; c++) {
+                    const auto &dc = disp_collects[c];
                     const auto color2 = ADColor(img_left_[dc.first], img_left_[dc.first + 1],
                                                 img_left_[dc.first + 2]);
                     const auto dist =
@@ -267,13 +331,13 @@ void MultiStepRefiner::ProperInterpolation() {
                 fill_disps[n] = d;
             } else {
                 float min_disp = Large_Float;
-                for (auto &dc : disp_collects) {
-                    min_disp = std::min(min_disp, dc.second);
+                for (int c = 0; c < num_collects; c++) {
+                    min_disp = std::min(min_disp, disp_collects[c].second);
                 }
                 fill_disps[n] = min_disp;
             }
         }
-        for (auto n = 0u; n < trg_pixels.size(); n++) {
+        for (int n = 0; n < num_pixels; n++) {
             auto &pix = trg_pixels[n];
             const int x = pix.first;
             const int y = pix.second;
@@ -301,8 +365,12 @@ void MultiStepRefiner::DepthDiscontinuityAdjustment() {
                 float &d = disp_ptr[x];
                 if (d != Invalid_Float) {
                     const int &di = lround(d);
-                    const auto cost_ptr = cost_ + y * width * disp_range + x * disp_range;
-                    float c0 = cost_ptr[di];
+                    // only compared, the fixed point costs need no scaling
+                    const int offset = y * width * disp_range + x * disp_range;
+                    auto cost_at = [&](const int &idx) -> float {
+                        return cost_ ? cost_[offset + idx] : cost_fixed_[offset + idx];
+                    };
+                    float c0 = cost_at(di);
 
                     bool adjust = false;
                     for (int k = 0; k < 2; k++) {
@@ -311,7 +379,7 @@ void MultiStepRefiner::DepthDiscontinuityAdjustment() {
                         const int &d2i = lround(d2);
                         if (d2 != Invalid_Float) {
                             const auto &c =
-                                (k == 0) ? cost_ptr[-disp_range + d2i] : cost_ptr[disp_range + d2i];
+                                (k == 0) ? cost_at(-disp_range + d2i) : cost_at(disp_range + d2i);
                             if (c < c0) {
                                 d = d2;
                                 c0 = c;
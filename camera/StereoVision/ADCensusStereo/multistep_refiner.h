@@ -9,15 +9,22 @@ class MultiStepRefiner {
     MultiStepRefiner();
     ~MultiStepRefiner();
 
-    bool Initialize(const int& width, const int& height);
+    // allocates the scratch of the refinement for disparity ranges up to disp_range and
+    // num_threads threads
+    bool Initialize(const int& width, const int& height, const int& disp_range,
+                    const int& num_threads = 1);
 
-    void SetData(const uint8* img_left, float* cost, const CrossArm* cross_arms, float* disp_left,
+    void SetData(const uint8* img_left, float* cost, const CrossArms* cross_arms, float* disp_left,
                  float* disp_right);
 
+    // same with the fixed point cost volume
+    void SetData(const uint8* img_left, uint16_t* cost, const CrossArms* cross_arms,
+                 float* disp_left, float* disp_right);
+
     void SetParam(const int& min_disparity, const int& max_disparity, const int& irv_ts,
                   const float& irv_th, const float& lrcheck_thres, const bool& do_lr_check,
                   const bool& do_region_voting, const bool& do_interpolating,
-                  const bool& do_discontinuity_adjustment);
+                  const bool& do_discontinuity_adjustment, const bool& do_parallel = false);
 
     void Refine();
 
@@ -27,6 +34,9 @@ class MultiStepRefiner {
     void ProperInterpolation();
     void DepthDiscontinuityAdjustment();
 
+    // disparity voted for by the cross region of (x, y), Invalid_Float without a clear winner
+    float VoteInRegion(const int& x, const int& y, int* histogram) const;
+
     static void EdgeDetect(uint8* edge_mask, const float* disp_ptr, const int& width,
                            const int& height, const float threshold);
 
@@ -37,7 +47,8 @@ class MultiStepRefiner {
     const uint8* img_left_;
 
     float* cost_;
-    const CrossArm* cross_arms_;
+    uint16_t* cost_fixed_;
+    const CrossArms* cross_arms_;
 
     float* disp_left_;
     float* disp_right_;
@@ -56,8 +67,23 @@ class MultiStepRefiner {
     bool do_region_voting_;
     bool do_interpolating_;
     bool do_discontinuity_adjustment_;
+    // split the region voting, the interpolation and the median filter among num_threads_
+    // threads. The voting then updates all pixels of an iteration at once from the previous one,
+    // the median filter writes to a copy.
+    bool do_parallel_;
+    int num_threads_;
 
     vector<pair<int, int>> occlusions_;
     vector<pair<int, int>> mismatches_;
+
+    // scratch, allocated in Initialize
+    int max_disp_range_;
+    vector<int> vec_histogram_;
+    vector<float> vec_fill_disps_;
+    vector<float> vec_median_in_;
+    vector<float> vec_median_wnd_;
+    // the 16 directions of the interpolation search
+    double search_sin_[16];
+    double search_cos_[16];
 };
 #endif
@@ -1,7 +1,13 @@
 #include "scanline_optimizer.h"
 
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <omp.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 ScanlineOptimizer::ScanlineOptimizer()
     : width_(0),
@@ -10,11 +16,14 @@ ScanlineOptimizer::ScanlineOptimizer()
       img_right_(nullptr),
       cost_init_(nullptr),
       cost_aggr_(nullptr),
+      cost_init_fixed_(nullptr),
+      cost_aggr_fixed_(nullptr),
       min_disparity_(0),
       max_disparity_(0),
       so_p1_(0),
       so_p2_(0),
-      so_tso_(0) {}
+      so_tso_(0),
+      num_threads_(1) {}
 
 ScanlineOptimizer::~ScanlineOptimizer() {}
 
@@ -24,11 +33,23 @@ void ScanlineOptimizer::SetData(const uint8 *img_left, const uint8 *img_right, f
     img_right_ = img_right;
     cost_init_ = cost_init;
     cost_aggr_ = cost_aggr;
+    cost_init_fixed_ = nullptr;
+    cost_aggr_fixed_ = nullptr;
+}
+
+void ScanlineOptimizer::SetData(const uint8 *img_left, const uint8 *img_right,
+                                uint16_t *cost_init, uint16_t *cost_aggr) {
+    img_left_ = img_left;
+    img_right_ = img_right;
+    cost_init_ = nullptr;
+    cost_aggr_ = nullptr;
+    cost_init_fixed_ = cost_init;
+    cost_aggr_fixed_ = cost_aggr;
 }
 
 void ScanlineOptimizer::SetParam(const int &width, const int &height, const int &min_disparity,
                                  const int &max_disparity, const float &p1, const float &p2,
-                                 const int &tso) {
+                                 const int &tso, const int &num_threads) {
     width_ = width;
     height_ = height;
     min_disparity_ = min_disparity;
@@ -36,32 +57,192 @@ void ScanlineOptimizer::SetParam(const int &width, const int &height, const int
     so_p1_ = p1;
     so_p2_ = p2;
     so_tso_ = tso;
+    num_threads_ = std::max(num_threads, 1);
+}
+
+// Path cost arithmetic per cost type. The fixed point costs are summed in int and saturate when
+// stored, the penalties are converted from the float parameters.
+template <typename T>
+struct PathCost;
+
+template <>
+struct PathCost<float> {
+    typedef float Sum;
+    static Sum Max() { return Large_Float; }
+    static Sum Penalty(const float &p) { return p; }
+    static float Halve(const Sum &cost) { return cost / 2; }
+};
+
+template <>
+struct PathCost<uint16_t> {
+    typedef int Sum;
+    static Sum Max() { return UINT16_MAX; }
+    static Sum Penalty(const float &p) { return static_cast<Sum>(lround(p * Fixed_Cost_One)); }
+    static uint16_t Halve(const Sum &cost) {
+        return static_cast<uint16_t>(std::min(cost / 2, static_cast<Sum>(UINT16_MAX)));
+    }
+};
+
+// min(cost[0], ..., cost[n - 1], init)
+static float MinCost(const float *cost, const int &n, const float &init) {
+    float min_cost = init;
+    int d = 0;
+#if defined(__SSE2__)
+    if (n >= 4) {
+        __m128 min4 = _mm_set1_ps(init);
+        for (; d + 4 <= n; d += 4) {
+            min4 = _mm_min_ps(min4, _mm_loadu_ps(cost + d));
+        }
+        min4 = _mm_min_ps(min4, _mm_shuffle_ps(min4, min4, _MM_SHUFFLE(1, 0, 3, 2)));
+        min4 = _mm_min_ps(min4, _mm_shuffle_ps(min4, min4, _MM_SHUFFLE(2, 3, 0, 1)));
+        min_cost = _mm_cvtss_f32(min4);
+    }
+#endif
+    for (; d < n; d++) {
+        min_cost = std::min(min_cost, cost[d]);
+    }
+    return min_cost;
+}
+
+static int MinCost(const uint16_t *cost, const int &n, const int &init) {
+    int min_cost = init;
+    int d = 0;
+#if defined(__SSE2__)
+    if (n >= 8) {
+        // SSE2 only has the signed 16 bit minimum, so the costs are shifted by 0x8000
+        const __m128i sign = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i min8 = _mm_set1_epi16(static_cast<short>(std::min(init, 0xffff) ^ 0x8000));
+        for (; d + 8 <= n; d += 8) {
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cost + d));
+            min8 = _mm_min_epi16(min8, _mm_xor_si128(c, sign));
+        }
+        min8 = _mm_min_epi16(min8, _mm_srli_si128(min8, 8));
+        min8 = _mm_min_epi16(min8, _mm_srli_si128(min8, 4));
+        min8 = _mm_min_epi16(min8, _mm_srli_si128(min8, 2));
+        min_cost = std::min(min_cost, (_mm_extract_epi16(min8, 0) ^ 0x8000));
+    }
+#endif
+    for (; d < n; d++) {
+        min_cost = std::min(min_cost, static_cast<int>(cost[d]));
+    }
+    return min_cost;
+}
+
+// One step of a scanline path for all disparities of a pixel. cost_last_path holds Lr(p-r) at
+// [1, disp_range] and the path maximum at both ends, it is updated to Lr(p). p1 and p2 are the
+// penalties per disparity. Returns min(Lr(p)).
+template <typename T>
+static typename PathCost<T>::Sum AggregatePixel(const T *cost_init, T *cost_aggr,
+                                                typename PathCost<T>::Sum *cost_last_path,
+                                                const typename PathCost<T>::Sum &mincost_last_path,
+                                                const typename PathCost<T>::Sum *p1,
+                                                const typename PathCost<T>::Sum *p2,
+                                                const int &disp_range) {
+    typedef typename PathCost<T>::Sum Sum;
+    // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
+    // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
+    for (int d = 0; d < disp_range; d++) {
+        const Sum cost = cost_init[d];
+        const Sum l1 = cost_last_path[d + 1];
+        const Sum l2 = cost_last_path[d] + p1[d];
+        const Sum l3 = cost_last_path[d + 2] + p1[d];
+        const Sum l4 = mincost_last_path + p2[d];
+        cost_aggr[d] = PathCost<T>::Halve(cost + std::min(std::min(l1, l2), std::min(l3, l4)));
+    }
+    const Sum min_cost = MinCost(cost_aggr, disp_range, PathCost<T>::Max());
+    std::copy(cost_aggr, cost_aggr + disp_range, cost_last_path + 1);
+    return min_cost;
+}
+
+// colour difference of the right image pixel xr to the previous one on the path, last is the
+// offset to it in bytes
+static inline int RightColorDist(const uint8 *img_right, const int &last, const int &xr) {
+    const uint8 *c = img_right + 3 * xr;
+    const uint8 *c_last = c + last;
+    return std::max(abs(c[0] - c_last[0]), std::max(abs(c[1] - c_last[1]), abs(c[2] - c_last[2])));
+}
+
+// Penalties of a scanline step for the pixels 1 <= x < width - 1 of a row, selected by the left
+// colour difference (below tso or not) and the right one at xr = x - d. Row k of table holds P1
+// (k = 0, 2) or P2 (k = 1, 3) for a small (k < 2) or large left difference, entry r belongs to
+// xr = width - 1 - r, so that a pixel reads its disparities forward from width - 1 - x. Left of
+// xr = 1 the right difference keeps its value of xr = 1. right_last is the offset of the
+// previous pixel on the path in img_right. Fills the entries [r_begin, r_end).
+template <typename Sum>
+static void BuildPenaltyRow(const uint8 *img_right, const int &right_last,
+                            const int &width, const int &tso, const Sum *p1, const Sum *p2,
+                            const int &r_begin, const int &r_end, Sum *table, const int &stride) {
+    for (int r = r_begin; r < r_end; r++) {
+        const int xr = std::max(width - 1 - r, 1);
+        int n = 0;
+        if (xr < width - 1) {
+            n = RightColorDist(img_right, right_last, xr) < tso ? 0 : 1;
+        }
+        table[r] = p1[n];
+        table[stride + r] = p2[n];
+        table[2 * stride + r] = p1[n + 1];
+        table[3 * stride + r] = p2[n + 1];
+    }
+}
+
+// Same as BuildPenaltyRow for a single pixel x, also at the image border, written to p1_x and
+// p2_x (disp_range each). d1 is the left colour difference.
+template <typename Sum>
+static void BuildPenaltyPixel(const uint8 *img_right, const int &right_last,
+                              const int &width, const int &x, const int &d1, const int &tso,
+                              const Sum *p1, const Sum *p2, const int &disp_range, Sum *p1_x,
+                              Sum *p2_x) {
+    int d2 = d1;
+    for (int d = 0; d < disp_range; d++) {
+        const int xr = x - d;
+        if (xr > 0 && xr < width - 1) {
+            d2 = RightColorDist(img_right, right_last, xr);
+        }
+        const int n = (d1 < tso ? 0 : 1) + (d2 < tso ? 0 : 1);
+        p1_x[d] = p1[n];
+        p2_x[d] = p2[n];
+    }
 }
 
 void ScanlineOptimizer::Optimize() {
-    if (width_ <= 0 || height_ <= 0 || img_left_ == nullptr || img_right_ == nullptr ||
-        cost_init_ == nullptr || cost_aggr_ == nullptr) {
+    if (width_ <= 0 || height_ <= 0 || img_left_ == nullptr || img_right_ == nullptr) {
         return;
     }
 
+    if (cost_init_ != nullptr && cost_aggr_ != nullptr) {
+        Optimize(cost_init_, cost_aggr_);
+    } else if (cost_init_fixed_ != nullptr && cost_aggr_fixed_ != nullptr) {
+        Optimize(cost_init_fixed_, cost_aggr_fixed_);
+    }
+}
+
+template <typename T>
+void ScanlineOptimizer::Optimize(T *cost_init, T *cost_aggr) {
     // left to right
-    CostAggregateLeftRight(cost_aggr_, cost_init_, true);
+    CostAggregateLeftRight(cost_aggr, cost_init, true);
     // right to left
-    CostAggregateLeftRight(cost_init_, cost_aggr_, false);
+    CostAggregateLeftRight(cost_init, cost_aggr, false);
     // up to down
-    CostAggregateUpDown(cost_aggr_, cost_init_, true);
+    CostAggregateUpDown(cost_aggr, cost_init, true);
     // down to up
-    CostAggregateUpDown(cost_init_, cost_aggr_, false);
+    CostAggregateUpDown(cost_init, cost_aggr, false);
 }
 
-void ScanlineOptimizer::CostAggregateLeftRight(const float *cost_so_src, float *cost_so_dst,
+
+template <typename T>
+void ScanlineOptimizer::CostAggregateLeftRight(const T *cost_so_src, T *cost_so_dst,
                                                bool is_forward) {
     const auto width = width_;
     const auto height = height_;
     const auto min_disparity = min_disparity_;
     const auto max_disparity = max_disparity_;
-    const auto p1 = so_p1_;
-    const auto p2 = so_p2_;
+    typedef typename PathCost<T>::Sum Sum;
+    const Sum large = PathCost<T>::Max();
+    // penalties for both, one or none of the color differences below tso
+    const Sum p1[3] = {PathCost<T>::Penalty(so_p1_), PathCost<T>::Penalty(so_p1_ / 4),
+                       PathCost<T>::Penalty(so_p1_ / 10)};
+    const Sum p2[3] = {PathCost<T>::Penalty(so_p2_), PathCost<T>::Penalty(so_p2_ / 4),
+                       PathCost<T>::Penalty(so_p2_ / 10)};
     const auto tso = so_tso_;
 
     assert(width > 0 && height > 0 && max_disparity > min_disparity);
@@ -70,103 +251,93 @@ void ScanlineOptimizer::CostAggregateLeftRight(const float *cost_so_src, float *
 
     const int direction = is_forward ? 1 : -1;
 
-    for (int y = 0u; y < height; y++) {
-        auto cost_init_row =
-            (is_forward) ? (cost_so_src + y * width * disp_range)
-                         : (cost_so_src + y * width * disp_range + (width - 1) * disp_range);
-        auto cost_aggr_row =
-            (is_forward) ? (cost_so_dst + y * width * disp_range)
-                         : (cost_so_dst + y * width * disp_range + (width - 1) * disp_range);
-        auto img_row = (is_forward) ? (img_left_ + y * width * 3)
-                                    : (img_left_ + y * width * 3 + 3 * (width - 1));
-        const auto img_row_r = img_right_ + y * width * 3;
-        int x = (is_forward) ? 0 : width - 1;
-
-        ADColor color(img_row[0], img_row[1], img_row[2]);
-        ADColor color_last = color;
-
-        std::vector<float> cost_last_path(disp_range + 2, Large_Float);
-
-        std::memcpy(cost_aggr_row, cost_init_row, disp_range * sizeof(float));
-        memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(float));
-        cost_init_row += direction * disp_range;
-        cost_aggr_row += direction * disp_range;
-        img_row += direction * 3;
-        x += direction;
-
-        float mincost_last_path = Large_Float;
-        for (auto cost : cost_last_path) {
-            mincost_last_path = std::min(mincost_last_path, cost);
-        }
+    const int table_stride = width + disp_range;
+
+    // the rows are independent
+#pragma omp parallel num_threads(num_threads_)
+    {
+        std::vector<Sum> cost_last_path(disp_range + 2);
+        std::vector<Sum> penalty_table(4 * table_stride);
+        std::vector<Sum> penalty_pixel(2 * disp_range);
+
+#pragma omp for schedule(static)
+        for (int y = 0; y < height; y++) {
+            auto cost_init_row =
+                (is_forward) ? (cost_so_src + y * width * disp_range)
+                             : (cost_so_src + y * width * disp_range + (width - 1) * disp_range);
+            auto cost_aggr_row =
+                (is_forward) ? (cost_so_dst + y * width * disp_range)
+                             : (cost_so_dst + y * width * disp_range + (width - 1) * disp_range);
+            auto img_row = (is_forward) ? (img_left_ + y * width * 3)
+                                        : (img_left_ + y * width * 3 + 3 * (width - 1));
+            const auto img_row_r = img_right_ + y * width * 3;
+            const int right_last = -3 * direction;
+            int x = (is_forward) ? 0 : width - 1;
+
+            BuildPenaltyRow(img_row_r, right_last, width, tso, p1, p2, 0, table_stride,
+                            &penalty_table[0], table_stride);
+
+            ADColor color(img_row[0], img_row[1], img_row[2]);
+            ADColor color_last = color;
+
+            std::fill(cost_last_path.begin(), cost_last_path.end(), large);
+
+            std::memcpy(cost_aggr_row, cost_init_row, disp_range * sizeof(T));
+            std::copy(cost_aggr_row, cost_aggr_row + disp_range, &cost_last_path[1]);
+            cost_init_row += direction * disp_range;
+            cost_aggr_row += direction * disp_range;
+            img_row += direction * 3;
+            x += direction;
 
-        for (int j = 0; j < width - 1; j++) {
-            color = ADColor(img_row[0], img_row[1], img_row[2]);
-            const uint8 d1 = ColorDist(color, color_last);
-            uint8 d2 = d1;
-            float min_cost = Large_Float;
-            for (int d = 0; d < disp_range; d++) {
-                const int xr = x - d;
-                if (xr > 0 && xr < width - 1) {
-                    const ADColor color_r =
-                        ADColor(img_row_r[3 * xr], img_row_r[3 * xr + 1], img_row_r[3 * xr + 2]);
-                    const ADColor color_last_r = ADColor(img_row_r[3 * (xr - direction)],
-                                                         img_row_r[3 * (xr - direction) + 1],
-                                                         img_row_r[3 * (xr - direction) + 2]);
-                    d2 = ColorDist(color_r, color_last_r);
-                }
+            Sum mincost_last_path = large;
+            for (auto cost : cost_last_path) {
+                mincost_last_path = std::min(mincost_last_path, cost);
+            }
 
-                float P1(0.0f), P2(0.0f);
-                if (d1 < tso && d2 < tso) {
-                    P1 = p1;
-                    P2 = p2;
-                } else if (d1 < tso && d2 >= tso) {
-                    P1 = p1 / 4;
-                    P2 = p2 / 4;
-                } else if (d1 >= tso && d2 < tso) {
-                    P1 = p1 / 4;
-                    P2 = p2 / 4;
-                } else if (d1 >= tso && d2 >= tso) {
-                    P1 = p1 / 10;
-                    P2 = p2 / 10;
+            for (int j = 0; j < width - 1; j++) {
+                color = ADColor(img_row[0], img_row[1], img_row[2]);
+                const uint8 d1 = ColorDist(color, color_last);
+
+                const Sum *p1_x, *p2_x;
+                if (x > 0 && x < width - 1) {
+                    const int k = d1 < tso ? 0 : 2;
+                    p1_x = &penalty_table[k * table_stride + width - 1 - x];
+                    p2_x = &penalty_table[(k + 1) * table_stride + width - 1 - x];
+                } else {
+                    BuildPenaltyPixel(img_row_r, right_last, width, x, d1, tso, p1, p2,
+                                      disp_range, &penalty_pixel[0], &penalty_pixel[disp_range]);
+                    p1_x = &penalty_pixel[0];
+                    p2_x = &penalty_pixel[disp_range];
                 }
 
-                // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-                // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-                const float cost = cost_init_row[d];
-                const float l1 = cost_last_path[d + 1];
-                const float l2 = cost_last_path[d] + P1;
-                const float l3 = cost_last_path[d + 2] + P1;
-                const float l4 = mincost_last_path + P2;
+                mincost_last_path = AggregatePixel(cost_init_row, cost_aggr_row, &cost_last_path[0],
+                                                   mincost_last_path, p1_x, p2_x, disp_range);
 
-                float cost_s =
-                    cost + static_cast<float>(std::min(std::min(l1, l2), std::min(l3, l4)));
-                cost_s /= 2;
+                cost_init_row += direction * disp_range;
+                cost_aggr_row += direction * disp_range;
+                img_row += direction * 3;
+                x += direction;
 
-                cost_aggr_row[d] = cost_s;
-                min_cost = std::min(min_cost, cost_s);
+                color_last = color;
             }
-
-            mincost_last_path = min_cost;
-            memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(float));
-
-            cost_init_row += direction * disp_range;
-            cost_aggr_row += direction * disp_range;
-            img_row += direction * 3;
-            x += direction;
-
-            color_last = color;
         }
     }
 }
 
-void ScanlineOptimizer::CostAggregateUpDown(const float *cost_so_src, float *cost_so_dst,
+template <typename T>
+void ScanlineOptimizer::CostAggregateUpDown(const T *cost_so_src, T *cost_so_dst,
                                             bool is_forward) {
     const auto width = width_;
     const auto height = height_;
     const auto min_disparity = min_disparity_;
     const auto max_disparity = max_disparity_;
-    const auto p1 = so_p1_;
-    const auto p2 = so_p2_;
+    typedef typename PathCost<T>::Sum Sum;
+    const Sum large = PathCost<T>::Max();
+    // penalties for both, one or none of the color differences below tso
+    const Sum p1[3] = {PathCost<T>::Penalty(so_p1_), PathCost<T>::Penalty(so_p1_ / 4),
+                       PathCost<T>::Penalty(so_p1_ / 10)};
+    const Sum p2[3] = {PathCost<T>::Penalty(so_p2_), PathCost<T>::Penalty(so_p2_ / 4),
+                       PathCost<T>::Penalty(so_p2_ / 10)};
     const auto tso = so_tso_;
 
     assert(width > 0 && height > 0 && max_disparity > min_disparity);
@@ -175,91 +346,74 @@ void ScanlineOptimizer::CostAggregateUpDown(const float *cost_so_src, float *cos
 
     const int direction = is_forward ? 1 : -1;
 
-    for (int x = 0; x < width; x++) {
-        auto cost_init_col =
-            (is_forward) ? (cost_so_src + x * disp_range)
-                         : (cost_so_src + (height - 1) * width * disp_range + x * disp_range);
-        auto cost_aggr_col =
-            (is_forward) ? (cost_so_dst + x * disp_range)
-                         : (cost_so_dst + (height - 1) * width * disp_range + x * disp_range);
-        auto img_col =
-            (is_forward) ? (img_left_ + 3 * x) : (img_left_ + (height - 1) * width * 3 + 3 * x);
-        int y = (is_forward) ? 0 : height - 1;
+    const int table_stride = width + disp_range;
 
-        ADColor color(img_col[0], img_col[1], img_col[2]);
-        ADColor color_last = color;
+    // the columns are independent. Every thread takes a band of columns and walks it row by row,
+    // which keeps the memory access contiguous instead of striding through the volume per column.
+#pragma omp parallel num_threads(num_threads_)
+    {
+        const int num_bands = omp_get_num_threads();
+        const int band = omp_get_thread_num();
+        const int x_begin = static_cast<int>(static_cast<long long>(width) * band / num_bands);
+        const int x_end = static_cast<int>(static_cast<long long>(width) * (band + 1) / num_bands);
+        const int band_width = x_end - x_begin;
 
-        std::vector<float> cost_last_path(disp_range + 2, Large_Float);
+        std::vector<Sum> cost_last_path(band_width * (disp_range + 2), large);
+        std::vector<Sum> mincost_last_path(band_width, large);
+        std::vector<Sum> penalty_table(4 * table_stride);
+        std::vector<Sum> penalty_pixel(2 * disp_range);
 
-        memcpy(cost_aggr_col, cost_init_col, disp_range * sizeof(float));
-        memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(float));
-        cost_init_col += direction * width * disp_range;
-        cost_aggr_col += direction * width * disp_range;
-        img_col += direction * width * 3;
-        y += direction;
+        // entries of the penalty table read by the band
+        const int r_begin = std::max(width - x_end, 0);
+        const int r_end = std::min(width - x_begin + disp_range, table_stride);
 
-        float mincost_last_path = Large_Float;
-        for (auto cost : cost_last_path) {
-            mincost_last_path = std::min(mincost_last_path, cost);
+        int y = (is_forward) ? 0 : height - 1;
+        for (int x = x_begin; x < x_end; x++) {
+            const auto offset = y * width * disp_range + x * disp_range;
+            Sum *last_path = &cost_last_path[(x - x_begin) * (disp_range + 2)];
+            memcpy(cost_so_dst + offset, cost_so_src + offset, disp_range * sizeof(T));
+            std::copy(cost_so_dst + offset, cost_so_dst + offset + disp_range, last_path + 1);
+            for (int d = 0; d < disp_range + 2; d++) {
+                mincost_last_path[x - x_begin] =
+                    std::min(mincost_last_path[x - x_begin], last_path[d]);
+            }
         }
+        y += direction;
 
-        for (int i = 0; i < height - 1; i++) {
-            color = ADColor(img_col[0], img_col[1], img_col[2]);
-            const uint8 d1 = ColorDist(color, color_last);
-            uint8 d2 = d1;
-            float min_cost = Large_Float;
-            for (int d = 0; d < disp_range; d++) {
-                const int xr = x - d;
-                if (xr > 0 && xr < width - 1) {
-                    const ADColor color_r = ADColor(img_right_[y * width * 3 + 3 * xr],
-                                                    img_right_[y * width * 3 + 3 * xr + 1],
-                                                    img_right_[y * width * 3 + 3 * xr + 2]);
-                    const ADColor color_last_r =
-                        ADColor(img_right_[(y - direction) * width * 3 + 3 * xr],
-                                img_right_[(y - direction) * width * 3 + 3 * xr + 1],
-                                img_right_[(y - direction) * width * 3 + 3 * xr + 2]);
-                    d2 = ColorDist(color_r, color_last_r);
+        for (int i = 0; i < height - 1 && band_width > 0; i++) {
+            const auto img_row = img_left_ + y * width * 3;
+            const auto img_row_last = img_row - direction * width * 3;
+            const auto img_row_r = img_right_ + y * width * 3;
+            const int right_last = -3 * direction * width;
+
+            BuildPenaltyRow(img_row_r, right_last, width, tso, p1, p2, r_begin, r_end,
+                            &penalty_table[0], table_stride);
+
+            for (int x = x_begin; x < x_end; x++) {
+                const ADColor color(img_row[3 * x], img_row[3 * x + 1], img_row[3 * x + 2]);
+                const ADColor color_last(img_row_last[3 * x], img_row_last[3 * x + 1],
+                                         img_row_last[3 * x + 2]);
+                const uint8 d1 = ColorDist(color, color_last);
+
+                const Sum *p1_x, *p2_x;
+                if (x > 0 && x < width - 1) {
+                    const int k = d1 < tso ? 0 : 2;
+                    p1_x = &penalty_table[k * table_stride + width - 1 - x];
+                    p2_x = &penalty_table[(k + 1) * table_stride + width - 1 - x];
+                } else {
+                    BuildPenaltyPixel(img_row_r, right_last, width, x, d1, tso, p1, p2,
+                                      disp_range, &penalty_pixel[0], &penalty_pixel[disp_range]);
+                    p1_x = &penalty_pixel[0];
+                    p2_x = &penalty_pixel[disp_range];
                 }
-                float P1(0.0f), P2(0.0f);
-                if (d1 < tso && d2 < tso) {
-                    P1 = p1;
-                    P2 = p2;
-                } else if (d1 < tso && d2 >= tso) {
-                    P1 = p1 / 4;
-                    P2 = p2 / 4;
-                } else if (d1 >= tso && d2 < tso) {
-                    P1 = p1 / 4;
-                    P2 = p2 / 4;
-                } else if (d1 >= tso && d2 >= tso) {
-                    P1 = p1 / 10;
-                    P2 = p2 / 10;
-                }
-
-                // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-                // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-                const float cost = cost_init_col[d];
-                const float l1 = cost_last_path[d + 1];
-                const float l2 = cost_last_path[d] + P1;
-                const float l3 = cost_last_path[d + 2] + P1;
-                const float l4 = mincost_last_path + P2;
 
-                float cost_s =
-                    cost + static_cast<float>(std::min(std::min(l1, l2), std::min(l3, l4)));
-                cost_s /= 2;
-
-                cost_aggr_col[d] = cost_s;
-                min_cost = std::min(min_cost, cost_s);
+                const auto offset = y * width * disp_range + x * disp_range;
+                mincost_last_path[x - x_begin] = AggregatePixel(
+                    cost_so_src + offset, cost_so_dst + offset,
+                    &cost_last_path[(x - x_begin) * (disp_range + 2)],
+                    mincost_last_path[x - x_begin], p1_x, p2_x, disp_range);
             }
-
-            mincost_last_path = min_cost;
-            memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(float));
-
-            cost_init_col += direction * width * disp_range;
-            cost_aggr_col += direction * width * disp_range;
-            img_col += direction * width * 3;
             y += direction;
-
-            color_last = color;
         }
     }
-}
+}
\ No newline at end of file
@@ -12,16 +12,27 @@ class ScanlineOptimizer {
 
     void SetData(const uint8* img_left, const uint8* img_right, float* cost_init, float* cost_aggr);
 
+    // fixed point volumes (Fixed_Cost_One), p1 and p2 are converted and the costs saturate
+    void SetData(const uint8* img_left, const uint8* img_right, uint16_t* cost_init,
+                 uint16_t* cost_aggr);
+
+    // the rows of the horizontal and the columns of the vertical passes are split among
+    // num_threads threads
     void SetParam(const int& width, const int& height, const int& min_disparity,
-                  const int& max_disparity, const float& p1, const float& p2, const int& tso);
+                  const int& max_disparity, const float& p1, const float& p2, const int& tso,
+                  const int& num_threads = 1);
 
     void Optimize();
 
    private:
-    void CostAggregateLeftRight(const float* cost_so_src, float* cost_so_dst,
-                                bool is_forward = true);
+    template <typename T>
+    void Optimize(T* cost_init, T* cost_aggr);
+
+    template <typename T>
+    void CostAggregateLeftRight(const T* cost_so_src, T* cost_so_dst, bool is_forward = true);
 
-    void CostAggregateUpDown(const float* cost_so_src, float* cost_so_dst, bool is_forward = true);
+    template <typename T>
+    void CostAggregateUpDown(const T* cost_so_src, T* cost_so_dst, bool is_forward = true);
 
     inline int ColorDist(const ADColor& c1, const ADColor& c2) {
         return std::max(abs(c1.r - c2.r), std::max(abs(c1.g - c2.g), abs(c1.b - c2.b)));
@@ -37,10 +48,14 @@ class ScanlineOptimizer {
     float* cost_init_;
     float* cost_aggr_;
 
+    uint16_t* cost_init_fixed_;
+    uint16_t* cost_aggr_fixed_;
+
     int min_disparity_;
     int max_disparity_;
     float so_p1_;
     float so_p2_;
     int so_tso_;
+    int num_threads_;
 };
 #endif
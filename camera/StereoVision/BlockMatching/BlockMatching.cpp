@@ -0,0 +1,303 @@
+#include "BlockMatching.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+
+BlockMatching::BlockMatching()
+    : width_(0), height_(0), disp_range_(0), col_sums_(nullptr),
+      row_costs_(nullptr), row_disp_right_(nullptr), is_initialized_(false) {}
+
+BlockMatching::~BlockMatching() {
+  arena_.Release();
+  is_initialized_ = false;
+}
+
+bool BlockMatching::Initialize(const int32_t &width, const int32_t &height,
+                               const BMOption &option) {
+  width_ = width;
+  height_ = height;
+  option_ = option;
+  option_.num_threads = std::max(option.num_threads, 1);
+  is_initialized_ = false;
+
+  if (width <= 0 || height <= 0) {
+    return false;
+  }
+
+  disp_range_ = option.max_disparity - option.min_disparity;
+  if (disp_range_ <= 0) {
+    return false;
+  }
+
+  if (option.window_size <= 0 || option.window_size % 2 == 0) {
+    return false;
+  }
+
+  // the scratch of every thread, a re-initialization to the same or a smaller
+  // size reuses the memory
+  const size_t row_volume = size_t(width) * disp_range_;
+  const int32_t num_threads = option_.num_threads;
+  arena_.Clear();
+  const size_t col_sums =
+      arena_.Reserve(num_threads * row_volume * sizeof(uint32_t));
+  const size_t row_costs =
+      arena_.Reserve(num_threads * row_volume * sizeof(uint32_t));
+  const size_t row_disp_right =
+      arena_.Reserve(num_threads * size_t(width) * sizeof(float));
+  if (!arena_.Allocate()) {
+    return false;
+  }
+
+  col_sums_ = arena_.Get<uint32_t>(col_sums);
+  row_costs_ = arena_.Get<uint32_t>(row_costs);
+  row_disp_right_ = arena_.Get<float>(row_disp_right);
+
+  is_initialized_ = true;
+  return true;
+}
+
+bool BlockMatching::Match(const uint8_t *img_left, const uint8_t *img_right,
+                          float *disp_left) {
+  if (!is_initialized_) {
+    return false;
+  }
+  if (img_left == nullptr || img_right == nullptr || disp_left == nullptr) {
+    return false;
+  }
+
+  timer_.Clear();
+
+  const int32_t width = width_;
+  const int32_t height = height_;
+  const int32_t radius = option_.window_size / 2;
+
+  // rows without a full window
+  const int32_t border_rows = std::min(radius, height);
+  std::fill(disp_left, disp_left + border_rows * width, Invalid_Float);
+  std::fill(disp_left + (height - border_rows) * width,
+            disp_left + height * width, Invalid_Float);
+
+  const int32_t num_rows = height - 2 * radius;
+  if (num_rows > 0) {
+#pragma omp parallel num_threads(option_.num_threads)
+    {
+      // contiguous strips, the column sums slide down a strip
+      const int32_t thread = omp_get_thread_num();
+      const int32_t num_threads = omp_get_num_threads();
+      const int32_t row_begin = radius + num_rows * thread / num_threads;
+      const int32_t row_end = radius + num_rows * (thread + 1) / num_threads;
+      if (row_begin < row_end) {
+        MatchStrip(img_left, img_right, disp_left, row_begin, row_end,
+                   thread);
+      }
+    }
+  }
+
+  const double ms = timer_.Lap("matching");
+  if (option_.is_print_timing) {
+    printf("block matching! timing :	%lf s\n", ms / 1000.0);
+  }
+
+  return true;
+}
+
+void BlockMatching::MatchStrip(const uint8_t *img_left,
+                               const uint8_t *img_right, float *disp_left,
+                               const int32_t &row_begin,
+                               const int32_t &row_end,
+                               const int32_t &thread) const {
+  const int32_t width = width_;
+  const int32_t radius = option_.window_size / 2;
+  const size_t row_volume = size_t(width) * disp_range_;
+
+  uint32_t *col_sums = col_sums_ + thread * row_volume;
+  uint32_t *costs = row_costs_ + thread * row_volume;
+  float *disp_right = row_disp_right_ + thread * width;
+
+  // window of the first row
+  memset(col_sums, 0, row_volume * sizeof(uint32_t));
+  for (int32_t i = row_begin - radius; i <= row_begin + radius; i++) {
+    UpdateColumnSums(img_left, img_right, i, 1, col_sums);
+  }
+
+  for (int32_t i = row_begin; i < row_end; i++) {
+    if (i > row_begin) {
+      UpdateColumnSums(img_left, img_right, i + radius, 1, col_sums);
+      UpdateColumnSums(img_left, img_right, i - radius - 1, -1, col_sums);
+    }
+
+    ComputeRowCosts(col_sums, costs);
+
+    float *disp_row = disp_left + i * width;
+    ComputeRowDisparity(costs, disp_row, disp_right);
+
+    if (option_.is_check_lr) {
+      LRCheckRow(disp_right, disp_row);
+    }
+  }
+}
+
+void BlockMatching::UpdateColumnSums(const uint8_t *img_left,
+                                     const uint8_t *img_right,
+                                     const int32_t &row, const int32_t &sign,
+                                     uint32_t *col_sums) const {
+  const int32_t width = width_;
+  const int32_t disp_range = disp_range_;
+  const int32_t min_disparity = option_.min_disparity;
+
+  const uint8_t *left = img_left + row * width;
+  const uint8_t *right = img_right + row * width;
+
+  for (int32_t j = 0; j < width; j++) {
+    // right column j - d inside the image, the other disparities are never
+    // part of a valid window
+    const int32_t d_begin = std::max(0, j - width + 1 - min_disparity);
+    const int32_t d_end = std::min(disp_range, j - min_disparity + 1);
+
+    const int32_t gray = left[j];
+    const uint8_t *right_col = right + j - min_disparity;
+    uint32_t *sums = col_sums + j * disp_range;
+    if (sign > 0) {
+      for (int32_t d = d_begin; d < d_end; d++) {
+        sums[d] += std::abs(gray - right_col[-d]);
+      }
+    } else {
+      for (int32_t d = d_begin; d < d_end; d++) {
+        sums[d] -= std::abs(gray - right_col[-d]);
+      }
+    }
+  }
+}
+
+void BlockMatching::ComputeRowCosts(const uint32_t *col_sums,
+                                    uint32_t *costs) const {
+  const int32_t width = width_;
+  const int32_t disp_range = disp_range_;
+  const int32_t radius = option_.window_size / 2;
+  if (width <= 2 * radius) {
+    return;
+  }
+
+  // window of the first column
+  uint32_t *cost = costs + radius * disp_range;
+  memcpy(cost, col_sums, disp_range * sizeof(uint32_t));
+  for (int32_t k = 1; k <= 2 * radius; k++) {
+    const uint32_t *sums = col_sums + k * disp_range;
+    for (int32_t d = 0; d < disp_range; d++) {
+      cost[d] += sums[d];
+    }
+  }
+
+  for (int32_t j = radius + 1; j < width - radius; j++) {
+    const uint32_t *prev = costs + (j - 1) * disp_range;
+    const uint32_t *enter = col_sums + (j + radius) * disp_range;
+    const uint32_t *leave = col_sums + (j - radius - 1) * disp_range;
+    cost = costs + j * disp_range;
+    for (int32_t d = 0; d < disp_range; d++) {
+      cost[d] = prev[d] + enter[d] - leave[d];
+    }
+  }
+}
+
+void BlockMatching::ComputeRowDisparity(const uint32_t *costs,
+                                        float *disp_left,
+                                        float *disp_right) const {
+  const int32_t width = width_;
+  const int32_t disp_range = disp_range_;
+  const int32_t min_disparity = option_.min_disparity;
+  const int32_t radius = option_.window_size / 2;
+  const bool is_check_unique = option_.is_check_unique;
+  const float uniqueness_ratio = option_.uniqueness_ratio;
+
+  std::fill(disp_left, disp_left + width, Invalid_Float);
+
+  for (int32_t j = radius; j < width - radius; j++) {
+    // disparities keeping the window inside the right image
+    const int32_t d_begin =
+        std::max(0, j + radius - (width - 1) - min_disparity);
+    const int32_t d_end = std::min(disp_range, j - radius - min_disparity + 1);
+    if (d_begin >= d_end) {
+      continue;
+    }
+
+    const uint32_t *cost_local = costs + j * disp_range;
+    uint32_t min_cost = UINT32_MAX;
+    int32_t best_d = d_begin;
+    for (int32_t d = d_begin; d < d_end; d++) {
+      if (min_cost > cost_local[d]) {
+        min_cost = cost_local[d];
+        best_d = d;
+      }
+    }
+
+    if (is_check_unique) {
+      uint32_t sec_min_cost = UINT32_MAX;
+      for (int32_t d = d_begin; d < d_end; d++) {
+        if (d != best_d) {
+          sec_min_cost = std::min(sec_min_cost, cost_local[d]);
+        }
+      }
+      if (sec_min_cost - min_cost <=
+          static_cast<uint32_t>(min_cost * (1 - uniqueness_ratio))) {
+        continue;
+      }
+    }
+
+    float disparity = static_cast<float>(best_d + min_disparity);
+    if (option_.is_subpixel && best_d > d_begin && best_d < d_end - 1) {
+      const int64_t cost_1 = cost_local[best_d - 1];
+      const int64_t cost_2 = cost_local[best_d + 1];
+      const int64_t denom =
+          std::max<int64_t>(1, cost_1 + cost_2 - 2 * min_cost);
+      disparity += static_cast<float>(cost_1 - cost_2) / (denom * 2.0f);
+    }
+    disp_left[j] = disparity;
+  }
+
+  if (!option_.is_check_lr) {
+    return;
+  }
+
+  // right pixel j matches left pixel j + d, its costs are read along the
+  // diagonal of the row costs
+  std::fill(disp_right, disp_right + width, Invalid_Float);
+  for (int32_t j = radius; j < width - radius; j++) {
+    const int32_t d_begin = std::max(0, radius - j - min_disparity);
+    const int32_t d_end =
+        std::min(disp_range, width - radius - j - min_disparity);
+
+    uint32_t min_cost = UINT32_MAX;
+    int32_t best_d = -1;
+    for (int32_t d = d_begin; d < d_end; d++) {
+      const uint32_t &cost = costs[(j + d + min_disparity) * disp_range + d];
+      if (min_cost > cost) {
+        min_cost = cost;
+        best_d = d;
+      }
+    }
+    if (best_d >= 0) {
+      disp_right[j] = static_cast<float>(best_d + min_disparity);
+    }
+  }
+}
+
+void BlockMatching::LRCheckRow(const float *disp_right,
+                               float *disp_left) const {
+  const int32_t width = width_;
+  const float threshold = option_.lrcheck_thres;
+
+  for (int32_t j = 0; j < width; j++) {
+    float &disp = disp_left[j];
+    if (disp == Invalid_Float) {
+      continue;
+    }
+    const int32_t col_right = static_cast<int32_t>(std::floor(j - disp + 0.5f));
+    if (col_right < 0 || col_right >= width ||
+        std::abs(disp - disp_right[col_right]) > threshold) {
+      disp = Invalid_Float;
+    }
+  }
+}
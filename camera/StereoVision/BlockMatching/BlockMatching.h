@@ -0,0 +1,107 @@
+#ifndef BLOCK_MATCHING_H_
+#define BLOCK_MATCHING_H_
+
+#include "../StereoCommon/aligned_arena.h"
+#include "../StereoCommon/stage_timer.h"
+#include "../StereoCommon/stereo_constants.h"
+#include <cstdint>
+
+// Local block matching with the sum of absolute differences over a square
+// window, the baseline of the other engines.
+//
+// The cost of a disparity is the box filtered absolute difference image of
+// that disparity. Both box filter passes are running sums: every row keeps
+// the window column sums of all disparities, updated by the row entering and
+// the row leaving the window, and a row of costs slides the window along the
+// columns. A pixel costs O(1) per disparity whatever the window size. The
+// rows are split into one strip per thread, each strip with its own column
+// sums.
+class BlockMatching {
+public:
+  BlockMatching();
+  ~BlockMatching();
+
+  struct BMOption {
+    // disparities in [min_disparity, max_disparity)
+    int32_t min_disparity;
+    int32_t max_disparity;
+
+    // odd side of the square window
+    int32_t window_size;
+
+    bool is_check_unique;
+    float uniqueness_ratio;
+
+    bool is_check_lr;
+    float lrcheck_thres;
+
+    // parabola fit through the costs around the minimum
+    bool is_subpixel;
+
+    // number of OpenMP threads, each matches a strip of rows
+    int32_t num_threads;
+
+    // print the time of every stage of Match
+    bool is_print_timing;
+
+    BMOption()
+        : min_disparity(0), max_disparity(64), window_size(9),
+          is_check_unique(true), uniqueness_ratio(0.95f), is_check_lr(true),
+          lrcheck_thres(1.0f), is_subpixel(true), num_threads(1),
+          is_print_timing(true) {}
+  };
+
+  bool Initialize(const int32_t &width, const int32_t &height,
+                  const BMOption &option);
+
+  // Matches two gray images of the initialized size. Pixels whose window
+  // leaves the image, that fail the checks or have no disparity keeping the
+  // window inside the right image are Invalid_Float.
+  bool Match(const uint8_t *img_left, const uint8_t *img_right,
+             float *disp_left);
+
+  // stage timings of the last Match
+  const StageTimer &GetStageTimer() const { return timer_; }
+
+private:
+  // matches the rows [row_begin, row_end) with the scratch of one thread
+  void MatchStrip(const uint8_t *img_left, const uint8_t *img_right,
+                  float *disp_left, const int32_t &row_begin,
+                  const int32_t &row_end, const int32_t &thread) const;
+
+  // adds (sign 1) or removes (sign -1) image row `row` to the column sums
+  void UpdateColumnSums(const uint8_t *img_left, const uint8_t *img_right,
+                        const int32_t &row, const int32_t &sign,
+                        uint32_t *col_sums) const;
+
+  // window costs of every pixel and disparity of a row from the column sums
+  void ComputeRowCosts(const uint32_t *col_sums, uint32_t *costs) const;
+
+  void ComputeRowDisparity(const uint32_t *costs, float *disp_left,
+                           float *disp_right) const;
+
+  void LRCheckRow(const float *disp_right, float *disp_left) const;
+
+private:
+  BMOption option_;
+
+  int32_t width_;
+  int32_t height_;
+  int32_t disp_range_;
+
+  // holds the scratch of every thread, laid out by Initialize so that Match
+  // does not allocate
+  AlignedArena arena_;
+  // width * disp_range_ column sums for each thread
+  uint32_t *col_sums_;
+  // width * disp_range_ costs of one row for each thread
+  uint32_t *row_costs_;
+  // right disparities of one row for each thread
+  float *row_disp_right_;
+
+  StageTimer timer_;
+
+  bool is_initialized_;
+};
+
+#endif
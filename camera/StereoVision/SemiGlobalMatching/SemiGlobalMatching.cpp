@@ -1,22 +1,26 @@
 #include "SemiGlobalMatching.h"
+#include "../StereoCommon/census.h"
 #include "sgm_util.h"
 #include <algorithm>
 #include <cassert>
-#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#include <omp.h>
 #include <vector>
 
-using namespace std::chrono;
-
 SemiGlobalMatching::SemiGlobalMatching()
-    : width_(0), height_(0), img_left_(nullptr), img_right_(nullptr),
-      census_left_(nullptr), census_right_(nullptr), cost_init_(nullptr),
-      cost_aggr_(nullptr), cost_aggr_1_(nullptr), cost_aggr_2_(nullptr),
-      cost_aggr_3_(nullptr), cost_aggr_4_(nullptr), cost_aggr_5_(nullptr),
-      cost_aggr_6_(nullptr), cost_aggr_7_(nullptr), cost_aggr_8_(nullptr),
-      disp_left_(nullptr), disp_right_(nullptr), is_initialized_(false) {}
+    : width_(0), height_(0), census_left_(nullptr), census_right_(nullptr),
+      volume_range_(0), cost_init_(nullptr), cost_aggr_(nullptr),
+      cost_aggr_1_(nullptr),
+      cost_aggr_2_(nullptr), cost_aggr_3_(nullptr), cost_aggr_4_(nullptr),
+      cost_aggr_5_(nullptr), cost_aggr_6_(nullptr), cost_aggr_7_(nullptr),
+      cost_aggr_8_(nullptr), disp_left_(nullptr), disp_right_(nullptr),
+      coarse_(nullptr), img_coarse_left_(nullptr), img_coarse_right_(nullptr),
+      disp_coarse_(nullptr), band_min_(nullptr), path_scratch_(nullptr),
+      fused_scratch_(nullptr), cost_scratch_(nullptr), row_scratch_(nullptr),
+      speckle_visited_(nullptr), speckle_pixels_(nullptr),
+      fill_disps_(nullptr), median_window_(nullptr), is_initialized_(false) {}
 
 SemiGlobalMatching::~SemiGlobalMatching() {
   Release();
@@ -28,61 +32,171 @@ bool SemiGlobalMatching::Initialize(const sint32 &width, const sint32 &height,
   width_ = width;
   height_ = height;
   option_ = option;
+  is_initialized_ = false;
 
   if (width == 0 || height == 0) {
     return false;
   }
 
-  const sint32 img_size = width * height;
-  if (option.census_size == Census5x5) {
-    census_left_ = new uint32[img_size]();
-    census_right_ = new uint32[img_size]();
-  } else {
-    census_left_ = new uint64[img_size]();
-    census_right_ = new uint64[img_size]();
-  }
-
   const sint32 disp_range = option.max_disparity - option.min_disparity;
   if (disp_range <= 0) {
     return false;
   }
 
-  const sint32 size = width * height * disp_range;
-  cost_init_ = new uint8[size]();
-  cost_aggr_ = new uint16[size]();
-  cost_aggr_1_ = new uint8[size]();
-  cost_aggr_2_ = new uint8[size]();
-  cost_aggr_3_ = new uint8[size]();
-  cost_aggr_4_ = new uint8[size]();
-  cost_aggr_5_ = new uint8[size]();
-  cost_aggr_6_ = new uint8[size]();
-  cost_aggr_7_ = new uint8[size]();
-  cost_aggr_8_ = new uint8[size]();
+  if (option.num_cost_slots <= 0) {
+    return false;
+  }
+
+  const sint32 img_size = width * height;
+  const sint32 num_threads = std::max(option.num_threads, 1);
+
+  volume_range_ = disp_range;
+  if (option.num_pyramid_levels > 0) {
+    // the coarser levels search half the disparities on half the image
+    SGMOption coarse_option = option;
+    coarse_option.num_pyramid_levels = option.num_pyramid_levels - 1;
+    coarse_option.min_disparity =
+        static_cast<sint32>(std::floor(option.min_disparity / 2.0));
+    coarse_option.max_disparity =
+        static_cast<sint32>(std::ceil(option.max_disparity / 2.0));
+    coarse_option.num_cost_slots = 1;
+    coarse_option.is_fill_holes = true;
+    if (coarse_ == nullptr) {
+      coarse_ = new SemiGlobalMatching();
+    }
+    if (!coarse_->Initialize(width / 2, height / 2, coarse_option)) {
+      return false;
+    }
+
+    volume_range_ = std::min(disp_range, 2 * option.band_radius + 1);
+    option_.is_fused_aggregation = true;
+  } else if (coarse_) {
+    delete coarse_;
+    coarse_ = nullptr;
+  }
 
-  disp_left_ = new float32[img_size]();
-  disp_right_ = new float32[img_size]();
+  // lay out every buffer of the engine in one arena, a re-initialization to
+  // the same or a smaller size reuses the memory
+  const sint32 size = img_size * volume_range_;
+  const size_t census_bytes =
+      (option.census_size == Census5x5) ? sizeof(uint32) : sizeof(uint64);
+  arena_.Clear();
+  const size_t census_left = arena_.Reserve(img_size * census_bytes);
+  const size_t census_right = arena_.Reserve(img_size * census_bytes);
+  const size_t cost_init =
+      arena_.Reserve(size_t(size) * option.num_cost_slots * sizeof(uint8));
+  const size_t cost_aggr = arena_.Reserve(size_t(size) * sizeof(uint16));
+  size_t cost_aggr_paths[8] = {0};
+  if (!option_.is_fused_aggregation) {
+    for (sint32 k = 0; k < 8; k++) {
+      cost_aggr_paths[k] = arena_.Reserve(size_t(size) * sizeof(uint8));
+    }
+  }
+  const size_t disp_left = arena_.Reserve(img_size * sizeof(float32));
+  const size_t disp_right = arena_.Reserve(img_size * sizeof(float32));
+
+  size_t img_coarse_left = 0, img_coarse_right = 0, disp_coarse = 0;
+  size_t band_min = 0;
+  if (option.num_pyramid_levels > 0) {
+    const sint32 coarse_size = (width / 2) * (height / 2);
+    img_coarse_left = arena_.Reserve(coarse_size * sizeof(uint8));
+    img_coarse_right = arena_.Reserve(coarse_size * sizeof(uint8));
+    disp_coarse = arena_.Reserve(coarse_size * sizeof(float32));
+    band_min = arena_.Reserve(size_t(img_size) * option.num_cost_slots *
+                              sizeof(sint16));
+  }
 
-  is_initialized_ =
-      census_left_ && census_right_ && cost_init_ && cost_aggr_ && disp_left_;
+  // scratch of the aggregation, disparity and refinement stages
+  size_t path_scratch = 0, fused_scratch = 0;
+  if (option_.is_fused_aggregation) {
+    fused_scratch = arena_.Reserve(sgm_util::CostAggregateFusedScratchSize(
+        width, height, volume_range_, option.num_paths, num_threads));
+  } else {
+    path_scratch = arena_.Reserve(num_threads * (volume_range_ + 2));
+  }
+  const size_t cost_scratch =
+      arena_.Reserve(num_threads * disp_range * sizeof(uint16));
+  const size_t row_scratch = arena_.Reserve(
+      num_threads * width * (2 * sizeof(uint16) + sizeof(sint32)));
+  const size_t speckle_visited = arena_.Reserve(img_size * sizeof(uint8));
+  const size_t speckle_pixels = arena_.Reserve(img_size * sizeof(sint32));
+  const size_t fill_disps = arena_.Reserve(img_size * sizeof(float32));
+  const size_t median_window = arena_.Reserve(9 * sizeof(float32));
+
+  if (!arena_.Allocate()) {
+    return false;
+  }
+
+  census_left_ = arena_.Get<void>(census_left);
+  census_right_ = arena_.Get<void>(census_right);
+  cost_init_ = arena_.Get<uint8>(cost_init);
+  cost_aggr_ = arena_.Get<uint16>(cost_aggr);
+  uint8 **cost_aggr_path[8] = {&cost_aggr_1_, &cost_aggr_2_, &cost_aggr_3_,
+                               &cost_aggr_4_, &cost_aggr_5_, &cost_aggr_6_,
+                               &cost_aggr_7_, &cost_aggr_8_};
+  for (sint32 k = 0; k < 8; k++) {
+    *cost_aggr_path[k] = option_.is_fused_aggregation
+                             ? nullptr
+                             : arena_.Get<uint8>(cost_aggr_paths[k]);
+  }
+  disp_left_ = arena_.Get<float32>(disp_left);
+  disp_right_ = arena_.Get<float32>(disp_right);
+  if (option.num_pyramid_levels > 0) {
+    img_coarse_left_ = arena_.Get<uint8>(img_coarse_left);
+    img_coarse_right_ = arena_.Get<uint8>(img_coarse_right);
+    disp_coarse_ = arena_.Get<float32>(disp_coarse);
+    band_min_ = arena_.Get<sint16>(band_min);
+  } else {
+    img_coarse_left_ = nullptr;
+    img_coarse_right_ = nullptr;
+    disp_coarse_ = nullptr;
+    band_min_ = nullptr;
+  }
+  path_scratch_ = option_.is_fused_aggregation
+                      ? nullptr
+                      : arena_.Get<uint8>(path_scratch);
+  fused_scratch_ = option_.is_fused_aggregation
+                       ? arena_.Get<void>(fused_scratch)
+                       : nullptr;
+  cost_scratch_ = arena_.Get<uint16>(cost_scratch);
+  row_scratch_ = arena_.Get<void>(row_scratch);
+  speckle_visited_ = arena_.Get<uint8>(speckle_visited);
+  speckle_pixels_ = arena_.Get<sint32>(speckle_pixels);
+  fill_disps_ = arena_.Get<float32>(fill_disps);
+  median_window_ = arena_.Get<float32>(median_window);
+
+  // at most every pixel is an occlusion or a mismatch
+  occlusions_.reserve(img_size);
+  mismatches_.reserve(img_size);
+
+  is_initialized_ = true;
 
   return is_initialized_;
 }
 
 void SemiGlobalMatching::Release() {
-  SAFE_DELETE(census_left_);
-  SAFE_DELETE(census_right_);
-  SAFE_DELETE(cost_init_);
-  SAFE_DELETE(cost_aggr_);
-  SAFE_DELETE(cost_aggr_1_);
-  SAFE_DELETE(cost_aggr_2_);
-  SAFE_DELETE(cost_aggr_3_);
-  SAFE_DELETE(cost_aggr_4_);
-  SAFE_DELETE(cost_aggr_5_);
-  SAFE_DELETE(cost_aggr_6_);
-  SAFE_DELETE(cost_aggr_7_);
-  SAFE_DELETE(cost_aggr_8_);
-  SAFE_DELETE(disp_left_);
-  SAFE_DELETE(disp_right_);
+  arena_.Release();
+  census_left_ = census_right_ = nullptr;
+  cost_init_ = nullptr;
+  cost_aggr_ = nullptr;
+  cost_aggr_1_ = cost_aggr_2_ = cost_aggr_3_ = cost_aggr_4_ = nullptr;
+  cost_aggr_5_ = cost_aggr_6_ = cost_aggr_7_ = cost_aggr_8_ = nullptr;
+  disp_left_ = disp_right_ = nullptr;
+  img_coarse_left_ = img_coarse_right_ = nullptr;
+  disp_coarse_ = nullptr;
+  band_min_ = nullptr;
+  path_scratch_ = nullptr;
+  fused_scratch_ = nullptr;
+  cost_scratch_ = nullptr;
+  row_scratch_ = nullptr;
+  speckle_visited_ = nullptr;
+  speckle_pixels_ = nullptr;
+  fill_disps_ = nullptr;
+  median_window_ = nullptr;
+  if (coarse_) {
+    delete coarse_;
+    coarse_ = nullptr;
+  }
 }
 
 bool SemiGlobalMatching::Match(const uint8 *img_left, const uint8 *img_right,
@@ -94,54 +208,92 @@ bool SemiGlobalMatching::Match(const uint8 *img_left, const uint8 *img_right,
     return false;
   }
 
-  img_left_ = img_left;
-  img_right_ = img_right;
+  timer_.Clear();
+
+  sint16 *band_min = GetBand(0);
+  if (band_min) {
+    ComputeBand(img_left, img_right, band_min);
+  }
 
-  auto start = std::chrono::steady_clock::now();
+  CensusTransform(img_left, img_right);
 
-  CensusTransform();
+  ComputeCost(cost_init_, band_min);
 
-  ComputeCost();
+  double ms = timer_.Lap("cost");
+  if (option_.is_print_timing) {
+    printf("computing cost! timing :	%lf s\n", ms / 1000.0);
+  }
 
-  auto end = steady_clock::now();
-  auto tt = duration_cast<milliseconds>(end - start);
-  printf("computing cost! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  CostAggregation(img_left, cost_init_, band_min);
 
-  CostAggregation();
+  ms = timer_.Lap("aggregation");
+  if (option_.is_print_timing) {
+    printf("cost aggregating! timing :	%lf s\n", ms / 1000.0);
+  }
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("cost aggregating! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  ComputeDisparity(band_min);
 
-  ComputeDisparity();
+  ms = timer_.Lap("disparity");
+  if (option_.is_print_timing) {
+    printf("computing disparities! timing :	%lf s\n", ms / 1000.0);
+  }
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("computing disparities! timing :	%lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  PostProcess(band_min);
 
-  if (option_.is_check_lr) {
-    ComputeDisparityRight();
-    LRCheck();
+  ms = timer_.Lap("postprocess");
+  if (option_.is_print_timing) {
+    printf("postprocessing! timing :        %lf s\n", ms / 1000.0);
   }
 
-  if (option_.is_remove_speckles) {
-    sgm_util::RemoveSpeckles(disp_left_, width_, height_, 1,
-                             option_.min_speckle_aera, Invalid_Float);
+  memcpy(disp_left, disp_left_, height_ * width_ * sizeof(float32));
+
+  return true;
+}
+
+bool SemiGlobalMatching::ComputeCostVolume(const uint8 *img_left,
+                                           const uint8 *img_right,
+                                           const sint32 &slot) {
+  if (!is_initialized_) {
+    return false;
+  }
+  if (img_left == nullptr || img_right == nullptr || slot < 0 ||
+      slot >= option_.num_cost_slots) {
+    return false;
   }
 
-  if (option_.is_fill_holes) {
-    FillHolesInDispMap();
+  const sint32 size = width_ * height_ * volume_range_;
+
+  sint16 *band_min = GetBand(slot);
+  if (band_min) {
+    ComputeBand(img_left, img_right, band_min);
   }
 
-  sgm_util::MedianFilter(disp_left_, disp_left_, width_, height_, 3);
+  CensusTransform(img_left, img_right);
 
-  end = steady_clock::now();
-  tt = duration_cast<milliseconds>(end - start);
-  printf("postprocessing! timing :        %lf s\n", tt.count() / 1000.0);
-  start = steady_clock::now();
+  ComputeCost(cost_init_ + slot * size, band_min);
+
+  return true;
+}
+
+bool SemiGlobalMatching::MatchCostVolume(const uint8 *img_left,
+                                         const sint32 &slot,
+                                         float32 *disp_left) {
+  if (!is_initialized_) {
+    return false;
+  }
+  if (img_left == nullptr || disp_left == nullptr || slot < 0 ||
+      slot >= option_.num_cost_slots) {
+    return false;
+  }
+
+  const sint32 size = width_ * height_ * volume_range_;
+  const sint16 *band_min = GetBand(slot);
+
+  CostAggregation(img_left, cost_init_ + slot * size, band_min);
+
+  ComputeDisparity(band_min);
+
+  PostProcess(band_min);
 
   memcpy(disp_left, disp_left_, height_ * width_ * sizeof(float32));
 
@@ -150,63 +302,106 @@ bool SemiGlobalMatching::Match(const uint8 *img_left, const uint8 *img_right,
 
 bool SemiGlobalMatching::Reset(const uint32 &width, const uint32 &height,
                                const SGMOption &option) {
-  Release();
-
-  is_initialized_ = false;
-
+  // Initialize lays the buffers out again and keeps the arena memory
   return Initialize(width, height, option);
 }
 
-void SemiGlobalMatching::CensusTransform() const {
+void SemiGlobalMatching::CensusTransform(const uint8 *img_left,
+                                         const uint8 *img_right) const {
   if (option_.census_size == Census5x5) {
-    sgm_util::census_transform_5x5(
-        img_left_, static_cast<uint32 *>(census_left_), width_, height_);
-    sgm_util::census_transform_5x5(
-        img_right_, static_cast<uint32 *>(census_right_), width_, height_);
+    census::Transform5x5(img_left, static_cast<uint32 *>(census_left_), width_,
+                         height_);
+    census::Transform5x5(img_right, static_cast<uint32 *>(census_right_),
+                         width_, height_);
   } else {
-    sgm_util::census_transform_9x7(
-        img_left_, static_cast<uint64 *>(census_left_), width_, height_);
-    sgm_util::census_transform_9x7(
-        img_right_, static_cast<uint64 *>(census_right_), width_, height_);
+    census::Transform9x7(img_left, static_cast<uint64 *>(census_left_), width_,
+                         height_);
+    census::Transform9x7(img_right, static_cast<uint64 *>(census_right_),
+                         width_, height_);
+  }
+}
+
+sint16 *SemiGlobalMatching::GetBand(const sint32 &slot) const {
+  return band_min_ ? band_min_ + slot * width_ * height_ : nullptr;
+}
+
+void SemiGlobalMatching::ComputeBand(const uint8 *img_left,
+                                     const uint8 *img_right,
+                                     sint16 *band_min) const {
+  const sint32 width_coarse = width_ / 2;
+  const sint32 height_coarse = height_ / 2;
+
+  sgm_util::DownsampleHalf(img_left, img_coarse_left_, width_, height_);
+  sgm_util::DownsampleHalf(img_right, img_coarse_right_, width_, height_);
+  coarse_->ComputeCostVolume(img_coarse_left_, img_coarse_right_, 0);
+  coarse_->MatchCostVolume(img_coarse_left_, 0, disp_coarse_);
+
+  // the band is centred on the upsampled coarse disparity and kept inside
+  // [min_disparity, max_disparity)
+  const sint32 band_lo = option_.min_disparity;
+  const sint32 band_hi = option_.max_disparity - volume_range_;
+  const sint32 center_default =
+      (option_.min_disparity + option_.max_disparity) / 2;
+
+#pragma omp parallel for schedule(static) num_threads(option_.num_threads)
+  for (sint32 i = 0; i < height_; i++) {
+    const float32 *disp_row =
+        disp_coarse_ + std::min(i / 2, height_coarse - 1) * width_coarse;
+    // pixels without a coarse disparity take the last valid one of the row
+    sint32 center = center_default;
+    for (sint32 j = 0; j < width_; j++) {
+      const float32 disp = disp_row[std::min(j / 2, width_coarse - 1)];
+      if (disp != Invalid_Float) {
+        center = static_cast<sint32>(lround(2.0f * disp));
+      }
+      const sint32 lo = center - option_.band_radius;
+      band_min[i * width_ + j] =
+          static_cast<sint16>(std::max(band_lo, std::min(band_hi, lo)));
+    }
   }
 }
 
-void SemiGlobalMatching::ComputeCost() const {
+void SemiGlobalMatching::ComputeCost(uint8 *cost_init,
+                                     const sint16 *band_min) const {
   const sint32 &min_disparity = option_.min_disparity;
   const sint32 &max_disparity = option_.max_disparity;
-  const sint32 disp_range = max_disparity - min_disparity;
+  const sint32 disp_range = volume_range_;
   if (disp_range <= 0) {
     return;
   }
 
+#pragma omp parallel for schedule(static) num_threads(option_.num_threads)
   for (sint32 i = 0; i < height_; i++) {
-    for (sint32 j = 0; j < width_; j++) {
-      for (sint32 d = min_disparity; d < max_disparity; d++) {
-        auto &cost = cost_init_[i * width_ * disp_range + j * disp_range +
-                                (d - min_disparity)];
-        if (j - d < 0 || j - d >= width_) {
-          cost = UINT8_MAX / 2;
-          continue;
-        }
-        if (option_.census_size == Census5x5) {
-          const auto &census_val_l =
-              static_cast<uint32 *>(census_left_)[i * width_ + j];
-          const auto &census_val_r =
-              static_cast<uint32 *>(census_right_)[i * width_ + j - d];
-          cost = sgm_util::Hamming32(census_val_l, census_val_r);
-        } else {
-          const auto &census_val_l =
-              static_cast<uint64 *>(census_left_)[i * width_ + j];
-          const auto &census_val_r =
-              static_cast<uint64 *>(census_right_)[i * width_ + j - d];
-          cost = sgm_util::Hamming64(census_val_l, census_val_r);
-        }
+    uint8 *cost_row = cost_init + i * width_ * disp_range;
+    if (band_min) {
+      if (option_.census_size == Census5x5) {
+        sgm_util::ComputeCostRowBand32(
+            static_cast<uint32 *>(census_left_) + i * width_,
+            static_cast<uint32 *>(census_right_) + i * width_, cost_row,
+            width_, band_min + i * width_, disp_range);
+      } else {
+        sgm_util::ComputeCostRowBand64(
+            static_cast<uint64 *>(census_left_) + i * width_,
+            static_cast<uint64 *>(census_right_) + i * width_, cost_row,
+            width_, band_min + i * width_, disp_range);
       }
+    } else if (option_.census_size == Census5x5) {
+      sgm_util::ComputeCostRow32(
+          static_cast<uint32 *>(census_left_) + i * width_,
+          static_cast<uint32 *>(census_right_) + i * width_, cost_row, width_,
+          min_disparity, max_disparity);
+    } else {
+      sgm_util::ComputeCostRow64(
+          static_cast<uint64 *>(census_left_) + i * width_,
+          static_cast<uint64 *>(census_right_) + i * width_, cost_row, width_,
+          min_disparity, max_disparity);
     }
   }
 }
 
-void SemiGlobalMatching::CostAggregation() const {
+void SemiGlobalMatching::CostAggregation(const uint8 *img_left,
+                                         const uint8 *cost_init,
+                                         const sint16 *band_min) const {
   const auto &min_disparity = option_.min_disparity;
   const auto &max_disparity = option_.max_disparity;
   assert(max_disparity > min_disparity);
@@ -219,52 +414,89 @@ void SemiGlobalMatching::CostAggregation() const {
   const auto &P1 = option_.p1;
   const auto &P2_Int = option_.p2_init;
 
-  if (option_.num_paths == 4 || option_.num_paths == 8) {
-    sgm_util::CostAggregateLeftRight(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_1_, true);
-    sgm_util::CostAggregateLeftRight(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_2_, false);
-    sgm_util::CostAggregateUpDown(img_left_, width_, height_, min_disparity,
-                                  max_disparity, P1, P2_Int, cost_init_,
-                                  cost_aggr_3_, true);
-    sgm_util::CostAggregateUpDown(img_left_, width_, height_, min_disparity,
-                                  max_disparity, P1, P2_Int, cost_init_,
-                                  cost_aggr_4_, false);
-  }
-
-  if (option_.num_paths == 8) {
-    sgm_util::CostAggregateDagonal_1(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_5_, true);
-    sgm_util::CostAggregateDagonal_1(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_6_, false);
-    sgm_util::CostAggregateDagonal_2(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_7_, true);
-    sgm_util::CostAggregateDagonal_2(img_left_, width_, height_, min_disparity,
-                                     max_disparity, P1, P2_Int, cost_init_,
-                                     cost_aggr_8_, false);
-  }
-
-  for (sint32 i = 0; i < size; i++) {
+  if (band_min) {
     if (option_.num_paths == 4 || option_.num_paths == 8) {
-      cost_aggr_[i] =
-          cost_aggr_1_[i] + cost_aggr_2_[i] + cost_aggr_3_[i] + cost_aggr_4_[i];
+      sgm_util::CostAggregateFusedBand(img_left, width_, height_, band_min,
+                                       volume_range_, P1, P2_Int, cost_init,
+                                       cost_aggr_, option_.num_paths,
+                                       option_.num_threads, fused_scratch_);
     }
+    return;
+  }
+
+  if (option_.is_fused_aggregation) {
+    if (option_.num_paths == 4 || option_.num_paths == 8) {
+      sgm_util::CostAggregateFused(img_left, width_, height_, min_disparity,
+                                   max_disparity, P1, P2_Int, cost_init,
+                                   cost_aggr_, option_.num_paths,
+                                   option_.num_threads, fused_scratch_);
+    }
+    return;
+  }
+
+  // all directions are issued from one parallel region, threads that finish
+  // their scanlines of one direction move on to the next one
+#pragma omp parallel num_threads(option_.num_threads)
+  {
+    // Lr buffer of this thread
+    uint8 *scratch =
+        path_scratch_ + omp_get_thread_num() * (volume_range_ + 2);
+
+    if (option_.num_paths == 4 || option_.num_paths == 8) {
+      sgm_util::CostAggregateLeftRight(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_1_, true,
+                                       scratch);
+      sgm_util::CostAggregateLeftRight(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_2_, false,
+                                       scratch);
+      sgm_util::CostAggregateUpDown(img_left, width_, height_, min_disparity,
+                                    max_disparity, P1, P2_Int, cost_init,
+                                    cost_aggr_3_, true, scratch);
+      sgm_util::CostAggregateUpDown(img_left, width_, height_, min_disparity,
+                                    max_disparity, P1, P2_Int, cost_init,
+                                    cost_aggr_4_, false, scratch);
+    }
+
     if (option_.num_paths == 8) {
-      cost_aggr_[i] +=
-          cost_aggr_5_[i] + cost_aggr_6_[i] + cost_aggr_7_[i] + cost_aggr_8_[i];
+      sgm_util::CostAggregateDagonal_1(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_5_, true,
+                                       scratch);
+      sgm_util::CostAggregateDagonal_1(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_6_, false,
+                                       scratch);
+      sgm_util::CostAggregateDagonal_2(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_7_, true,
+                                       scratch);
+      sgm_util::CostAggregateDagonal_2(img_left, width_, height_,
+                                       min_disparity, max_disparity, P1,
+                                       P2_Int, cost_init, cost_aggr_8_, false,
+                                       scratch);
+    }
+
+#pragma omp barrier
+
+#pragma omp for schedule(static)
+    for (sint32 i = 0; i < size; i++) {
+      if (option_.num_paths == 4 || option_.num_paths == 8) {
+        cost_aggr_[i] = cost_aggr_1_[i] + cost_aggr_2_[i] + cost_aggr_3_[i] +
+                        cost_aggr_4_[i];
+      }
+      if (option_.num_paths == 8) {
+        cost_aggr_[i] += cost_aggr_5_[i] + cost_aggr_6_[i] + cost_aggr_7_[i] +
+                         cost_aggr_8_[i];
+      }
     }
   }
 }
 
-void SemiGlobalMatching::ComputeDisparity() const {
+void SemiGlobalMatching::ComputeDisparity(const sint16 *band_min) const {
   const sint32 &min_disparity = option_.min_disparity;
-  const sint32 &max_disparity = option_.max_disparity;
-  const sint32 disp_range = max_disparity - min_disparity;
+  const sint32 disp_range = volume_range_;
   if (disp_range <= 0) {
     return;
   }
@@ -277,18 +509,22 @@ void SemiGlobalMatching::ComputeDisparity() const {
   const bool is_check_unique = option_.is_check_unique;
   const float32 uniqueness_ratio = option_.uniqueness_ratio;
 
-  std::vector<uint16> cost_local(disp_range);
-
+#pragma omp parallel for schedule(static) num_threads(option_.num_threads)
   for (sint32 i = 0; i < height; i++) {
     for (sint32 j = 0; j < width; j++) {
       uint16 min_cost = UINT16_MAX;
       uint16 sec_min_cost = UINT16_MAX;
       sint32 best_disparity = 0;
 
-      for (sint32 d = min_disparity; d < max_disparity; d++) {
-        const sint32 d_idx = d - min_disparity;
-        const auto &cost = cost_local[d_idx] =
-            cost_ptr[i * width * disp_range + j * disp_range + d_idx];
+      // disparities held by this pixel, the band or the full range
+      const sint32 min_disp =
+          band_min ? band_min[i * width + j] : min_disparity;
+      const sint32 max_disp = min_disp + disp_range;
+
+      // costs of the pixel, read in place
+      const uint16 *cost_local = cost_ptr + (i * width + j) * disp_range;
+      for (sint32 d = min_disp; d < max_disp; d++) {
+        const auto &cost = cost_local[d - min_disp];
         if (min_cost > cost) {
           min_cost = cost;
           best_disparity = d;
@@ -296,11 +532,11 @@ void SemiGlobalMatching::ComputeDisparity() const {
       }
 
       if (is_check_unique) {
-        for (sint32 d = min_disparity; d < max_disparity; d++) {
+        for (sint32 d = min_disp; d < max_disp; d++) {
           if (d == best_disparity) {
             continue;
           }
-          const auto &cost = cost_local[d - min_disparity];
+          const auto &cost = cost_local[d - min_disp];
           sec_min_cost = std::min(sec_min_cost, cost);
         }
 
@@ -311,13 +547,13 @@ void SemiGlobalMatching::ComputeDisparity() const {
         }
       }
 
-      if (best_disparity == min_disparity ||
-          best_disparity == max_disparity - 1) {
+      // a minimum at the border of a band means the band missed the match
+      if (best_disparity == min_disp || best_disparity == max_disp - 1) {
         disparity[i * width + j] = Invalid_Float;
         continue;
       }
-      const sint32 idx_1 = best_disparity - 1 - min_disparity;
-      const sint32 idx_2 = best_disparity + 1 - min_disparity;
+      const sint32 idx_1 = best_disparity - 1 - min_disp;
+      const sint32 idx_2 = best_disparity + 1 - min_disp;
       const uint16 cost_1 = cost_local[idx_1];
       const uint16 cost_2 = cost_local[idx_2];
       const uint16 denom = std::max(1, cost_1 + cost_2 - 2 * min_cost);
@@ -344,59 +580,162 @@ void SemiGlobalMatching::ComputeDisparityRight() const {
   const bool is_check_unique = option_.is_check_unique;
   const float32 uniqueness_ratio = option_.uniqueness_ratio;
 
-  std::vector<uint16> cost_local(disp_range);
+#pragma omp parallel num_threads(option_.num_threads)
+  {
+    // costs of the right pixel gathered from the left pixels
+    uint16 *cost_local = cost_scratch_ + omp_get_thread_num() * disp_range;
 
-  for (sint32 i = 0; i < height; i++) {
-    for (sint32 j = 0; j < width; j++) {
-      uint16 min_cost = UINT16_MAX;
-      uint16 sec_min_cost = UINT16_MAX;
-      sint32 best_disparity = 0;
+#pragma omp for schedule(static)
+    for (sint32 i = 0; i < height; i++) {
+      for (sint32 j = 0; j < width; j++) {
+        uint16 min_cost = UINT16_MAX;
+        uint16 sec_min_cost = UINT16_MAX;
+        sint32 best_disparity = 0;
 
-      for (sint32 d = min_disparity; d < max_disparity; d++) {
-        const sint32 d_idx = d - min_disparity;
-        const sint32 col_left = j + d;
-        if (col_left >= 0 && col_left < width) {
-          const auto &cost = cost_local[d_idx] =
-              cost_ptr[i * width * disp_range + col_left * disp_range + d_idx];
-          if (min_cost > cost) {
-            min_cost = cost;
-            best_disparity = d;
+        for (sint32 d = min_disparity; d < max_disparity; d++) {
+          const sint32 d_idx = d - min_disparity;
+          const sint32 col_left = j + d;
+          if (col_left >= 0 && col_left < width) {
+            const auto &cost = cost_local[d_idx] =
+                cost_ptr[i * width * disp_range + col_left * disp_range +
+                         d_idx];
+            if (min_cost > cost) {
+              min_cost = cost;
+              best_disparity = d;
+            }
+          } else {
+            cost_local[d_idx] = UINT16_MAX;
           }
-        } else {
-          cost_local[d_idx] = UINT16_MAX;
         }
-      }
 
-      if (is_check_unique) {
-        for (sint32 d = min_disparity; d < max_disparity; d++) {
-          if (d == best_disparity) {
+        if (is_check_unique) {
+          for (sint32 d = min_disparity; d < max_disparity; d++) {
+            if (d == best_disparity) {
+              continue;
+            }
+            const auto &cost = cost_local[d - min_disparity];
+            sec_min_cost = std::min(sec_min_cost, cost);
+          }
+
+          if (sec_min_cost - min_cost <=
+              static_cast<uint16>(min_cost * (1 - uniqueness_ratio))) {
+            disparity[i * width + j] = Invalid_Float;
             continue;
           }
-          const auto &cost = cost_local[d - min_disparity];
-          sec_min_cost = std::min(sec_min_cost, cost);
         }
 
-        if (sec_min_cost - min_cost <=
-            static_cast<uint16>(min_cost * (1 - uniqueness_ratio))) {
+        if (best_disparity == min_disparity ||
+            best_disparity == max_disparity - 1) {
           disparity[i * width + j] = Invalid_Float;
           continue;
         }
+
+        const sint32 idx_1 = best_disparity - 1 - min_disparity;
+        const sint32 idx_2 = best_disparity + 1 - min_disparity;
+        const uint16 cost_1 = cost_local[idx_1];
+        const uint16 cost_2 = cost_local[idx_2];
+        const uint16 denom = std::max(1, cost_1 + cost_2 - 2 * min_cost);
+        disparity[i * width + j] =
+            static_cast<float32>(best_disparity) +
+            static_cast<float32>(cost_1 - cost_2) / (denom * 2.0f);
       }
+    }
+  }
+}
 
-      if (best_disparity == min_disparity ||
-          best_disparity == max_disparity - 1) {
-        disparity[i * width + j] = Invalid_Float;
-        continue;
+void SemiGlobalMatching::ComputeDisparityRightBand(
+    const sint16 *band_min) const {
+  const sint32 &min_disparity = option_.min_disparity;
+  const sint32 &max_disparity = option_.max_disparity;
+  const sint32 band_range = volume_range_;
+
+  const auto disparity = disp_right_;
+  const auto cost_ptr = cost_aggr_;
+
+  const sint32 width = width_;
+  const sint32 height = height_;
+  const bool is_check_unique = option_.is_check_unique;
+  const float32 uniqueness_ratio = option_.uniqueness_ratio;
+
+#pragma omp parallel num_threads(option_.num_threads)
+  {
+    // best and second best cost of the right pixels of one row
+    uint16 *min_cost = static_cast<uint16 *>(row_scratch_) +
+                       omp_get_thread_num() * width * 4;
+    uint16 *sec_min_cost = min_cost + width;
+    sint32 *best_disparity = reinterpret_cast<sint32 *>(sec_min_cost + width);
+
+#pragma omp for schedule(static)
+    for (sint32 i = 0; i < height; i++) {
+      const sint16 *band_row = band_min + i * width;
+      const uint16 *cost_row = cost_ptr + i * width * band_range;
+
+      // cost(xr,yr,d) = cost(xr+d,yl,d), scattered from the bands of the
+      // left pixels instead of gathered over the full range
+      std::fill(min_cost, min_cost + width, UINT16_MAX);
+      std::fill(sec_min_cost, sec_min_cost + width, UINT16_MAX);
+      std::fill(best_disparity, best_disparity + width, 0);
+      for (sint32 col_left = 0; col_left < width; col_left++) {
+        const uint16 *cost = cost_row + col_left * band_range;
+        for (sint32 k = 0; k < band_range; k++) {
+          const sint32 d = band_row[col_left] + k;
+          const sint32 j = col_left - d;
+          if (j < 0 || j >= width) {
+            continue;
+          }
+          if (cost[k] < min_cost[j]) {
+            sec_min_cost[j] = min_cost[j];
+            min_cost[j] = cost[k];
+            best_disparity[j] = d;
+          } else if (cost[k] < sec_min_cost[j]) {
+            sec_min_cost[j] = cost[k];
+          }
+        }
       }
 
-      const sint32 idx_1 = best_disparity - 1 - min_disparity;
-      const sint32 idx_2 = best_disparity + 1 - min_disparity;
-      const uint16 cost_1 = cost_local[idx_1];
-      const uint16 cost_2 = cost_local[idx_2];
-      const uint16 denom = std::max(1, cost_1 + cost_2 - 2 * min_cost);
-      disparity[i * width + j] =
-          static_cast<float32>(best_disparity) +
-          static_cast<float32>(cost_1 - cost_2) / (denom * 2.0f);
+      for (sint32 j = 0; j < width; j++) {
+        if (min_cost[j] == UINT16_MAX) {
+          disparity[i * width + j] = Invalid_Float;
+          continue;
+        }
+
+        if (is_check_unique &&
+            sec_min_cost[j] - min_cost[j] <=
+                static_cast<uint16>(min_cost[j] * (1 - uniqueness_ratio))) {
+          disparity[i * width + j] = Invalid_Float;
+          continue;
+        }
+
+        const sint32 best = best_disparity[j];
+        if (best == min_disparity || best == max_disparity - 1) {
+          disparity[i * width + j] = Invalid_Float;
+          continue;
+        }
+
+        // a minimum at the border of the band of its left pixel means the
+        // band missed the match, as for the left map
+        const sint32 k = best - band_row[j + best];
+        if (k == 0 || k == band_range - 1) {
+          disparity[i * width + j] = Invalid_Float;
+          continue;
+        }
+
+        // neighbouring disparities, only held if inside the left pixel's band
+        const sint32 col_1 = j + best - 1;
+        const sint32 col_2 = j + best + 1;
+        const sint32 k_1 = (col_1 >= 0) ? best - 1 - band_row[col_1] : -1;
+        const sint32 k_2 = (col_2 < width) ? best + 1 - band_row[col_2] : -1;
+        if (k_1 < 0 || k_1 >= band_range || k_2 < 0 || k_2 >= band_range) {
+          disparity[i * width + j] = Invalid_Float;
+          continue;
+        }
+        const uint16 cost_1 = cost_row[col_1 * band_range + k_1];
+        const uint16 cost_2 = cost_row[col_2 * band_range + k_2];
+        const uint16 denom = std::max(1, cost_1 + cost_2 - 2 * min_cost[j]);
+        disparity[i * width + j] =
+            static_cast<float32>(best) +
+            static_cast<float32>(cost_1 - cost_2) / (denom * 2.0f);
+      }
     }
   }
 }
@@ -452,7 +791,8 @@ void SemiGlobalMatching::FillHolesInDispMap() {
   const sint32 width = width_;
   const sint32 height = height_;
 
-  std::vector<float32> disp_collects;
+  // at most one disparity per direction
+  float32 disp_collects[8];
 
   const float32 pi = 3.1415926f;
   float32 angle1[8] = {pi, 3 * pi / 4, pi / 2,     pi / 4,
@@ -469,17 +809,18 @@ void SemiGlobalMatching::FillHolesInDispMap() {
     if (trg_pixels.empty()) {
       continue;
     }
-    std::vector<float32> fill_disps(trg_pixels.size());
-    std::vector<std::pair<sint32, sint32>> inv_pixels;
+    float32 *fill_disps = fill_disps_;
+    memset(fill_disps, 0, height * width * sizeof(float32));
     if (k == 2) {
+      // the capacity reserved at Initialize holds every pixel
+      trg_pixels.clear();
       for (sint32 i = 0; i < height; i++) {
         for (sint32 j = 0; j < width; j++) {
           if (disp_ptr[i * width + j] == Invalid_Float) {
-            inv_pixels.emplace_back(i, j);
+            trg_pixels.emplace_back(i, j);
           }
         }
       }
-      trg_pixels = inv_pixels;
     }
 
     for (auto n = 0; n < trg_pixels.size(); n++) {
@@ -491,7 +832,7 @@ void SemiGlobalMatching::FillHolesInDispMap() {
         angle = angle2;
       }
 
-      disp_collects.clear();
+      sint32 num_collects = 0;
       for (sint32 s = 0; s < 8; s++) {
         const float32 ang = angle[s];
         const float32 sina = float32(sin(ang));
@@ -504,25 +845,33 @@ void SemiGlobalMatching::FillHolesInDispMap() {
           }
           const auto &disp = *(disp_ptr + yy * width + xx);
           if (disp != Invalid_Float) {
-            disp_collects.push_back(disp);
+            disp_collects[num_collects++] = disp;
             break;
           }
         }
       }
-      if (disp_collects.empty()) {
+      if (num_collects == 0) {
         continue;
       }
 
-      std::sort(disp_collects.begin(), disp_collects.end());
+      // insertion sort of the at most 8 disparities
+      for (sint32 a = 1; a < num_collects; a++) {
+        const float32 value = disp_collects[a];
+        sint32 b = a;
+        for (; b > 0 && disp_collects[b - 1] > value; b--) {
+          disp_collects[b] = disp_collects[b - 1];
+        }
+        disp_collects[b] = value;
+      }
 
       if (k == 0) {
-        if (disp_collects.size() > 1) {
+        if (num_collects > 1) {
           fill_disps[n] = disp_collects[1];
         } else {
           fill_disps[n] = disp_collects[0];
         }
       } else {
-        fill_disps[n] = disp_collects[disp_collects.size() / 2];
+        fill_disps[n] = disp_collects[num_collects / 2];
       }
     }
     for (auto n = 0u; n < trg_pixels.size(); n++) {
@@ -532,4 +881,28 @@ void SemiGlobalMatching::FillHolesInDispMap() {
       disp_ptr[y * width + x] = fill_disps[n];
     }
   }
-}
\ No newline at end of file
+}
+
+void SemiGlobalMatching::PostProcess(const sint16 *band_min) {
+  if (option_.is_check_lr) {
+    if (band_min) {
+      ComputeDisparityRightBand(band_min);
+    } else {
+      ComputeDisparityRight();
+    }
+    LRCheck();
+  }
+
+  if (option_.is_remove_speckles) {
+    sgm_util::RemoveSpeckles(disp_left_, width_, height_, 1,
+                             option_.min_speckle_aera, Invalid_Float,
+                             speckle_visited_, speckle_pixels_);
+  }
+
+  if (option_.is_fill_holes) {
+    FillHolesInDispMap();
+  }
+
+  sgm_util::MedianFilter(disp_left_, disp_left_, width_, height_, 3,
+                         median_window_);
+}
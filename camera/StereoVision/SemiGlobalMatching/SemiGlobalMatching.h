@@ -1,3 +1,8 @@
+#ifndef SEMI_GLOBAL_MATCHING_H_
+#define SEMI_GLOBAL_MATCHING_H_
+
+#include "../StereoCommon/aligned_arena.h"
+#include "../StereoCommon/stage_timer.h"
 #include "sgm_types.h"
 #include <vector>
 
@@ -31,12 +36,37 @@ public:
     sint32 p1;
     sint32 p2_init;
 
+    // aggregate all paths in a forward and a backward raster pass straight
+    // into the summed cost, without one cost volume per path
+    bool is_fused_aggregation;
+
+    // number of OpenMP threads used by cost computation, aggregation and
+    // disparity computation
+    sint32 num_threads;
+
+    // number of cost volumes, with 2 the cost of the next frame can be
+    // computed while the current one is aggregated (see SGMStream)
+    sint32 num_cost_slots;
+
+    // coarse-to-fine matching: number of half resolution levels matched
+    // before the full resolution image, 0 searches the full disparity range
+    // directly. Above the coarsest level every pixel only searches the
+    // 2 * band_radius + 1 disparities around the upsampled result of the level
+    // below, using the fused aggregation.
+    sint32 num_pyramid_levels;
+    sint32 band_radius;
+
+    // print the time of every stage of Match
+    bool is_print_timing;
+
     SGMOption()
         : num_paths(8), min_disparity(0), max_disparity(64),
           census_size(Census5x5), is_check_unique(true),
           uniqueness_ratio(0.95f), is_check_lr(true), lrcheck_thres(1.0f),
           is_remove_speckles(true), min_speckle_aera(20), is_fill_holes(true),
-          p1(10), p2_init(150) {}
+          p1(10), p2_init(150), is_fused_aggregation(false),
+          num_threads(1), num_cost_slots(1), num_pyramid_levels(0),
+          band_radius(4), is_print_timing(true) {}
   };
 
 public:
@@ -45,41 +75,71 @@ public:
 
   bool Match(const uint8 *img_left, const uint8 *img_right, float32 *disp_left);
 
+  // Match split into two stages for pipelining. ComputeCostVolume runs the
+  // census transform and fills cost volume `slot`, MatchCostVolume aggregates
+  // that volume and computes the disparity. The census buffers belong to the
+  // first stage and the aggregation/disparity buffers to the second, so the
+  // two may run concurrently on different slots.
+  bool ComputeCostVolume(const uint8 *img_left, const uint8 *img_right,
+                         const sint32 &slot);
+
+  bool MatchCostVolume(const uint8 *img_left, const sint32 &slot,
+                       float32 *disp_left);
+
+  // Initialize again, keeping the memory if the new layout fits into it.
+  // Initialize itself may be called repeatedly as well.
   bool Reset(const uint32 &width, const uint32 &height,
              const SGMOption &option);
 
+  // stage timings of the last Match
+  const StageTimer &GetStageTimer() const { return timer_; }
+
 private:
-  void CensusTransform() const;
+  void CensusTransform(const uint8 *img_left, const uint8 *img_right) const;
+
+  void ComputeBand(const uint8 *img_left, const uint8 *img_right,
+                   sint16 *band_min) const;
 
-  void ComputeCost() const;
+  void ComputeCost(uint8 *cost_init, const sint16 *band_min) const;
 
-  void CostAggregation() const;
+  void CostAggregation(const uint8 *img_left, const uint8 *cost_init,
+                       const sint16 *band_min) const;
 
-  void ComputeDisparity() const;
+  void ComputeDisparity(const sint16 *band_min) const;
 
   void ComputeDisparityRight() const;
 
+  void ComputeDisparityRightBand(const sint16 *band_min) const;
+
   void LRCheck();
 
   void FillHolesInDispMap();
 
+  void PostProcess(const sint16 *band_min);
+
+  sint16 *GetBand(const sint32 &slot) const;
+
   void Release();
 
 private:
   SGMOption option_;
 
+  // holds every buffer below, laid out by Initialize so that Match does not
+  // allocate
+  AlignedArena arena_;
+
   sint32 width_;
 
   sint32 height_;
 
-  const uint8 *img_left_;
-
-  const uint8 *img_right_;
-
   void *census_left_;
 
   void *census_right_;
 
+  // disparities per pixel in the cost volumes, the full range or the band
+  sint32 volume_range_;
+
+  // num_cost_slots volumes of width * height * volume_range_
   uint8 *cost_init_;
 
   uint16 *cost_aggr_;
@@ -96,8 +156,35 @@ private:
   float32 *disp_left_;
   float32 *disp_right_;
 
+  // coarse-to-fine matching, see SGMOption::num_pyramid_levels
+  SemiGlobalMatching *coarse_;
+  uint8 *img_coarse_left_;
+  uint8 *img_coarse_right_;
+  float32 *disp_coarse_;
+  // first disparity of the band of each pixel, one map per cost slot
+  sint16 *band_min_;
+
+  // Lr of one path for each thread (separate path aggregation)
+  uint8 *path_scratch_;
+  // line buffers of the fused aggregation
+  void *fused_scratch_;
+  // costs of one pixel for each thread (right disparity)
+  uint16 *cost_scratch_;
+  // best costs of one row for each thread (right disparity of a band)
+  void *row_scratch_;
+  // refinement: speckle regions, hole filling and the median window
+  uint8 *speckle_visited_;
+  sint32 *speckle_pixels_;
+  float32 *fill_disps_;
+  float32 *median_window_;
+
+  StageTimer timer_;
+
   bool is_initialized_;
 
+  // reserved for every pixel at Initialize
   std::vector<std::pair<int, int>> occlusions_;
   std::vector<std::pair<int, int>> mismatches_;
 };
+
+#endif
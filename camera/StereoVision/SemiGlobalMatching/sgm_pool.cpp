@@ -0,0 +1,77 @@
+#include "sgm_pool.h"
+
+SGMEnginePool::SGMEnginePool() {}
+
+SGMEnginePool::~SGMEnginePool() { Clear(); }
+
+bool SGMEnginePool::Initialize(const sint32 &num_engines, const sint32 &width,
+                               const sint32 &height,
+                               const SemiGlobalMatching::SGMOption &option) {
+  Clear();
+  if (num_engines <= 0) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  engines_.reserve(num_engines);
+  free_.reserve(num_engines);
+  for (sint32 n = 0; n < num_engines; n++) {
+    SemiGlobalMatching *engine = new SemiGlobalMatching();
+    engines_.push_back(engine);
+    if (!engine->Initialize(width, height, option)) {
+      // no half built pool, Acquire then fails instead of handing out the
+      // engines built so far
+      for (auto built : engines_) {
+        delete built;
+      }
+      engines_.clear();
+      free_.clear();
+      return false;
+    }
+    free_.push_back(engine);
+  }
+  return true;
+}
+
+SemiGlobalMatching *SGMEnginePool::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (engines_.empty()) {
+    return nullptr;
+  }
+  engine_free_.wait(lock, [this] { return !free_.empty(); });
+  SemiGlobalMatching *engine = free_.back();
+  free_.pop_back();
+  return engine;
+}
+
+void SGMEnginePool::Release(SemiGlobalMatching *engine) {
+  if (engine == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(engine);
+  }
+  engine_free_.notify_one();
+}
+
+bool SGMEnginePool::Match(const uint8 *img_left, const uint8 *img_right,
+                          float32 *disp_left) {
+  SemiGlobalMatching *engine = Acquire();
+  if (engine == nullptr) {
+    return false;
+  }
+  const bool ok = engine->Match(img_left, img_right, disp_left);
+  Release(engine);
+  return ok;
+}
+
+void SGMEnginePool::Clear() {
+  // all engines are expected to be released
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto engine : engines_) {
+    delete engine;
+  }
+  engines_.clear();
+  free_.clear();
+}
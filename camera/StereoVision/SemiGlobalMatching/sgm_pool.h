@@ -0,0 +1,50 @@
+#ifndef SGM_POOL_H_
+#define SGM_POOL_H_
+
+#include "SemiGlobalMatching.h"
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// A fixed set of initialized SemiGlobalMatching engines of one size and
+// option. Threads matching different pairs at the same time check an engine
+// out with Acquire and return it with Release, so no engine is set up or
+// allocated while matching.
+class SGMEnginePool {
+public:
+  SGMEnginePool();
+  ~SGMEnginePool();
+
+  // Initializes num_engines engines. option.num_threads is used by every
+  // engine, with one engine per thread it is typically 1. On failure the pool
+  // is left empty.
+  bool Initialize(const sint32 &num_engines, const sint32 &width,
+                  const sint32 &height,
+                  const SemiGlobalMatching::SGMOption &option);
+
+  // Blocks until an engine is free.
+  SemiGlobalMatching *Acquire();
+
+  void Release(SemiGlobalMatching *engine);
+
+  // Acquire, Match and Release.
+  bool Match(const uint8 *img_left, const uint8 *img_right, float32 *disp_left);
+
+  sint32 size() const { return static_cast<sint32>(engines_.size()); }
+
+private:
+  SGMEnginePool(const SGMEnginePool &);
+  SGMEnginePool &operator=(const SGMEnginePool &);
+
+  void Clear();
+
+private:
+  std::vector<SemiGlobalMatching *> engines_;
+
+  std::mutex mutex_;
+  std::condition_variable engine_free_;
+  // engines not checked out, capacity for all engines
+  std::vector<SemiGlobalMatching *> free_;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "sgm_region.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+SGMRegionMatcher::SGMRegionMatcher()
+    : width_(0), height_(0), margin_(0), num_tiles_(0),
+      is_initialized_(false) {}
+
+SGMRegionMatcher::~SGMRegionMatcher() { Release(); }
+
+bool SGMRegionMatcher::Initialize(const sint32 &width, const sint32 &height,
+                                  const SemiGlobalMatching::SGMOption &option,
+                                  const sint32 &margin) {
+  Release();
+
+  is_initialized_ = false;
+  if (width <= 0 || height <= 0 || margin < 0 ||
+      option.max_disparity <= option.min_disparity) {
+    return false;
+  }
+
+  width_ = width;
+  height_ = height;
+  margin_ = margin;
+  option_ = option;
+  option_.num_threads = std::max(option.num_threads, 1);
+
+  is_initialized_ = true;
+  return is_initialized_;
+}
+
+bool SGMRegionMatcher::Match(const uint8 *img_left, const uint8 *img_right,
+                             const std::vector<region::Rect> &regions,
+                             float32 *disp_left) {
+  if (!is_initialized_) {
+    return false;
+  }
+  if (img_left == nullptr || img_right == nullptr || disp_left == nullptr) {
+    return false;
+  }
+
+  timer_.Clear();
+
+  if (!PrepareTiles(regions)) {
+    return false;
+  }
+
+  // one tile per thread, or the tiles one after another when each engine has
+  // all threads. A team of one keeps the parallel regions of the engines
+  // active, nested teams would run on a single thread.
+  const sint32 num_threads = num_tiles_ >= option_.num_threads
+                                 ? std::min(option_.num_threads, num_tiles_)
+                                 : 1;
+  bool ok = true;
+#pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads) \
+    reduction(&& : ok)
+  for (sint32 n = 0; n < num_tiles_; n++) {
+    auto &tile = tiles_[n];
+    const auto &window = tile.window;
+    for (sint32 i = 0; i < window.height; i++) {
+      const sint32 offset = (window.y + i) * width_ + window.x;
+      memcpy(&tile.img_left[i * window.width], img_left + offset,
+             window.width * sizeof(uint8));
+      memcpy(&tile.img_right[i * window.width], img_right + offset,
+             window.width * sizeof(uint8));
+    }
+    if (!tile.sgm->Match(&tile.img_left[0], &tile.img_right[0],
+                         &tile.disp_left[0])) {
+      ok = false;
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+
+  // stitch the regions into the output in the order they were given
+  std::fill(disp_left, disp_left + width_ * height_, Invalid_Float);
+  for (sint32 n = 0; n < num_tiles_; n++) {
+    const auto &tile = tiles_[n];
+    const auto &roi = tile.roi;
+    const auto &window = tile.window;
+    for (sint32 i = 0; i < roi.height; i++) {
+      const float32 *src = &tile.disp_left[(roi.y - window.y + i) *
+                                               window.width +
+                                           roi.x - window.x];
+      memcpy(disp_left + (roi.y + i) * width_ + roi.x, src,
+             roi.width * sizeof(float32));
+    }
+  }
+
+  const double ms = timer_.Lap("matching");
+  if (option_.is_print_timing) {
+    printf("matching %d regions! timing :	%lf s\n", num_tiles_, ms / 1000.0);
+  }
+
+  return true;
+}
+
+bool SGMRegionMatcher::PrepareTiles(const std::vector<region::Rect> &regions) {
+  std::vector<region::Rect> rois;
+  for (const auto &roi : regions) {
+    const auto clipped = region::Clip(roi, width_, height_);
+    if (!clipped.Empty()) {
+      rois.push_back(clipped);
+    }
+  }
+  num_tiles_ = static_cast<sint32>(rois.size());
+  if (tiles_.size() < rois.size()) {
+    Tile tile;
+    tile.num_threads = 0;
+    tile.sgm = nullptr;
+    tiles_.resize(rois.size(), tile);
+  }
+
+  // with fewer tiles than threads the tiles are matched one after another,
+  // each engine with all threads, otherwise each engine has a single thread
+  const sint32 num_threads =
+      num_tiles_ < option_.num_threads ? option_.num_threads : 1;
+
+  for (sint32 n = 0; n < num_tiles_; n++) {
+    auto &tile = tiles_[n];
+    const auto window =
+        region::MatchWindow(rois[n], width_, height_, option_.min_disparity,
+                            option_.max_disparity, margin_);
+    const bool is_same_size = tile.sgm != nullptr &&
+                              tile.window.width == window.width &&
+                              tile.window.height == window.height &&
+                              tile.num_threads == num_threads;
+    tile.roi = rois[n];
+    tile.window = window;
+    if (is_same_size) {
+      continue;
+    }
+
+    delete tile.sgm;
+    tile.sgm = new SemiGlobalMatching();
+    tile.num_threads = num_threads;
+    auto option = option_;
+    option.num_threads = num_threads;
+    // the tiles run in parallel, Match prints one line for all of them
+    option.is_print_timing = false;
+    if (!tile.sgm->Initialize(window.width, window.height, option)) {
+      delete tile.sgm;
+      tile.sgm = nullptr;
+      return false;
+    }
+    const sint32 window_size = window.width * window.height;
+    tile.img_left.resize(window_size);
+    tile.img_right.resize(window_size);
+    tile.disp_left.resize(window_size);
+  }
+
+  return true;
+}
+
+void SGMRegionMatcher::Release() {
+  for (auto &tile : tiles_) {
+    delete tile.sgm;
+    tile.sgm = nullptr;
+  }
+  tiles_.clear();
+  num_tiles_ = 0;
+}
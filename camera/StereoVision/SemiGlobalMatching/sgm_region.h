@@ -0,0 +1,65 @@
+#ifndef SGM_REGION_H_
+#define SGM_REGION_H_
+
+#include "../StereoCommon/region.h"
+#include "../StereoCommon/stage_timer.h"
+#include "SemiGlobalMatching.h"
+#include <vector>
+
+// Matches only a list of regions of interest, e.g. obstacle boxes or the lower
+// half of the image for the ground. Each region is matched as a tile with its
+// own SemiGlobalMatching engine over region::MatchWindow and the tiles run in
+// parallel. Engines and tile buffers are kept between calls and only
+// reallocated when the size of a tile changes.
+class SGMRegionMatcher {
+public:
+  SGMRegionMatcher();
+  ~SGMRegionMatcher();
+
+  // margin is the number of pixels matched around every region so that the
+  // aggregation paths entering it have settled. With at least
+  // option.num_threads regions the tiles run in parallel with one thread
+  // each, with fewer regions they run one after another with all threads.
+  bool Initialize(const sint32 &width, const sint32 &height,
+                  const SemiGlobalMatching::SGMOption &option,
+                  const sint32 &margin = 64);
+
+  // disp_left is width x height. Pixels outside all regions are set to
+  // Invalid_Float, where regions overlap the later one is kept.
+  bool Match(const uint8 *img_left, const uint8 *img_right,
+             const std::vector<region::Rect> &regions, float32 *disp_left);
+
+  // time of the last Match
+  const StageTimer &GetStageTimer() const { return timer_; }
+
+private:
+  struct Tile {
+    region::Rect roi;
+    region::Rect window;
+    sint32 num_threads;
+    SemiGlobalMatching *sgm;
+    std::vector<uint8> img_left;
+    std::vector<uint8> img_right;
+    std::vector<float32> disp_left;
+  };
+
+  bool PrepareTiles(const std::vector<region::Rect> &regions);
+
+  void Release();
+
+private:
+  SemiGlobalMatching::SGMOption option_;
+
+  sint32 width_;
+  sint32 height_;
+  sint32 margin_;
+
+  std::vector<Tile> tiles_;
+  sint32 num_tiles_;
+
+  StageTimer timer_;
+
+  bool is_initialized_;
+};
+
+#endif
@@ -0,0 +1,209 @@
+#include "sgm_stream.h"
+#include <cstring>
+
+SGMStream::SGMStream()
+    : width_(0), height_(0), next_id_(0), is_running_(false),
+      is_stopping_(false), is_cost_done_(false), is_match_done_(false) {}
+
+SGMStream::~SGMStream() { Stop(); }
+
+bool SGMStream::Initialize(const sint32 &width, const sint32 &height,
+                           const SemiGlobalMatching::SGMOption &option,
+                           const sint32 &queue_size,
+                           const Callback &callback) {
+  Stop();
+
+  if (width <= 0 || height <= 0 || queue_size <= 0) {
+    return false;
+  }
+
+  // one cost volume is filled while the other one is aggregated
+  SemiGlobalMatching::SGMOption stream_option = option;
+  stream_option.num_cost_slots = 2;
+  if (!sgm_.Reset(width, height, stream_option)) {
+    return false;
+  }
+
+  width_ = width;
+  height_ = height;
+  callback_ = callback;
+
+  const sint32 img_size = width * height;
+  frames_.resize(queue_size);
+  free_frames_.clear();
+  for (sint32 n = 0; n < queue_size; n++) {
+    frames_[n].img_left.resize(img_size);
+    frames_[n].img_right.resize(img_size);
+    frames_[n].disp_left.resize(img_size);
+    free_frames_.push_back(n);
+  }
+  cost_queue_.clear();
+  match_queue_.clear();
+  output_queue_.clear();
+  free_slots_ = {0, 1};
+
+  next_id_ = 0;
+  is_stopping_ = false;
+  is_cost_done_ = false;
+  is_match_done_ = false;
+  is_running_ = true;
+
+  cost_thread_ = std::thread(&SGMStream::CostWorker, this);
+  match_thread_ = std::thread(&SGMStream::MatchWorker, this);
+
+  return true;
+}
+
+bool SGMStream::Push(const uint8 *img_left, const uint8 *img_right,
+                     uint64 *frame_id) {
+  if (img_left == nullptr || img_right == nullptr) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!is_running_ || is_stopping_) {
+    return false;
+  }
+  // Stop wakes a producer waiting for a buffer, nothing returns one without
+  // a consumer
+  cond_.wait(lock, [this] { return !free_frames_.empty() || is_stopping_; });
+  if (is_stopping_) {
+    return false;
+  }
+  const sint32 idx = free_frames_.front();
+  free_frames_.pop_front();
+  auto &frame = frames_[idx];
+  frame.id = next_id_++;
+  if (frame_id != nullptr) {
+    *frame_id = frame.id;
+  }
+  lock.unlock();
+
+  // the buffer is owned by the caller until it is queued
+  const sint32 img_size = width_ * height_;
+  memcpy(&frame.img_left[0], img_left, img_size * sizeof(uint8));
+  memcpy(&frame.img_right[0], img_right, img_size * sizeof(uint8));
+
+  lock.lock();
+  if (is_stopping_) {
+    // stopped while copying, the cost worker may already have drained its
+    // queue and exited, the frame would never be processed
+    free_frames_.push_back(idx);
+    cond_.notify_all();
+    return false;
+  }
+  cost_queue_.push_back(idx);
+  cond_.notify_all();
+
+  return true;
+}
+
+bool SGMStream::Pop(uint64 *frame_id, float32 *disp_left) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock,
+             [this] { return !output_queue_.empty() || is_match_done_; });
+  if (output_queue_.empty()) {
+    return false;
+  }
+  const sint32 idx = output_queue_.front();
+  output_queue_.pop_front();
+  lock.unlock();
+
+  const auto &frame = frames_[idx];
+  if (frame_id != nullptr) {
+    *frame_id = frame.id;
+  }
+  if (disp_left != nullptr) {
+    memcpy(disp_left, &frame.disp_left[0],
+           width_ * height_ * sizeof(float32));
+  }
+
+  lock.lock();
+  free_frames_.push_back(idx);
+  cond_.notify_all();
+
+  return true;
+}
+
+void SGMStream::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!is_running_) {
+      return;
+    }
+    is_stopping_ = true;
+    cond_.notify_all();
+  }
+
+  cost_thread_.join();
+  match_thread_.join();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_running_ = false;
+}
+
+void SGMStream::CostWorker() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] {
+      return (!cost_queue_.empty() && !free_slots_.empty()) ||
+             (cost_queue_.empty() && is_stopping_);
+    });
+    if (cost_queue_.empty()) {
+      break;
+    }
+    const sint32 idx = cost_queue_.front();
+    cost_queue_.pop_front();
+    const sint32 slot = free_slots_.front();
+    free_slots_.pop_front();
+    lock.unlock();
+
+    auto &frame = frames_[idx];
+    frame.slot = slot;
+    sgm_.ComputeCostVolume(&frame.img_left[0], &frame.img_right[0], slot);
+
+    lock.lock();
+    match_queue_.push_back(idx);
+    cond_.notify_all();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_cost_done_ = true;
+  cond_.notify_all();
+}
+
+void SGMStream::MatchWorker() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock,
+               [this] { return !match_queue_.empty() || is_cost_done_; });
+    if (match_queue_.empty()) {
+      break;
+    }
+    const sint32 idx = match_queue_.front();
+    match_queue_.pop_front();
+    lock.unlock();
+
+    auto &frame = frames_[idx];
+    sgm_.MatchCostVolume(&frame.img_left[0], frame.slot, &frame.disp_left[0]);
+
+    lock.lock();
+    free_slots_.push_back(frame.slot);
+    cond_.notify_all();
+    if (!callback_) {
+      output_queue_.push_back(idx);
+      continue;
+    }
+    lock.unlock();
+
+    callback_(frame.id, &frame.disp_left[0]);
+
+    lock.lock();
+    free_frames_.push_back(idx);
+    cond_.notify_all();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  is_match_done_ = true;
+  cond_.notify_all();
+}
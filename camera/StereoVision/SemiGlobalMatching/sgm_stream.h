@@ -0,0 +1,90 @@
+#ifndef SGM_STREAM_H_
+#define SGM_STREAM_H_
+
+#include "SemiGlobalMatching.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Streaming front end for SemiGlobalMatching. Rectified pairs are queued with
+// Push and processed by two worker threads: one runs census and cost of frame
+// N+1 while the other aggregates frame N and computes its disparity. All
+// frame buffers and cost volumes are allocated in Initialize and reused.
+class SGMStream {
+public:
+  typedef std::function<void(const uint64 &frame_id, const float32 *disp_left)>
+      Callback;
+
+  SGMStream();
+  ~SGMStream();
+
+  // queue_size is the number of frames that may be in flight, i.e. queued,
+  // being processed or waiting in the output queue. Without a callback the
+  // disparity maps are kept in the output queue until read with Pop. The
+  // callback is invoked on the matching thread.
+  bool Initialize(const sint32 &width, const sint32 &height,
+                  const SemiGlobalMatching::SGMOption &option,
+                  const sint32 &queue_size = 4,
+                  const Callback &callback = Callback());
+
+  // Copies the pair into a free frame buffer and queues it, blocks while all
+  // buffers are in use. Returns false, without queuing the pair, once the
+  // stream is stopping.
+  bool Push(const uint8 *img_left, const uint8 *img_right,
+            uint64 *frame_id = nullptr);
+
+  // Waits for the next disparity map (in push order) and copies it to
+  // disp_left. Returns false once the stream is stopped and drained.
+  bool Pop(uint64 *frame_id, float32 *disp_left);
+
+  // Finishes all queued frames and joins the worker threads.
+  void Stop();
+
+private:
+  struct Frame {
+    uint64 id;
+    sint32 slot;
+    std::vector<uint8> img_left;
+    std::vector<uint8> img_right;
+    std::vector<float32> disp_left;
+  };
+
+  void CostWorker();
+
+  void MatchWorker();
+
+private:
+  SemiGlobalMatching sgm_;
+
+  sint32 width_;
+  sint32 height_;
+
+  Callback callback_;
+
+  std::vector<Frame> frames_;
+
+  // indices into frames_ / cost slots of sgm_
+  std::deque<sint32> free_frames_;
+  std::deque<sint32> cost_queue_;
+  std::deque<sint32> match_queue_;
+  std::deque<sint32> output_queue_;
+  std::deque<sint32> free_slots_;
+
+  uint64 next_id_;
+
+  bool is_running_;
+  bool is_stopping_;
+  bool is_cost_done_;
+  bool is_match_done_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  std::thread cost_thread_;
+  std::thread match_thread_;
+};
+
+#endif
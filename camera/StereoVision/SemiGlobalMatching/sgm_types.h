@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <limits>
 #include <vector>
+#include "../StereoCommon/stereo_constants.h"
 using std::pair;
 using std::vector;
 using namespace std;
@@ -28,9 +29,4 @@ typedef uint64_t uint64; // 无符号64位整数
 typedef float float32;   // 单精度浮点
 typedef double float64;  // 双精度浮点
 
-constexpr auto Invalid_Float = std::numeric_limits<float>::infinity();
-
-constexpr auto Large_Float = 99999.0f;
-constexpr auto Small_Float = -99999.0f;
-
 #endif
@@ -1,86 +1,349 @@
 
 #include "sgm_util.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <new>
+#include <omp.h>
 #include <queue>
+#include <thread>
 #include <vector>
 
-void sgm_util::census_transform_5x5(const uint8 *source, uint32 *census,
-                                    const sint32 &width, const sint32 &height) {
-  if (source == nullptr || census == nullptr || width <= 5 || height <= 5) {
-    return;
-  }
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+// select SIMD code paths at runtime, see ComputeCostRow32/64
+#define SGM_CPU_DISPATCH
+#endif
 
-  for (sint32 i = 2; i < height - 2; i++) {
-    for (sint32 j = 2; j < width - 2; j++) {
-      const uint8 gray_center = source[i * width + j];
-
-      uint32 census_val = 0u;
-      for (sint32 r = -2; r <= 2; r++) {
-        for (sint32 c = -2; c <= 2; c++) {
-          census_val <<= 1;
-          const uint8 gray = source[(i + r) * width + j + c];
-          if (gray < gray_center) {
-            census_val += 1;
-          }
-        }
-      }
+uint8 sgm_util::Hamming32(const uint32 &x, const uint32 &y) {
+  return static_cast<uint8>(__builtin_popcount(x ^ y));
+}
 
-      census[i * width + j] = census_val;
+uint8 sgm_util::Hamming64(const uint64 &x, const uint64 &y) {
+  return static_cast<uint8>(__builtin_popcountll(x ^ y));
+}
+
+// Census cost of a run of disparities of one pixel: cost[k] is the Hamming
+// distance between census_left and census_right[-k].
+struct CensusCostScalar {
+  template <typename T>
+  static inline __attribute__((always_inline)) void
+  Run(const T &census_left, const T *census_right, uint8 *cost,
+      const sint32 &n) {
+    for (sint32 k = 0; k < n; k++) {
+      const uint64 diff = static_cast<uint64>(census_left ^ census_right[-k]);
+      cost[k] = static_cast<uint8>(__builtin_popcountll(diff));
     }
   }
+};
+
+// Fills one row of the cost volume. Pixel j covers disparities
+// [band_min[j], band_min[j] + disp_range), or [min_disparity, ...) for all
+// pixels when band_min is null. Disparities whose matching pixel lies outside
+// of the right image get UINT8_MAX / 2.
+template <typename T, typename Kernel>
+static inline __attribute__((always_inline)) void
+CensusCostRow(const T *census_left, const T *census_right, uint8 *cost_row,
+              const sint32 &width, const sint32 &min_disparity,
+              const sint32 &disp_range, const sint16 *band_min) {
+  for (sint32 j = 0; j < width; j++) {
+    uint8 *cost = cost_row + j * disp_range;
+    const sint32 min_disp_j = band_min ? band_min[j] : min_disparity;
+    const sint32 max_disp_j = min_disp_j + disp_range;
+    const sint32 d_lo = std::max(min_disp_j, j - width + 1);
+    const sint32 d_hi = std::min(max_disp_j, j + 1);
+    if (d_lo >= d_hi) {
+      memset(cost, UINT8_MAX / 2, disp_range * sizeof(uint8));
+      continue;
+    }
+    memset(cost, UINT8_MAX / 2, (d_lo - min_disp_j) * sizeof(uint8));
+    memset(cost + d_hi - min_disp_j, UINT8_MAX / 2,
+           (max_disp_j - d_hi) * sizeof(uint8));
+    Kernel::Run(census_left[j], census_right + j - d_lo,
+                cost + d_lo - min_disp_j, d_hi - d_lo);
+  }
 }
 
-void sgm_util::census_transform_9x7(const uint8 *source, uint64 *census,
-                                    const sint32 &width, const sint32 &height) {
-  if (source == nullptr || census == nullptr || width <= 9 || height <= 7) {
-    return;
+template <typename T>
+static void CensusCostRowGeneric(const T *census_left, const T *census_right,
+                                 uint8 *cost_row, const sint32 &width,
+                                 const sint32 &min_disparity,
+                                 const sint32 &disp_range,
+                                 const sint16 *band_min) {
+  CensusCostRow<T, CensusCostScalar>(census_left, census_right, cost_row,
+                                     width, min_disparity, disp_range,
+                                     band_min);
+}
+
+#ifdef SGM_CPU_DISPATCH
+// same as the generic version, but __builtin_popcount becomes one popcnt
+template <typename T>
+__attribute__((target("popcnt"))) static void
+CensusCostRowPopcnt(const T *census_left, const T *census_right,
+                    uint8 *cost_row, const sint32 &width,
+                    const sint32 &min_disparity, const sint32 &disp_range,
+                    const sint16 *band_min) {
+  CensusCostRow<T, CensusCostScalar>(census_left, census_right, cost_row,
+                                     width, min_disparity, disp_range,
+                                     band_min);
+}
+
+// XOR and popcount of 8 (32 bit) or 4 (64 bit) disparities at once. AVX2 has
+// no popcount instruction, bits are counted per nibble with a lookup shuffle.
+struct CensusCostAVX2 {
+  __attribute__((target("avx2"), always_inline)) static inline __m256i
+  PopCountBytes(const __m256i &v) {
+    const __m256i lut =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1,
+                         1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(v, mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                           _mm256_shuffle_epi8(lut, hi));
   }
 
-  for (sint32 i = 4; i < height - 4; i++) {
-    for (sint32 j = 3; j < width - 3; j++) {
-      const uint8 gray_center = source[i * width + j];
-
-      uint64 census_val = 0u;
-      for (sint32 r = -4; r <= 4; r++) {
-        for (sint32 c = -3; c <= 3; c++) {
-          census_val <<= 1;
-          const uint8 gray = source[(i + r) * width + j + c];
-          if (gray < gray_center) {
-            census_val += 1;
-          }
-        }
-      }
+  __attribute__((target("avx2,popcnt"))) static void
+  Run(const uint32 &census_left, const uint32 *census_right, uint8 *cost,
+      const sint32 &n) {
+    const __m256i left = _mm256_set1_epi32(static_cast<int>(census_left));
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i ones_8 = _mm256_set1_epi8(1);
+    const __m256i ones_16 = _mm256_set1_epi16(1);
+    sint32 k = 0;
+    for (; k + 8 <= n; k += 8) {
+      // census_right[-k - 7] ... census_right[-k], reversed
+      __m256i right = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(census_right - k - 7));
+      right = _mm256_permutevar8x32_epi32(right, reverse);
+      const __m256i count = PopCountBytes(_mm256_xor_si256(left, right));
+      const __m256i count_32 = _mm256_madd_epi16(
+          _mm256_maddubs_epi16(count, ones_8), ones_16);
+      // 32 -> 16 -> 8 bit, the two 128 bit lanes hold 4 costs each
+      __m256i packed = _mm256_packus_epi32(count_32, count_32);
+      packed = _mm256_packus_epi16(packed, packed);
+      const __m128i costs =
+          _mm_unpacklo_epi32(_mm256_castsi256_si128(packed),
+                             _mm256_extracti128_si256(packed, 1));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(cost + k), costs);
+    }
+    CensusCostScalar::Run(census_left, census_right - k, cost + k, n - k);
+  }
 
-      census[i * width + j] = census_val;
+  __attribute__((target("avx2,popcnt"))) static void
+  Run(const uint64 &census_left, const uint64 *census_right, uint8 *cost,
+      const sint32 &n) {
+    const __m256i left =
+        _mm256_set1_epi64x(static_cast<long long>(census_left));
+    // bytes 0 and 8 of each 128 bit lane hold the two 64 bit counts
+    const __m256i gather =
+        _mm256_setr_epi8(0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                         -1, -1, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                         -1, -1, -1, -1);
+    sint32 k = 0;
+    for (; k + 4 <= n; k += 4) {
+      // census_right[-k - 3] ... census_right[-k], reversed
+      __m256i right = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(census_right - k - 3));
+      right = _mm256_permute4x64_epi64(right, 0x1B);
+      const __m256i count = _mm256_sad_epu8(
+          PopCountBytes(_mm256_xor_si256(left, right)), _mm256_setzero_si256());
+      const __m256i packed = _mm256_shuffle_epi8(count, gather);
+      const __m128i costs =
+          _mm_unpacklo_epi16(_mm256_castsi256_si128(packed),
+                             _mm256_extracti128_si256(packed, 1));
+      const sint32 costs_4 = _mm_cvtsi128_si32(costs);
+      memcpy(cost + k, &costs_4, 4);
     }
+    CensusCostScalar::Run(census_left, census_right - k, cost + k, n - k);
+  }
+};
+
+template <typename T>
+__attribute__((target("avx2,popcnt"))) static void
+CensusCostRowAVX2(const T *census_left, const T *census_right,
+                  uint8 *cost_row, const sint32 &width,
+                  const sint32 &min_disparity, const sint32 &disp_range,
+                  const sint16 *band_min) {
+  CensusCostRow<T, CensusCostAVX2>(census_left, census_right, cost_row, width,
+                                   min_disparity, disp_range, band_min);
+}
+#endif
+
+template <typename T>
+using CensusCostRowFunc = void (*)(const T *, const T *, uint8 *,
+                                   const sint32 &, const sint32 &,
+                                   const sint32 &, const sint16 *);
+
+// picks the fastest implementation supported by the running CPU
+template <typename T> static CensusCostRowFunc<T> SelectCensusCostRow() {
+#ifdef SGM_CPU_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return CensusCostRowAVX2<T>;
+  }
+  if (__builtin_cpu_supports("popcnt")) {
+    return CensusCostRowPopcnt<T>;
   }
+#endif
+  return CensusCostRowGeneric<T>;
 }
 
-uint8 sgm_util::Hamming32(const uint32 &x, const uint32 &y) {
-  uint32 dist = 0, val = x ^ y;
+void sgm_util::ComputeCostRow32(const uint32 *census_left,
+                                const uint32 *census_right, uint8 *cost_row,
+                                const sint32 &width,
+                                const sint32 &min_disparity,
+                                const sint32 &max_disparity) {
+  static const CensusCostRowFunc<uint32> func = SelectCensusCostRow<uint32>();
+  func(census_left, census_right, cost_row, width, min_disparity,
+       max_disparity - min_disparity, nullptr);
+}
 
-  // Count the number of set bits
-  while (val) {
-    ++dist;
-    val &= val - 1;
-  }
+void sgm_util::ComputeCostRowBand32(const uint32 *census_left,
+                                    const uint32 *census_right,
+                                    uint8 *cost_row, const sint32 &width,
+                                    const sint16 *band_min,
+                                    const sint32 &band_range) {
+  static const CensusCostRowFunc<uint32> func = SelectCensusCostRow<uint32>();
+  func(census_left, census_right, cost_row, width, 0, band_range, band_min);
+}
 
-  return static_cast<uint8>(dist);
+void sgm_util::ComputeCostRow64(const uint64 *census_left,
+                                const uint64 *census_right, uint8 *cost_row,
+                                const sint32 &width,
+                                const sint32 &min_disparity,
+                                const sint32 &max_disparity) {
+  static const CensusCostRowFunc<uint64> func = SelectCensusCostRow<uint64>();
+  func(census_left, census_right, cost_row, width, min_disparity,
+       max_disparity - min_disparity, nullptr);
 }
 
-uint8 sgm_util::Hamming64(const uint64 &x, const uint64 &y) {
-  uint64 dist = 0, val = x ^ y;
+void sgm_util::ComputeCostRowBand64(const uint64 *census_left,
+                                    const uint64 *census_right,
+                                    uint8 *cost_row, const sint32 &width,
+                                    const sint16 *band_min,
+                                    const sint32 &band_range) {
+  static const CensusCostRowFunc<uint64> func = SelectCensusCostRow<uint64>();
+  func(census_left, census_right, cost_row, width, 0, band_range, band_min);
+}
+
+uint8 sgm_util::CostAggregatePixel(const uint8 *cost_init,
+                                   const uint8 *cost_last, uint8 *cost_aggr,
+                                   const sint32 &disp_range,
+                                   const uint8 &mincost_last, const sint32 &p1,
+                                   const sint32 &p2) {
+  // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) + P1,
+  // min(Lr(p-r))+P2 ) - min(Lr(p-r)), computed in 16 bits and saturated to
+  // UINT8_MAX on store
+  const uint16 P1 = static_cast<uint16>(std::min(p1, sint32(UINT8_MAX)));
+  const uint16 l4 = static_cast<uint16>(
+      mincost_last + std::min(p2, sint32(UINT16_MAX - UINT8_MAX)));
+
+  uint16 min_cost = UINT8_MAX;
+  sint32 d = 0;
+
+#if defined(__AVX2__)
+  const __m256i v_p1 = _mm256_set1_epi16(P1);
+  const __m256i v_l4 = _mm256_set1_epi16(l4);
+  const __m256i v_mincost_last = _mm256_set1_epi16(mincost_last);
+  const __m256i v_max = _mm256_set1_epi16(UINT8_MAX);
+  __m256i v_min_cost = v_max;
+  for (; d + 16 <= disp_range; d += 16) {
+    const __m256i cost = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(cost_init + d)));
+    const __m256i l1 = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(cost_last + d)));
+    const __m256i l2 = _mm256_adds_epu16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(cost_last + d - 1))),
+        v_p1);
+    const __m256i l3 = _mm256_adds_epu16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(cost_last + d + 1))),
+        v_p1);
+
+    __m256i cost_s = _mm256_min_epu16(_mm256_min_epu16(l1, l2),
+                                      _mm256_min_epu16(l3, v_l4));
+    cost_s = _mm256_adds_epu16(cost, _mm256_sub_epi16(cost_s, v_mincost_last));
+    cost_s = _mm256_min_epu16(cost_s, v_max);
+    v_min_cost = _mm256_min_epu16(v_min_cost, cost_s);
+
+    // packus works per 128-bit lane, so gather both halves into the low lane
+    const __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(cost_s, cost_s), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(cost_aggr + d),
+                     _mm256_castsi256_si128(packed));
+  }
+  const __m128i v_min_half =
+      _mm_min_epu16(_mm256_castsi256_si128(v_min_cost),
+                    _mm256_extracti128_si256(v_min_cost, 1));
+  min_cost = std::min(
+      min_cost,
+      static_cast<uint16>(_mm_extract_epi16(_mm_minpos_epu16(v_min_half), 0)));
+#endif
+
+#if defined(__SSE4_1__)
+  const __m128i v_p1_8 = _mm_set1_epi16(P1);
+  const __m128i v_l4_8 = _mm_set1_epi16(l4);
+  const __m128i v_mincost_last_8 = _mm_set1_epi16(mincost_last);
+  const __m128i v_max_8 = _mm_set1_epi16(UINT8_MAX);
+  __m128i v_min_cost_8 = v_max_8;
+  for (; d + 8 <= disp_range; d += 8) {
+    const __m128i cost = _mm_cvtepu8_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(cost_init + d)));
+    const __m128i l1 = _mm_cvtepu8_epi16(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(cost_last + d)));
+    const __m128i l2 = _mm_adds_epu16(
+        _mm_cvtepu8_epi16(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(cost_last + d - 1))),
+        v_p1_8);
+    const __m128i l3 = _mm_adds_epu16(
+        _mm_cvtepu8_epi16(_mm_loadl_epi64(
+            reinterpret_cast<const __m128i *>(cost_last + d + 1))),
+        v_p1_8);
+
+    __m128i cost_s =
+        _mm_min_epu16(_mm_min_epu16(l1, l2), _mm_min_epu16(l3, v_l4_8));
+    cost_s = _mm_adds_epu16(cost, _mm_sub_epi16(cost_s, v_mincost_last_8));
+    cost_s = _mm_min_epu16(cost_s, v_max_8);
+    v_min_cost_8 = _mm_min_epu16(v_min_cost_8, cost_s);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(cost_aggr + d),
+                     _mm_packus_epi16(cost_s, cost_s));
+  }
+  min_cost = std::min(min_cost, static_cast<uint16>(_mm_extract_epi16(
+                                     _mm_minpos_epu16(v_min_cost_8), 0)));
+#endif
+
+  for (; d < disp_range; d++) {
+    const uint16 l1 = cost_last[d];
+    const uint16 l2 = cost_last[d - 1] + P1;
+    const uint16 l3 = cost_last[d + 1] + P1;
+
+    const uint16 cost_s =
+        cost_init[d] +
+        (std::min(std::min(l1, l2), std::min(l3, l4)) - mincost_last);
 
-  // Count the number of set bits
-  while (val) {
-    ++dist;
-    val &= val - 1;
+    cost_aggr[d] = static_cast<uint8>(std::min(cost_s, uint16(UINT8_MAX)));
+    min_cost = std::min(min_cost, uint16(cost_aggr[d]));
   }
 
-  return static_cast<uint8>(dist);
+  return static_cast<uint8>(min_cost);
+}
+
+// Lr(p-r) buffer of a path function padded with UINT8_MAX, in scratch when
+// the caller provides one, otherwise in fallback
+static uint8 *PathBuffer(uint8 *scratch, const sint32 &disp_range,
+                         std::vector<uint8> *fallback) {
+  if (scratch == nullptr) {
+    fallback->assign(disp_range + 2, UINT8_MAX);
+    return &(*fallback)[0];
+  }
+  scratch[0] = UINT8_MAX;
+  scratch[disp_range + 1] = UINT8_MAX;
+  return scratch;
 }
 
 void sgm_util::CostAggregateLeftRight(const uint8 *img_data,
@@ -89,7 +352,7 @@ void sgm_util::CostAggregateLeftRight(const uint8 *img_data,
                                       const sint32 &max_disparity,
                                       const sint32 &p1, const sint32 &p2_init,
                                       const uint8 *cost_init, uint8 *cost_aggr,
-                                      bool is_forward) {
+                                      bool is_forward, uint8 *scratch) {
   assert(width > 0 && height > 0 && max_disparity > min_disparity);
 
   const sint32 disp_range = max_disparity - min_disparity;
@@ -100,6 +363,11 @@ void sgm_util::CostAggregateLeftRight(const uint8 *img_data,
 
   const sint32 direction = is_forward ? 1 : -1;
 
+  // Lr(p-r) padded with UINT8_MAX on both ends, reused for every path
+  std::vector<uint8> buffer;
+  uint8 *cost_last_path = PathBuffer(scratch, disp_range, &buffer);
+
+#pragma omp for schedule(static) nowait
   for (sint32 i = 0u; i < height; i++) {
     auto cost_init_row =
         (is_forward)
@@ -115,8 +383,6 @@ void sgm_util::CostAggregateLeftRight(const uint8 *img_data,
     uint8 gray = *img_row;
     uint8 gray_last = *img_row;
 
-    std::vector<uint8> cost_last_path(disp_range + 2, UINT8_MAX);
-
     memcpy(cost_aggr_row, cost_init_row, disp_range * sizeof(uint8));
     memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(uint8));
     cost_init_row += direction * disp_range;
@@ -124,33 +390,16 @@ void sgm_util::CostAggregateLeftRight(const uint8 *img_data,
     img_row += direction;
 
     uint8 mincost_last_path = UINT8_MAX;
-    for (auto cost : cost_last_path) {
-      mincost_last_path = std::min(mincost_last_path, cost);
+    for (sint32 d = 0; d < disp_range + 2; d++) {
+      mincost_last_path = std::min(mincost_last_path, cost_last_path[d]);
     }
 
     for (sint32 j = 0; j < width - 1; j++) {
       gray = *img_row;
-      uint8 min_cost = UINT8_MAX;
-      for (sint32 d = 0; d < disp_range; d++) {
-        // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-        // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-        const uint8 cost = cost_init_row[d];
-        const uint16 l1 = cost_last_path[d + 1];
-        const uint16 l2 = cost_last_path[d] + P1;
-        const uint16 l3 = cost_last_path[d + 2] + P1;
-        const uint16 l4 = mincost_last_path +
-                          std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
-
-        const uint8 cost_s =
-            cost +
-            static_cast<uint8>(std::min(std::min(l1, l2), std::min(l3, l4)) -
-                               mincost_last_path);
-
-        cost_aggr_row[d] = cost_s;
-        min_cost = std::min(min_cost, cost_s);
-      }
-
-      mincost_last_path = min_cost;
+      const sint32 P2 = std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
+      mincost_last_path =
+          CostAggregatePixel(cost_init_row, &cost_last_path[1], cost_aggr_row,
+                             disp_range, mincost_last_path, P1, P2);
       memcpy(&cost_last_path[1], cost_aggr_row, disp_range * sizeof(uint8));
 
       cost_init_row += direction * disp_range;
@@ -168,7 +417,7 @@ void sgm_util::CostAggregateUpDown(const uint8 *img_data, const sint32 &width,
                                    const sint32 &max_disparity,
                                    const sint32 &p1, const sint32 &p2_init,
                                    const uint8 *cost_init, uint8 *cost_aggr,
-                                   bool is_forward) {
+                                   bool is_forward, uint8 *scratch) {
   assert(width > 0 && height > 0 && max_disparity > min_disparity);
 
   const sint32 disp_range = max_disparity - min_disparity;
@@ -179,6 +428,11 @@ void sgm_util::CostAggregateUpDown(const uint8 *img_data, const sint32 &width,
 
   const sint32 direction = is_forward ? 1 : -1;
 
+  // Lr(p-r) padded with UINT8_MAX on both ends, reused for every path
+  std::vector<uint8> buffer;
+  uint8 *cost_last_path = PathBuffer(scratch, disp_range, &buffer);
+
+#pragma omp for schedule(static) nowait
   for (sint32 j = 0; j < width; j++) {
     auto cost_init_col =
         (is_forward)
@@ -194,8 +448,6 @@ void sgm_util::CostAggregateUpDown(const uint8 *img_data, const sint32 &width,
     uint8 gray = *img_col;
     uint8 gray_last = *img_col;
 
-    std::vector<uint8> cost_last_path(disp_range + 2, UINT8_MAX);
-
     memcpy(cost_aggr_col, cost_init_col, disp_range * sizeof(uint8));
     memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
     cost_init_col += direction * width * disp_range;
@@ -203,33 +455,16 @@ void sgm_util::CostAggregateUpDown(const uint8 *img_data, const sint32 &width,
     img_col += direction * width;
 
     uint8 mincost_last_path = UINT8_MAX;
-    for (auto cost : cost_last_path) {
-      mincost_last_path = std::min(mincost_last_path, cost);
+    for (sint32 d = 0; d < disp_range + 2; d++) {
+      mincost_last_path = std::min(mincost_last_path, cost_last_path[d]);
     }
 
     for (sint32 i = 0; i < height - 1; i++) {
       gray = *img_col;
-      uint8 min_cost = UINT8_MAX;
-      for (sint32 d = 0; d < disp_range; d++) {
-        // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-        // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-        const uint8 cost = cost_init_col[d];
-        const uint16 l1 = cost_last_path[d + 1];
-        const uint16 l2 = cost_last_path[d] + P1;
-        const uint16 l3 = cost_last_path[d + 2] + P1;
-        const uint16 l4 = mincost_last_path +
-                          std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
-
-        const uint8 cost_s =
-            cost +
-            static_cast<uint8>(std::min(std::min(l1, l2), std::min(l3, l4)) -
-                               mincost_last_path);
-
-        cost_aggr_col[d] = cost_s;
-        min_cost = std::min(min_cost, cost_s);
-      }
-
-      mincost_last_path = min_cost;
+      const sint32 P2 = std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
+      mincost_last_path =
+          CostAggregatePixel(cost_init_col, &cost_last_path[1], cost_aggr_col,
+                             disp_range, mincost_last_path, P1, P2);
       memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
 
       cost_init_col += direction * width * disp_range;
@@ -247,7 +482,7 @@ void sgm_util::CostAggregateDagonal_1(const uint8 *img_data,
                                       const sint32 &max_disparity,
                                       const sint32 &p1, const sint32 &p2_init,
                                       const uint8 *cost_init, uint8 *cost_aggr,
-                                      bool is_forward) {
+                                      bool is_forward, uint8 *scratch) {
   assert(width > 1 && height > 1 && max_disparity > min_disparity);
 
   const sint32 disp_range = max_disparity - min_disparity;
@@ -258,9 +493,14 @@ void sgm_util::CostAggregateDagonal_1(const uint8 *img_data,
 
   const sint32 direction = is_forward ? 1 : -1;
 
-  sint32 current_row = 0;
-  sint32 current_col = 0;
+  // Lr(p-r) padded with UINT8_MAX on both ends, reused for every path
+  std::vector<uint8> buffer;
+  uint8 *cost_last_path = PathBuffer(scratch, disp_range, &buffer);
 
+  // the path starting at column j wraps to the next row at the image border,
+  // it visits column (j +/- i) % width of row i, so paths are disjoint and
+  // can be aggregated in parallel
+#pragma omp for schedule(static) nowait
   for (sint32 j = 0; j < width; j++) {
     auto cost_init_col =
         (is_forward)
@@ -273,16 +513,14 @@ void sgm_util::CostAggregateDagonal_1(const uint8 *img_data,
     auto img_col =
         (is_forward) ? (img_data + j) : (img_data + (height - 1) * width + j);
 
-    std::vector<uint8> cost_last_path(disp_range + 2, UINT8_MAX);
-
     memcpy(cost_aggr_col, cost_init_col, disp_range * sizeof(uint8));
     memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
 
     uint8 gray = *img_col;
     uint8 gray_last = *img_col;
 
-    current_row = is_forward ? 0 : height - 1;
-    current_col = j;
+    sint32 current_row = is_forward ? 0 : height - 1;
+    sint32 current_col = j;
     if (is_forward && current_col == width - 1 && current_row < height - 1) {
       cost_init_col =
           cost_init + (current_row + direction) * width * disp_range;
@@ -304,33 +542,16 @@ void sgm_util::CostAggregateDagonal_1(const uint8 *img_data,
     }
 
     uint8 mincost_last_path = UINT8_MAX;
-    for (auto cost : cost_last_path) {
-      mincost_last_path = std::min(mincost_last_path, cost);
+    for (sint32 d = 0; d < disp_range + 2; d++) {
+      mincost_last_path = std::min(mincost_last_path, cost_last_path[d]);
     }
 
     for (sint32 i = 0; i < height - 1; i++) {
       gray = *img_col;
-      uint8 min_cost = UINT8_MAX;
-      for (sint32 d = 0; d < disp_range; d++) {
-        // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-        // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-        const uint8 cost = cost_init_col[d];
-        const uint16 l1 = cost_last_path[d + 1];
-        const uint16 l2 = cost_last_path[d] + P1;
-        const uint16 l3 = cost_last_path[d + 2] + P1;
-        const uint16 l4 = mincost_last_path +
-                          std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
-
-        const uint8 cost_s =
-            cost +
-            static_cast<uint8>(std::min(std::min(l1, l2), std::min(l3, l4)) -
-                               mincost_last_path);
-
-        cost_aggr_col[d] = cost_s;
-        min_cost = std::min(min_cost, cost_s);
-      }
-
-      mincost_last_path = min_cost;
+      const sint32 P2 = std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
+      mincost_last_path =
+          CostAggregatePixel(cost_init_col, &cost_last_path[1], cost_aggr_col,
+                             disp_range, mincost_last_path, P1, P2);
       memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
 
       current_row += direction;
@@ -367,7 +588,7 @@ void sgm_util::CostAggregateDagonal_2(const uint8 *img_data,
                                       const sint32 &max_disparity,
                                       const sint32 &p1, const sint32 &p2_init,
                                       const uint8 *cost_init, uint8 *cost_aggr,
-                                      bool is_forward) {
+                                      bool is_forward, uint8 *scratch) {
   assert(width > 1 && height > 1 && max_disparity > min_disparity);
 
   const sint32 disp_range = max_disparity - min_disparity;
@@ -378,9 +599,14 @@ void sgm_util::CostAggregateDagonal_2(const uint8 *img_data,
 
   const sint32 direction = is_forward ? 1 : -1;
 
-  sint32 current_row = 0;
-  sint32 current_col = 0;
+  // Lr(p-r) padded with UINT8_MAX on both ends, reused for every path
+  std::vector<uint8> buffer;
+  uint8 *cost_last_path = PathBuffer(scratch, disp_range, &buffer);
 
+  // the path starting at column j wraps to the next row at the image border,
+  // it visits column (j +/- i) % width of row i, so paths are disjoint and
+  // can be aggregated in parallel
+#pragma omp for schedule(static) nowait
   for (sint32 j = 0; j < width; j++) {
     auto cost_init_col =
         (is_forward)
@@ -393,16 +619,14 @@ void sgm_util::CostAggregateDagonal_2(const uint8 *img_data,
     auto img_col =
         (is_forward) ? (img_data + j) : (img_data + (height - 1) * width + j);
 
-    std::vector<uint8> cost_last_path(disp_range + 2, UINT8_MAX);
-
     memcpy(cost_aggr_col, cost_init_col, disp_range * sizeof(uint8));
     memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
 
     uint8 gray = *img_col;
     uint8 gray_last = *img_col;
 
-    current_row = is_forward ? 0 : height - 1;
-    current_col = j;
+    sint32 current_row = is_forward ? 0 : height - 1;
+    sint32 current_col = j;
     if (is_forward && current_col == 0 && current_row < height - 1) {
       cost_init_col = cost_init +
                       (current_row + direction) * width * disp_range +
@@ -424,33 +648,16 @@ void sgm_util::CostAggregateDagonal_2(const uint8 *img_data,
     }
 
     uint8 mincost_last_path = UINT8_MAX;
-    for (auto cost : cost_last_path) {
-      mincost_last_path = std::min(mincost_last_path, cost);
+    for (sint32 d = 0; d < disp_range + 2; d++) {
+      mincost_last_path = std::min(mincost_last_path, cost_last_path[d]);
     }
 
     for (sint32 i = 0; i < height - 1; i++) {
       gray = *img_col;
-      uint8 min_cost = UINT8_MAX;
-      for (sint32 d = 0; d < disp_range; d++) {
-        // Lr(p,d) = C(p,d) + min( Lr(p-r,d), Lr(p-r,d-1) + P1, Lr(p-r,d+1) +
-        // P1, min(Lr(p-r))+P2 ) - min(Lr(p-r))
-        const uint8 cost = cost_init_col[d];
-        const uint16 l1 = cost_last_path[d + 1];
-        const uint16 l2 = cost_last_path[d] + P1;
-        const uint16 l3 = cost_last_path[d + 2] + P1;
-        const uint16 l4 = mincost_last_path +
-                          std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
-
-        const uint8 cost_s =
-            cost +
-            static_cast<uint8>(std::min(std::min(l1, l2), std::min(l3, l4)) -
-                               mincost_last_path);
-
-        cost_aggr_col[d] = cost_s;
-        min_cost = std::min(min_cost, cost_s);
-      }
-
-      mincost_last_path = min_cost;
+      const sint32 P2 = std::max(P1, P2_Init / (abs(gray - gray_last) + 1));
+      mincost_last_path =
+          CostAggregatePixel(cost_init_col, &cost_last_path[1], cost_aggr_col,
+                             disp_range, mincost_last_path, P1, P2);
       memcpy(&cost_last_path[1], cost_aggr_col, disp_range * sizeof(uint8));
 
       current_row += direction;
@@ -481,31 +688,308 @@ void sgm_util::CostAggregateDagonal_2(const uint8 *img_data,
   }
 }
 
+// Lr of a band starting `shift` disparities below the current one, aligned to
+// the current band. Returns lr_last itself when the bands coincide, otherwise
+// fills `shifted` (padded like lr_last) and returns it.
+static inline const uint8 *ShiftBand(const uint8 *lr_last, const sint32 &shift,
+                                     const sint32 &disp_range,
+                                     uint8 *shifted) {
+  if (shift == 0) {
+    return lr_last;
+  }
+  // shifted[k] = lr_last[k + shift]
+  const sint32 k_begin = std::max(0, -shift);
+  const sint32 k_end = std::min(disp_range, disp_range - shift);
+  if (k_begin >= k_end) {
+    memset(shifted, UINT8_MAX, disp_range * sizeof(uint8));
+    return shifted;
+  }
+  memset(shifted, UINT8_MAX, k_begin * sizeof(uint8));
+  memcpy(shifted + k_begin, lr_last + k_begin + shift,
+         (k_end - k_begin) * sizeof(uint8));
+  memset(shifted + k_end, UINT8_MAX, (disp_range - k_end) * sizeof(uint8));
+  return shifted;
+}
+
+// Byte offsets of the buffers of CostAggregateFusedPass inside its scratch:
+// the row slots of the line paths, their minima, three padded Lr per thread
+// and the row progress counters.
+struct FusedScratchLayout {
+  FusedScratchLayout(const sint32 &width, const sint32 &height,
+                     const sint32 &disp_range, const sint32 &num_paths,
+                     const sint32 &num_threads) {
+    const sint32 line_paths = (num_paths == 8) ? 3 : 1;
+    stride = disp_range + 2;
+    line_size = width * stride;
+    num_slots = std::max(num_threads, 1) + 2;
+    pixels_per_thread = 3 * stride;
+    lines = 0;
+    mins = lines + size_t(num_slots) * line_paths * line_size;
+    pixels = mins + size_t(num_slots) * line_paths * width;
+    progress = pixels + size_t(std::max(num_threads, 1)) * pixels_per_thread;
+    progress = (progress + sizeof(std::atomic<sint32>) - 1) /
+               sizeof(std::atomic<sint32>) * sizeof(std::atomic<sint32>);
+    size = progress + size_t(height) * sizeof(std::atomic<sint32>);
+  }
+
+  sint32 stride;
+  sint32 line_size;
+  sint32 num_slots;
+  sint32 pixels_per_thread;
+  size_t lines;
+  size_t mins;
+  size_t pixels;
+  size_t progress;
+  size_t size;
+};
+
+// One raster pass of the fused aggregation. The forward pass walks top-left to
+// bottom-right and aggregates the left, up, up-left and up-right paths; the
+// backward pass walks the other way with the mirrored paths. Only Lr of the
+// previous row (and of the previous pixel for the horizontal path) is needed.
+//
+// Rows are distributed over the threads as a wavefront: a row may aggregate
+// its m-th pixel once the row before it has finished pixel m+1. Lr of the rows
+// in flight lives in a ring of row slots; since every row trails the previous
+// one by at least two pixels a slot is never overwritten while still read.
+//
+// With band_min every pixel holds its own range of disp_range disparities.
+// Lr(p-r) is then shifted onto the band of p, disparities outside of the band
+// of p-r count as UINT8_MAX.
+static void CostAggregateFusedPass(const uint8 *img_data, const sint32 &width,
+                                   const sint32 &height,
+                                   const sint32 &disp_range,
+                                   const sint16 *band_min, const sint32 &p1,
+                                   const sint32 &p2_init,
+                                   const uint8 *cost_init, uint16 *cost_aggr,
+                                   const sint32 &num_paths,
+                                   const sint32 &num_threads, bool is_forward,
+                                   void *scratch) {
+  // number of paths kept in line buffers (vertical and both diagonals)
+  const sint32 line_paths = (num_paths == 8) ? 3 : 1;
+  // column offset of the predecessor of each line path
+  const sint32 direction = is_forward ? 1 : -1;
+  const sint32 line_offset[3] = {0, -direction, direction};
+
+  // Lr padded with UINT8_MAX on both ends, see CostAggregatePixel
+  const FusedScratchLayout layout(width, height, disp_range, num_paths,
+                                  num_threads);
+  const sint32 stride = layout.stride;
+  const sint32 line_size = layout.line_size;
+  const sint32 num_slots = layout.num_slots;
+  std::vector<uint8> buffer;
+  if (scratch == nullptr) {
+    buffer.resize(layout.size);
+    scratch = &buffer[0];
+  }
+  uint8 *const base = static_cast<uint8 *>(scratch);
+  uint8 *const lines = base + layout.lines;
+  uint8 *const mins = base + layout.mins;
+  memset(lines, UINT8_MAX, layout.mins - layout.lines);
+  memset(mins, UINT8_MAX, layout.pixels - layout.mins);
+
+  // number of finished pixels of each row
+  std::atomic<sint32> *const progress =
+      reinterpret_cast<std::atomic<sint32> *>(base + layout.progress);
+  for (sint32 i = 0; i < height; i++) {
+    new (&progress[i]) std::atomic<sint32>(0);
+  }
+
+#pragma omp parallel num_threads(num_threads)
+  {
+    // Lr of the previous and the current pixel and the shifted band
+    uint8 *pixel_last = base + layout.pixels +
+                        omp_get_thread_num() * layout.pixels_per_thread;
+    uint8 *pixel_cur = pixel_last + stride;
+    uint8 *const band_shifted = pixel_cur + stride;
+    memset(pixel_last, UINT8_MAX, layout.pixels_per_thread);
+
+#pragma omp for schedule(static, 1)
+    for (sint32 n = 0; n < height; n++) {
+      const sint32 i = is_forward ? n : height - 1 - n;
+      const uint8 *img_row = img_data + i * width;
+      const uint8 *img_row_last = img_row - direction * width;
+      const sint16 *band_row = band_min ? band_min + i * width : nullptr;
+      const sint16 *band_row_last = band_row ? band_row - direction * width
+                                             : nullptr;
+
+      const sint32 slot = n % num_slots;
+      const sint32 slot_last = (n + num_slots - 1) % num_slots;
+      uint8 *line_cur = &lines[slot * line_paths * line_size];
+      const uint8 *line_last = &lines[slot_last * line_paths * line_size];
+      uint8 *min_cur = &mins[slot * line_paths * width];
+      const uint8 *min_last = &mins[slot_last * line_paths * width];
+
+      uint8 min_pixel_last = UINT8_MAX;
+      for (sint32 m = 0; m < width; m++) {
+        const sint32 j = is_forward ? m : width - 1 - m;
+        const uint8 gray = img_row[j];
+        const uint8 *cost_init_pixel =
+            cost_init + (i * width + j) * disp_range;
+        uint16 *cost_aggr_pixel = cost_aggr + (i * width + j) * disp_range;
+
+        if (n > 0) {
+          const sint32 needed = std::min(m + 2, width);
+          while (progress[n - 1].load(std::memory_order_acquire) < needed) {
+            std::this_thread::yield();
+          }
+        }
+
+        // horizontal path
+        uint8 *lr = &pixel_cur[1];
+        uint8 min_lr;
+        if (m == 0) {
+          memcpy(lr, cost_init_pixel, disp_range * sizeof(uint8));
+          min_lr = *std::min_element(lr, lr + disp_range);
+        } else {
+          const uint8 gray_last = img_row[j - direction];
+          const sint32 P2 =
+              std::max(p1, p2_init / (abs(gray - gray_last) + 1));
+          const uint8 *lr_last = &pixel_last[1];
+          if (band_row) {
+            lr_last = ShiftBand(lr_last, band_row[j] - band_row[j - direction],
+                                disp_range, &band_shifted[1]);
+          }
+          min_lr = sgm_util::CostAggregatePixel(cost_init_pixel, lr_last, lr,
+                                                disp_range, min_pixel_last, p1,
+                                                P2);
+        }
+        min_pixel_last = min_lr;
+        std::swap(pixel_last, pixel_cur);
+
+        if (is_forward) {
+          for (sint32 d = 0; d < disp_range; d++) {
+            cost_aggr_pixel[d] = lr[d];
+          }
+        } else {
+          for (sint32 d = 0; d < disp_range; d++) {
+            cost_aggr_pixel[d] += lr[d];
+          }
+        }
+
+        // paths coming from the previous row
+        for (sint32 k = 0; k < line_paths; k++) {
+          const sint32 j_last = j + line_offset[k];
+          lr = &line_cur[k * line_size + j * stride + 1];
+          if (n == 0 || j_last < 0 || j_last >= width) {
+            memcpy(lr, cost_init_pixel, disp_range * sizeof(uint8));
+            min_lr = *std::min_element(lr, lr + disp_range);
+          } else {
+            const uint8 gray_last = img_row_last[j_last];
+            const sint32 P2 =
+                std::max(p1, p2_init / (abs(gray - gray_last) + 1));
+            const uint8 *lr_last =
+                &line_last[k * line_size + j_last * stride + 1];
+            if (band_row) {
+              lr_last = ShiftBand(lr_last, band_row[j] - band_row_last[j_last],
+                                  disp_range, &band_shifted[1]);
+            }
+            min_lr = sgm_util::CostAggregatePixel(
+                cost_init_pixel, lr_last, lr, disp_range,
+                min_last[k * width + j_last], p1, P2);
+          }
+          min_cur[k * width + j] = min_lr;
+
+          for (sint32 d = 0; d < disp_range; d++) {
+            cost_aggr_pixel[d] += lr[d];
+          }
+        }
+
+        progress[n].store(m + 1, std::memory_order_release);
+      }
+    }
+  }
+}
+
+void sgm_util::CostAggregateFused(const uint8 *img_data, const sint32 &width,
+                                  const sint32 &height,
+                                  const sint32 &min_disparity,
+                                  const sint32 &max_disparity,
+                                  const sint32 &p1, const sint32 &p2_init,
+                                  const uint8 *cost_init, uint16 *cost_aggr,
+                                  const sint32 &num_paths,
+                                  const sint32 &num_threads, void *scratch) {
+  assert(width > 0 && height > 0 && max_disparity > min_disparity);
+  assert(num_paths == 4 || num_paths == 8);
+
+  const sint32 disp_range = max_disparity - min_disparity;
+
+  CostAggregateFusedPass(img_data, width, height, disp_range, nullptr, p1,
+                         p2_init, cost_init, cost_aggr, num_paths, num_threads,
+                         true, scratch);
+  CostAggregateFusedPass(img_data, width, height, disp_range, nullptr, p1,
+                         p2_init, cost_init, cost_aggr, num_paths, num_threads,
+                         false, scratch);
+}
+
+void sgm_util::CostAggregateFusedBand(
+    const uint8 *img_data, const sint32 &width, const sint32 &height,
+    const sint16 *band_min, const sint32 &band_range, const sint32 &p1,
+    const sint32 &p2_init, const uint8 *cost_init, uint16 *cost_aggr,
+    const sint32 &num_paths, const sint32 &num_threads, void *scratch) {
+  assert(width > 0 && height > 0 && band_range > 0 && band_min != nullptr);
+  assert(num_paths == 4 || num_paths == 8);
+
+  CostAggregateFusedPass(img_data, width, height, band_range, band_min, p1,
+                         p2_init, cost_init, cost_aggr, num_paths, num_threads,
+                         true, scratch);
+  CostAggregateFusedPass(img_data, width, height, band_range, band_min, p1,
+                         p2_init, cost_init, cost_aggr, num_paths, num_threads,
+                         false, scratch);
+}
+
+size_t sgm_util::CostAggregateFusedScratchSize(const sint32 &width,
+                                               const sint32 &height,
+                                               const sint32 &disp_range,
+                                               const sint32 &num_paths,
+                                               const sint32 &num_threads) {
+  return FusedScratchLayout(width, height, disp_range, num_paths, num_threads)
+      .size;
+}
+
+void sgm_util::DownsampleHalf(const uint8 *in, uint8 *out,
+                              const sint32 &width, const sint32 &height) {
+  const sint32 width_half = width / 2;
+  const sint32 height_half = height / 2;
+  for (sint32 i = 0; i < height_half; i++) {
+    const uint8 *row_0 = in + 2 * i * width;
+    const uint8 *row_1 = row_0 + width;
+    for (sint32 j = 0; j < width_half; j++) {
+      const sint32 sum = row_0[2 * j] + row_0[2 * j + 1] + row_1[2 * j] +
+                         row_1[2 * j + 1];
+      out[i * width_half + j] = static_cast<uint8>((sum + 2) / 4);
+    }
+  }
+}
+
 void sgm_util::MedianFilter(const float32 *in, float32 *out,
                             const sint32 &width, const sint32 &height,
                             const sint32 wnd_size) {
-  const sint32 radius = wnd_size / 2;
-  const sint32 size = wnd_size * wnd_size;
+  std::vector<float32> wnd_data(wnd_size * wnd_size);
+  MedianFilter(in, out, width, height, wnd_size, &wnd_data[0]);
+}
 
-  std::vector<float32> wnd_data;
-  wnd_data.reserve(size);
+void sgm_util::MedianFilter(const float32 *in, float32 *out,
+                            const sint32 &width, const sint32 &height,
+                            const sint32 wnd_size, float32 *wnd_data) {
+  const sint32 radius = wnd_size / 2;
 
   for (sint32 i = 0; i < height; i++) {
     for (sint32 j = 0; j < width; j++) {
-      wnd_data.clear();
+      sint32 size = 0;
 
       for (sint32 r = -radius; r <= radius; r++) {
         for (sint32 c = -radius; c <= radius; c++) {
           const sint32 row = i + r;
           const sint32 col = j + c;
           if (row >= 0 && row < height && col >= 0 && col < width) {
-            wnd_data.push_back(in[row * width + col]);
+            wnd_data[size++] = in[row * width + col];
           }
         }
       }
 
-      std::sort(wnd_data.begin(), wnd_data.end());
-      out[i * width + j] = wnd_data[wnd_data.size() / 2];
+      std::sort(wnd_data, wnd_data + size);
+      out[i * width + j] = wnd_data[size / 2];
     }
   }
 }
@@ -519,24 +1003,41 @@ void sgm_util::RemoveSpeckles(float32 *disparity_map, const sint32 &width,
     return;
   }
 
-  std::vector<bool> visited(uint32(width * height), false);
+  std::vector<uint8> visited(uint32(width * height));
+  std::vector<sint32> pixels(uint32(width * height));
+  RemoveSpeckles(disparity_map, width, height, diff_insame, min_speckle_aera,
+                 invalid_val, &visited[0], &pixels[0]);
+}
+
+void sgm_util::RemoveSpeckles(float32 *disparity_map, const sint32 &width,
+                              const sint32 &height, const sint32 &diff_insame,
+                              const uint32 &min_speckle_aera,
+                              const float32 &invalid_val, uint8 *visited,
+                              sint32 *pixels) {
+  assert(width > 0 && height > 0);
+  if (width < 0 || height < 0) {
+    return;
+  }
+
+  // pixels holds the region grown from the current seed in breadth first
+  // order, as linear indices
+  memset(visited, 0, width * height * sizeof(uint8));
   for (sint32 i = 0; i < height; i++) {
     for (sint32 j = 0; j < width; j++) {
       if (visited[i * width + j] ||
           disparity_map[i * width + j] == invalid_val) {
         continue;
       }
-      std::vector<std::pair<sint32, sint32>> vec;
-      vec.emplace_back(i, j);
-      visited[i * width + j] = true;
+      uint32 count = 0;
+      pixels[count++] = i * width + j;
+      visited[i * width + j] = 1;
       uint32 cur = 0;
       uint32 next = 0;
       do {
-        next = vec.size();
+        next = count;
         for (uint32 k = cur; k < next; k++) {
-          const auto &pixel = vec[k];
-          const sint32 row = pixel.first;
-          const sint32 col = pixel.second;
+          const sint32 row = pixels[k] / width;
+          const sint32 col = pixels[k] % width;
           const auto &disp_base = disparity_map[row * width + col];
           for (int r = -1; r <= 1; r++) {
             for (int c = -1; c <= 1; c++) {
@@ -550,19 +1051,19 @@ void sgm_util::RemoveSpeckles(float32 *disparity_map, const sint32 &width,
                     (disparity_map[i * width + j] != invalid_val) &&
                     abs(disparity_map[rowr * width + colc] - disp_base) <=
                         diff_insame) {
-                  vec.emplace_back(rowr, colc);
-                  visited[rowr * width + colc] = true;
+                  pixels[count++] = rowr * width + colc;
+                  visited[rowr * width + colc] = 1;
                 }
               }
             }
           }
         }
         cur = next;
-      } while (next < vec.size());
+      } while (next < count);
 
-      if (vec.size() < min_speckle_aera) {
-        for (auto &pix : vec) {
-          disparity_map[pix.first * width + pix.second] = invalid_val;
+      if (count < min_speckle_aera) {
+        for (uint32 k = 0; k < count; k++) {
+          disparity_map[pixels[k]] = invalid_val;
         }
       }
     }
@@ -11,41 +11,124 @@
 
 namespace sgm_util {
 
-void census_transform_5x5(const uint8 *source, uint32 *census,
-                          const sint32 &width, const sint32 &height);
-void census_transform_9x7(const uint8 *source, uint64 *census,
-                          const sint32 &width, const sint32 &height);
 uint8 Hamming32(const uint32 &x, const uint32 &y);
 uint8 Hamming64(const uint64 &x, const uint64 &y);
 
+// Census cost of one image row for all disparities, written to cost_row
+// (width * disp_range). Disparities without a match in the right image get
+// UINT8_MAX / 2. The implementation (AVX2, popcnt or generic) is selected at
+// runtime from the CPU features.
+void ComputeCostRow32(const uint32 *census_left, const uint32 *census_right,
+                      uint8 *cost_row, const sint32 &width,
+                      const sint32 &min_disparity, const sint32 &max_disparity);
+void ComputeCostRow64(const uint64 *census_left, const uint64 *census_right,
+                      uint8 *cost_row, const sint32 &width,
+                      const sint32 &min_disparity, const sint32 &max_disparity);
+
+// Same for a sparse cost volume, pixel j holds the band_range disparities
+// starting at band_min[j].
+void ComputeCostRowBand32(const uint32 *census_left,
+                          const uint32 *census_right, uint8 *cost_row,
+                          const sint32 &width, const sint16 *band_min,
+                          const sint32 &band_range);
+void ComputeCostRowBand64(const uint64 *census_left,
+                          const uint64 *census_right, uint8 *cost_row,
+                          const sint32 &width, const sint16 *band_min,
+                          const sint32 &band_range);
+
+// One step of path aggregation for all disparities of a pixel. cost_last
+// points to Lr(p-r,0), cost_last[-1] and cost_last[disp_range] must be
+// readable and hold UINT8_MAX. Returns min(Lr(p)). Uses AVX2/SSE4.1 when the
+// build enables them.
+uint8 CostAggregatePixel(const uint8 *cost_init, const uint8 *cost_last,
+                         uint8 *cost_aggr, const sint32 &disp_range,
+                         const uint8 &mincost_last, const sint32 &p1,
+                         const sint32 &p2);
+
+// The path aggregations below split their scanlines among the threads of the
+// enclosing OpenMP parallel region without a closing barrier, so several
+// directions can be issued from one region and run concurrently. Outside of a
+// parallel region they run on the calling thread. scratch, if given, holds
+// disp_range + 2 bytes private to the calling thread, otherwise a buffer is
+// allocated per call.
 void CostAggregateLeftRight(const uint8 *img_data, const sint32 &width,
                             const sint32 &height, const sint32 &min_disparity,
                             const sint32 &max_disparity, const sint32 &p1,
                             const sint32 &p2_init, const uint8 *cost_init,
-                            uint8 *cost_aggr, bool is_forward = true);
+                            uint8 *cost_aggr, bool is_forward = true,
+                            uint8 *scratch = nullptr);
 
 void CostAggregateUpDown(const uint8 *img_data, const sint32 &width,
                          const sint32 &height, const sint32 &min_disparity,
                          const sint32 &max_disparity, const sint32 &p1,
                          const sint32 &p2_init, const uint8 *cost_init,
-                         uint8 *cost_aggr, bool is_forward = true);
+                         uint8 *cost_aggr, bool is_forward = true,
+                         uint8 *scratch = nullptr);
 
 void CostAggregateDagonal_1(const uint8 *img_data, const sint32 &width,
                             const sint32 &height, const sint32 &min_disparity,
                             const sint32 &max_disparity, const sint32 &p1,
                             const sint32 &p2_init, const uint8 *cost_init,
-                            uint8 *cost_aggr, bool is_forward = true);
+                            uint8 *cost_aggr, bool is_forward = true,
+                            uint8 *scratch = nullptr);
 
 void CostAggregateDagonal_2(const uint8 *img_data, const sint32 &width,
                             const sint32 &height, const sint32 &min_disparity,
                             const sint32 &max_disparity, const sint32 &p1,
                             const sint32 &p2_init, const uint8 *cost_init,
-                            uint8 *cost_aggr, bool is_forward = true);
+                            uint8 *cost_aggr, bool is_forward = true,
+                            uint8 *scratch = nullptr);
+
+// Single-pass 4/8-path aggregation summed straight into cost_aggr. Runs the
+// forward paths in one raster pass and the backward paths in a reverse pass,
+// keeping only line buffers for the previous row. Diagonal paths start at the
+// image border instead of wrapping around like CostAggregateDagonal_1/2.
+// Rows are processed as a wavefront on num_threads threads. scratch, if given,
+// holds CostAggregateFusedScratchSize bytes aligned to 8 bytes, otherwise the
+// line buffers are allocated per call.
+void CostAggregateFused(const uint8 *img_data, const sint32 &width,
+                        const sint32 &height, const sint32 &min_disparity,
+                        const sint32 &max_disparity, const sint32 &p1,
+                        const sint32 &p2_init, const uint8 *cost_init,
+                        uint16 *cost_aggr, const sint32 &num_paths,
+                        const sint32 &num_threads = 1, void *scratch = nullptr);
+
+// CostAggregateFused on a sparse cost volume where pixel p holds the
+// band_range disparities starting at band_min[p].
+void CostAggregateFusedBand(const uint8 *img_data, const sint32 &width,
+                            const sint32 &height, const sint16 *band_min,
+                            const sint32 &band_range, const sint32 &p1,
+                            const sint32 &p2_init, const uint8 *cost_init,
+                            uint16 *cost_aggr, const sint32 &num_paths,
+                            const sint32 &num_threads = 1,
+                            void *scratch = nullptr);
+
+// Size of the scratch memory of CostAggregateFused/Band in bytes.
+size_t CostAggregateFusedScratchSize(const sint32 &width,
+                                     const sint32 &height,
+                                     const sint32 &disp_range,
+                                     const sint32 &num_paths,
+                                     const sint32 &num_threads);
+
+// Halves an image by averaging 2x2 blocks, out is (width/2) x (height/2).
+void DownsampleHalf(const uint8 *in, uint8 *out, const sint32 &width,
+                    const sint32 &height);
 
 void MedianFilter(const float32 *in, float32 *out, const sint32 &width,
                   const sint32 &height, const sint32 wnd_size);
 
+// Same with the window gathered in wnd_data (wnd_size * wnd_size).
+void MedianFilter(const float32 *in, float32 *out, const sint32 &width,
+                  const sint32 &height, const sint32 wnd_size,
+                  float32 *wnd_data);
+
 void RemoveSpeckles(float32 *disparity_map, const sint32 &width,
                     const sint32 &height, const sint32 &diff_insame,
                     const uint32 &min_speckle_aera, const float32 &invalid_val);
+
+// Same with caller provided scratch, visited and pixels of width * height.
+void RemoveSpeckles(float32 *disparity_map, const sint32 &width,
+                    const sint32 &height, const sint32 &diff_insame,
+                    const uint32 &min_speckle_aera, const float32 &invalid_val,
+                    uint8 *visited, sint32 *pixels);
 } // namespace sgm_util
\ No newline at end of file
@@ -0,0 +1,44 @@
+#include "aligned_arena.h"
+#include <cstdlib>
+#include <cstring>
+
+AlignedArena::AlignedArena()
+    : raw_(nullptr), data_(nullptr), size_(0), capacity_(0) {}
+
+AlignedArena::~AlignedArena() { Release(); }
+
+void AlignedArena::Clear() { size_ = 0; }
+
+size_t AlignedArena::Reserve(const size_t &bytes) {
+  const size_t offset = size_;
+  size_ += (bytes + kAlignment - 1) / kAlignment * kAlignment;
+  return offset;
+}
+
+bool AlignedArena::Allocate() {
+  if (size_ > capacity_) {
+    free(raw_);
+    raw_ = malloc(size_ + kAlignment);
+    if (raw_ == nullptr) {
+      data_ = nullptr;
+      capacity_ = 0;
+      return false;
+    }
+    const uintptr_t address = reinterpret_cast<uintptr_t>(raw_);
+    data_ = reinterpret_cast<uint8_t *>((address + kAlignment - 1) /
+                                        kAlignment * kAlignment);
+    capacity_ = size_;
+  }
+  if (size_ > 0) {
+    memset(data_, 0, size_);
+  }
+  return true;
+}
+
+void AlignedArena::Release() {
+  free(raw_);
+  raw_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef STEREO_COMMON_ALIGNED_ARENA_H_
+#define STEREO_COMMON_ALIGNED_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// One cache line aligned allocation carved into blocks. The blocks are laid
+// out with Reserve and become usable after Allocate, which only reallocates
+// when the layout outgrew the memory held so far. An engine that is
+// re-initialized with the same or a smaller size keeps its memory.
+class AlignedArena {
+public:
+  static const size_t kAlignment = 64;
+
+  AlignedArena();
+  ~AlignedArena();
+
+  // Forgets the layout, the memory is kept for the next Allocate.
+  void Clear();
+
+  // Appends a block of `bytes` to the layout and returns its offset.
+  size_t Reserve(const size_t &bytes);
+
+  // Makes the blocks reserved since Clear available, zero filled.
+  bool Allocate();
+
+  // Frees the memory.
+  void Release();
+
+  template <typename T> T *Get(const size_t &offset) const {
+    return static_cast<T *>(static_cast<void *>(data_ + offset));
+  }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+
+private:
+  AlignedArena(const AlignedArena &);
+  AlignedArena &operator=(const AlignedArena &);
+
+  void *raw_;
+  uint8_t *data_;
+  size_t size_;
+  size_t capacity_;
+};
+
+#endif
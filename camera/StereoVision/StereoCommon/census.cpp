@@ -0,0 +1,135 @@
+#include "census.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// scalar census of one pixel
+template <typename T, int kRows, int kCols>
+inline T CensusPixel(const uint8_t *source, const int &width, const int &i,
+                     const int &j) {
+  const uint8_t gray_center = source[i * width + j];
+  T census_val = 0u;
+  for (int r = -kRows / 2; r <= kRows / 2; r++) {
+    for (int c = -kCols / 2; c <= kCols / 2; c++) {
+      census_val <<= 1;
+      const uint8_t gray = source[(i + r) * width + j + c];
+      if (gray < gray_center) {
+        census_val += 1;
+      }
+    }
+  }
+  return census_val;
+}
+
+#if defined(__SSE2__)
+// Census bits of 16 centre pixels as byte planes: plane 0 holds the 8 least
+// significant bits of each pixel, the last plane the remaining high bits.
+// Each neighbour is compared against all 16 centres at once and its bit is
+// shifted into the byte lane of every pixel.
+template <int kRows, int kCols>
+inline void CensusPlanes16(const uint8_t *source, const int &width,
+                           const int &i, const int &j, __m128i *planes) {
+  const int num_bits = kRows * kCols;
+  const int num_planes = (num_bits + 7) / 8;
+  const __m128i sign = _mm_set1_epi8(static_cast<char>(0x80));
+  const __m128i center = _mm_xor_si128(
+      _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(source + i * width + j)),
+      sign);
+
+  // the first neighbour is the most significant bit, so the top plane
+  // takes the num_bits % 8 leading neighbours
+  int plane = num_planes - 1;
+  int bits_left = (num_bits % 8 == 0) ? 8 : num_bits % 8;
+  __m128i acc = _mm_setzero_si128();
+  for (int r = -kRows / 2; r <= kRows / 2; r++) {
+    const uint8_t *row = source + (i + r) * width + j;
+    for (int c = -kCols / 2; c <= kCols / 2; c++) {
+      const __m128i gray = _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + c)), sign);
+      // unsigned gray < center, 0xff or 0 per pixel
+      const __m128i is_less = _mm_cmplt_epi8(gray, center);
+      // acc = (acc << 1) | bit
+      acc = _mm_sub_epi8(_mm_add_epi8(acc, acc), is_less);
+      if (--bits_left == 0) {
+        planes[plane--] = acc;
+        acc = _mm_setzero_si128();
+        bits_left = 8;
+      }
+    }
+  }
+}
+
+void StoreCensus16(const __m128i *planes, uint32_t *census) {
+  const __m128i lo_lo = _mm_unpacklo_epi8(planes[0], planes[1]);
+  const __m128i lo_hi = _mm_unpackhi_epi8(planes[0], planes[1]);
+  const __m128i hi_lo = _mm_unpacklo_epi8(planes[2], planes[3]);
+  const __m128i hi_hi = _mm_unpackhi_epi8(planes[2], planes[3]);
+  __m128i *dst = reinterpret_cast<__m128i *>(census);
+  _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(lo_lo, hi_lo));
+  _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo_lo, hi_lo));
+  _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(lo_hi, hi_hi));
+  _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(lo_hi, hi_hi));
+}
+
+void StoreCensus16(const __m128i *planes, uint64_t *census) {
+  __m128i words[4][2];
+  for (int k = 0; k < 4; k++) {
+    words[k][0] = _mm_unpacklo_epi8(planes[2 * k], planes[2 * k + 1]);
+    words[k][1] = _mm_unpackhi_epi8(planes[2 * k], planes[2 * k + 1]);
+  }
+  __m128i *dst = reinterpret_cast<__m128i *>(census);
+  for (int h = 0; h < 2; h++) {
+    // 32 bit halves of pixels 8h .. 8h+7
+    const __m128i lo_0 = _mm_unpacklo_epi16(words[0][h], words[1][h]);
+    const __m128i lo_1 = _mm_unpackhi_epi16(words[0][h], words[1][h]);
+    const __m128i hi_0 = _mm_unpacklo_epi16(words[2][h], words[3][h]);
+    const __m128i hi_1 = _mm_unpackhi_epi16(words[2][h], words[3][h]);
+    _mm_storeu_si128(dst + 4 * h + 0, _mm_unpacklo_epi32(lo_0, hi_0));
+    _mm_storeu_si128(dst + 4 * h + 1, _mm_unpackhi_epi32(lo_0, hi_0));
+    _mm_storeu_si128(dst + 4 * h + 2, _mm_unpacklo_epi32(lo_1, hi_1));
+    _mm_storeu_si128(dst + 4 * h + 3, _mm_unpackhi_epi32(lo_1, hi_1));
+  }
+}
+#endif
+
+template <typename T, int kRows, int kCols>
+void CensusTransform(const uint8_t *source, T *census, const int &width,
+                     const int &height) {
+  const int radius_r = kRows / 2;
+  const int radius_c = kCols / 2;
+  for (int i = radius_r; i < height - radius_r; i++) {
+    int j = radius_c;
+#if defined(__SSE2__)
+    __m128i planes[sizeof(T)];
+    for (; j + 16 <= width - radius_c; j += 16) {
+      CensusPlanes16<kRows, kCols>(source, width, i, j, planes);
+      StoreCensus16(planes, census + i * width + j);
+    }
+#endif
+    for (; j < width - radius_c; j++) {
+      census[i * width + j] = CensusPixel<T, kRows, kCols>(source, width, i, j);
+    }
+  }
+}
+
+} // namespace
+
+void census::Transform5x5(const uint8_t *source, uint32_t *census,
+                          const int &width, const int &height) {
+  if (source == nullptr || census == nullptr || width <= 5 || height <= 5) {
+    return;
+  }
+  CensusTransform<uint32_t, 5, 5>(source, census, width, height);
+}
+
+void census::Transform9x7(const uint8_t *source, uint64_t *census,
+                          const int &width, const int &height) {
+  if (source == nullptr || census == nullptr || width <= 9 || height <= 7) {
+    return;
+  }
+  CensusTransform<uint64_t, 9, 7>(source, census, width, height);
+}
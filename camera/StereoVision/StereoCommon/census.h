@@ -0,0 +1,22 @@
+#ifndef STEREO_COMMON_CENSUS_H_
+#define STEREO_COMMON_CENSUS_H_
+
+#include <cstdint>
+
+// Census transforms shared by SemiGlobalMatching and ADCensusStereo. Bit k
+// (counted from the most significant used bit) is set when the k-th pixel of
+// the window in raster order is darker than the centre pixel. Pixels whose
+// window leaves the image are not written.
+namespace census {
+
+// 5x5 window, 25 bits per pixel
+void Transform5x5(const uint8_t *source, uint32_t *census, const int &width,
+                  const int &height);
+
+// 9 rows x 7 columns window, 63 bits per pixel
+void Transform9x7(const uint8_t *source, uint64_t *census, const int &width,
+                  const int &height);
+
+} // namespace census
+
+#endif
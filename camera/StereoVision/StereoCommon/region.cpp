@@ -0,0 +1,25 @@
+#include "region.h"
+#include <algorithm>
+
+region::Rect region::Clip(const Rect &roi, const int &width,
+                          const int &height) {
+  const int x0 = std::max(roi.x, 0);
+  const int y0 = std::max(roi.y, 0);
+  const int x1 = std::min(roi.x + roi.width, width);
+  const int y1 = std::min(roi.y + roi.height, height);
+  if (x1 <= x0 || y1 <= y0) {
+    return Rect();
+  }
+  return Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+region::Rect region::MatchWindow(const Rect &roi, const int &width,
+                                 const int &height, const int &min_disparity,
+                                 const int &max_disparity, const int &margin) {
+  // left pixel x is compared with right pixel x - d
+  const int left = margin + std::max(max_disparity, 0);
+  const int right = margin + std::max(-min_disparity, 0);
+  return Clip(Rect(roi.x - left, roi.y - margin, roi.width + left + right,
+                   roi.height + 2 * margin),
+              width, height);
+}
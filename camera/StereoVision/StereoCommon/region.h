@@ -0,0 +1,35 @@
+#ifndef STEREO_COMMON_REGION_H_
+#define STEREO_COMMON_REGION_H_
+
+// Region of interest helpers shared by the tiled matchers of
+// SemiGlobalMatching and ADCensusStereo.
+namespace region {
+
+struct Rect {
+  int x;
+  int y;
+  int width;
+  int height;
+
+  Rect() : x(0), y(0), width(0), height(0) {}
+  Rect(const int &_x, const int &_y, const int &_width, const int &_height)
+      : x(_x), y(_y), width(_width), height(_height) {}
+
+  bool Empty() const { return width <= 0 || height <= 0; }
+};
+
+// Intersection of roi with the width x height image.
+Rect Clip(const Rect &roi, const int &width, const int &height);
+
+// Window of both images that has to be matched so that every pixel of roi
+// gets the same search range as in a full frame match. The roi is grown by
+// margin on every side, for the aggregation paths and support windows that
+// enter the roi, and by the disparity range towards the side the right image
+// is searched. The result is clipped to the image.
+Rect MatchWindow(const Rect &roi, const int &width, const int &height,
+                 const int &min_disparity, const int &max_disparity,
+                 const int &margin);
+
+} // namespace region
+
+#endif
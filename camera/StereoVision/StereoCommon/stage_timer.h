@@ -0,0 +1,48 @@
+#ifndef STEREO_COMMON_STAGE_TIMER_H_
+#define STEREO_COMMON_STAGE_TIMER_H_
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Wall clock time of the stages of one match, in the order they ran. The
+// engines restart it at the beginning of every match and record a lap at the
+// end of every stage.
+class StageTimer {
+public:
+  typedef std::vector<std::pair<std::string, double>> Stages;
+
+  StageTimer() { Clear(); }
+
+  void Clear() {
+    stages_.clear();
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  // Records the time since the last Clear or Lap as stage `name`, in ms.
+  double Lap(const std::string &name) {
+    const auto now = std::chrono::steady_clock::now();
+    const double ms =
+        std::chrono::duration<double, std::milli>(now - start_).count();
+    stages_.push_back(std::make_pair(name, ms));
+    start_ = now;
+    return ms;
+  }
+
+  const Stages &stages() const { return stages_; }
+
+  double total() const {
+    double ms = 0.0;
+    for (const auto &stage : stages_) {
+      ms += stage.second;
+    }
+    return ms;
+  }
+
+private:
+  Stages stages_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef STEREO_COMMON_STEREO_CONSTANTS_H_
+#define STEREO_COMMON_STEREO_CONSTANTS_H_
+
+#include <limits>
+
+// Float disparity values of all engines.
+constexpr auto Invalid_Float = std::numeric_limits<float>::infinity();
+
+constexpr auto Large_Float = 99999.0f;
+constexpr auto Small_Float = -99999.0f;
+
+#endif
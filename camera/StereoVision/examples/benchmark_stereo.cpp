@@ -0,0 +1,671 @@
+// Benchmark of the stereovision engines (BlockMatching, SemiGlobalMatching,
+// ADCensusStereo, ADCensusBM) over a folder of rectified pairs.
+//
+// Every subdirectory of the data folder is one scene, laid out like the
+// Middlebury sets in data/:
+//   - left and right image: the first two of im*, view*, left*, right* in
+//     name order (im0/im1, im2/im6, view1/view5, left/right)
+//   - optional ground truth of the left view: the first disp* file in name
+//     order, PFM (inf = unknown), 16 bit PNG (KITTI, disparity * 256) or 8 bit
+//     PNG (disparity * gt_scale), 0 = unknown for PNG
+//   - optional d_range.txt with "dmin=..." and "dmax=..." lines
+//
+// Every engine runs each scene `runs` times after one warm up run and reports
+// the latency percentiles of every stage, the peak resident memory while the
+// engine ran, and against the ground truth the bad pixel rate (error above
+// bad_thres or no disparity, over all pixels with ground truth), the end point
+// error over pixels with both disparities and the density.
+
+#include "../ADCensusBM/stereoprocessor.h"
+#include "../ADCensusStereo/ADCensusStereo.h"
+#include "../BlockMatching/BlockMatching.h"
+#include "../SemiGlobalMatching/SemiGlobalMatching.h"
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <omp.h>
+#include <opencv2/opencv.hpp>
+#include <sstream>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct BenchmarkConfig {
+  std::string data_dir;
+  std::vector<std::string> engines;
+  int runs;
+  int min_disparity;
+  int max_disparity;
+  float gt_scale;
+  float bad_thres;
+  int num_threads;
+  int block_size;
+  std::string bm_config;
+  std::string csv_path;
+  std::string json_path;
+
+  BenchmarkConfig()
+      : engines({"block", "sgm", "adcensus", "adcensusbm"}), runs(5),
+        min_disparity(0), max_disparity(64), gt_scale(4.0f), bad_thres(1.0f),
+        num_threads(omp_get_max_threads()), block_size(9),
+        bm_config("ADCensusBM/config/adcensus.yaml"),
+        csv_path("benchmark.csv"), json_path("benchmark.json") {}
+};
+
+struct Scene {
+  std::string name;
+  cv::Mat left;
+  cv::Mat right;
+  // CV_32F, NaN where unknown
+  cv::Mat gt;
+  int min_disparity;
+  int max_disparity;
+};
+
+struct StageStats {
+  std::string name;
+  int count;
+  double mean_ms;
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+};
+
+struct Accuracy {
+  bool has_gt;
+  double bad_pixel_rate;
+  double epe;
+  double density;
+
+  Accuracy() : has_gt(false), bad_pixel_rate(0.0), epe(0.0), density(0.0) {}
+};
+
+struct Report {
+  std::string engine;
+  std::string scene;
+  int width;
+  int height;
+  std::vector<StageStats> stages;
+  long peak_rss_kb;
+  Accuracy accuracy;
+};
+
+// Runs one engine `runs` times on a scene, fills the stage timings of every
+// run and the disparity of the left view (CV_32F, Invalid_Float or NaN where
+// unknown)
+typedef bool (*EngineRunner)(const Scene &scene, const BenchmarkConfig &config,
+                             std::vector<StageTimer::Stages> *timings,
+                             cv::Mat *disparity);
+
+// SAD block matching, the baseline of the other engines
+bool RunBM(const Scene &scene, const BenchmarkConfig &config,
+           std::vector<StageTimer::Stages> *timings, cv::Mat *disparity) {
+  cv::Mat gray_left, gray_right;
+  cv::cvtColor(scene.left, gray_left, cv::COLOR_BGR2GRAY);
+  cv::cvtColor(scene.right, gray_right, cv::COLOR_BGR2GRAY);
+
+  BlockMatching::BMOption bm_option;
+  bm_option.min_disparity = scene.min_disparity;
+  bm_option.max_disparity = scene.max_disparity;
+  bm_option.window_size = config.block_size;
+  bm_option.num_threads = config.num_threads;
+  bm_option.is_print_timing = false;
+
+  BlockMatching bm;
+  if (!bm.Initialize(gray_left.cols, gray_left.rows, bm_option)) {
+    return false;
+  }
+
+  disparity->create(gray_left.rows, gray_left.cols, CV_32F);
+  for (int n = 0; n <= config.runs; n++) {
+    if (!bm.Match(gray_left.data, gray_right.data,
+                  reinterpret_cast<float *>(disparity->data))) {
+      return false;
+    }
+    if (n > 0) {
+      timings->push_back(bm.GetStageTimer().stages());
+    }
+  }
+  return true;
+}
+
+bool RunSGM(const Scene &scene, const BenchmarkConfig &config,
+            std::vector<StageTimer::Stages> *timings, cv::Mat *disparity) {
+  cv::Mat gray_left, gray_right;
+  cv::cvtColor(scene.left, gray_left, cv::COLOR_BGR2GRAY);
+  cv::cvtColor(scene.right, gray_right, cv::COLOR_BGR2GRAY);
+
+  SemiGlobalMatching::SGMOption sgm_option;
+  sgm_option.min_disparity = scene.min_disparity;
+  sgm_option.max_disparity = scene.max_disparity;
+  sgm_option.is_fill_holes = false;
+  sgm_option.is_fused_aggregation = true;
+  sgm_option.num_threads = config.num_threads;
+  sgm_option.is_print_timing = false;
+
+  SemiGlobalMatching sgm;
+  if (!sgm.Initialize(gray_left.cols, gray_left.rows, sgm_option)) {
+    return false;
+  }
+
+  disparity->create(gray_left.rows, gray_left.cols, CV_32F);
+  for (int n = 0; n <= config.runs; n++) {
+    if (!sgm.Match(gray_left.data, gray_right.data,
+                   reinterpret_cast<float32 *>(disparity->data))) {
+      return false;
+    }
+    // the first run warms up caches and the thread pool
+    if (n > 0) {
+      timings->push_back(sgm.GetStageTimer().stages());
+    }
+  }
+  return true;
+}
+
+bool RunADCensusOption(const Scene &scene, const BenchmarkConfig &config,
+                       ADCensusOption ad_option,
+                       std::vector<StageTimer::Stages> *timings,
+                       cv::Mat *disparity) {
+  ad_option.min_disparity = scene.min_disparity;
+  ad_option.max_disparity = scene.max_disparity;
+  ad_option.do_filling = false;
+  ad_option.num_threads = config.num_threads;
+  ad_option.do_print_timing = false;
+
+  ADCensusStereo ad_census;
+  if (!ad_census.Initialize(scene.left.cols, scene.left.rows, ad_option)) {
+    return false;
+  }
+
+  disparity->create(scene.left.rows, scene.left.cols, CV_32F);
+  for (int n = 0; n <= config.runs; n++) {
+    if (!ad_census.Match(scene.left, scene.right, *disparity)) {
+      return false;
+    }
+    if (n > 0) {
+      timings->push_back(ad_census.GetStageTimer().stages());
+    }
+  }
+  return true;
+}
+
+bool RunADCensus(const Scene &scene, const BenchmarkConfig &config,
+                 std::vector<StageTimer::Stages> *timings, cv::Mat *disparity) {
+  return RunADCensusOption(scene, config, ADCensusOption(), timings,
+                           disparity);
+}
+
+// ADCensusStereo with the uint16 fixed point cost volumes and the integral
+// aggregation
+bool RunADCensusFixed(const Scene &scene, const BenchmarkConfig &config,
+                      std::vector<StageTimer::Stages> *timings,
+                      cv::Mat *disparity) {
+  ADCensusOption ad_option;
+  ad_option.do_fixed_point = true;
+  ad_option.do_integral_aggregation = true;
+  return RunADCensusOption(scene, config, ad_option, timings, disparity);
+}
+
+// ADCensusStereo with the fast preset
+bool RunADCensusFast(const Scene &scene, const BenchmarkConfig &config,
+                     std::vector<StageTimer::Stages> *timings,
+                     cv::Mat *disparity) {
+  return RunADCensusOption(scene, config, ADCensusOption::Fast(), timings,
+                           disparity);
+}
+
+bool RunADCensusBM(const Scene &scene, const BenchmarkConfig &config,
+                   std::vector<StageTimer::Stages> *timings,
+                   cv::Mat *disparity) {
+  StereoParams bm_params;
+  if (!bm_params.read(config.bm_config)) {
+    return false;
+  }
+  bm_params.dMin = scene.min_disparity;
+  bm_params.dMax = scene.max_disparity;
+  bm_params.printTiming = false;
+
+  // one processor for all runs like for a stream of frames, every run sets the
+  // pair again
+  StereoProcessor sP(bm_params);
+  for (int n = 0; n <= config.runs; n++) {
+    if (!sP.compute(scene.left, scene.right)) {
+      return false;
+    }
+    if (n > 0) {
+      timings->push_back(sP.getStageTimer().stages());
+    }
+  }
+  sP.getDisparity().convertTo(*disparity, CV_32F);
+  // occlusions and mismatches that were not interpolated are below dMin
+  disparity->setTo(Invalid_Float, *disparity < scene.min_disparity);
+  return true;
+}
+
+// Middlebury PFM, rows are stored bottom to top
+cv::Mat ReadPFM(const std::string &path) {
+  std::ifstream file(path.c_str(), std::ios::binary);
+  std::string type;
+  int width = 0, height = 0;
+  double scale = 0.0;
+  file >> type >> width >> height >> scale;
+  file.get();
+  if (!file || type != "Pf" || width <= 0 || height <= 0) {
+    return cv::Mat();
+  }
+
+  cv::Mat pfm(height, width, CV_32F);
+  for (int i = height - 1; i >= 0; i--) {
+    file.read(reinterpret_cast<char *>(pfm.ptr<float>(i)),
+              width * sizeof(float));
+  }
+  if (!file) {
+    return cv::Mat();
+  }
+  if (scale > 0.0) {
+    // big endian
+    for (int i = 0; i < height; i++) {
+      auto row = reinterpret_cast<uint8_t *>(pfm.ptr<float>(i));
+      for (int j = 0; j < width; j++) {
+        std::reverse(row + 4 * j, row + 4 * j + 4);
+      }
+    }
+  }
+  for (int i = 0; i < height; i++) {
+    for (int j = 0; j < width; j++) {
+      float &disp = pfm.at<float>(i, j);
+      if (!std::isfinite(disp)) {
+        disp = NAN;
+      }
+    }
+  }
+  return pfm;
+}
+
+cv::Mat ReadGroundTruth(const std::string &path, const float &gt_scale) {
+  if (fs::path(path).extension() == ".pfm") {
+    return ReadPFM(path);
+  }
+
+  const cv::Mat png = cv::imread(path, cv::IMREAD_UNCHANGED);
+  if (png.empty() || png.channels() != 1) {
+    return cv::Mat();
+  }
+  const float scale = png.depth() == CV_16U ? 256.0f : gt_scale;
+  cv::Mat gt;
+  png.convertTo(gt, CV_32F, 1.0 / scale);
+  gt.setTo(NAN, png == 0);
+  return gt;
+}
+
+bool LoadScene(const fs::path &dir, const BenchmarkConfig &config,
+               Scene *scene) {
+  std::vector<std::string> images, disparities;
+  for (fs::directory_iterator it(dir); it != fs::directory_iterator(); ++it) {
+    if (!fs::is_regular_file(it->path())) {
+      continue;
+    }
+    const std::string name = it->path().filename().string();
+    const std::string stem = it->path().stem().string();
+    if (stem.compare(0, 4, "disp") == 0) {
+      disparities.push_back(name);
+    } else if (stem.compare(0, 2, "im") == 0 ||
+               stem.compare(0, 4, "view") == 0 ||
+               stem.compare(0, 4, "left") == 0 ||
+               stem.compare(0, 5, "right") == 0) {
+      images.push_back(name);
+    }
+  }
+  if (images.size() < 2) {
+    return false;
+  }
+  std::sort(images.begin(), images.end());
+  std::sort(disparities.begin(), disparities.end());
+
+  scene->name = dir.filename().string();
+  scene->left = cv::imread((dir / images[0]).string(), cv::IMREAD_COLOR);
+  scene->right = cv::imread((dir / images[1]).string(), cv::IMREAD_COLOR);
+  if (scene->left.empty() || scene->right.empty() ||
+      scene->left.size() != scene->right.size()) {
+    return false;
+  }
+  if (!disparities.empty()) {
+    scene->gt = ReadGroundTruth((dir / disparities[0]).string(),
+                                config.gt_scale);
+    if (scene->gt.size() != scene->left.size()) {
+      scene->gt = cv::Mat();
+    }
+  }
+
+  scene->min_disparity = config.min_disparity;
+  scene->max_disparity = config.max_disparity;
+  std::ifstream range((dir / "d_range.txt").string().c_str());
+  std::string line;
+  while (std::getline(range, line)) {
+    if (line.compare(0, 5, "dmin=") == 0) {
+      scene->min_disparity = atoi(line.c_str() + 5);
+    } else if (line.compare(0, 5, "dmax=") == 0) {
+      scene->max_disparity = atoi(line.c_str() + 5);
+    }
+  }
+  return true;
+}
+
+// Linux only, VmHWM of the process in kB, 0 where unavailable
+long PeakRSS() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return atol(line.c_str() + 6);
+    }
+  }
+  return 0;
+}
+
+// lets VmHWM start over from the current resident size
+void ResetPeakRSS() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+}
+
+Accuracy Evaluate(const cv::Mat &disparity, const cv::Mat &gt,
+                  const float &bad_thres) {
+  Accuracy accuracy;
+  if (gt.empty()) {
+    return accuracy;
+  }
+
+  long num_gt = 0, num_valid = 0, num_bad = 0;
+  double error_sum = 0.0;
+  for (int i = 0; i < gt.rows; i++) {
+    for (int j = 0; j < gt.cols; j++) {
+      const float gt_disp = gt.at<float>(i, j);
+      if (std::isnan(gt_disp)) {
+        continue;
+      }
+      num_gt++;
+      const float disp = disparity.at<float>(i, j);
+      if (!std::isfinite(disp)) {
+        num_bad++;
+        continue;
+      }
+      const float error = std::abs(disp - gt_disp);
+      num_valid++;
+      error_sum += error;
+      if (error > bad_thres) {
+        num_bad++;
+      }
+    }
+  }
+
+  accuracy.has_gt = num_gt > 0;
+  if (accuracy.has_gt) {
+    accuracy.bad_pixel_rate = static_cast<double>(num_bad) / num_gt;
+    accuracy.density = static_cast<double>(num_valid) / num_gt;
+    accuracy.epe = num_valid > 0 ? error_sum / num_valid : 0.0;
+  }
+  return accuracy;
+}
+
+// nearest rank percentile of sorted values
+double Percentile(const std::vector<double> &sorted, const double &p) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+StageStats Summarize(const std::string &name, std::vector<double> values) {
+  StageStats stats;
+  stats.name = name;
+  stats.count = static_cast<int>(values.size());
+  std::sort(values.begin(), values.end());
+  double sum = 0.0;
+  for (const auto &value : values) {
+    sum += value;
+  }
+  stats.mean_ms = values.empty() ? 0.0 : sum / values.size();
+  stats.p50_ms = Percentile(values, 0.50);
+  stats.p90_ms = Percentile(values, 0.90);
+  stats.p99_ms = Percentile(values, 0.99);
+  return stats;
+}
+
+// one entry per stage in the order they ran plus "total"
+std::vector<StageStats>
+SummarizeStages(const std::vector<StageTimer::Stages> &timings) {
+  std::vector<std::string> names;
+  std::vector<std::vector<double>> values;
+  std::vector<double> totals;
+  for (const auto &stages : timings) {
+    double total = 0.0;
+    for (const auto &stage : stages) {
+      auto it = std::find(names.begin(), names.end(), stage.first);
+      if (it == names.end()) {
+        names.push_back(stage.first);
+        values.push_back(std::vector<double>());
+        it = names.end() - 1;
+      }
+      values[it - names.begin()].push_back(stage.second);
+      total += stage.second;
+    }
+    totals.push_back(total);
+  }
+
+  std::vector<StageStats> summary;
+  for (size_t n = 0; n < names.size(); n++) {
+    summary.push_back(Summarize(names[n], values[n]));
+  }
+  summary.push_back(Summarize("total", totals));
+  return summary;
+}
+
+void WriteCSV(const std::string &path, const std::vector<Report> &reports) {
+  std::ofstream csv(path.c_str());
+  csv << "engine,scene,width,height,stage,runs,mean_ms,p50_ms,p90_ms,p99_ms,"
+         "peak_rss_kb,bad_pixel_rate,epe,density\n";
+  for (const auto &report : reports) {
+    for (const auto &stage : report.stages) {
+      csv << report.engine << "," << report.scene << "," << report.width
+          << "," << report.height << "," << stage.name << "," << stage.count
+          << "," << stage.mean_ms << "," << stage.p50_ms << ","
+          << stage.p90_ms << "," << stage.p99_ms << "," << report.peak_rss_kb;
+      if (report.accuracy.has_gt) {
+        csv << "," << report.accuracy.bad_pixel_rate << ","
+            << report.accuracy.epe << "," << report.accuracy.density << "\n";
+      } else {
+        csv << ",,,\n";
+      }
+    }
+  }
+}
+
+void WriteJSON(const std::string &path, const std::vector<Report> &reports) {
+  std::ofstream json(path.c_str());
+  json << "[\n";
+  for (size_t n = 0; n < reports.size(); n++) {
+    const auto &report = reports[n];
+    json << "  {\"engine\": \"" << report.engine << "\", \"scene\": \""
+         << report.scene << "\", \"width\": " << report.width
+         << ", \"height\": " << report.height
+         << ", \"peak_rss_kb\": " << report.peak_rss_kb;
+    if (report.accuracy.has_gt) {
+      json << ", \"bad_pixel_rate\": " << report.accuracy.bad_pixel_rate
+           << ", \"epe\": " << report.accuracy.epe
+           << ", \"density\": " << report.accuracy.density;
+    }
+    json << ",\n   \"stages\": [";
+    for (size_t k = 0; k < report.stages.size(); k++) {
+      const auto &stage = report.stages[k];
+      json << (k == 0 ? "\n" : ",\n") << "     {\"name\": \"" << stage.name
+           << "\", \"runs\": " << stage.count
+           << ", \"mean_ms\": " << stage.mean_ms
+           << ", \"p50_ms\": " << stage.p50_ms
+           << ", \"p90_ms\": " << stage.p90_ms
+           << ", \"p99_ms\": " << stage.p99_ms << "}";
+    }
+    json << "]}" << (n + 1 < reports.size() ? ",\n" : "\n");
+  }
+  json << "]\n";
+}
+
+std::vector<std::string> Split(const std::string &list) {
+  std::vector<std::string> items;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+void PrintUsage() {
+  std::cout
+      << "Usage: benchmark_stereo <data_dir> [options]\n"
+         "  --engines <list>    comma separated, block,sgm,adcensus,\n"
+         "                      adcensus_fixed,adcensus_fast,adcensusbm\n"
+         "  --runs <n>          timed runs per scene after a warm up run (5)\n"
+         "  --dmin <d>          min disparity without d_range.txt (0)\n"
+         "  --dmax <d>          max disparity without d_range.txt (64)\n"
+         "  --gt_scale <s>      scale of 8 bit PNG ground truth (4)\n"
+         "  --bad_thres <t>     bad pixel threshold in pixels (1)\n"
+         "  --threads <n>       threads of block, sgm and adcensus\n"
+         "  --block_size <n>    odd window side of block (9)\n"
+         "  --bm_config <yaml>  ADCensusBM parameters\n"
+         "  --csv <path>        CSV report (benchmark.csv)\n"
+         "  --json <path>       JSON report (benchmark.json)"
+      << std::endl;
+}
+
+bool ParseArgs(int argc, char **argv, BenchmarkConfig *config) {
+  if (argc < 2) {
+    return false;
+  }
+  config->data_dir = argv[1];
+  for (int n = 2; n < argc; n++) {
+    const std::string arg = argv[n];
+    if (n + 1 >= argc) {
+      return false;
+    }
+    const std::string value = argv[++n];
+    if (arg == "--engines") {
+      config->engines = Split(value);
+    } else if (arg == "--runs") {
+      config->runs = std::max(atoi(value.c_str()), 1);
+    } else if (arg == "--dmin") {
+      config->min_disparity = atoi(value.c_str());
+    } else if (arg == "--dmax") {
+      config->max_disparity = atoi(value.c_str());
+    } else if (arg == "--gt_scale") {
+      config->gt_scale = static_cast<float>(atof(value.c_str()));
+    } else if (arg == "--bad_thres") {
+      config->bad_thres = static_cast<float>(atof(value.c_str()));
+    } else if (arg == "--threads") {
+      config->num_threads = std::max(atoi(value.c_str()), 1);
+    } else if (arg == "--block_size") {
+      config->block_size = atoi(value.c_str());
+    } else if (arg == "--bm_config") {
+      config->bm_config = value;
+    } else if (arg == "--csv") {
+      config->csv_path = value;
+    } else if (arg == "--json") {
+      config->json_path = value;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  BenchmarkConfig config;
+  if (!ParseArgs(argc, argv, &config)) {
+    PrintUsage();
+    return -1;
+  }
+
+  std::vector<fs::path> scene_dirs;
+  for (fs::directory_iterator it(config.data_dir);
+       it != fs::directory_iterator(); ++it) {
+    if (fs::is_directory(it->path())) {
+      scene_dirs.push_back(it->path());
+    }
+  }
+  std::sort(scene_dirs.begin(), scene_dirs.end());
+
+  std::vector<Report> reports;
+  for (const auto &dir : scene_dirs) {
+    Scene scene;
+    if (!LoadScene(dir, config, &scene)) {
+      std::cout << "skipping " << dir.string() << std::endl;
+      continue;
+    }
+    printf("%s: w = %d, h = %d, d = [%d,%d]%s\n", scene.name.c_str(),
+           scene.left.cols, scene.left.rows, scene.min_disparity,
+           scene.max_disparity, scene.gt.empty() ? ", no ground truth" : "");
+
+    for (const auto &engine : config.engines) {
+      EngineRunner runner = nullptr;
+      if (engine == "block") {
+        runner = RunBM;
+      } else if (engine == "sgm") {
+        runner = RunSGM;
+      } else if (engine == "adcensus") {
+        runner = RunADCensus;
+      } else if (engine == "adcensus_fixed") {
+        runner = RunADCensusFixed;
+      } else if (engine == "adcensus_fast") {
+        runner = RunADCensusFast;
+      } else if (engine == "adcensusbm") {
+        runner = RunADCensusBM;
+      } else {
+        std::cout << "unknown engine " << engine << std::endl;
+        return -1;
+      }
+
+      std::vector<StageTimer::Stages> timings;
+      cv::Mat disparity;
+      ResetPeakRSS();
+      if (!runner(scene, config, &timings, &disparity)) {
+        std::cout << engine << " failed on " << scene.name << std::endl;
+        continue;
+      }
+
+      Report report;
+      report.engine = engine;
+      report.scene = scene.name;
+      report.width = scene.left.cols;
+      report.height = scene.left.rows;
+      report.stages = SummarizeStages(timings);
+      report.peak_rss_kb = PeakRSS();
+      report.accuracy = Evaluate(disparity, scene.gt, config.bad_thres);
+      reports.push_back(report);
+
+      const auto &total = report.stages.back();
+      printf("  %-14s p50 %8.1f ms  p99 %8.1f ms  peak %7ld kB", engine.c_str(),
+             total.p50_ms, total.p99_ms, report.peak_rss_kb);
+      if (report.accuracy.has_gt) {
+        printf("  bad %5.2f%%  epe %5.2f  density %5.2f%%",
+               100.0 * report.accuracy.bad_pixel_rate, report.accuracy.epe,
+               100.0 * report.accuracy.density);
+      }
+      printf("\n");
+    }
+  }
+
+  WriteCSV(config.csv_path, reports);
+  WriteJSON(config.json_path, reports);
+
+  return 0;
+}
@@ -39,6 +39,7 @@
 #include <cmath>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -47,11 +48,8 @@
 #if defined __GNUC__ && defined __APPLE__
 #pragma GCC diagnostic ignored "-Wshadow"
 #endif
+#include <omp.h>
 #include <Eigen/Dense>
-#include <Eigen/IterativeLinearSolvers>
-#include <Eigen/Sparse>
-#include <Eigen/SparseCholesky>
-#include <Eigen/SparseCore>
 
 typedef std::unordered_map<long long /* hash */, int /* vert id */> mapId;
 
@@ -71,42 +69,18 @@ class FastBilateralSolverFilterImpl : public FastBilateralSolverFilter {
     }
 
     void filter(InputArray src, InputArray confidence, OutputArray dst) {
-        CV_Assert(!src.empty() &&
-                  (src.depth() == CV_8U || src.depth() == CV_16S || src.depth() == CV_16U ||
-                   src.depth() == CV_32F) &&
-                  src.channels() <= 4);
-        CV_Assert(!confidence.empty() &&
-                  (confidence.depth() == CV_8U || confidence.depth() == CV_32F) &&
-                  confidence.channels() == 1);
-        if (src.rows() != rows || src.cols() != cols) {
-            CV_Error(Error::StsBadSize,
-                     "Size of the filtered image must be equal to the size of the "
-                     "guide image");
-            return;
-        }
-        if (confidence.rows() != rows || confidence.cols() != cols) {
-            CV_Error(Error::StsBadSize,
-                     "Size of the confidence image must be equal to the size of the "
-                     "guide image");
-            return;
-        }
+        checkInput(src, confidence);
 
         std::vector<Mat> src_channels;
-        std::vector<Mat> dst_channels;
         if (src.channels() == 1)
             src_channels.push_back(src.getMat());
         else
             split(src, src_channels);
 
-        Mat conf = confidence.getMat();
-
-        for (int i = 0; i < src.channels(); i++) {
-            Mat cur_res = src_channels[i].clone();
-
-            solve(cur_res, conf, cur_res);
-            cur_res.convertTo(cur_res, src.type());
-            dst_channels.push_back(cur_res);
-        }
+        // the channels share the confidence and are solved as one batch
+        std::vector<Mat> confidences(src_channels.size(), confidence.getMat());
+        std::vector<Mat> dst_channels;
+        solveBatch(src_channels, confidences, dst_channels);
 
         dst.create(src.size(), src_channels[0].type());
         if (src.channels() == 1) {
@@ -117,36 +91,168 @@ class FastBilateralSolverFilterImpl : public FastBilateralSolverFilter {
         CV_Assert(src.type() == dst.type() && src.size() == dst.size());
     }
 
+    void filterBatch(const std::vector<Mat>& src, const std::vector<Mat>& confidence,
+                     std::vector<Mat>& dst) {
+        CV_Assert(src.size() == confidence.size());
+
+        // one solve per channel of every image
+        std::vector<Mat> targets, confidences, results;
+        for (size_t k = 0; k < src.size(); k++) {
+            checkInput(src[k], confidence[k]);
+            std::vector<Mat> channels;
+            split(src[k], channels);
+            for (size_t c = 0; c < channels.size(); c++) {
+                targets.push_back(channels[c]);
+                confidences.push_back(confidence[k]);
+            }
+        }
+
+        solveBatch(targets, confidences, results);
+
+        dst.resize(src.size());
+        size_t next = 0;
+        for (size_t k = 0; k < src.size(); k++) {
+            std::vector<Mat> channels(results.begin() + next,
+                                      results.begin() + next + src[k].channels());
+            next += src[k].channels();
+            if (channels.size() == 1)
+                dst[k] = channels[0];
+            else
+                merge(channels, dst[k]);
+        }
+    }
+
+    bool setGuide(InputArray guide) {
+        CV_Assert(guide.type() == guide_type && guide.rows() == rows && guide.cols() == cols);
+
+        std::vector<long long> hashes;
+        computeHashes(guide.getMat(), hashes);
+
+        // the vertices of the new pixels, -1 for a cell that is not in the grid
+        std::vector<int> new_splat_idx(npixels);
+        bool is_covered = true;
+#pragma omp parallel for schedule(static) reduction(&& : is_covered)
+        for (int i = 0; i < npixels; i++) {
+            mapId::const_iterator it = hashed_coords.find(hashes[i]);
+            new_splat_idx[i] = it == hashed_coords.end() ? -1 : it->second;
+            is_covered = is_covered && it != hashed_coords.end();
+        }
+
+        if (is_covered && new_splat_idx == splat_idx) {
+            return true;
+        }
+
+        // every vertex must keep a pixel, the solve divides by the pixels of a vertex
+        bool is_reusable = is_covered;
+        if (is_covered) {
+            std::vector<int> vertex_pixels(nvertices, 0);
+            for (int i = 0; i < npixels; i++) {
+                vertex_pixels[new_splat_idx[i]]++;
+            }
+            is_reusable =
+                std::find(vertex_pixels.begin(), vertex_pixels.end(), 0) == vertex_pixels.end();
+        }
+
+        if (is_reusable) {
+            splat_idx.swap(new_splat_idx);
+        } else {
+            buildGrid(hashes);
+        }
+        buildSplatLists();
+        bistochastize();
+        return is_reusable;
+    }
+
     // protected:
-    void solve(cv::Mat& src, cv::Mat& confidence, cv::Mat& dst);
+    void solve(const cv::Mat& src, const cv::Mat& confidence, cv::Mat& dst, int& iterations,
+               float& error) const;
     void init(cv::Mat& reference, double sigma_spatial, double sigma_luma, double sigma_chroma,
               double lambda, int num_iter, double max_tol);
 
-    void Splat(Eigen::VectorXf& input, Eigen::VectorXf& dst);
-    void Blur(Eigen::VectorXf& input, Eigen::VectorXf& dst);
-    void Slice(Eigen::VectorXf& input, Eigen::VectorXf& dst);
+    // The grid operations run in parallel over the vertices (Splat, Blur) or the pixels
+    // (Slice), each output entry is written by one thread.
+    void Splat(const Eigen::VectorXf& input, Eigen::VectorXf& dst) const;
+    void Blur(const Eigen::VectorXf& input, Eigen::VectorXf& dst) const;
+    void Slice(const Eigen::VectorXf& input, Eigen::VectorXf& dst) const;
 
-    void diagonal(Eigen::VectorXf& v, Eigen::SparseMatrix<float>& mat) {
-        mat = Eigen::SparseMatrix<float>(v.size(), v.size());
-        for (int i = 0; i < int(v.size()); i++) {
-            mat.insert(i, i) = v(i);
+   private:
+    void checkInput(InputArray src, InputArray confidence) const {
+        CV_Assert(!src.empty() &&
+                  (src.depth() == CV_8U || src.depth() == CV_16S || src.depth() == CV_16U ||
+                   src.depth() == CV_32F) &&
+                  src.channels() <= 4);
+        CV_Assert(!confidence.empty() &&
+                  (confidence.depth() == CV_8U || confidence.depth() == CV_32F) &&
+                  confidence.channels() == 1);
+        if (src.rows() != rows || src.cols() != cols) {
+            CV_Error(Error::StsBadSize,
+                     "Size of the filtered image must be equal to the size of the "
+                     "guide image");
+        }
+        if (confidence.rows() != rows || confidence.cols() != cols) {
+            CV_Error(Error::StsBadSize,
+                     "Size of the confidence image must be equal to the size of the "
+                     "guide image");
         }
     }
 
-   private:
+    // Solves the single channel targets, in parallel when there are several. A single solve
+    // parallelizes its grid operations instead.
+    void solveBatch(const std::vector<Mat>& targets, const std::vector<Mat>& confidences,
+                    std::vector<Mat>& results) const {
+        const int num_targets = static_cast<int>(targets.size());
+        results.resize(num_targets);
+        std::vector<int> iterations(num_targets);
+        std::vector<float> errors(num_targets);
+
+#pragma omp parallel for schedule(dynamic) if (num_targets > 1)
+        for (int k = 0; k < num_targets; k++) {
+            Mat cur_res = targets[k].clone();
+            Mat conf = confidences[k].isContinuous() ? confidences[k] : confidences[k].clone();
+            solve(cur_res, conf, cur_res, iterations[k], errors[k]);
+            cur_res.convertTo(cur_res, targets[k].type());
+            results[k] = cur_res;
+        }
+
+        for (int k = 0; k < num_targets; k++) {
+            std::cout << "#iterations:     " << iterations[k] << std::endl;
+            std::cout << "estimated error: " << errors[k] << std::endl;
+        }
+    }
+
+    // grid cell of every pixel of the guide, hashed
+    void computeHashes(const cv::Mat& reference, std::vector<long long>& hashes) const;
+    // vertices of the hashed cells, splat_idx and blur_neighbors
+    void buildGrid(const std::vector<long long>& hashes);
+    // pixels of every vertex from splat_idx
+    void buildSplatLists();
+    // normalization n, m of the blur
+    void bistochastize();
+
+    // A * p of A = lam * (Dm - Dn * B * Dn) + diag(w_splat), B the blur
+    void applyA(const Eigen::VectorXf& p, const Eigen::VectorXf& w_splat, Eigen::VectorXf& dst,
+                Eigen::VectorXf& scratch_n, Eigen::VectorXf& scratch_blur) const;
+
     int npixels;
     int nvertices;
     int dim;
     int cols;
     int rows;
+    int guide_type;
+    long long hash_vec[5];
+    // vertex of every hashed grid cell
+    mapId hashed_coords;
+    // vertex of every pixel
     std::vector<int> splat_idx;
-    std::vector<std::pair<int, int> > blur_idx;
+    // pixels of vertex v are splat_pixels[splat_offsets[v], splat_offsets[v + 1]), in pixel order
+    std::vector<int> splat_offsets;
+    std::vector<int> splat_pixels;
+    // neighbors of every vertex, offset -1 then +1 along each dimension, -1 when missing
+    std::vector<int> blur_neighbors;
+    // pixels of every vertex
+    Eigen::VectorXf pixel_counts;
     Eigen::VectorXf m;
     Eigen::VectorXf n;
-    Eigen::SparseMatrix<float, Eigen::ColMajor> blurs;
-    Eigen::SparseMatrix<float, Eigen::ColMajor> S;
-    Eigen::SparseMatrix<float, Eigen::ColMajor> Dn;
-    Eigen::SparseMatrix<float, Eigen::ColMajor> Dm;
 
     struct grid_params {
         float spatialSigma;
@@ -174,6 +280,10 @@ class FastBilateralSolverFilterImpl : public FastBilateralSolverFilter {
 
     grid_params grid_param;
     bs_params bs_param;
+    // the sigmas as given, the hashes divide by them in double
+    double sigma_spatial;
+    double sigma_luma;
+    double sigma_chroma;
 };
 
 void FastBilateralSolverFilterImpl::init(cv::Mat& reference, double sigma_spatial,
@@ -182,324 +292,294 @@ void FastBilateralSolverFilterImpl::init(cv::Mat& reference, double sigma_spatia
     bs_param.lam = lambda;
     bs_param.cg_maxiter = num_iter;
     bs_param.cg_tol = max_tol;
+    grid_param.spatialSigma = sigma_spatial;
+    grid_param.lumaSigma = sigma_luma;
+    grid_param.chromaSigma = sigma_chroma;
+    this->sigma_spatial = sigma_spatial;
+    this->sigma_luma = sigma_luma;
+    this->sigma_chroma = sigma_chroma;
+
+    guide_type = reference.type();
+    dim = reference.channels() == 1 ? 3 : 5;
+    cols = reference.cols;
+    rows = reference.rows;
+    npixels = cols * rows;
+    for (int i = 0; i < 5; ++i) hash_vec[i] = static_cast<long long>(std::pow(255, i));
+
+    std::vector<long long> hashes;
+    computeHashes(reference, hashes);
+    buildGrid(hashes);
+    buildSplatLists();
+    bistochastize();
+}
 
-    if (reference.channels() == 1) {
-        dim = 3;
-        cols = reference.cols;
-        rows = reference.rows;
-        npixels = cols * rows;
-        long long hash_vec[3];
-        for (int i = 0; i < 3; ++i) hash_vec[i] = static_cast<long long>(std::pow(255, i));
+void FastBilateralSolverFilterImpl::computeHashes(const cv::Mat& reference,
+                                                  std::vector<long long>& hashes) const {
+    cv::Mat reference_yuv;
+    if (dim == 5)
+        cv::cvtColor(reference, reference_yuv, COLOR_BGR2YCrCb);
+    else
+        reference_yuv = reference;
+
+    hashes.resize(npixels);
+#pragma omp parallel for schedule(static)
+    for (int y = 0; y < rows; ++y) {
+        const unsigned char* pref = reference_yuv.ptr<unsigned char>(y);
+        for (int x = 0; x < cols; ++x) {
+            long long coord[5];
+            coord[0] = int(x / sigma_spatial);
+            coord[1] = int(y / sigma_spatial);
+            coord[2] = int(pref[0] / sigma_luma);
+            if (dim == 5) {
+                coord[3] = int(pref[1] / sigma_chroma);
+                coord[4] = int(pref[2] / sigma_chroma);
+            }
+
+            // convert the coordinate to a hash value
+            long long hash_coord = 0;
+            for (int i = 0; i < dim; ++i) hash_coord += coord[i] * hash_vec[i];
+            hashes[y * cols + x] = hash_coord;
+
+            pref += dim - 2;  // skip 1 byte (y) or 3 bytes (y u v)
+        }
+    }
+}
 
-        mapId hashed_coords;
+void FastBilateralSolverFilterImpl::buildGrid(const std::vector<long long>& hashes) {
+    hashed_coords.clear();
 #if __cplusplus <= 199711L
 #else
-        hashed_coords.reserve(cols * rows);
+    hashed_coords.reserve(cols * rows);
 #endif
 
-        const unsigned char* pref = (const unsigned char*)reference.data;
-        int vert_idx = 0;
-        int pix_idx = 0;
-
-        // construct Splat(Slice) matrices
-        splat_idx.resize(npixels);
-        for (int y = 0; y < rows; ++y) {
-            for (int x = 0; x < cols; ++x) {
-                long long coord[3];
-                coord[0] = int(x / sigma_spatial);
-                coord[1] = int(y / sigma_spatial);
-                coord[2] = int(pref[0] / sigma_luma);
-
-                // convert the coordinate to a hash value
-                long long hash_coord = 0;
-                for (int i = 0; i < 3; ++i) hash_coord += coord[i] * hash_vec[i];
-
-                // pixels whom are alike will have the same hash value.
-                // We only want to keep a unique list of hash values, therefore make
-                // sure we only insert unique hash values.
-                mapId::iterator it = hashed_coords.find(hash_coord);
-                if (it == hashed_coords.end()) {
-                    hashed_coords.insert(std::pair<long long, int>(hash_coord, vert_idx));
-                    splat_idx[pix_idx] = vert_idx;
-                    ++vert_idx;
-                } else {
-                    splat_idx[pix_idx] = it->second;
-                }
-
-                pref += 1;  // skip 1 bytes (y)
-                ++pix_idx;
-            }
+    // construct Splat(Slice) indices. Pixels whom are alike have the same hash value, the
+    // vertices are numbered in the order their first pixel is met.
+    std::vector<long long> vertex_hashes;
+    splat_idx.resize(npixels);
+    for (int i = 0; i < npixels; ++i) {
+        mapId::iterator it = hashed_coords.find(hashes[i]);
+        if (it == hashed_coords.end()) {
+            const int vert_idx = static_cast<int>(vertex_hashes.size());
+            hashed_coords.insert(std::pair<long long, int>(hashes[i], vert_idx));
+            vertex_hashes.push_back(hashes[i]);
+            splat_idx[i] = vert_idx;
+        } else {
+            splat_idx[i] = it->second;
         }
-        nvertices = static_cast<int>(hashed_coords.size());
-
-        // construct Blur matrices
-        Eigen::VectorXf ones_nvertices = Eigen::VectorXf::Ones(nvertices);
-        diagonal(ones_nvertices, blurs);
-        blurs *= 10;
-        for (int offset = -1; offset <= 1; ++offset) {
-            if (offset == 0) continue;
-            for (int i = 0; i < dim; ++i) {
-                Eigen::SparseMatrix<float, Eigen::ColMajor> blur_temp(hashed_coords.size(),
-                                                                      hashed_coords.size());
-                blur_temp.reserve(Eigen::VectorXi::Constant(nvertices, 6));
-                long long offset_hash_coord = offset * hash_vec[i];
-                for (mapId::iterator it = hashed_coords.begin(); it != hashed_coords.end(); ++it) {
-                    long long neighb_coord = it->first + offset_hash_coord;
-                    mapId::iterator it_neighb = hashed_coords.find(neighb_coord);
-                    if (it_neighb != hashed_coords.end()) {
-                        blur_temp.insert(it->second, it_neighb->second) = 1.0f;
-                        blur_idx.push_back(std::pair<int, int>(it->second, it_neighb->second));
-                    }
-                }
-                blurs += blur_temp;
+    }
+    nvertices = static_cast<int>(vertex_hashes.size());
+
+    // construct the Blur neighbors
+    const int num_neighbors = 2 * dim;
+    blur_neighbors.assign(static_cast<size_t>(nvertices) * num_neighbors, -1);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < nvertices; ++v) {
+        for (int k = 0; k < num_neighbors; ++k) {
+            const long long offset = k < dim ? -1 : 1;
+            const long long neighb_coord = vertex_hashes[v] + offset * hash_vec[k % dim];
+            mapId::const_iterator it_neighb = hashed_coords.find(neighb_coord);
+            if (it_neighb != hashed_coords.end()) {
+                blur_neighbors[static_cast<size_t>(v) * num_neighbors + k] = it_neighb->second;
             }
         }
-        blurs.finalize();
-
-        // bistochastize
-        int maxiter = 10;
-        n = ones_nvertices;
-        m = Eigen::VectorXf::Zero(nvertices);
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            m(splat_idx[i]) += 1.0f;
-        }
-
-        Eigen::VectorXf bluredn(nvertices);
+    }
+}
 
-        for (int i = 0; i < maxiter; i++) {
-            Blur(n, bluredn);
-            n = ((n.array() * m.array()).array() / bluredn.array()).array().sqrt();
-        }
-        Blur(n, bluredn);
+void FastBilateralSolverFilterImpl::buildSplatLists() {
+    splat_offsets.assign(nvertices + 1, 0);
+    for (int i = 0; i < npixels; i++) {
+        splat_offsets[splat_idx[i] + 1]++;
+    }
+    pixel_counts.resize(nvertices);
+    for (int v = 0; v < nvertices; v++) {
+        pixel_counts(v) = static_cast<float>(splat_offsets[v + 1]);
+        splat_offsets[v + 1] += splat_offsets[v];
+    }
 
-        m = n.array() * (bluredn).array();
-        diagonal(m, Dm);
-        diagonal(n, Dn);
+    std::vector<int> next(splat_offsets.begin(), splat_offsets.end() - 1);
+    splat_pixels.resize(npixels);
+    for (int i = 0; i < npixels; i++) {
+        splat_pixels[next[splat_idx[i]]++] = i;
+    }
+}
 
-    } else {
-        dim = 5;
-        cv::Mat reference_yuv;
-        cv::cvtColor(reference, reference_yuv, COLOR_BGR2YCrCb);
+void FastBilateralSolverFilterImpl::bistochastize() {
+    int maxiter = 10;
+    n = Eigen::VectorXf::Ones(nvertices);
+    m = pixel_counts;
 
-        cols = reference_yuv.cols;
-        rows = reference_yuv.rows;
-        npixels = cols * rows;
-        long long hash_vec[5];
-        for (int i = 0; i < 5; ++i) hash_vec[i] = static_cast<long long>(std::pow(255, i));
+    Eigen::VectorXf bluredn(nvertices);
 
-        mapId hashed_coords;
-#if __cplusplus <= 199711L
-#else
-        hashed_coords.reserve(cols * rows);
-#endif
+    for (int i = 0; i < maxiter; i++) {
+        Blur(n, bluredn);
+        n = ((n.array() * m.array()).array() / bluredn.array()).array().sqrt();
+    }
+    Blur(n, bluredn);
 
-        const unsigned char* pref = (const unsigned char*)reference_yuv.data;
-        int vert_idx = 0;
-        int pix_idx = 0;
-
-        // construct Splat(Slice) matrices
-        splat_idx.resize(npixels);
-        for (int y = 0; y < rows; ++y) {
-            for (int x = 0; x < cols; ++x) {
-                long long coord[5];
-                coord[0] = int(x / sigma_spatial);
-                coord[1] = int(y / sigma_spatial);
-                coord[2] = int(pref[0] / sigma_luma);
-                coord[3] = int(pref[1] / sigma_chroma);
-                coord[4] = int(pref[2] / sigma_chroma);
+    m = n.array() * (bluredn).array();
+}
 
-                // convert the coordinate to a hash value
-                long long hash_coord = 0;
-                for (int i = 0; i < 5; ++i) hash_coord += coord[i] * hash_vec[i];
-
-                // pixels whom are alike will have the same hash value.
-                // We only want to keep a unique list of hash values, therefore make
-                // sure we only insert unique hash values.
-                mapId::iterator it = hashed_coords.find(hash_coord);
-                if (it == hashed_coords.end()) {
-                    hashed_coords.insert(std::pair<long long, int>(hash_coord, vert_idx));
-                    splat_idx[pix_idx] = vert_idx;
-                    ++vert_idx;
-                } else {
-                    splat_idx[pix_idx] = it->second;
-                }
-
-                pref += 3;  // skip 3 bytes (y u v)
-                ++pix_idx;
-            }
-        }
-        nvertices = static_cast<int>(hashed_coords.size());
-
-        // construct Blur matrices
-        Eigen::VectorXf ones_nvertices = Eigen::VectorXf::Ones(nvertices);
-        diagonal(ones_nvertices, blurs);
-        blurs *= 10;
-        for (int offset = -1; offset <= 1; ++offset) {
-            if (offset == 0) continue;
-            for (int i = 0; i < dim; ++i) {
-                Eigen::SparseMatrix<float, Eigen::ColMajor> blur_temp(hashed_coords.size(),
-                                                                      hashed_coords.size());
-                blur_temp.reserve(Eigen::VectorXi::Constant(nvertices, 6));
-                long long offset_hash_coord = offset * hash_vec[i];
-                for (mapId::iterator it = hashed_coords.begin(); it != hashed_coords.end(); ++it) {
-                    long long neighb_coord = it->first + offset_hash_coord;
-                    mapId::iterator it_neighb = hashed_coords.find(neighb_coord);
-                    if (it_neighb != hashed_coords.end()) {
-                        blur_temp.insert(it->second, it_neighb->second) = 1.0f;
-                        blur_idx.push_back(std::pair<int, int>(it->second, it_neighb->second));
-                    }
-                }
-                blurs += blur_temp;
-            }
-        }
-        blurs.finalize();
-
-        // bistochastize
-        int maxiter = 10;
-        n = ones_nvertices;
-        m = Eigen::VectorXf::Zero(nvertices);
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            m(splat_idx[i]) += 1.0f;
+void FastBilateralSolverFilterImpl::Splat(const Eigen::VectorXf& input,
+                                          Eigen::VectorXf& output) const {
+    output.resize(nvertices);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < nvertices; v++) {
+        float sum = 0.0f;
+        for (int k = splat_offsets[v]; k < splat_offsets[v + 1]; k++) {
+            sum += input(splat_pixels[k]);
         }
+        output(v) = sum;
+    }
+}
 
-        Eigen::VectorXf bluredn(nvertices);
-
-        for (int i = 0; i < maxiter; i++) {
-            Blur(n, bluredn);
-            n = ((n.array() * m.array()).array() / bluredn.array()).array().sqrt();
+void FastBilateralSolverFilterImpl::Blur(const Eigen::VectorXf& input,
+                                         Eigen::VectorXf& output) const {
+    const int num_neighbors = 2 * dim;
+    output.resize(nvertices);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < nvertices; v++) {
+        const int* neighbors = blur_neighbors.data() + static_cast<size_t>(v) * num_neighbors;
+        float sum = input(v) * 10;
+        for (int k = 0; k < num_neighbors; k++) {
+            if (neighbors[k] >= 0) sum += input(neighbors[k]);
         }
-        Blur(n, bluredn);
-
-        m = n.array() * (bluredn).array();
-        diagonal(m, Dm);
-        diagonal(n, Dn);
+        output(v) = sum;
     }
 }
 
-void FastBilateralSolverFilterImpl::Splat(Eigen::VectorXf& input, Eigen::VectorXf& output) {
-    output.setZero();
-    for (int i = 0; i < int(splat_idx.size()); i++) {
-        output(splat_idx[i]) += input(i);
+void FastBilateralSolverFilterImpl::Slice(const Eigen::VectorXf& input,
+                                          Eigen::VectorXf& output) const {
+    output.resize(npixels);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < npixels; i++) {
+        output(i) = input(splat_idx[i]);
     }
 }
 
-void FastBilateralSolverFilterImpl::Blur(Eigen::VectorXf& input, Eigen::VectorXf& output) {
-    output.setZero();
-    output = input * 10;
-    for (int i = 0; i < int(blur_idx.size()); i++) {
-        output(blur_idx[i].first) += input(blur_idx[i].second);
+void FastBilateralSolverFilterImpl::applyA(const Eigen::VectorXf& p,
+                                           const Eigen::VectorXf& w_splat,
+                                           Eigen::VectorXf& output, Eigen::VectorXf& scratch_n,
+                                           Eigen::VectorXf& scratch_blur) const {
+    const float lam = bs_param.lam;
+    scratch_n = n.array() * p.array();
+    Blur(scratch_n, scratch_blur);
+    output.resize(nvertices);
+#pragma omp parallel for schedule(static)
+    for (int v = 0; v < nvertices; v++) {
+        output(v) = lam * (m(v) * p(v) - n(v) * scratch_blur(v)) + w_splat(v) * p(v);
     }
 }
 
-void FastBilateralSolverFilterImpl::Slice(Eigen::VectorXf& input, Eigen::VectorXf& output) {
-    output.setZero();
-    for (int i = 0; i < int(splat_idx.size()); i++) {
-        output(i) = input(splat_idx[i]);
+// dot product accumulated in double, over threads
+static double dotProduct(const Eigen::VectorXf& a, const Eigen::VectorXf& b) {
+    double sum = 0.0;
+    const int size = static_cast<int>(a.size());
+#pragma omp parallel for schedule(static) reduction(+ : sum)
+    for (int i = 0; i < size; i++) {
+        sum += static_cast<double>(a(i)) * b(i);
     }
+    return sum;
 }
 
-void FastBilateralSolverFilterImpl::solve(cv::Mat& target, cv::Mat& confidence, cv::Mat& output) {
-    Eigen::SparseMatrix<float, Eigen::ColMajor> M(nvertices, nvertices);
-    Eigen::SparseMatrix<float, Eigen::ColMajor> A_data(nvertices, nvertices);
-    Eigen::SparseMatrix<float, Eigen::ColMajor> A(nvertices, nvertices);
+void FastBilateralSolverFilterImpl::solve(const cv::Mat& target, const cv::Mat& confidence,
+                                          cv::Mat& output, int& iterations, float& error) const {
     Eigen::VectorXf b(nvertices);
     Eigen::VectorXf y(nvertices);
-    Eigen::VectorXf y0(nvertices);
-    Eigen::VectorXf y1(nvertices);
     Eigen::VectorXf w_splat(nvertices);
 
     Eigen::VectorXf x(npixels);
     Eigen::VectorXf w(npixels);
 
-    if (target.depth() == CV_16S) {
-        const int16_t* pft = reinterpret_cast<const int16_t*>(target.data);
-        for (int i = 0; i < npixels; i++) {
-            x(i) = (cv::saturate_cast<float>(pft[i]) + 32768.0f) / 65535.0f;
-        }
-    } else if (target.depth() == CV_16U) {
-        const uint16_t* pft = reinterpret_cast<const uint16_t*>(target.data);
-        for (int i = 0; i < npixels; i++) {
-            x(i) = cv::saturate_cast<float>(pft[i]) / 65535.0f;
-        }
-    } else if (target.depth() == CV_8U) {
-        const uchar* pft = reinterpret_cast<const uchar*>(target.data);
-        for (int i = 0; i < npixels; i++) {
-            x(i) = cv::saturate_cast<float>(pft[i]) / 255.0f;
-        }
-    } else if (target.depth() == CV_32F) {
-        const float* pft = reinterpret_cast<const float*>(target.data);
-        for (int i = 0; i < npixels; i++) {
-            x(i) = pft[i];
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < npixels; i++) {
+        if (target.depth() == CV_16S) {
+            x(i) = (cv::saturate_cast<float>(reinterpret_cast<const int16_t*>(target.data)[i]) +
+                    32768.0f) /
+                   65535.0f;
+        } else if (target.depth() == CV_16U) {
+            x(i) = cv::saturate_cast<float>(reinterpret_cast<const uint16_t*>(target.data)[i]) /
+                   65535.0f;
+        } else if (target.depth() == CV_8U) {
+            x(i) = cv::saturate_cast<float>(target.data[i]) / 255.0f;
+        } else {
+            x(i) = reinterpret_cast<const float*>(target.data)[i];
         }
-    }
 
-    if (confidence.depth() == CV_8U) {
-        const uchar* pfc = reinterpret_cast<const uchar*>(confidence.data);
-        for (int i = 0; i < npixels; i++) {
-            w(i) = cv::saturate_cast<float>(pfc[i]) / 255.0f;
-        }
-    } else if (confidence.depth() == CV_32F) {
-        const float* pfc = reinterpret_cast<const float*>(confidence.data);
-        for (int i = 0; i < npixels; i++) {
-            w(i) = pfc[i];
+        if (confidence.depth() == CV_8U) {
+            w(i) = cv::saturate_cast<float>(confidence.data[i]) / 255.0f;
+        } else {
+            w(i) = reinterpret_cast<const float*>(confidence.data)[i];
         }
     }
 
-    // construct A
+    // construct A, only its diagonal is stored
     Splat(w, w_splat);
-
-    diagonal(w_splat, A_data);
-    A = bs_param.lam * (Dm - Dn * (blurs * Dn)) + A_data;
+    Eigen::VectorXf inv_diag(nvertices);
+    for (int v = 0; v < nvertices; v++) {
+        const float diag = bs_param.lam * (m(v) - n(v) * (10.0f * n(v))) + w_splat(v);
+        inv_diag(v) = diag != 0.0f ? 1.0f / diag : 1.0f;
+    }
 
     // construct b
-    b.setZero();
-    for (int i = 0; i < int(splat_idx.size()); i++) {
-        b(splat_idx[i]) += x(i) * w(i);
-    }
+    Eigen::VectorXf xw = x.array() * w.array();
+    Splat(xw, b);
 
     // construct guess for y
-    y0.setZero();
-    for (int i = 0; i < int(splat_idx.size()); i++) {
-        y0(splat_idx[i]) += x(i);
-    }
-    y1.setZero();
-    for (int i = 0; i < int(splat_idx.size()); i++) {
-        y1(splat_idx[i]) += 1.0f;
-    }
-    for (int i = 0; i < nvertices; i++) {
-        y0(i) = y0(i) / y1(i);
+    Splat(x, y);
+    y.array() /= pixel_counts.array();
+
+    // solve Ay = b by the Jacobi preconditioned conjugate gradient of Eigen, with A applied
+    // through the grid instead of a sparse matrix
+    Eigen::VectorXf residual(nvertices), p(nvertices), z(nvertices), tmp(nvertices);
+    Eigen::VectorXf scratch_n(nvertices), scratch_blur(nvertices);
+    applyA(y, w_splat, tmp, scratch_n, scratch_blur);
+    residual = b - tmp;
+
+    const double rhs_norm2 = dotProduct(b, b);
+    iterations = 0;
+    error = 0.0f;
+    if (rhs_norm2 == 0) {
+        y.setZero();
+    } else {
+        const double threshold = std::max(static_cast<double>(bs_param.cg_tol) * bs_param.cg_tol *
+                                              rhs_norm2,
+                                          static_cast<double>(std::numeric_limits<float>::min()));
+        double residual_norm2 = dotProduct(residual, residual);
+        if (residual_norm2 >= threshold) {
+            p = inv_diag.array() * residual.array();
+            double abs_new = dotProduct(residual, p);
+            while (iterations < bs_param.cg_maxiter) {
+                applyA(p, w_splat, tmp, scratch_n, scratch_blur);
+                const float alpha = static_cast<float>(abs_new / dotProduct(p, tmp));
+                y += alpha * p;
+                residual -= alpha * tmp;
+                residual_norm2 = dotProduct(residual, residual);
+                if (residual_norm2 < threshold) break;
+                z = inv_diag.array() * residual.array();
+                const double abs_old = abs_new;
+                abs_new = dotProduct(residual, z);
+                const float beta = static_cast<float>(abs_new / abs_old);
+                p = z + beta * p;
+                iterations++;
+            }
+        }
+        error = static_cast<float>(std::sqrt(residual_norm2 / rhs_norm2));
     }
 
-    // solve Ay = b
-    Eigen::ConjugateGradient<Eigen::SparseMatrix<float>, Eigen::Lower | Eigen::Upper> cg;
-    cg.compute(A);
-    cg.setMaxIterations(bs_param.cg_maxiter);
-    cg.setTolerance(bs_param.cg_tol);
-    // y = cg.solve(b);
-    y = cg.solveWithGuess(b, y0);
-    std::cout << "#iterations:     " << cg.iterations() << std::endl;
-    std::cout << "estimated error: " << cg.error() << std::endl;
-
     // slice
-    if (target.depth() == CV_16S) {
-        int16_t* pftar = (int16_t*)output.data;
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            pftar[i] = cv::saturate_cast<short>(y(splat_idx[i]) * 65535.0f - 32768.0f);
-        }
-    } else if (target.depth() == CV_16U) {
-        uint16_t* pftar = (uint16_t*)output.data;
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            pftar[i] = cv::saturate_cast<ushort>(y(splat_idx[i]) * 65535.0f);
-        }
-    } else if (target.depth() == CV_8U) {
-        uchar* pftar = (uchar*)output.data;
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            pftar[i] = cv::saturate_cast<uchar>(y(splat_idx[i]) * 255.0f);
-        }
-    } else {
-        float* pftar = (float*)(output.data);
-        for (int i = 0; i < int(splat_idx.size()); i++) {
-            pftar[i] = y(splat_idx[i]);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < npixels; i++) {
+        const float value = y(splat_idx[i]);
+        if (target.depth() == CV_16S) {
+            reinterpret_cast<int16_t*>(output.data)[i] =
+                cv::saturate_cast<short>(value * 65535.0f - 32768.0f);
+        } else if (target.depth() == CV_16U) {
+            reinterpret_cast<uint16_t*>(output.data)[i] =
+                cv::saturate_cast<ushort>(value * 65535.0f);
+        } else if (target.depth() == CV_8U) {
+            output.data[i] = cv::saturate_cast<uchar>(value * 255.0f);
+        } else {
+            reinterpret_cast<float*>(output.data)[i] = value;
         }
     }
 }
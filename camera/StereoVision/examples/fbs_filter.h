@@ -25,6 +25,29 @@ class CV_EXPORTS_W FastBilateralSolverFilter : public Algorithm {
     CV_32F in [0, 1] range.
     */
     CV_WRAP virtual void filter(InputArray src, InputArray confidence, OutputArray dst) = 0;
+
+    /** @brief Apply smoothing operation to several source images with the same guide.
+
+    @param src source images, each as in filter().
+
+    @param confidence confidence image of every source image.
+
+    @param dst destination images.
+
+    @note The channels of all the images are solved in parallel on the one grid.
+    */
+    virtual void filterBatch(const std::vector<Mat>& src, const std::vector<Mat>& confidence,
+                             std::vector<Mat>& dst) = 0;
+
+    /** @brief Replace the guide image, e.g. by the next frame of a video.
+
+    @param guide guide image of the size and type of the one the filter was created with.
+
+    @return true if the bilateral grid was kept, which needs every pixel of the new guide to
+    fall in a vertex of the grid and every vertex to keep a pixel. Otherwise the grid is
+    rebuilt from the new guide.
+    */
+    virtual bool setGuide(InputArray guide) = 0;
 };
 
 CV_EXPORTS_W Ptr<FastBilateralSolverFilter> createFastBilateralSolverFilter(
@@ -34,6 +34,7 @@ int main(int argv, char **argc) {
   ad_option.lrcheck_thres = 1.0f;
 
   ad_option.do_lr_check = true;
+  ad_option.do_integral_aggregation = true;
 
   ad_option.do_filling = false;
 
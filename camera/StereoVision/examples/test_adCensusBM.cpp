@@ -5,7 +5,6 @@
 #include <iomanip>
 #include <iostream>
 #include <opencv2/opencv.hpp>
-#include <yaml-cpp/yaml.h>
 
 using namespace std;
 using namespace cv;
@@ -25,45 +24,22 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  YAML::Node config = YAML::LoadFile(argv[1]);
-
-  uint dMin = config["dMin"].as<uint>();
-  uint dMax = config["dMax"].as<uint>();
-  uint censusWinH = config["censusWinH"].as<uint>();
-  uint censusWinW = config["censusWinW"].as<uint>();
-  Size censusWin = Size(censusWinH, censusWinW);
-  float defaultBorderCost = config["defaultBorderCost"].as<float>();
-  float lambdaAD = config["lambdaAD"].as<float>();
-  float lambdaCensus = config["lambdaCensus"].as<float>();
-  uint aggregatingIterations = config["aggregatingIterations"].as<uint>();
-  uint colorThreshold1 = config["colorThreshold1"].as<uint>();
-  uint colorThreshold2 = config["colorThreshold2"].as<uint>();
-  uint maxLength1 = config["maxLength1"].as<uint>();
-  uint maxLength2 = config["maxLength2"].as<uint>();
-  uint colorDifference = config["colorDifference"].as<uint>();
-  float pi1 = config["pi1"].as<float>();
-  float pi2 = config["pi2"].as<float>();
-  uint dispTolerance = config["dispTolerance"].as<uint>();
-  uint votingThreshold = config["votingThreshold"].as<uint>();
-  float votingRatioThreshold = config["votingRatioThreshold"].as<float>();
-  uint maxSearchDepth = config["maxSearchDepth"].as<uint>();
-  uint blurKernelSize = config["blurKernelSize"].as<uint>();
-  uint cannyThreshold1 = config["cannyThreshold1"].as<uint>();
-  uint cannyThreshold2 = config["cannyThreshold2"].as<uint>();
-  uint cannyKernelSize = config["cannyKernelSize"].as<uint>();
+  StereoParams params;
+  if (!params.read(argv[1])) {
+    std::cout << "can not read " << argv[1] << std::endl;
+    return -1;
+  }
 
   const cv::Mat img_left = cv::imread(argv[2]);
   const cv::Mat img_right = cv::imread(argv[3]);
 
-  StereoProcessor sP(
-      dMin, dMax, img_left, img_right, censusWin, defaultBorderCost, lambdaAD,
-      lambdaCensus, aggregatingIterations, colorThreshold1, colorThreshold2,
-      maxLength1, maxLength2, colorDifference, pi1, pi2, dispTolerance,
-      votingThreshold, votingRatioThreshold, maxSearchDepth, blurKernelSize,
-      cannyThreshold1, cannyThreshold2, cannyKernelSize);
-
-  sP.init();
-  sP.compute();
+  // the processor keeps its buffers, further pairs of this size go through
+  // compute(img_left, img_right) without reallocation
+  StereoProcessor sP(params);
+  if (!sP.compute(img_left, img_right)) {
+    std::cout << "can not compute the disparity" << std::endl;
+    return -1;
+  }
 
   const cv::Mat disparity = sP.getDisparity();
 
@@ -0,0 +1,121 @@
+#include "../ADCensusBM/costvolume.h"
+#include "../ADCensusBM/scanlineoptimization.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+
+// Checks that the scanline optimization of ADCensusBM gives the same costs,
+// bit for bit, with one thread and with several threads. Returns non-zero if
+// any volume differs.
+
+namespace {
+
+const int Width = 97;
+const int Height = 61;
+const int DMin = 0;
+const int DMax = 15;
+const int Shift = 6;
+
+// deterministic pseudo-random numbers, the same on every platform
+struct Lcg {
+  uint32_t state;
+  explicit Lcg(uint32_t seed) : state(seed) {}
+  uint32_t next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+};
+
+// textured left image with a brighter square, the right image is the left
+// one shifted by Shift columns
+void MakePair(cv::Mat &left, cv::Mat &right) {
+  Lcg rng(7);
+  left.create(Height, Width, CV_8UC3);
+  for (int i = 0; i < Height; i++) {
+    for (int j = 0; j < Width; j++) {
+      const bool inside = i > Height / 4 && i < 3 * Height / 4 &&
+                          j > Width / 4 && j < 3 * Width / 4;
+      cv::Vec3b &color = left.at<cv::Vec3b>(i, j);
+      for (int c = 0; c < 3; c++) {
+        color[c] = static_cast<uchar>((inside ? 120 : 20) + rng.next() % 100);
+      }
+    }
+  }
+
+  right.create(Height, Width, CV_8UC3);
+  for (int i = 0; i < Height; i++) {
+    for (int j = 0; j < Width; j++) {
+      right.at<cv::Vec3b>(i, j) =
+          left.at<cv::Vec3b>(i, std::min(j + Shift, Width - 1));
+    }
+  }
+}
+
+bool MakeCosts(uint32_t seed, CostVolume &costs) {
+  if (!costs.create(Height, Width, DMax - DMin + 1)) {
+    return false;
+  }
+  Lcg rng(seed);
+  for (int i = 0; i < Height; i++) {
+    for (int j = 0; j < Width; j++) {
+      costType *cost = costs.ptr(i, j);
+      for (int d = 0; d < costs.getDisparities(); d++) {
+        cost[d] = static_cast<costType>(rng.next() % COST_FACTOR);
+      }
+    }
+  }
+  return true;
+}
+
+// optimizes the volumes of both images like StereoProcessor does
+bool Optimize(const cv::Mat &left, const cv::Mat &right, int num_threads,
+              CostVolume costs[2]) {
+  for (int imageNo = 0; imageNo < 2; imageNo++) {
+    if (!MakeCosts(11 + imageNo, costs[imageNo])) {
+      return false;
+    }
+  }
+  ScanlineOptimization scanline(left, right, DMin, DMax, 20, 1.0f, 3.0f,
+                                num_threads);
+  for (int imageNo = 0; imageNo < 2; imageNo++) {
+    scanline.optimization(&costs[imageNo], imageNo == 1);
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  cv::Mat left, right;
+  MakePair(left, right);
+
+  CostVolume serial[2];
+  if (!Optimize(left, right, 1, serial)) {
+    std::cout << "can not allocate the cost volumes" << std::endl;
+    return 1;
+  }
+
+  int failures = 0;
+  const int thread_counts[] = {2, 3, 4, 7};
+  for (const int num_threads : thread_counts) {
+    CostVolume parallel[2];
+    if (!Optimize(left, right, num_threads, parallel)) {
+      std::cout << "can not allocate the cost volumes" << std::endl;
+      return 1;
+    }
+    for (int imageNo = 0; imageNo < 2; imageNo++) {
+      const bool same =
+          memcmp(serial[imageNo].ptr(0, 0), parallel[imageNo].ptr(0, 0),
+                 serial[imageNo].total() * sizeof(costType)) == 0;
+      std::cout << "image " << imageNo << ", " << num_threads << " threads: "
+                << (same ? "matches" : "differs from") << " 1 thread"
+                << std::endl;
+      if (!same) {
+        failures++;
+      }
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -2,6 +2,7 @@
 #include "../SemiGlobalMatching/SemiGlobalMatching.h"
 #include "fbs_filter.h"
 #include <chrono>
+#include <omp.h>
 using namespace std::chrono;
 
 // opencv library
@@ -57,6 +58,8 @@ int main(int argv, char **argc) {
   sgm_option.p1 = 10;
   sgm_option.p2_init = 150;
   sgm_option.is_fill_holes = false;
+  sgm_option.is_fused_aggregation = true;
+  sgm_option.num_threads = omp_get_max_threads();
 
   printf("w = %d, h = %d, d = [%d,%d]\n\n", width, height,
          sgm_option.min_disparity, sgm_option.max_disparity);
@@ -0,0 +1,114 @@
+#include "../SemiGlobalMatching/sgm_stream.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Stops an SGMStream while a producer pushes frames. Every frame Push
+// accepted has to come out of the stream, through the callback or Pop, and
+// a producer blocked on a full stream has to return. Returns non-zero
+// otherwise, a lost wake-up hangs the test.
+
+namespace {
+
+const sint32 Width = 64;
+const sint32 Height = 48;
+
+SemiGlobalMatching::SGMOption MakeOption() {
+  SemiGlobalMatching::SGMOption option;
+  option.num_paths = 4;
+  option.min_disparity = 0;
+  option.max_disparity = 16;
+  option.is_print_timing = false;
+  return option;
+}
+
+// pushes until the stream refuses a frame, returns the accepted frames
+uint64 PushUntilStopped(SGMStream &stream, const std::vector<uint8> &image) {
+  uint64 accepted = 0;
+  while (stream.Push(&image[0], &image[0])) {
+    accepted++;
+  }
+  return accepted;
+}
+
+// the callback returns every frame, the producer never blocks for long
+bool StopWithCallback(const std::vector<uint8> &image, const int &delay_ms) {
+  std::atomic<uint64> delivered(0);
+  SGMStream stream;
+  if (!stream.Initialize(Width, Height, MakeOption(), 3,
+                         [&delivered](const uint64 &, const float32 *) {
+                           delivered++;
+                         })) {
+    return false;
+  }
+
+  uint64 accepted = 0;
+  std::thread producer([&stream, &image, &accepted] {
+    accepted = PushUntilStopped(stream, image);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+  stream.Stop();
+  producer.join();
+
+  if (accepted != delivered) {
+    std::cout << "callback: " << accepted << " frames pushed, " << delivered
+              << " delivered" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// nobody pops, the producer blocks once all buffers are in use until Stop
+bool StopWithoutConsumer(const std::vector<uint8> &image) {
+  SGMStream stream;
+  if (!stream.Initialize(Width, Height, MakeOption(), 2)) {
+    return false;
+  }
+
+  uint64 accepted = 0;
+  std::thread producer([&stream, &image, &accepted] {
+    accepted = PushUntilStopped(stream, image);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  stream.Stop();
+  producer.join();
+
+  uint64 popped = 0;
+  std::vector<float32> disparity(Width * Height);
+  while (stream.Pop(nullptr, &disparity[0])) {
+    popped++;
+  }
+  if (accepted != popped) {
+    std::cout << "no consumer: " << accepted << " frames pushed, " << popped
+              << " popped" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+int main() {
+  std::vector<uint8> image(Width * Height);
+  for (sint32 i = 0; i < Width * Height; i++) {
+    image[i] = static_cast<uint8>((i * 37 + i / Width * 11) % 251);
+  }
+
+  int failures = 0;
+  for (int run = 0; run < 100; run++) {
+    if (!StopWithCallback(image, run % 5)) {
+      failures++;
+    }
+  }
+  for (int run = 0; run < 3; run++) {
+    if (!StopWithoutConsumer(image)) {
+      failures++;
+    }
+  }
+
+  std::cout << (failures == 0 ? "all stops clean" : "stops lost frames")
+            << std::endl;
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+#include "dp_stereo.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+// cost of cells outside of the band, small enough to add costs without overflow
+const int kInfCost = INT_MAX / 4;
+
+enum Direction : uint8_t { kMatch = 1, kLeftOcclusion = 2, kRightOcclusion = 3 };
+
+}  // namespace
+
+DPStereo::DPStereo() : width_(0), height_(0), band_(0), dir_stride_(0), num_threads_(1) {}
+
+bool DPStereo::Initialize(int width, int height, const Options &options) {
+    // the disparities are stored as uchar
+    if (width <= 0 || height <= 0 || options.occlusion_cost < 0 || options.max_disparity < 0 ||
+        options.max_disparity > UCHAR_MAX) {
+        return false;
+    }
+
+    options_ = options;
+    width_ = width;
+    height_ = height;
+    band_ = std::min(options.max_disparity + 1, width);
+    dir_stride_ = (band_ + 3) / 4;
+
+    num_threads_ = 1;
+#ifdef _OPENMP
+    num_threads_ = options.num_threads > 0 ? options.num_threads : omp_get_max_threads();
+#endif
+
+    scratch_.resize(num_threads_);
+    for (auto &scratch : scratch_) {
+        scratch.cost_prev.assign(band_ + 2, kInfCost);
+        scratch.cost_curr.assign(band_ + 2, kInfCost);
+        scratch.directions.assign(static_cast<size_t>(width_) * dir_stride_, 0);
+    }
+    return true;
+}
+
+bool DPStereo::Match(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity) {
+    if (scratch_.empty() || left.type() != CV_8UC1 || right.type() != CV_8UC1 || left.cols != width_ ||
+        left.rows != height_ || right.size() != left.size()) {
+        return false;
+    }
+
+    disparity.create(height_, width_, CV_8UC1);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4) num_threads(num_threads_)
+#endif
+    for (int i = 0; i < height_; ++i) {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        MatchRow(left.ptr<uint8_t>(i), right.ptr<uint8_t>(i), disparity.ptr<uint8_t>(i), scratch_[thread]);
+    }
+    return true;
+}
+
+void DPStereo::MatchRow(const uint8_t *left, const uint8_t *right, uint8_t *disparity, RowScratch &scratch) const {
+    const int occ = options_.occlusion_cost;
+    const int band = band_;
+    const int stride = dir_stride_;
+
+    // cell t of left pixel j is right pixel k = j - t, index -1 and band are the sentinels
+    int *prev = scratch.cost_prev.data() + 1;
+    int *curr = scratch.cost_curr.data() + 1;
+    uint8_t *directions = scratch.directions.data();
+
+    // left pixel 0 only reaches right pixel 0
+    std::fill(prev, prev + band, kInfCost);
+    prev[0] = 0;
+
+    for (int j = 1; j < width_; ++j) {
+        uint8_t *dir_row = directions + static_cast<size_t>(j) * stride;
+        std::memset(dir_row, 0, stride);
+
+        // cells left of the right image border, and the border itself which only occludes
+        const int t_max = std::min(band - 1, j - 1);
+        for (int t = band - 1; t > t_max; --t) {
+            curr[t] = (t == j) ? j * occ : kInfCost;
+        }
+
+        const int left_val = left[j];
+        for (int t = t_max; t >= 0; --t) {
+            const int min1 = prev[t] + std::abs(left_val - static_cast<int>(right[j - t]));
+            const int min2 = prev[t - 1] + occ;
+            const int min3 = curr[t + 1] + occ;
+
+            int cost, dir;
+            if (min1 <= min2 && min1 <= min3) {
+                cost = min1;
+                dir = kMatch;
+            } else if (min2 <= min3) {
+                cost = min2;
+                dir = kLeftOcclusion;
+            } else {
+                cost = min3;
+                dir = kRightOcclusion;
+            }
+            curr[t] = cost;
+            dir_row[t >> 2] |= static_cast<uint8_t>(dir << ((t & 3) * 2));
+        }
+
+        std::swap(prev, curr);
+    }
+
+    // follow the directions back from the last pixels of both images
+    std::fill(disparity, disparity + width_, 0);
+    int p = width_ - 1, q = width_ - 1;
+    while (p > 0 && q > 0) {
+        const int t = p - q;
+        const int dir = (directions[static_cast<size_t>(p) * stride + (t >> 2)] >> ((t & 3) * 2)) & 3;
+        if (dir == kMatch) {
+            disparity[p] = static_cast<uint8_t>(t);
+            p--;
+            q--;
+        } else if (dir == kLeftOcclusion) {
+            disparity[p] = 0;
+            p--;
+        } else {
+            q--;
+        }
+    }
+}
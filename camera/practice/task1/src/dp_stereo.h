@@ -0,0 +1,58 @@
+#ifndef DP_STEREO_H
+#define DP_STEREO_H
+
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Scanline dynamic programming stereo. Every row is matched on its own by the
+// classic left/right alignment with an occlusion cost, restricted to the
+// disparity band [0, max_disparity]: left pixel j may only match right pixel
+// j - d. A row keeps two cost lines of the band and a 2 bit direction per
+// band cell, so the memory is linear in the width, and the rows run in
+// parallel with OpenMP.
+class DPStereo {
+ public:
+    struct Options {
+        // cost of leaving a pixel of either image unmatched
+        int occlusion_cost;
+        // largest disparity searched, the band has max_disparity + 1 cells
+        int max_disparity;
+        // rows matched at once, <= 0 uses all OpenMP threads
+        int num_threads;
+
+        Options() : occlusion_cost(10), max_disparity(64), num_threads(0) {}
+    };
+
+    DPStereo();
+
+    // Allocates the scratch of every thread for images of the given width.
+    bool Initialize(int width, int height, const Options &options);
+
+    // Matches two CV_8UC1 images of the initialized size. disparity becomes
+    // CV_8UC1 with the disparity of every left pixel, 0 where occluded.
+    bool Match(const cv::Mat &left, const cv::Mat &right, cv::Mat &disparity);
+
+ private:
+    // per thread memory of one row
+    struct RowScratch {
+        // costs of the band of the previous and the current left pixel, with
+        // an infinite sentinel on both ends
+        std::vector<int> cost_prev;
+        std::vector<int> cost_curr;
+        // 2 bit directions of the band cells, dir_stride_ bytes per left pixel
+        std::vector<uint8_t> directions;
+    };
+
+    void MatchRow(const uint8_t *left, const uint8_t *right, uint8_t *disparity, RowScratch &scratch) const;
+
+    Options options_;
+    int width_;
+    int height_;
+    int band_;
+    int dir_stride_;
+    int num_threads_;
+    std::vector<RowScratch> scratch_;
+};
+
+#endif  // DP_STEREO_H
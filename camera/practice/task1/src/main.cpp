@@ -1,4 +1,5 @@
 #include "main.h"
+#include "dp_stereo.h"
 #include <algorithm>
 #include <fstream>
 #include <iostream>
@@ -25,6 +26,8 @@ int main(int argc, char **argv) {
 
     // stereo estimate parameters(dynamic programming)
     const int occCost = 10;
+    // largest disparity searched, at most 255 as the disparities are uchar
+    const int dpMaxDisparity = 255;
 
     ///////////////////////////
     // Commandline arguments //
@@ -75,7 +78,7 @@ int main(int argc, char **argv) {
 
     cv::Mat dp_disparities = cv::Mat::zeros(height, width, CV_8UC1);
 
-    StereoEstimation_DP(image1, image2, dp_disparities, occCost);
+    StereoEstimation_DP(image1, image2, dp_disparities, occCost, dpMaxDisparity);
     ////////////
     // Output //
     ////////////
@@ -106,62 +109,14 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-void StereoEstimation_DP(const cv::Mat &image1, const cv::Mat &image2, cv::Mat &disp, int occCost) {
-    const int width = image1.cols, height = image1.rows;
+void StereoEstimation_DP(const cv::Mat &image1, const cv::Mat &image2, cv::Mat &disp, int occCost, int maxDisparity) {
+    DPStereo::Options options;
+    options.occlusion_cost = occCost;
+    options.max_disparity = maxDisparity;
 
-    cv::Mat costMap(width, width, CV_32SC1);
-    cv::Mat directionMap(width, width, CV_32SC1);
-
-    for (int i = 0; i < height; ++i) {
-        costMap = cv::Mat::zeros(width, width, CV_32SC1);
-        directionMap = cv::Mat::zeros(width, width, CV_32SC1);
-        for (int j = 0; j < width; ++j) {
-            costMap.at<int>(0, j) = j * occCost;
-            costMap.at<int>(j, 0) = j * occCost;
-        }
-
-        for (int j = 1; j < width; ++j) {
-            for (int k = 1; k < width; ++k) {
-                int min1 = costMap.at<int>(j - 1, k - 1) +
-                           abs(static_cast<int>(image1.at<uchar>(i, j)) - static_cast<int>(image2.at<uchar>(i, k)));
-                int min2 = costMap.at<int>(j - 1, k) + occCost;
-                int min3 = costMap.at<int>(j, k - 1) + occCost;
-
-                // int minVal = std::min(std::min(min1, min2), min3);
-
-                // costMap.at<int>(j, k) = minVal;
-                if (min1 <= min2 && min1 <= min3) {
-                    costMap.at<int>(j, k) = min1;
-                    directionMap.at<int>(j, k) = 1;
-                } else if (min2 <= min3 && min2 < min1) {
-                    costMap.at<int>(j, k) = min2;
-
-                    directionMap.at<int>(j, k) = 2;
-                } else {
-                    costMap.at<int>(j, k) = min3;
-                    directionMap.at<int>(j, k) = 3;
-                }
-            }
-        }
-
-        int P = width - 1, Q = width - 1;
-        while (P > 0 && Q > 0) {
-            switch (directionMap.at<int>(P, Q)) {
-            case 1:
-                disp.at<uchar>(i, P) = abs(P - Q);
-                P--;
-                Q--;
-                break;
-            case 2:
-                disp.at<uchar>(i, P) = 0;
-                P--;
-                break;
-            default:
-                disp.at<uchar>(i, Q) = 0;
-                Q--;
-                break;
-            }
-        }
+    DPStereo dp_stereo;
+    if (!dp_stereo.Initialize(image1.cols, image1.rows, options) || !dp_stereo.Match(image1, image2, disp)) {
+        std::cerr << "Dynamic programming stereo failed" << std::endl;
     }
 }
 
@@ -10,7 +10,8 @@ void StereoEstimation_Naive(const int &window_size, const int &dmin, int height,
 void Disparity2PointCloud(const std::string &output_file, int height, int width, cv::Mat &disparities,
                           const int &window_size, const int &dmin, const double &baseline, const double &focal_length);
 
-void StereoEstimation_DP(const cv::Mat &image1, const cv::Mat &image2, cv::Mat &disp, int occusionVal);
+void StereoEstimation_DP(const cv::Mat &image1, const cv::Mat &image2, cv::Mat &disp, int occusionVal,
+                         int maxDisparity);
 
 void showPointCloud(const std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d>> &pointcloud);
 
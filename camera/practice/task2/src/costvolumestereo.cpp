@@ -0,0 +1,139 @@
+#include "costvolumestereo.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "guidedfilter.h"
+
+// central difference along the rows of a gray image, borders replicated
+static cv::Mat gradientX(const cv::Mat &image) {
+    cv::Mat gray;
+    if (image.channels() == 3)
+        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+    else
+        gray = image;
+
+    cv::Mat gradient(gray.size(), CV_32F);
+    const int width = gray.cols;
+    for (int y = 0; y < gray.rows; ++y) {
+        const uchar *g = gray.ptr<uchar>(y);
+        float *grad = gradient.ptr<float>(y);
+        for (int x = 0; x < width; ++x) {
+            grad[x] = 0.5f * (g[std::min(x + 1, width - 1)] - g[std::max(x - 1, 0)]);
+        }
+    }
+    return gradient;
+}
+
+// Truncated cost of matching every left pixel x to the right pixel x - d,
+// right pixels outside of the image get the largest cost.
+static void matchingCost(const cv::Mat &left, const cv::Mat &right, const cv::Mat &grad_left,
+                         const cv::Mat &grad_right, int d, const CostVolumeStereo::Options &options, cv::Mat &cost) {
+    const int width = left.cols, channels = left.channels();
+    const float w_color = static_cast<float>((1.0 - options.alpha) / channels);
+    const float w_gradient = static_cast<float>(options.alpha);
+    const float tau_color = static_cast<float>(options.tau_color * channels);
+    const float tau_gradient = static_cast<float>(options.tau_gradient);
+    const float border_cost = w_color * tau_color + w_gradient * tau_gradient;
+
+    // left pixels whose match is inside the right image
+    const int x_begin = std::min(std::max(d, 0), width);
+    const int x_end = std::max(std::min(width + d, width), x_begin);
+
+    cost.create(left.size(), CV_32F);
+    for (int y = 0; y < left.rows; ++y) {
+        const uchar *l = left.ptr<uchar>(y);
+        const uchar *r = right.ptr<uchar>(y);
+        const float *gl = grad_left.ptr<float>(y);
+        const float *gr = grad_right.ptr<float>(y);
+        float *c = cost.ptr<float>(y);
+
+        std::fill(c, c + x_begin, border_cost);
+        for (int x = x_begin; x < x_end; ++x) {
+            const int xr = x - d;
+            float color = 0.0f;
+            for (int k = 0; k < channels; ++k) {
+                color += std::abs(static_cast<float>(l[x * channels + k]) - r[xr * channels + k]);
+            }
+            const float gradient = std::abs(gl[x] - gr[xr]);
+            c[x] = w_color * std::min(color, tau_color) + w_gradient * std::min(gradient, tau_gradient);
+        }
+        std::fill(c + x_end, c + width, border_cost);
+    }
+}
+
+CostVolumeStereo::CostVolumeStereo(const Options &options) : options(options) {
+    CV_Assert(options.min_disparity < options.max_disparity);
+    CV_Assert(options.r >= 0 && options.s >= 1);
+}
+
+cv::Mat CostVolumeStereo::compute(const cv::Mat &left, const cv::Mat &right) const {
+    CV_Assert(left.size() == right.size() && left.type() == right.type());
+    CV_Assert(left.type() == CV_8UC1 || left.type() == CV_8UC3);
+
+    const cv::Mat grad_left = gradientX(left);
+    const cv::Mat grad_right = gradientX(right);
+
+    // the mean and the (inverse) covariance of the guide, computed once for all slices
+    const GuidedFilter filter(left, options.r, options.eps, options.s);
+
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = options.num_threads > 0 ? options.num_threads : omp_get_max_threads();
+#endif
+
+    // winner-take-all of the slices filtered by each thread, merged at the end
+    std::vector<cv::Mat> best_costs(num_threads), best_disps(num_threads), costs(num_threads);
+    for (int t = 0; t < num_threads; ++t) {
+        best_costs[t] = cv::Mat(left.size(), CV_32F, cv::Scalar::all(std::numeric_limits<float>::max()));
+        best_disps[t] = cv::Mat(left.size(), CV_32F, cv::Scalar::all(options.min_disparity));
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+#endif
+    for (int d = options.min_disparity; d < options.max_disparity; ++d) {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        matchingCost(left, right, grad_left, grad_right, d, options, costs[thread]);
+        const cv::Mat filtered = filter.filter(costs[thread]);
+
+        cv::Mat &best_cost = best_costs[thread], &best_disp = best_disps[thread];
+        for (int y = 0; y < filtered.rows; ++y) {
+            const float *c = filtered.ptr<float>(y);
+            float *bc = best_cost.ptr<float>(y);
+            float *bd = best_disp.ptr<float>(y);
+            for (int x = 0; x < filtered.cols; ++x) {
+                // ties keep the smaller disparity, like a single pass over all slices
+                if (c[x] < bc[x] || (c[x] == bc[x] && d < bd[x])) {
+                    bc[x] = c[x];
+                    bd[x] = static_cast<float>(d);
+                }
+            }
+        }
+    }
+
+    cv::Mat &disparity = best_disps[0];
+    for (int t = 1; t < num_threads; ++t) {
+        for (int y = 0; y < disparity.rows; ++y) {
+            float *bc = best_costs[0].ptr<float>(y);
+            float *bd = disparity.ptr<float>(y);
+            const float *c = best_costs[t].ptr<float>(y);
+            const float *d = best_disps[t].ptr<float>(y);
+            for (int x = 0; x < disparity.cols; ++x) {
+                if (c[x] < bc[x] || (c[x] == bc[x] && d[x] < bd[x])) {
+                    bc[x] = c[x];
+                    bd[x] = d[x];
+                }
+            }
+        }
+    }
+    return disparity;
+}
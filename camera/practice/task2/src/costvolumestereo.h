@@ -0,0 +1,44 @@
+#ifndef COST_VOLUME_STEREO_H
+#define COST_VOLUME_STEREO_H
+
+#include <opencv2/opencv.hpp>
+
+// Stereo matching by cost volume filtering (Hosni et al.): every disparity
+// slice of a truncated color and gradient cost is smoothed by a guided filter
+// with the left image as guide, then each pixel takes the disparity of the
+// lowest filtered cost. The guide statistics are computed once per pair and
+// shared by all slices, which are filtered in parallel.
+class CostVolumeStereo {
+ public:
+    struct Options {
+        // disparities in [min_disparity, max_disparity)
+        int min_disparity;
+        int max_disparity;
+        // guided filter radius and regularization, for images in [0, 255]
+        int r;
+        double eps;
+        // subsampling of the fast guided filter, 1 is the exact filter
+        int s;
+        // weight of the gradient cost, the color cost has 1 - alpha
+        double alpha;
+        // truncation of the color and the gradient cost
+        double tau_color;
+        double tau_gradient;
+        // slices filtered at once, <= 0 uses all OpenMP threads
+        int num_threads;
+
+        Options()
+            : min_disparity(0), max_disparity(64), r(9), eps(0.0001 * 255 * 255), s(1), alpha(0.9), tau_color(7.0),
+              tau_gradient(2.0), num_threads(0) {}
+    };
+
+    explicit CostVolumeStereo(const Options &options = Options());
+
+    // Disparity (CV_32F) of every left pixel for a CV_8UC1 or CV_8UC3 pair.
+    cv::Mat compute(const cv::Mat &left, const cv::Mat &right) const;
+
+ private:
+    Options options;
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "guidedfilter.h"
 
+#include <algorithm>
+#include <vector>
+
 // bad implementation, repeated computation
 void OurFilerBox(const cv::Mat &input, cv::Mat &output, const int window_size) {
 
@@ -24,22 +27,110 @@ void OurFilerBox(const cv::Mat &input, cv::Mat &output, const int window_size) {
     }
 }
 
-static cv::Mat boxfilter(const cv::Mat &I, int r) {
+static cv::Mat convertTo(const cv::Mat &mat, int depth) {
+    if (mat.depth() == depth)
+        return mat;
+
     cv::Mat result;
-    cv::blur(I, result, cv::Size(r, r), cv::Point(-1, -1), cv::BORDER_REPLICATE);
-    // OurFilerBox(I, result, r);
+    mat.convertTo(result, depth);
     return result;
 }
 
-static cv::Mat convertTo(const cv::Mat &mat, int depth) {
-    if (mat.depth() == depth)
+// one box filtered plane: plane a, times plane b if b >= 0
+struct BoxTerm {
+    int a;
+    int b;
+};
+
+// Box means of several terms in one sweep over the planes. The integral image
+// of every term is only kept for the rows under the window: the column sums
+// of the window rows, moved down by the row entering and the row leaving the
+// window, and their prefix sums along the current row. A mean costs O(1) per
+// pixel whatever the window size, borders are replicated like cv::blur with
+// BORDER_REPLICATE.
+template <typename T>
+static void boxMeans(const cv::Mat *planes, const BoxTerm *terms, int num_terms, int ksize, cv::Mat *means) {
+    const int width = planes[0].cols, height = planes[0].rows;
+    const int radius = ksize / 2;
+    const int prefix_width = width + 2 * radius + 1;
+    const double norm = 1.0 / (static_cast<double>(ksize) * ksize);
+
+    std::vector<double> col_sums(static_cast<size_t>(width) * num_terms, 0.0);
+    std::vector<double> prefix(static_cast<size_t>(prefix_width) * num_terms, 0.0);
+    for (int t = 0; t < num_terms; ++t) {
+        means[t].create(height, width, planes[0].type());
+    }
+
+    auto add_row = [&](int row, double sign) {
+        row = std::min(std::max(row, 0), height - 1);
+        for (int t = 0; t < num_terms; ++t) {
+            const T *a = planes[terms[t].a].ptr<T>(row);
+            double *sums = col_sums.data() + static_cast<size_t>(t) * width;
+            if (terms[t].b >= 0) {
+                const T *b = planes[terms[t].b].ptr<T>(row);
+                for (int x = 0; x < width; ++x) {
+                    sums[x] += sign * (static_cast<double>(a[x]) * b[x]);
+                }
+            } else {
+                for (int x = 0; x < width; ++x) {
+                    sums[x] += sign * a[x];
+                }
+            }
+        }
+    };
+
+    for (int y = -radius; y <= radius; ++y) {
+        add_row(y, 1.0);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        if (y > 0) {
+            add_row(y + radius, 1.0);
+            add_row(y - radius - 1, -1.0);
+        }
+
+        for (int t = 0; t < num_terms; ++t) {
+            const double *sums = col_sums.data() + static_cast<size_t>(t) * width;
+            double *pre = prefix.data() + static_cast<size_t>(t) * prefix_width;
+
+            // prefix sums of the replicated row, pre[k] sums the first k padded columns
+            for (int x = 0; x < radius; ++x) {
+                pre[x + 1] = pre[x] + sums[0];
+            }
+            for (int x = 0; x < width; ++x) {
+                pre[radius + x + 1] = pre[radius + x] + sums[x];
+            }
+            for (int x = radius + width; x < prefix_width - 1; ++x) {
+                pre[x + 1] = pre[x] + sums[width - 1];
+            }
+
+            T *mean = means[t].ptr<T>(y);
+            for (int x = 0; x < width; ++x) {
+                mean[x] = static_cast<T>((pre[x + ksize] - pre[x]) * norm);
+            }
+        }
+    }
+}
+
+// nearest neighbour subsampling by s, the fast guided filter of He and Sun
+static cv::Mat subsample(const cv::Mat &mat, int s) {
+    if (s == 1)
         return mat;
 
     cv::Mat result;
-    mat.convertTo(result, depth);
+    cv::resize(mat, result, cv::Size(), 1.0 / s, 1.0 / s, cv::INTER_NEAREST);
     return result;
 }
 
+static void upsample(cv::Mat &mat, const cv::Size &size) {
+    if (mat.size() == size)
+        return;
+
+    cv::Mat result;
+    cv::resize(mat, result, size, 0, 0, cv::INTER_LINEAR);
+    mat = result;
+}
+
 class GuidedFilterImpl {
  public:
     virtual ~GuidedFilterImpl() {}
@@ -53,30 +144,45 @@ class GuidedFilterImpl {
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const = 0;
 };
 
+// The coefficients a, b are computed on I and p subsampled by s with the
+// radius r / s and upsampled bilinearly before the output q = mean_a * I +
+// mean_b at full resolution. s = 1 is the exact guided filter.
 class GuidedFilterMono : public GuidedFilterImpl {
  public:
-    GuidedFilterMono(const cv::Mat &I, int r, double eps);
+    GuidedFilterMono(const cv::Mat &I, int r, double eps, int s);
 
  private:
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
 
+    template <typename T>
+    void init();
+    template <typename T>
+    cv::Mat filterSingleChannel(const cv::Mat &p) const;
+
  private:
-    int r;
+    int ksize;
     double eps;
-    cv::Mat I, mean_I, var_I;
+    int s;
+    cv::Mat I, I_sub, mean_I, var_I;
 };
 
 class GuidedFilterColor : public GuidedFilterImpl {
  public:
-    GuidedFilterColor(const cv::Mat &I, int r, double eps);
+    GuidedFilterColor(const cv::Mat &I, int r, double eps, int s);
 
  private:
     virtual cv::Mat filterSingleChannel(const cv::Mat &p) const;
 
+    template <typename T>
+    void init();
+    template <typename T>
+    cv::Mat filterSingleChannel(const cv::Mat &p) const;
+
  private:
-    std::vector<cv::Mat> Ichannels;
-    int r;
+    std::vector<cv::Mat> Ichannels, Ichannels_sub;
+    int ksize;
     double eps;
+    int s;
     cv::Mat mean_I_r, mean_I_g, mean_I_b;
     cv::Mat invrr, invrg, invrb, invgg, invgb, invbb;
 };
@@ -100,34 +206,91 @@ cv::Mat GuidedFilterImpl::filter(const cv::Mat &p, int depth) {
     return convertTo(result, depth == -1 ? p.depth() : depth);
 }
 
-GuidedFilterMono::GuidedFilterMono(const cv::Mat &origI, int r, double eps) : r(r), eps(eps) {
+// box side of the radius r at the subsampled resolution
+static int subsampledBoxSize(int r, int s) { return 2 * (s == 1 ? r : std::max(r / s, 1)) + 1; }
+
+GuidedFilterMono::GuidedFilterMono(const cv::Mat &origI, int r, double eps, int s)
+    : ksize(subsampledBoxSize(r, s)), eps(eps), s(s) {
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
         I = origI.clone();
     else
         I = convertTo(origI, CV_32F);
 
     Idepth = I.depth();
+    I_sub = subsample(I, s);
 
-    mean_I = boxfilter(I, r);
-    cv::Mat mean_II = boxfilter(I.mul(I), r);
-    var_I = mean_II - mean_I.mul(mean_I);
+    if (Idepth == CV_32F)
+        init<float>();
+    else
+        init<double>();
 }
 
-cv::Mat GuidedFilterMono::filterSingleChannel(const cv::Mat &p) const {
-    cv::Mat mean_p = boxfilter(p, r);
-    cv::Mat mean_Ip = boxfilter(I.mul(p), r);
-    cv::Mat cov_Ip = mean_Ip - mean_I.mul(mean_p); // this is the covariance of (I, p) in each local patch.
+template <typename T>
+void GuidedFilterMono::init() {
+    const cv::Mat planes[] = {I_sub};
+    const BoxTerm terms[] = {{0, -1}, {0, 0}};
+    cv::Mat means[2];
+    boxMeans<T>(planes, terms, 2, ksize, means);
+
+    mean_I = means[0];
+    var_I = means[1];
+    for (int y = 0; y < var_I.rows; ++y) {
+        const T *m_I = mean_I.ptr<T>(y);
+        T *v_I = var_I.ptr<T>(y);
+        for (int x = 0; x < var_I.cols; ++x) {
+            v_I[x] -= m_I[x] * m_I[x];
+        }
+    }
+}
 
-    cv::Mat a = cov_Ip / (var_I + eps); // Eqn. (5) in the paper;
-    cv::Mat b = mean_p - a.mul(mean_I); // Eqn. (6) in the paper;
+cv::Mat GuidedFilterMono::filterSingleChannel(const cv::Mat &p) const {
+    return Idepth == CV_32F ? filterSingleChannel<float>(p) : filterSingleChannel<double>(p);
+}
 
-    cv::Mat mean_a = boxfilter(a, r);
-    cv::Mat mean_b = boxfilter(b, r);
+template <typename T>
+cv::Mat GuidedFilterMono::filterSingleChannel(const cv::Mat &p) const {
+    const cv::Mat planes[] = {I_sub, subsample(p, s)};
+    const BoxTerm terms[] = {{1, -1}, {0, 1}};
+    cv::Mat means[2];
+    boxMeans<T>(planes, terms, 2, ksize, means);
+
+    // a and b overwrite mean_p and mean_Ip
+    cv::Mat &a = means[1], &b = means[0];
+    for (int y = 0; y < a.rows; ++y) {
+        const T *m_I = mean_I.ptr<T>(y);
+        const T *v_I = var_I.ptr<T>(y);
+        T *ay = a.ptr<T>(y);
+        T *by = b.ptr<T>(y);
+        for (int x = 0; x < a.cols; ++x) {
+            const T mean_p = by[x];
+            const T cov_Ip = ay[x] - m_I[x] * mean_p; // this is the covariance of (I, p) in each local patch.
+            ay[x] = static_cast<T>(cov_Ip / (v_I[x] + eps)); // Eqn. (5) in the paper;
+            by[x] = mean_p - ay[x] * m_I[x];                 // Eqn. (6) in the paper;
+        }
+    }
 
-    return mean_a.mul(I) + mean_b;
+    const cv::Mat coefficients[] = {a, b};
+    const BoxTerm coefficient_terms[] = {{0, -1}, {1, -1}};
+    cv::Mat mean_ab[2];
+    boxMeans<T>(coefficients, coefficient_terms, 2, ksize, mean_ab);
+    upsample(mean_ab[0], I.size());
+    upsample(mean_ab[1], I.size());
+
+    cv::Mat q(I.size(), I.type());
+    for (int y = 0; y < q.rows; ++y) {
+        const T *Iy = I.ptr<T>(y);
+        const T *mean_a = mean_ab[0].ptr<T>(y);
+        const T *mean_b = mean_ab[1].ptr<T>(y);
+        T *qy = q.ptr<T>(y);
+        for (int x = 0; x < q.cols; ++x) {
+            qy[x] = mean_a[x] * Iy[x] + mean_b[x];
+        }
+    }
+    return q;
 }
 
-GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps) : r(r), eps(eps) {
+GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps, int s)
+    : ksize(subsampledBoxSize(r, s)), eps(eps), s(s) {
     cv::Mat I;
     if (origI.depth() == CV_32F || origI.depth() == CV_64F)
         I = origI.clone();
@@ -137,70 +300,135 @@ GuidedFilterColor::GuidedFilterColor(const cv::Mat &origI, int r, double eps) :
     Idepth = I.depth();
 
     cv::split(I, Ichannels);
+    for (std::size_t i = 0; i < Ichannels.size(); ++i)
+        Ichannels_sub.push_back(subsample(Ichannels[i], s));
 
-    mean_I_r = boxfilter(Ichannels[0], r);
-    mean_I_g = boxfilter(Ichannels[1], r);
-    mean_I_b = boxfilter(Ichannels[2], r);
-
-    // variance of I in each local patch: the matrix Sigma in Eqn (14).
-    // Note the variance in each local patch is a 3x3 symmetric matrix:
-    //           rr, rg, rb
-    //   Sigma = rg, gg, gb
-    //           rb, gb, bb
-    cv::Mat var_I_rr = boxfilter(Ichannels[0].mul(Ichannels[0]), r) - mean_I_r.mul(mean_I_r) + eps;
-    cv::Mat var_I_rg = boxfilter(Ichannels[0].mul(Ichannels[1]), r) - mean_I_r.mul(mean_I_g);
-    cv::Mat var_I_rb = boxfilter(Ichannels[0].mul(Ichannels[2]), r) - mean_I_r.mul(mean_I_b);
-    cv::Mat var_I_gg = boxfilter(Ichannels[1].mul(Ichannels[1]), r) - mean_I_g.mul(mean_I_g) + eps;
-    cv::Mat var_I_gb = boxfilter(Ichannels[1].mul(Ichannels[2]), r) - mean_I_g.mul(mean_I_b);
-    cv::Mat var_I_bb = boxfilter(Ichannels[2].mul(Ichannels[2]), r) - mean_I_b.mul(mean_I_b) + eps;
-
-    // Inverse of Sigma + eps * I
-    invrr = var_I_gg.mul(var_I_bb) - var_I_gb.mul(var_I_gb);
-    invrg = var_I_gb.mul(var_I_rb) - var_I_rg.mul(var_I_bb);
-    invrb = var_I_rg.mul(var_I_gb) - var_I_gg.mul(var_I_rb);
-    invgg = var_I_rr.mul(var_I_bb) - var_I_rb.mul(var_I_rb);
-    invgb = var_I_rb.mul(var_I_rg) - var_I_rr.mul(var_I_gb);
-    invbb = var_I_rr.mul(var_I_gg) - var_I_rg.mul(var_I_rg);
-
-    cv::Mat covDet = invrr.mul(var_I_rr) + invrg.mul(var_I_rg) + invrb.mul(var_I_rb);
-
-    invrr /= covDet;
-    invrg /= covDet;
-    invrb /= covDet;
-    invgg /= covDet;
-    invgb /= covDet;
-    invbb /= covDet;
+    if (Idepth == CV_32F)
+        init<float>();
+    else
+        init<double>();
 }
 
-cv::Mat GuidedFilterColor::filterSingleChannel(const cv::Mat &p) const {
-    cv::Mat mean_p = boxfilter(p, r);
-
-    cv::Mat mean_Ip_r = boxfilter(Ichannels[0].mul(p), r);
-    cv::Mat mean_Ip_g = boxfilter(Ichannels[1].mul(p), r);
-    cv::Mat mean_Ip_b = boxfilter(Ichannels[2].mul(p), r);
-
-    // covariance of (I, p) in each local patch.
-    cv::Mat cov_Ip_r = mean_Ip_r - mean_I_r.mul(mean_p);
-    cv::Mat cov_Ip_g = mean_Ip_g - mean_I_g.mul(mean_p);
-    cv::Mat cov_Ip_b = mean_Ip_b - mean_I_b.mul(mean_p);
+template <typename T>
+void GuidedFilterColor::init() {
+    // the means of the channels and of their products, in one sweep
+    const BoxTerm terms[] = {{0, -1}, {1, -1}, {2, -1}, {0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    cv::Mat means[9];
+    boxMeans<T>(Ichannels_sub.data(), terms, 9, ksize, means);
+
+    mean_I_r = means[0];
+    mean_I_g = means[1];
+    mean_I_b = means[2];
+
+    const cv::Size size = mean_I_r.size();
+    invrr.create(size, Idepth);
+    invrg.create(size, Idepth);
+    invrb.create(size, Idepth);
+    invgg.create(size, Idepth);
+    invgb.create(size, Idepth);
+    invbb.create(size, Idepth);
+
+    for (int y = 0; y < size.height; ++y) {
+        const T *m_r = mean_I_r.ptr<T>(y), *m_g = mean_I_g.ptr<T>(y), *m_b = mean_I_b.ptr<T>(y);
+        const T *m_rr = means[3].ptr<T>(y), *m_rg = means[4].ptr<T>(y), *m_rb = means[5].ptr<T>(y);
+        const T *m_gg = means[6].ptr<T>(y), *m_gb = means[7].ptr<T>(y), *m_bb = means[8].ptr<T>(y);
+        T *i_rr = invrr.ptr<T>(y), *i_rg = invrg.ptr<T>(y), *i_rb = invrb.ptr<T>(y);
+        T *i_gg = invgg.ptr<T>(y), *i_gb = invgb.ptr<T>(y), *i_bb = invbb.ptr<T>(y);
+
+        for (int x = 0; x < size.width; ++x) {
+            // variance of I in each local patch: the matrix Sigma in Eqn (14).
+            // Note the variance in each local patch is a 3x3 symmetric matrix:
+            //           rr, rg, rb
+            //   Sigma = rg, gg, gb
+            //           rb, gb, bb
+            const T var_I_rr = static_cast<T>(m_rr[x] - m_r[x] * m_r[x] + eps);
+            const T var_I_rg = m_rg[x] - m_r[x] * m_g[x];
+            const T var_I_rb = m_rb[x] - m_r[x] * m_b[x];
+            const T var_I_gg = static_cast<T>(m_gg[x] - m_g[x] * m_g[x] + eps);
+            const T var_I_gb = m_gb[x] - m_g[x] * m_b[x];
+            const T var_I_bb = static_cast<T>(m_bb[x] - m_b[x] * m_b[x] + eps);
+
+            // Inverse of Sigma + eps * I
+            const T rr = var_I_gg * var_I_bb - var_I_gb * var_I_gb;
+            const T rg = var_I_gb * var_I_rb - var_I_rg * var_I_bb;
+            const T rb = var_I_rg * var_I_gb - var_I_gg * var_I_rb;
+            const T gg = var_I_rr * var_I_bb - var_I_rb * var_I_rb;
+            const T gb = var_I_rb * var_I_rg - var_I_rr * var_I_gb;
+            const T bb = var_I_rr * var_I_gg - var_I_rg * var_I_rg;
+
+            const T covDet = rr * var_I_rr + rg * var_I_rg + rb * var_I_rb;
+
+            i_rr[x] = rr / covDet;
+            i_rg[x] = rg / covDet;
+            i_rb[x] = rb / covDet;
+            i_gg[x] = gg / covDet;
+            i_gb[x] = gb / covDet;
+            i_bb[x] = bb / covDet;
+        }
+    }
+}
 
-    cv::Mat a_r = invrr.mul(cov_Ip_r) + invrg.mul(cov_Ip_g) + invrb.mul(cov_Ip_b);
-    cv::Mat a_g = invrg.mul(cov_Ip_r) + invgg.mul(cov_Ip_g) + invgb.mul(cov_Ip_b);
-    cv::Mat a_b = invrb.mul(cov_Ip_r) + invgb.mul(cov_Ip_g) + invbb.mul(cov_Ip_b);
+cv::Mat GuidedFilterColor::filterSingleChannel(const cv::Mat &p) const {
+    return Idepth == CV_32F ? filterSingleChannel<float>(p) : filterSingleChannel<double>(p);
+}
 
-    cv::Mat b = mean_p - a_r.mul(mean_I_r) - a_g.mul(mean_I_g) - a_b.mul(mean_I_b); // Eqn. (15) in the paper;
+template <typename T>
+cv::Mat GuidedFilterColor::filterSingleChannel(const cv::Mat &p) const {
+    const cv::Mat planes[] = {Ichannels_sub[0], Ichannels_sub[1], Ichannels_sub[2], subsample(p, s)};
+    const BoxTerm terms[] = {{3, -1}, {0, 3}, {1, 3}, {2, 3}};
+    cv::Mat means[4];
+    boxMeans<T>(planes, terms, 4, ksize, means);
+
+    // a_r, a_g, a_b and b overwrite mean_Ip_r, mean_Ip_g, mean_Ip_b and mean_p
+    for (int y = 0; y < means[0].rows; ++y) {
+        const T *m_r = mean_I_r.ptr<T>(y), *m_g = mean_I_g.ptr<T>(y), *m_b = mean_I_b.ptr<T>(y);
+        const T *i_rr = invrr.ptr<T>(y), *i_rg = invrg.ptr<T>(y), *i_rb = invrb.ptr<T>(y);
+        const T *i_gg = invgg.ptr<T>(y), *i_gb = invgb.ptr<T>(y), *i_bb = invbb.ptr<T>(y);
+        T *b = means[0].ptr<T>(y), *a_r = means[1].ptr<T>(y), *a_g = means[2].ptr<T>(y), *a_b = means[3].ptr<T>(y);
+
+        for (int x = 0; x < means[0].cols; ++x) {
+            const T mean_p = b[x];
+
+            // covariance of (I, p) in each local patch.
+            const T cov_Ip_r = a_r[x] - m_r[x] * mean_p;
+            const T cov_Ip_g = a_g[x] - m_g[x] * mean_p;
+            const T cov_Ip_b = a_b[x] - m_b[x] * mean_p;
+
+            a_r[x] = i_rr[x] * cov_Ip_r + i_rg[x] * cov_Ip_g + i_rb[x] * cov_Ip_b;
+            a_g[x] = i_rg[x] * cov_Ip_r + i_gg[x] * cov_Ip_g + i_gb[x] * cov_Ip_b;
+            a_b[x] = i_rb[x] * cov_Ip_r + i_gb[x] * cov_Ip_g + i_bb[x] * cov_Ip_b;
+
+            b[x] = mean_p - a_r[x] * m_r[x] - a_g[x] * m_g[x] - a_b[x] * m_b[x]; // Eqn. (15) in the paper;
+        }
+    }
 
-    return (boxfilter(a_r, r).mul(Ichannels[0]) + boxfilter(a_g, r).mul(Ichannels[1]) +
-            boxfilter(a_b, r).mul(Ichannels[2]) + boxfilter(b, r)); // Eqn. (16) in the paper;
+    const BoxTerm coefficient_terms[] = {{0, -1}, {1, -1}, {2, -1}, {3, -1}};
+    cv::Mat mean_coefficients[4];
+    boxMeans<T>(means, coefficient_terms, 4, ksize, mean_coefficients);
+    for (int i = 0; i < 4; ++i)
+        upsample(mean_coefficients[i], Ichannels[0].size());
+
+    cv::Mat q(Ichannels[0].size(), Idepth);
+    for (int y = 0; y < q.rows; ++y) {
+        const T *I_r = Ichannels[0].ptr<T>(y), *I_g = Ichannels[1].ptr<T>(y), *I_b = Ichannels[2].ptr<T>(y);
+        const T *mean_b = mean_coefficients[0].ptr<T>(y), *mean_a_r = mean_coefficients[1].ptr<T>(y);
+        const T *mean_a_g = mean_coefficients[2].ptr<T>(y), *mean_a_b = mean_coefficients[3].ptr<T>(y);
+        T *qy = q.ptr<T>(y);
+        for (int x = 0; x < q.cols; ++x) {
+            qy[x] = mean_a_r[x] * I_r[x] + mean_a_g[x] * I_g[x] + mean_a_b[x] * I_b[x] + mean_b[x]; // Eqn. (16)
+        }
+    }
+    return q;
 }
 
-GuidedFilter::GuidedFilter(const cv::Mat &I, int r, double eps) {
+GuidedFilter::GuidedFilter(const cv::Mat &I, int r, double eps, int s) {
     CV_Assert(I.channels() == 1 || I.channels() == 3);
+    CV_Assert(r >= 0 && s >= 1);
 
     if (I.channels() == 1)
-        impl_ = new GuidedFilterMono(I, 2 * r + 1, eps);
+        impl_ = new GuidedFilterMono(I, r, eps, s);
     else
-        impl_ = new GuidedFilterColor(I, 2 * r + 1, eps);
+        impl_ = new GuidedFilterColor(I, r, eps, s);
 }
 
 GuidedFilter::~GuidedFilter() { delete impl_; }
@@ -210,3 +438,7 @@ cv::Mat GuidedFilter::filter(const cv::Mat &p, int depth) const { return impl_->
 cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth) {
     return GuidedFilter(I, r, eps).filter(p, depth);
 }
+
+cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int s, int depth) {
+    return GuidedFilter(I, r, eps, s).filter(p, depth);
+}
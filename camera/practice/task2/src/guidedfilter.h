@@ -5,9 +5,17 @@
 
 class GuidedFilterImpl;
 
+// Guided filter of He et al. with the window radius r and the regularization
+// eps. All box means of a pass are computed together in one sweep with O(1)
+// cost per pixel. With s > 1 it is the fast guided filter: the coefficients
+// are computed on I and p subsampled by s and upsampled, about s * s times
+// fewer box means for a small loss of accuracy.
+//
+// The statistics of I are computed by the constructor and shared by every
+// filter call, which may run from several threads at once.
 class GuidedFilter {
  public:
-    GuidedFilter(const cv::Mat &I, int r, double eps);
+    GuidedFilter(const cv::Mat &I, int r, double eps, int s = 1);
     ~GuidedFilter();
 
     cv::Mat filter(const cv::Mat &p, int depth = -1) const;
@@ -18,4 +26,6 @@ class GuidedFilter {
 
 cv::Mat guidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int depth = -1);
 
+cv::Mat fastGuidedFilter(const cv::Mat &I, const cv::Mat &p, int r, double eps, int s, int depth = -1);
+
 #endif
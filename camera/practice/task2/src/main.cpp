@@ -1,5 +1,7 @@
+#include "costvolumestereo.h"
 #include "guidedfilter.h"
 #include <iostream>
+#include <string>
 #include <opencv2/opencv.hpp>
 
 float distance(int x, int y, int i, int j) { return float(sqrt(pow(x - i, 2) + pow(y - j, 2))); }
@@ -104,7 +106,75 @@ double PSNR(const cv::Mat &image1, const cv::Mat &image2) {
     return 20.0 * log10(pixel_max / sqrt(mse));
 }
 
+// Textured pair whose right image is the left one shifted by `shift` pixels, the matcher has to find
+// `shift` inside the image and give the same disparity with one and with all threads.
+bool checkCostVolumeStereo() {
+    const int width = 120, height = 80, shift = 7;
+    cv::Mat left(height, width, CV_8UC3), right(height, width, CV_8UC3);
+    cv::RNG rng(3);
+    rng.fill(left, cv::RNG::UNIFORM, 0, 256);
+    cv::GaussianBlur(left, left, cv::Size(5, 5), 1.0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            right.at<cv::Vec3b>(y, x) = left.at<cv::Vec3b>(y, std::min(x + shift, width - 1));
+        }
+    }
+
+    CostVolumeStereo::Options options;
+    options.max_disparity = 16;
+    options.r = 4;
+    options.num_threads = 1;
+    const cv::Mat serial = CostVolumeStereo(options).compute(left, right);
+    options.num_threads = 0;
+    const cv::Mat parallel = CostVolumeStereo(options).compute(left, right);
+
+    if (cv::countNonZero(serial != parallel) != 0) {
+        std::cerr << "CostVolumeStereo: the disparity depends on the number of threads" << std::endl;
+        return false;
+    }
+
+    // pixels away from the borders, the right border has no match
+    const cv::Rect inner(options.max_disparity, options.r, width - 2 * options.max_disparity,
+                         height - 2 * options.r);
+    const int correct = cv::countNonZero(serial(inner) == shift);
+    std::cout << "CostVolumeStereo: " << correct << " of " << inner.area() << " pixels at disparity " << shift
+              << std::endl;
+    return correct >= 0.95 * inner.area();
+}
+
+// filter stereo [left right [max_disparity]]: disparity of a rectified pair with the guided filter cost
+// volume, without images the synthetic check above
+int runStereo(int argc, char **argv) {
+    if (argc < 4) {
+        return checkCostVolumeStereo() ? 0 : 1;
+    }
+
+    const cv::Mat left = cv::imread(argv[2], cv::IMREAD_COLOR);
+    const cv::Mat right = cv::imread(argv[3], cv::IMREAD_COLOR);
+    if (left.empty() || right.empty()) {
+        std::cerr << "Failed to load image" << std::endl;
+        return 1;
+    }
+
+    CostVolumeStereo::Options options;
+    if (argc > 4) options.max_disparity = std::stoi(argv[4]);
+
+    const int64 start = cv::getTickCount();
+    const cv::Mat disparity = CostVolumeStereo(options).compute(left, right);
+    std::cout << "cost volume stereo: " << (cv::getTickCount() - start) / cv::getTickFrequency() << " s"
+              << std::endl;
+
+    cv::Mat disparity8;
+    disparity.convertTo(disparity8, CV_8U, 255.0 / options.max_disparity);
+    cv::imwrite("../data/disparity.png", disparity8);
+    return 0;
+}
+
 int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "stereo") {
+        return runStereo(argc, argv);
+    }
+
     cv::Mat im = cv::imread(argv[1], 0);
     cv::Mat im1 = cv::imread(argv[2], 0);
 